@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QHash>
+
+#include "QXmppAtom_p.h"
+#include "QXmppConstants.h"
+
+class QXmppAtomTable
+{
+public:
+    QXmppAtomTable();
+    QHash<QString, int> atoms;
+};
+
+QXmppAtomTable::QXmppAtomTable()
+{
+    // namespaces
+    atoms.insert(ns_client, QXmppAtom::NsClient);
+    atoms.insert(ns_compress, QXmppAtom::NsCompress);
+    atoms.insert(ns_sasl, QXmppAtom::NsSasl);
+    atoms.insert(ns_server, QXmppAtom::NsServer);
+    atoms.insert(ns_stream, QXmppAtom::NsStream);
+    atoms.insert(ns_stream_management, QXmppAtom::NsStreamManagement);
+    atoms.insert(ns_tls, QXmppAtom::NsTls);
+
+    // element names
+    atoms.insert("a", QXmppAtom::A);
+    atoms.insert("challenge", QXmppAtom::Challenge);
+    atoms.insert("compressed", QXmppAtom::Compressed);
+    atoms.insert("enabled", QXmppAtom::Enabled);
+    atoms.insert("error", QXmppAtom::Error);
+    atoms.insert("failed", QXmppAtom::Failed);
+    atoms.insert("failure", QXmppAtom::Failure);
+    atoms.insert("features", QXmppAtom::Features);
+    atoms.insert("iq", QXmppAtom::Iq);
+    atoms.insert("message", QXmppAtom::Message);
+    atoms.insert("presence", QXmppAtom::Presence);
+    atoms.insert("proceed", QXmppAtom::Proceed);
+    atoms.insert("r", QXmppAtom::R);
+    atoms.insert("resumed", QXmppAtom::Resumed);
+    atoms.insert("success", QXmppAtom::Success);
+}
+
+Q_GLOBAL_STATIC(QXmppAtomTable, atomTable)
+
+/// Returns the atom for the given namespace or element name, or
+/// QXmppAtom::Unknown if it is not a well-known string.
+///
+/// \param string
+
+int QXmppAtom::lookup(const QString &string)
+{
+    if (string.isEmpty())
+        return Unknown;
+    return atomTable()->atoms.value(string, Unknown);
+}
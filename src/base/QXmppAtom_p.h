@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPATOM_P_H
+#define QXMPPATOM_P_H
+
+#include <QString>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStreamParser class and of stanza dispatching code.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// The QXmppAtom class maps the namespaces and names of the top-level
+/// elements handled by the stream classes to integers.
+///
+/// The stream parser looks up the atom once per interned string, so
+/// dispatching on a received element's name and namespace needs no string
+/// comparison.
+///
+/// Unknown strings map to QXmppAtom::Unknown.
+
+class QXMPP_AUTOTEST_EXPORT QXmppAtom
+{
+public:
+    enum Atom {
+        Unknown = 0,
+
+        // namespaces
+        NsClient,
+        NsCompress,
+        NsSasl,
+        NsServer,
+        NsStream,
+        NsStreamManagement,
+        NsTls,
+
+        // element names
+        A,
+        Challenge,
+        Compressed,
+        Enabled,
+        Error,
+        Failed,
+        Failure,
+        Features,
+        Iq,
+        Message,
+        Presence,
+        Proceed,
+        R,
+        Resumed,
+        Success,
+    };
+
+    static int lookup(const QString &string);
+};
+
+#endif
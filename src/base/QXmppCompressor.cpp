@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef QXMPP_USE_ZLIB
+#include <zlib.h>
+
+#include "QXmppCompressor_p.h"
+
+// Keep the compressor's memory usage to about 64kB per stream, instead of
+// the 256kB zlib uses by default. The decompressor needs a full 32kB window
+// as the peer may use one.
+static const int deflateWindowBits = 13;
+static const int deflateMemLevel = 6;
+static const int bufferSize = 4096;
+
+static bool deflateData(z_stream *stream, const QByteArray &data, int flush, QByteArray &output)
+{
+    char buffer[bufferSize];
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream->avail_in = data.size();
+    do {
+        stream->next_out = reinterpret_cast<Bytef*>(buffer);
+        stream->avail_out = bufferSize;
+        const int ret = deflate(stream, flush);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return false;
+        output.append(buffer, bufferSize - stream->avail_out);
+    } while (stream->avail_out == 0);
+    return true;
+}
+
+/// Constructs a zlib compressor.
+
+QXmppCompressor::QXmppCompressor()
+    : m_stream(new z_stream)
+{
+    memset(m_stream, 0, sizeof(z_stream));
+    if (deflateInit2(m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     deflateWindowBits, deflateMemLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete m_stream;
+        m_stream = 0;
+    }
+}
+
+/// Destroys a zlib compressor.
+
+QXmppCompressor::~QXmppCompressor()
+{
+    if (m_stream) {
+        deflateEnd(m_stream);
+        delete m_stream;
+    }
+}
+
+/// Returns true if the compressor was successfully initialised.
+
+bool QXmppCompressor::isValid() const
+{
+    return m_stream != 0;
+}
+
+/// Compresses the given data and returns the compressed bytes which are
+/// already available.
+///
+/// \param data
+
+QByteArray QXmppCompressor::compress(const QByteArray &data)
+{
+    QByteArray output;
+    if (m_stream && !data.isEmpty())
+        deflateData(m_stream, data, Z_NO_FLUSH, output);
+    return output;
+}
+
+/// Performs a sync flush and returns the remaining compressed bytes, so
+/// that the peer can decompress all the data passed to compress().
+
+QByteArray QXmppCompressor::flush()
+{
+    QByteArray output;
+    if (m_stream)
+        deflateData(m_stream, QByteArray(), Z_SYNC_FLUSH, output);
+    return output;
+}
+
+/// Constructs a zlib decompressor.
+///
+/// \param maximumSize the maximum number of bytes a single call to
+/// decompress() may produce
+
+QXmppDecompressor::QXmppDecompressor(int maximumSize)
+    : m_stream(new z_stream)
+    , m_maximumSize(maximumSize)
+{
+    memset(m_stream, 0, sizeof(z_stream));
+    if (inflateInit(m_stream) != Z_OK) {
+        delete m_stream;
+        m_stream = 0;
+    }
+}
+
+/// Destroys a zlib decompressor.
+
+QXmppDecompressor::~QXmppDecompressor()
+{
+    if (m_stream) {
+        inflateEnd(m_stream);
+        delete m_stream;
+    }
+}
+
+/// Returns true if the decompressor was successfully initialised.
+
+bool QXmppDecompressor::isValid() const
+{
+    return m_stream != 0;
+}
+
+/// Decompresses the given data.
+///
+/// Returns false if the data is not a valid zlib stream or decompresses
+/// to more than the maximum size.
+///
+/// \param data
+/// \param output
+
+bool QXmppDecompressor::decompress(const QByteArray &data, QByteArray &output)
+{
+    if (!m_stream)
+        return false;
+
+    char buffer[bufferSize];
+    m_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    m_stream->avail_in = data.size();
+    do {
+        m_stream->next_out = reinterpret_cast<Bytef*>(buffer);
+        m_stream->avail_out = bufferSize;
+        const int ret = inflate(m_stream, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return false;
+        output.append(buffer, bufferSize - m_stream->avail_out);
+        if (output.size() > m_maximumSize)
+            return false;
+    } while (m_stream->avail_out == 0);
+    return true;
+}
+#endif
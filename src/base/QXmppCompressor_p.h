@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCOMPRESSOR_P_H
+#define QXMPPCOMPRESSOR_P_H
+
+#include <QByteArray>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+#ifdef QXMPP_USE_ZLIB
+struct z_stream_s;
+
+/// The QXmppCompressor class compresses outgoing stream data using zlib,
+/// as per XEP-0138: Stream Compression.
+///
+/// Data passed to compress() is only guaranteed to be output once flush()
+/// is called, which lets a batch of stanzas share a single sync flush.
+
+class QXMPP_AUTOTEST_EXPORT QXmppCompressor
+{
+public:
+    QXmppCompressor();
+    ~QXmppCompressor();
+
+    bool isValid() const;
+    QByteArray compress(const QByteArray &data);
+    QByteArray flush();
+
+private:
+    Q_DISABLE_COPY(QXmppCompressor)
+    struct z_stream_s *m_stream;
+};
+
+/// The QXmppDecompressor class decompresses incoming stream data using
+/// zlib, as per XEP-0138: Stream Compression.
+///
+/// To protect against decompression bombs, decompress() fails if a single
+/// call would produce more than maximumSize bytes.
+
+class QXMPP_AUTOTEST_EXPORT QXmppDecompressor
+{
+public:
+    QXmppDecompressor(int maximumSize);
+    ~QXmppDecompressor();
+
+    bool isValid() const;
+    bool decompress(const QByteArray &data, QByteArray &output);
+
+private:
+    Q_DISABLE_COPY(QXmppDecompressor)
+    struct z_stream_s *m_stream;
+    int m_maximumSize;
+};
+#endif
+
+#endif
@@ -99,6 +99,8 @@ extern const char* ns_jingle_rtp_audio;
 extern const char* ns_jingle_rtp_video;
 // XEP-0184: Message Receipts
 extern const char* ns_message_receipts;
+// XEP-0198: Stream Management
+extern const char* ns_stream_management;
 // XEP-0199: XMPP Ping
 extern const char* ns_ping;
 // XEP-0202: Entity Time
@@ -115,5 +117,7 @@ extern const char* ns_attention;
 extern const char* ns_bob;
 // XEP-0249: Direct MUC Invitations
 extern const char* ns_conference;
+// XEP-0294: Jingle RTP Header Extensions Negotiation
+extern const char* ns_jingle_rtp_hdrext;
 
 #endif // QXMPPCONSTANTS_H
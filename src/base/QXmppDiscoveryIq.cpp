@@ -123,34 +123,74 @@ void QXmppDiscoveryIq::Item::setNode(const QString &node)
     m_node = node;
 }
 
+class QXmppDiscoveryIqPrivate : public QSharedData
+{
+public:
+    QStringList features;
+    QList<QXmppDiscoveryIq::Identity> identities;
+    QList<QXmppDiscoveryIq::Item> items;
+    QXmppDataForm form;
+    QString queryNode;
+    QXmppDiscoveryIq::QueryType queryType;
+};
+
+/// Constructs a service discovery IQ.
+
+QXmppDiscoveryIq::QXmppDiscoveryIq()
+    : d(new QXmppDiscoveryIqPrivate)
+{
+    d->queryType = InfoQuery;
+}
+
+/// Constructs a copy of \a other.
+
+QXmppDiscoveryIq::QXmppDiscoveryIq(const QXmppDiscoveryIq &other)
+    : QXmppIq(other)
+    , d(other.d)
+{
+}
+
+QXmppDiscoveryIq::~QXmppDiscoveryIq()
+{
+}
+
+/// Assigns \a other to this service discovery IQ.
+
+QXmppDiscoveryIq& QXmppDiscoveryIq::operator=(const QXmppDiscoveryIq &other)
+{
+    QXmppIq::operator=(other);
+    d = other.d;
+    return *this;
+}
+
 QStringList QXmppDiscoveryIq::features() const
 {
-    return m_features;
+    return d->features;
 }
 
 void QXmppDiscoveryIq::setFeatures(const QStringList &features)
 {
-    m_features = features;
+    d->features = features;
 }
 
 QList<QXmppDiscoveryIq::Identity> QXmppDiscoveryIq::identities() const
 {
-    return m_identities;
+    return d->identities;
 }
 
 void QXmppDiscoveryIq::setIdentities(const QList<QXmppDiscoveryIq::Identity> &identities)
 {
-    m_identities = identities;
+    d->identities = identities;
 }
 
 QList<QXmppDiscoveryIq::Item> QXmppDiscoveryIq::items() const
 {
-    return m_items;
+    return d->items;
 }
 
 void QXmppDiscoveryIq::setItems(const QList<QXmppDiscoveryIq::Item> &items)
 {
-    m_items = items;
+    d->items = items;
 }
 
 /// Returns the QXmppDataForm for this IQ, as defined by
@@ -159,7 +199,7 @@ void QXmppDiscoveryIq::setItems(const QList<QXmppDiscoveryIq::Item> &items)
 
 QXmppDataForm QXmppDiscoveryIq::form() const
 {
-    return m_form;
+    return d->form;
 }
 
 /// Sets the QXmppDataForm for this IQ, as define by
@@ -170,27 +210,27 @@ QXmppDataForm QXmppDiscoveryIq::form() const
 
 void QXmppDiscoveryIq::setForm(const QXmppDataForm &form)
 {
-    m_form = form;
+    d->form = form;
 }
 
 QString QXmppDiscoveryIq::queryNode() const
 {
-    return m_queryNode;
+    return d->queryNode;
 }
 
 void QXmppDiscoveryIq::setQueryNode(const QString &node)
 {
-    m_queryNode = node;
+    d->queryNode = node;
 }
 
 enum QXmppDiscoveryIq::QueryType QXmppDiscoveryIq::queryType() const
 {
-    return m_queryType;
+    return d->queryType;
 }
 
 void QXmppDiscoveryIq::setQueryType(enum QXmppDiscoveryIq::QueryType type)
 {
-    m_queryType = type;
+    d->queryType = type;
 }
 
 /// Calculate the verification string for XEP-0115 : Entity Capabilities
@@ -198,9 +238,9 @@ void QXmppDiscoveryIq::setQueryType(enum QXmppDiscoveryIq::QueryType type)
 QByteArray QXmppDiscoveryIq::verificationString() const
 {
     QString S;
-    QList<QXmppDiscoveryIq::Identity> sortedIdentities = m_identities;
+    QList<QXmppDiscoveryIq::Identity> sortedIdentities = d->identities;
     qSort(sortedIdentities.begin(), sortedIdentities.end(), identityLessThan);
-    QStringList sortedFeatures = m_features;
+    QStringList sortedFeatures = d->features;
     qSort(sortedFeatures);
     sortedFeatures.removeDuplicates();
     foreach (const QXmppDiscoveryIq::Identity &identity, sortedIdentities)
@@ -208,9 +248,9 @@ QByteArray QXmppDiscoveryIq::verificationString() const
     foreach (const QString &feature, sortedFeatures)
         S += feature + QLatin1String("<");
 
-    if (!m_form.isNull()) {
+    if (!d->form.isNull()) {
         QMap<QString, QXmppDataForm::Field> fieldMap;
-        foreach (const QXmppDataForm::Field &field, m_form.fields()) {
+        foreach (const QXmppDataForm::Field &field, d->form.fields()) {
             fieldMap.insert(field.key(), field);
         }
 
@@ -253,18 +293,18 @@ bool QXmppDiscoveryIq::isDiscoveryIq(const QDomElement &element)
 void QXmppDiscoveryIq::parseElementFromChild(const QDomElement &element)
 {
     QDomElement queryElement = element.firstChildElement("query");
-    m_queryNode = queryElement.attribute("node");
+    d->queryNode = queryElement.attribute("node");
     if (queryElement.namespaceURI() == ns_disco_items)
-        m_queryType = ItemsQuery;
+        d->queryType = ItemsQuery;
     else
-        m_queryType = InfoQuery;
+        d->queryType = InfoQuery;
 
     QDomElement itemElement = queryElement.firstChildElement();
     while (!itemElement.isNull())
     {
         if (itemElement.tagName() == "feature")
         {
-            m_features.append(itemElement.attribute("var"));
+            d->features.append(itemElement.attribute("var"));
         }
         else if (itemElement.tagName() == "identity")
         {
@@ -284,7 +324,7 @@ void QXmppDiscoveryIq::parseElementFromChild(const QDomElement &element)
                 }
             }
 
-            m_identities.append(identity);
+            d->identities.append(identity);
         }
         else if (itemElement.tagName() == "item")
         {
@@ -292,12 +332,12 @@ void QXmppDiscoveryIq::parseElementFromChild(const QDomElement &element)
             item.setJid(itemElement.attribute("jid"));
             item.setName(itemElement.attribute("name"));
             item.setNode(itemElement.attribute("node"));
-            m_items.append(item);
+            d->items.append(item);
         }
         else if (itemElement.tagName() == "x" &&
                  itemElement.namespaceURI() == ns_data)
         {
-            m_form.parse(itemElement);
+            d->form.parse(itemElement);
         }
         itemElement = itemElement.nextSiblingElement();
     }
@@ -307,11 +347,11 @@ void QXmppDiscoveryIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("query");
     writer->writeAttribute("xmlns",
-        m_queryType == InfoQuery ? ns_disco_info : ns_disco_items);
-    helperToXmlAddAttribute(writer, "node", m_queryNode);
+        d->queryType == InfoQuery ? ns_disco_info : ns_disco_items);
+    helperToXmlAddAttribute(writer, "node", d->queryNode);
 
-    if (m_queryType == InfoQuery) {
-        foreach (const QXmppDiscoveryIq::Identity& identity, m_identities) {
+    if (d->queryType == InfoQuery) {
+        foreach (const QXmppDiscoveryIq::Identity& identity, d->identities) {
             writer->writeStartElement("identity");
             helperToXmlAddAttribute(writer, "xml:lang", identity.language());
             helperToXmlAddAttribute(writer, "category", identity.category());
@@ -320,13 +360,13 @@ void QXmppDiscoveryIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
             writer->writeEndElement();
         }
 
-        foreach (const QString &feature, m_features) {
+        foreach (const QString &feature, d->features) {
             writer->writeStartElement("feature");
             helperToXmlAddAttribute(writer, "var", feature);
             writer->writeEndElement();
         }
     } else {
-        foreach (const QXmppDiscoveryIq::Item& item, m_items) {
+        foreach (const QXmppDiscoveryIq::Item& item, d->items) {
             writer->writeStartElement("item");
             helperToXmlAddAttribute(writer, "jid", item.jid());
             helperToXmlAddAttribute(writer, "name", item.name());
@@ -335,7 +375,7 @@ void QXmppDiscoveryIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
         }
     }
 
-    m_form.toXml(writer);
+    d->form.toXml(writer);
 
     writer->writeEndElement();
 }
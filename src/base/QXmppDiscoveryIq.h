@@ -28,6 +28,7 @@
 #include "QXmppIq.h"
 
 class QDomElement;
+class QXmppDiscoveryIqPrivate;
 
 class QXMPP_EXPORT QXmppDiscoveryIq : public QXmppIq
 {
@@ -77,6 +78,12 @@ public:
         ItemsQuery,
     };
 
+    QXmppDiscoveryIq();
+    QXmppDiscoveryIq(const QXmppDiscoveryIq &other);
+    ~QXmppDiscoveryIq();
+
+    QXmppDiscoveryIq& operator=(const QXmppDiscoveryIq &other);
+
     QStringList features() const;
     void setFeatures(const QStringList &features);
 
@@ -106,12 +113,7 @@ protected:
     /// \endcond
 
 private:
-    QStringList m_features;
-    QList<QXmppDiscoveryIq::Identity> m_identities;
-    QList<QXmppDiscoveryIq::Item> m_items;
-    QXmppDataForm m_form;
-    QString m_queryNode;
-    enum QueryType m_queryType;
+    QSharedDataPointer<QXmppDiscoveryIqPrivate> d;
 };
 
 #endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPDISPATCHINDEX_P_H
+#define QXMPPDISPATCHINDEX_P_H
+
+#include <QDomElement>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QtAlgorithms>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppClient and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// The QXmppDispatchIndex class maps the namespaces of a stanza's child
+/// elements to the extensions which handle them.
+///
+/// Extensions which do not declare any namespace are offered every stanza.
+/// Candidates are always returned in the order the extensions were given,
+/// which is their priority order. The list for each namespace is merged
+/// with the catch-all extensions when the index is built, so looking up a
+/// stanza whose payload uses a single namespace does not build a new list.
+
+template <class T>
+class QXmppDispatchIndex
+{
+public:
+    /// Rebuilds the index for the given extensions, in priority order.
+
+    void rebuild(const QList<T*> &extensions)
+    {
+        m_extensions = extensions;
+        m_namespaces.clear();
+
+        QList<int> wildcards;
+        QHash<QString, QList<int> > namespaces;
+        for (int i = 0; i < extensions.size(); ++i) {
+            const QStringList handled = extensions[i]->handledNamespaces();
+            if (handled.isEmpty()) {
+                wildcards << i;
+            } else {
+                foreach (const QString &ns, handled) {
+                    QList<int> &positions = namespaces[ns];
+                    if (positions.isEmpty() || positions.last() != i)
+                        positions << i;
+                }
+            }
+        }
+
+        QHash<QString, QList<int> >::const_iterator it;
+        for (it = namespaces.constBegin(); it != namespaces.constEnd(); ++it) {
+            Entry &entry = m_namespaces[it.key()];
+            entry.positions = it.value() + wildcards;
+            entry.extensions = extensionsAt(entry.positions);
+        }
+        m_wildcards = extensionsAt(wildcards);
+    }
+
+    /// Returns the extensions which should be offered the given stanza.
+
+    QList<T*> candidates(const QDomElement &stanza) const
+    {
+        typename QHash<QString, Entry>::const_iterator found = m_namespaces.constEnd();
+        QList<int> positions;
+        QDomElement child = stanza.firstChildElement();
+        while (!child.isNull()) {
+            typename QHash<QString, Entry>::const_iterator it = m_namespaces.constFind(child.namespaceURI());
+            if (it != m_namespaces.constEnd() && it != found) {
+                if (found == m_namespaces.constEnd()) {
+                    found = it;
+                } else {
+                    // the payload uses several namespaces
+                    if (positions.isEmpty())
+                        positions = found.value().positions;
+                    positions += it.value().positions;
+                }
+            }
+            child = child.nextSiblingElement();
+        }
+
+        if (found == m_namespaces.constEnd())
+            return m_wildcards;
+        else if (positions.isEmpty())
+            return found.value().extensions;
+        else
+            return extensionsAt(positions);
+    }
+
+private:
+    class Entry
+    {
+    public:
+        QList<int> positions;
+        QList<T*> extensions;
+    };
+
+    /// Returns the extensions at the given positions, in priority order
+    /// and without duplicates. The positions are sorted in place.
+
+    QList<T*> extensionsAt(QList<int> &positions) const
+    {
+        qSort(positions);
+
+        QList<T*> found;
+        int previous = -1;
+        foreach (int i, positions) {
+            if (i != previous)
+                found << m_extensions[i];
+            previous = i;
+        }
+        return found;
+    }
+
+    QList<T*> m_extensions;
+    QHash<QString, Entry> m_namespaces;
+    QList<T*> m_wildcards;
+};
+
+#endif
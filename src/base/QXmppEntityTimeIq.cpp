@@ -29,12 +29,48 @@
 #include "QXmppConstants.h"
 #include "QXmppUtils.h"
 
+class QXmppEntityTimeIqPrivate : public QSharedData
+{
+public:
+    int tzo;
+    QDateTime utc;
+};
+
+/// Constructs an entity time IQ.
+
+QXmppEntityTimeIq::QXmppEntityTimeIq()
+    : d(new QXmppEntityTimeIqPrivate)
+{
+    d->tzo = 0;
+}
+
+/// Constructs a copy of \a other.
+
+QXmppEntityTimeIq::QXmppEntityTimeIq(const QXmppEntityTimeIq &other)
+    : QXmppIq(other)
+    , d(other.d)
+{
+}
+
+QXmppEntityTimeIq::~QXmppEntityTimeIq()
+{
+}
+
+/// Assigns \a other to this entity time IQ.
+
+QXmppEntityTimeIq& QXmppEntityTimeIq::operator=(const QXmppEntityTimeIq &other)
+{
+    QXmppIq::operator=(other);
+    d = other.d;
+    return *this;
+}
+
 /// Returns the timezone offset in seconds.
 ///
 
 int QXmppEntityTimeIq::tzo() const
 {
-    return m_tzo;
+    return d->tzo;
 }
 
 /// Sets the timezone offset in seconds.
@@ -43,7 +79,7 @@ int QXmppEntityTimeIq::tzo() const
 
 void QXmppEntityTimeIq::setTzo(int tzo)
 {
-    m_tzo = tzo;
+    d->tzo = tzo;
 }
 
 /// Returns the date/time in Coordinated Universal Time (UTC).
@@ -51,7 +87,7 @@ void QXmppEntityTimeIq::setTzo(int tzo)
 
 QDateTime QXmppEntityTimeIq::utc() const
 {
-    return m_utc;
+    return d->utc;
 }
 
 /// Sets the date/time in Coordinated Universal Time (UTC).
@@ -60,7 +96,7 @@ QDateTime QXmppEntityTimeIq::utc() const
 
 void QXmppEntityTimeIq::setUtc(const QDateTime &utc)
 {
-    m_utc = utc;
+    d->utc = utc;
 }
 
 /// \cond
@@ -73,8 +109,8 @@ bool QXmppEntityTimeIq::isEntityTimeIq(const QDomElement &element)
 void QXmppEntityTimeIq::parseElementFromChild(const QDomElement &element)
 {
     QDomElement timeElement = element.firstChildElement("time");
-    m_tzo = QXmppUtils::timezoneOffsetFromString(timeElement.firstChildElement("tzo").text());
-    m_utc = QXmppUtils::datetimeFromString(timeElement.firstChildElement("utc").text());
+    d->tzo = QXmppUtils::timezoneOffsetFromString(timeElement.firstChildElement("tzo").text());
+    d->utc = QXmppUtils::datetimeFromString(timeElement.firstChildElement("utc").text());
 }
 
 void QXmppEntityTimeIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -82,10 +118,10 @@ void QXmppEntityTimeIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeStartElement("time");
     writer->writeAttribute("xmlns", ns_entity_time);
 
-    if(m_utc.isValid())
+    if(d->utc.isValid())
     {
-        helperToXmlAddTextElement(writer, "tzo", QXmppUtils::timezoneOffsetToString(m_tzo));
-        helperToXmlAddTextElement(writer, "utc", QXmppUtils::datetimeToString(m_utc));
+        helperToXmlAddTextElement(writer, "tzo", QXmppUtils::timezoneOffsetToString(d->tzo));
+        helperToXmlAddTextElement(writer, "utc", QXmppUtils::datetimeToString(d->utc));
     }
     writer->writeEndElement();
 }
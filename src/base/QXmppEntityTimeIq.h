@@ -29,11 +29,19 @@
 
 #include "QXmppIq.h"
 
+class QXmppEntityTimeIqPrivate;
+
 /// \ingroup Stanzas
 
 class QXMPP_EXPORT QXmppEntityTimeIq : public QXmppIq
 {
 public:
+    QXmppEntityTimeIq();
+    QXmppEntityTimeIq(const QXmppEntityTimeIq &other);
+    ~QXmppEntityTimeIq();
+
+    QXmppEntityTimeIq& operator=(const QXmppEntityTimeIq &other);
+
     int tzo() const;
     void setTzo(int tzo);
 
@@ -49,8 +57,7 @@ protected:
     /// \endcond
 
 private:
-    int m_tzo;
-    QDateTime m_utc;
+    QSharedDataPointer<QXmppEntityTimeIqPrivate> d;
 };
 
 #endif //QXMPPENTITYTIMEIQ_H
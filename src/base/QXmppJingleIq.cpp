@@ -129,6 +129,16 @@ void QXmppJingleIq::Content::setPayloadTypes(const QList<QXmppJinglePayloadType>
     m_payloadTypes = payloadTypes;
 }
 
+QMap<int, QString> QXmppJingleIq::Content::rtpHeaderExtensions() const
+{
+    return m_rtpHeaderExtensions;
+}
+
+void QXmppJingleIq::Content::setRtpHeaderExtensions(const QMap<int, QString> &extensions)
+{
+    m_rtpHeaderExtensions = extensions;
+}
+
 void QXmppJingleIq::Content::addTransportCandidate(const QXmppJingleCandidate &candidate)
 {
     m_transportType = ns_jingle_ice_udp;
@@ -180,6 +190,17 @@ void QXmppJingleIq::Content::parse(const QDomElement &element)
         m_payloadTypes << payload;
         child = child.nextSiblingElement("payload-type");
     }
+    child = descriptionElement.firstChildElement("rtp-hdrext");
+    while (!child.isNull())
+    {
+        if (child.namespaceURI() == ns_jingle_rtp_hdrext) {
+            bool ok;
+            const int id = child.attribute("id").toInt(&ok);
+            if (ok && id > 0 && id < 256)
+                m_rtpHeaderExtensions.insert(id, child.attribute("uri"));
+        }
+        child = child.nextSiblingElement("rtp-hdrext");
+    }
 
     // transport
     QDomElement transportElement = element.firstChildElement("transport");
@@ -215,6 +236,14 @@ void QXmppJingleIq::Content::toXml(QXmlStreamWriter *writer) const
         helperToXmlAddAttribute(writer, "media", m_descriptionMedia);
         foreach (const QXmppJinglePayloadType &payload, m_payloadTypes)
             payload.toXml(writer);
+        QMap<int, QString>::const_iterator it;
+        for (it = m_rtpHeaderExtensions.constBegin(); it != m_rtpHeaderExtensions.constEnd(); ++it) {
+            writer->writeStartElement("rtp-hdrext");
+            writer->writeAttribute("xmlns", ns_jingle_rtp_hdrext);
+            writer->writeAttribute("id", QString::number(it.key()));
+            writer->writeAttribute("uri", it.value());
+            writer->writeEndElement();
+        }
         writer->writeEndElement();
     }
 
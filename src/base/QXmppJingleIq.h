@@ -200,6 +200,10 @@ public:
         QList<QXmppJinglePayloadType> payloadTypes() const;
         void setPayloadTypes(const QList<QXmppJinglePayloadType> &payloadTypes);
 
+        // XEP-0294: Jingle RTP Header Extensions Negotiation
+        QMap<int, QString> rtpHeaderExtensions() const;
+        void setRtpHeaderExtensions(const QMap<int, QString> &extensions);
+
         void addTransportCandidate(const QXmppJingleCandidate &candidate);
         QList<QXmppJingleCandidate> transportCandidates() const;
 
@@ -226,6 +230,7 @@ public:
         QString m_transportUser;
         QString m_transportPassword;
         QList<QXmppJinglePayloadType> m_payloadTypes;
+        QMap<int, QString> m_rtpHeaderExtensions;
         QList<QXmppJingleCandidate> m_transportCandidates;
     };
 
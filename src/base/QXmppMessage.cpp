@@ -23,7 +23,8 @@
  */
 
 #include <QDomElement>
-#include <QTextStream>
+#include <QThread>
+#include <QXmlSimpleReader>
 #include <QXmlStreamWriter>
 
 #include "QXmppConstants.h"
@@ -55,6 +56,14 @@ enum StampType
     DelayedDelivery,        // XEP-0203: Delayed Delivery
 };
 
+// states of a lazily decoded payload
+enum DecodeState
+{
+    Decoded = 0,
+    DecodePending,
+    Decoding
+};
+
 class QXmppMessagePrivate : public QSharedData
 {
 public:
@@ -70,12 +79,175 @@ public:
 
     // XEP-0071: XHTML-IM
     QString xhtml;
+    QDomElement xhtmlElement;
 
     // Request message receipt as per XEP-0184.
     QString receiptId;
     bool receiptRequested;
+
+    // lazy parsing
+    void decode();
+    QDomDocument document;
+    QDomElement element;
+    QAtomicInt decodeState;
 };
 
+/// Decodes the payload of a received message.
+
+void QXmppMessagePrivate::decode()
+{
+    if (element.isNull())
+        return;
+    const QDomElement stanza = element;
+    element = QDomElement();
+
+    body = QString();
+    xhtml = QString();
+    xhtmlElement = QDomElement();
+    subject = QString();
+    thread = QString();
+    receiptId = QString();
+    receiptRequested = false;
+    attentionRequested = false;
+
+    // walk the children once, keeping the first of each known element
+    bool seenBody = false, seenSubject = false, seenThread = false;
+    bool seenReceived = false, seenRequest = false, seenDelay = false;
+    bool seenAttention = false, seenHtml = false, seenState = false;
+    QDomElement child = stanza.firstChildElement();
+    while (!child.isNull())
+    {
+        const QString name = child.tagName();
+        const QString ns = child.namespaceURI();
+
+        if (name == QLatin1String("body")) {
+            if (!seenBody) {
+                body = child.text();
+                seenBody = true;
+            }
+        } else if (name == QLatin1String("subject")) {
+            if (!seenSubject) {
+                subject = child.text();
+                seenSubject = true;
+            }
+        } else if (name == QLatin1String("thread")) {
+            if (!seenThread) {
+                thread = child.text();
+                seenThread = true;
+            }
+        } else if (ns == ns_chat_states) {
+            // chat states
+            if (!seenState) {
+                for (int i = QXmppMessage::Active; i <= QXmppMessage::Paused; i++) {
+                    if (name == chat_states[i]) {
+                        state = static_cast<QXmppMessage::State>(i);
+                        seenState = true;
+                        break;
+                    }
+                }
+            }
+        } else if (name == QLatin1String("html")) {
+            // XEP-0071: XHTML-IM
+            if (!seenHtml && ns == ns_xhtml_im) {
+                // the body is kept as parsed and only written out on demand
+                QDomElement bodyElement = child.firstChildElement("body");
+                if (bodyElement.namespaceURI() == ns_xhtml && bodyElement.hasChildNodes())
+                    xhtmlElement = bodyElement;
+            }
+            seenHtml = true;
+        } else if (name == QLatin1String("received")) {
+            // XEP-0184: Message Delivery Receipts
+            if (!seenReceived && ns == ns_message_receipts) {
+                receiptId = child.attribute("id");
+
+                // compatibility with old-style XEP
+                if (receiptId.isEmpty())
+                    receiptId = stanza.attribute("id");
+            }
+            seenReceived = true;
+        } else if (name == QLatin1String("request")) {
+            if (!seenRequest)
+                receiptRequested = (ns == ns_message_receipts);
+            seenRequest = true;
+        } else if (name == QLatin1String("delay")) {
+            // XEP-0203: Delayed Delivery
+            if (!seenDelay && ns == ns_delayed_delivery) {
+                const QString str = child.attribute("stamp");
+                stamp = QXmppUtils::datetimeFromString(str);
+                stampType = DelayedDelivery;
+            }
+            seenDelay = true;
+        } else if (name == QLatin1String("attention")) {
+            // XEP-0224: Attention
+            if (!seenAttention)
+                attentionRequested = (ns == ns_attention);
+            seenAttention = true;
+        } else if (name == QLatin1String("x")) {
+            if (ns == ns_legacy_delayed_delivery) {
+                // XEP-0091: Legacy Delayed Delivery
+                const QString str = child.attribute("stamp");
+                stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
+                stamp.setTimeSpec(Qt::UTC);
+                stampType = LegacyDelayedDelivery;
+            }
+        }
+        child = child.nextSiblingElement();
+    }
+
+    // the document is only needed as long as the XHTML body refers to it
+    if (xhtmlElement.isNull())
+        document = QDomDocument();
+}
+
+// Returns the message's private data, decoding it first if needed.
+//
+// The private data is shared between copies, which may be read from
+// different threads. The first reader to claim the payload decodes it and
+// the others wait for it, so unrelated messages never contend. Setters
+// call this before detaching, so a copy is never taken half-way through.
+
+static inline QXmppMessagePrivate *decoded(const QSharedDataPointer<QXmppMessagePrivate> &d)
+{
+    QXmppMessagePrivate *data = const_cast<QXmppMessagePrivate*>(d.constData());
+    if (!data->decodeState.testAndSetAcquire(Decoded, Decoded)) {
+        if (data->decodeState.testAndSetAcquire(DecodePending, Decoding)) {
+            data->decode();
+            data->decodeState.fetchAndStoreRelease(Decoded);
+        } else {
+            while (!data->decodeState.testAndSetAcquire(Decoded, Decoded))
+                QThread::yieldCurrentThread();
+        }
+    }
+    return data;
+}
+
+// Writes the children of a parsed XHTML-IM body, leaving out the
+// XHTML namespace which the enclosing body element declares.
+
+static void writeXhtml(QXmlStreamWriter *xmlWriter, const QDomElement &element)
+{
+    QDomNode child = element.firstChild();
+    while (!child.isNull()) {
+        if (child.isElement()) {
+            const QDomElement childElement = child.toElement();
+            xmlWriter->writeStartElement(childElement.tagName());
+            const QString ns = childElement.namespaceURI();
+            if (!ns.isEmpty() && ns != ns_xhtml)
+                xmlWriter->writeAttribute("xmlns", ns);
+            const QDomNamedNodeMap attributes = childElement.attributes();
+            for (int i = 0; i < attributes.size(); ++i) {
+                const QDomAttr attribute = attributes.item(i).toAttr();
+                xmlWriter->writeAttribute(attribute.name(), attribute.value());
+            }
+            writeXhtml(xmlWriter, childElement);
+            xmlWriter->writeEndElement();
+        } else if (child.isText()) {
+            xmlWriter->writeCharacters(child.toText().data());
+        }
+        child = child.nextSibling();
+    }
+}
+
 /// Constructs a QXmppMessage.
 ///
 /// \param from
@@ -124,7 +296,7 @@ QXmppMessage& QXmppMessage::operator=(const QXmppMessage &other)
 
 QString QXmppMessage::body() const
 {
-    return d->body;
+    return decoded(d)->body;
 }
 
 /// Sets the message's body.
@@ -133,6 +305,7 @@ QString QXmppMessage::body() const
 
 void QXmppMessage::setBody(const QString& body)
 {
+    decoded(d);
     d->body = body;
 }
 
@@ -141,7 +314,7 @@ void QXmppMessage::setBody(const QString& body)
 
 bool QXmppMessage::isAttentionRequested() const
 {
-    return d->attentionRequested;
+    return decoded(d)->attentionRequested;
 }
 
 /// Sets whether the user's attention is requested, as defined
@@ -151,6 +324,7 @@ bool QXmppMessage::isAttentionRequested() const
 
 void QXmppMessage::setAttentionRequested(bool requested)
 {
+    decoded(d);
     d->attentionRequested = requested;
 }
 
@@ -159,7 +333,7 @@ void QXmppMessage::setAttentionRequested(bool requested)
 
 bool QXmppMessage::isReceiptRequested() const
 {
-    return d->receiptRequested;
+    return decoded(d)->receiptRequested;
 }
 
 /// Sets whether a delivery receipt is requested, as defined
@@ -169,6 +343,7 @@ bool QXmppMessage::isReceiptRequested() const
 
 void QXmppMessage::setReceiptRequested(bool requested)
 {
+    decoded(d);
     d->receiptRequested = requested;
     if (requested && id().isEmpty())
         generateAndSetNextId();
@@ -179,7 +354,7 @@ void QXmppMessage::setReceiptRequested(bool requested)
 
 QString QXmppMessage::receiptId() const
 {
-    return d->receiptId;
+    return decoded(d)->receiptId;
 }
 
 /// Make this message a delivery receipt for the message with
@@ -187,6 +362,7 @@ QString QXmppMessage::receiptId() const
 
 void QXmppMessage::setReceiptId(const QString &id)
 {
+    decoded(d);
     d->receiptId = id;
 }
 
@@ -204,6 +380,7 @@ QXmppMessage::Type QXmppMessage::type() const
 
 void QXmppMessage::setType(QXmppMessage::Type type)
 {
+    decoded(d);
     d->type = type;
 }
 
@@ -211,7 +388,7 @@ void QXmppMessage::setType(QXmppMessage::Type type)
 
 QDateTime QXmppMessage::stamp() const
 {
-    return d->stamp;
+    return decoded(d)->stamp;
 }
 
 /// Sets the message's timestamp.
@@ -220,6 +397,7 @@ QDateTime QXmppMessage::stamp() const
 
 void QXmppMessage::setStamp(const QDateTime &stamp)
 {
+    decoded(d);
     d->stamp = stamp;
 }
 
@@ -228,7 +406,7 @@ void QXmppMessage::setStamp(const QDateTime &stamp)
 
 QXmppMessage::State QXmppMessage::state() const
 {
-    return d->state;
+    return decoded(d)->state;
 }
 
 /// Sets the message's chat state.
@@ -237,6 +415,7 @@ QXmppMessage::State QXmppMessage::state() const
 
 void QXmppMessage::setState(QXmppMessage::State state)
 {
+    decoded(d);
     d->state = state;
 }
 
@@ -245,7 +424,7 @@ void QXmppMessage::setState(QXmppMessage::State state)
 
 QString QXmppMessage::subject() const
 {
-    return d->subject;
+    return decoded(d)->subject;
 }
 
 /// Sets the message's subject.
@@ -254,6 +433,7 @@ QString QXmppMessage::subject() const
 
 void QXmppMessage::setSubject(const QString& subject)
 {
+    decoded(d);
     d->subject = subject;
 }
 
@@ -261,7 +441,7 @@ void QXmppMessage::setSubject(const QString& subject)
 
 QString QXmppMessage::thread() const
 {
-    return d->thread;
+    return decoded(d)->thread;
 }
 
 /// Sets the message's thread.
@@ -270,6 +450,7 @@ QString QXmppMessage::thread() const
 
 void QXmppMessage::setThread(const QString& thread)
 {
+    decoded(d);
     d->thread = thread;
 }
 
@@ -278,7 +459,16 @@ void QXmppMessage::setThread(const QString& thread)
 
 QString QXmppMessage::xhtml() const
 {
-    return d->xhtml;
+    const QXmppMessagePrivate *data = decoded(d);
+    if (!data->xhtml.isEmpty() || data->xhtmlElement.isNull())
+        return data->xhtml;
+
+    // the decoded DOM is only read from here on, so copies in other
+    // threads may serialize it at the same time
+    QString xhtml;
+    QXmlStreamWriter xmlWriter(&xhtml);
+    writeXhtml(&xmlWriter, data->xhtmlElement);
+    return xhtml;
 }
 
 /// Sets the message's XHTML body as defined by
@@ -286,7 +476,28 @@ QString QXmppMessage::xhtml() const
 
 void QXmppMessage::setXhtml(const QString &xhtml)
 {
+    decoded(d);
     d->xhtml = xhtml;
+    d->xhtmlElement = QDomElement();
+    d->document = QDomDocument();
+    if (xhtml.isEmpty())
+        return;
+
+    // parse the markup once, so that toXml() can write it through the
+    // writer like the rest of the stanza
+    QXmlSimpleReader reader;
+    reader.setFeature("http://xml.org/sax/features/namespaces", true);
+    reader.setFeature("http://xml.org/sax/features/namespace-prefixes", false);
+    reader.setFeature("http://trolltech.com/xml/features/report-whitespace-only-CharData", true);
+
+    QXmlInputSource source;
+    source.setData(QString("<body xmlns=\"%1\">%2</body>").arg(QLatin1String(ns_xhtml), xhtml));
+
+    QDomDocument document;
+    if (document.setContent(&source, &reader)) {
+        d->document = document;
+        d->xhtmlElement = document.documentElement();
+    }
 }
 
 /// \cond
@@ -294,6 +505,7 @@ void QXmppMessage::parse(const QDomElement &element)
 {
     QXmppStanza::parse(element);
 
+    decoded(d);
     const QString type = element.attribute("type");
     d->type = Normal;
     for (int i = Error; i <= Headline; i++) {
@@ -303,77 +515,18 @@ void QXmppMessage::parse(const QDomElement &element)
         }
     }
 
-    d->body = element.firstChildElement("body").text();
-    d->subject = element.firstChildElement("subject").text();
-    d->thread = element.firstChildElement("thread").text();
-
-    // chat states
-    for (int i = Active; i <= Paused; i++)
-    {
-        QDomElement stateElement = element.firstChildElement(chat_states[i]);
-        if (!stateElement.isNull() &&
-            stateElement.namespaceURI() == ns_chat_states)
-        {
-            d->state = static_cast<QXmppMessage::State>(i);
-            break;
-        }
-    }
-
-    // XEP-0071: XHTML-IM
-    QDomElement htmlElement = element.firstChildElement("html");
-    if (!htmlElement.isNull() && htmlElement.namespaceURI() == ns_xhtml_im) {
-        QDomElement bodyElement = htmlElement.firstChildElement("body");
-        if (!bodyElement.isNull() && bodyElement.namespaceURI() == ns_xhtml) {
-            QTextStream stream(&d->xhtml, QIODevice::WriteOnly);
-            bodyElement.save(stream, 0);
-
-            d->xhtml = d->xhtml.mid(d->xhtml.indexOf('>') + 1);
-            d->xhtml.replace(" xmlns=\"http://www.w3.org/1999/xhtml\"", "");
-            d->xhtml.replace("</body>", "");
-            d->xhtml = d->xhtml.trimmed();
-        }
-    }
-
-    // XEP-0184: Message Delivery Receipts
-    QDomElement receivedElement = element.firstChildElement("received");
-    if (!receivedElement.isNull() && receivedElement.namespaceURI() == ns_message_receipts) {
-        d->receiptId = receivedElement.attribute("id");
-
-        // compatibility with old-style XEP
-        if (d->receiptId.isEmpty())
-            d->receiptId = id();
-    } else {
-        d->receiptId = QString();
-    }
-    d->receiptRequested = element.firstChildElement("request").namespaceURI() == ns_message_receipts;
-
-    // XEP-0203: Delayed Delivery
-    QDomElement delayElement = element.firstChildElement("delay");
-    if (!delayElement.isNull() && delayElement.namespaceURI() == ns_delayed_delivery)
-    {
-        const QString str = delayElement.attribute("stamp");
-        d->stamp = QXmppUtils::datetimeFromString(str);
-        d->stampType = DelayedDelivery;
-    }
-
-    // XEP-0224: Attention
-    d->attentionRequested = element.firstChildElement("attention").namespaceURI() == ns_attention;
+    // the payload is only decoded when first accessed, the document
+    // is kept so that the element stays valid until then
+    d->document = element.ownerDocument();
+    d->element = element;
+    d->decodeState.fetchAndStoreRelease(DecodePending);
 
     QXmppElementList extensions;
     QDomElement xElement = element.firstChildElement("x");
     while (!xElement.isNull())
     {
-        if (xElement.namespaceURI() == ns_legacy_delayed_delivery)
-        {
-            // XEP-0091: Legacy Delayed Delivery
-            const QString str = xElement.attribute("stamp");
-            d->stamp = QDateTime::fromString(str, "yyyyMMddThh:mm:ss");
-            d->stamp.setTimeSpec(Qt::UTC);
-            d->stampType = LegacyDelayedDelivery;
-        } else {
-            // other extensions
+        if (xElement.namespaceURI() != ns_legacy_delayed_delivery)
             extensions << QXmppElement(xElement);
-        }
         xElement = xElement.nextSiblingElement("x");
     }
     setExtensions(extensions);
@@ -381,6 +534,8 @@ void QXmppMessage::parse(const QDomElement &element)
 
 void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
 {
+    const QXmppMessagePrivate *data = decoded(d);
+
     xmlWriter->writeStartElement("message");
     helperToXmlAddAttribute(xmlWriter, "xml:lang", lang());
     helperToXmlAddAttribute(xmlWriter, "id", id());
@@ -404,13 +559,18 @@ void QXmppMessage::toXml(QXmlStreamWriter *xmlWriter) const
     }
 
     // XEP-0071: XHTML-IM
-    if (!d->xhtml.isEmpty()) {
+    if (!data->xhtml.isEmpty() || !data->xhtmlElement.isNull()) {
         xmlWriter->writeStartElement("html");
         xmlWriter->writeAttribute("xmlns", ns_xhtml_im);
         xmlWriter->writeStartElement("body");
         xmlWriter->writeAttribute("xmlns", ns_xhtml);
-        xmlWriter->writeCharacters("");
-        xmlWriter->device()->write(d->xhtml.toUtf8());
+        if (!data->xhtmlElement.isNull()) {
+            // forward the parsed body without turning it into a string
+            writeXhtml(xmlWriter, data->xhtmlElement);
+        } else {
+            // the markup is not well-formed, send it as text
+            xmlWriter->writeCharacters(data->xhtml);
+        }
         xmlWriter->writeEndElement();
         xmlWriter->writeEndElement();
     }
@@ -26,6 +26,7 @@
 #include "QXmppUtils.h"
 #include <QtDebug>
 #include <QDomElement>
+#include <QThread>
 #include <QXmlStreamWriter>
 #include "QXmppConstants.h"
 
@@ -49,6 +50,14 @@ static const char* presence_shows[] = {
     "invisible"
 };
 
+// states of a lazily decoded payload
+enum DecodeState
+{
+    Decoded = 0,
+    DecodePending,
+    Decoding
+};
+
 class QXmppPresencePrivate : public QSharedData
 {
 public:
@@ -73,8 +82,92 @@ public:
     // XEP-0045: Multi-User Chat
     QXmppMucItem mucItem;
     QList<int> mucStatusCodes;
+
+    // lazy parsing
+    void decode();
+    QDomDocument document;
+    QDomElement element;
+    QAtomicInt decodeState;
 };
 
+/// Decodes the payload of a received presence.
+
+void QXmppPresencePrivate::decode()
+{
+    if (element.isNull())
+        return;
+    const QDomElement stanza = element;
+    element = QDomElement();
+    document = QDomDocument();
+
+    status.parse(stanza);
+
+    QDomElement xElement = stanza.firstChildElement();
+    vCardUpdateType = QXmppPresence::VCardUpdateNone;
+    while(!xElement.isNull())
+    {
+        // XEP-0045: Multi-User Chat
+        if(xElement.namespaceURI() == ns_muc_user)
+        {
+            QDomElement itemElement = xElement.firstChildElement("item");
+            mucItem.parse(itemElement);
+            QDomElement statusElement = xElement.firstChildElement("status");
+            mucStatusCodes.clear();
+            while (!statusElement.isNull()) {
+                mucStatusCodes << statusElement.attribute("code").toInt();
+                statusElement = statusElement.nextSiblingElement("status");
+            }
+        }
+        // XEP-0153: vCard-Based Avatars
+        else if(xElement.namespaceURI() == ns_vcard_update)
+        {
+            QDomElement photoElement = xElement.firstChildElement("photo");
+            if(!photoElement.isNull())
+            {
+                photoHash = QByteArray::fromHex(photoElement.text().toAscii());
+                if(photoHash.isEmpty())
+                    vCardUpdateType = QXmppPresence::VCardUpdateNoPhoto;
+                else
+                    vCardUpdateType = QXmppPresence::VCardUpdateValidPhoto;
+            }
+            else
+            {
+                photoHash = QByteArray();
+                vCardUpdateType = QXmppPresence::VCardUpdateNotReady;
+            }
+        }
+        // XEP-0115: Entity Capabilities
+        else if(xElement.tagName() == "c" && xElement.namespaceURI() == ns_capabilities)
+        {
+            capabilityNode = xElement.attribute("node");
+            capabilityVer = QByteArray::fromBase64(xElement.attribute("ver").toAscii());
+            capabilityHash = xElement.attribute("hash");
+            capabilityExt = xElement.attribute("ext").split(" ", QString::SkipEmptyParts);
+        }
+        xElement = xElement.nextSiblingElement();
+    }
+}
+
+// Returns the presence's private data, decoding it first if needed.
+//
+// As for QXmppMessage, the first reader to claim the payload decodes it
+// and the others wait for it, and setters call this before detaching.
+
+static inline QXmppPresencePrivate *decoded(const QSharedDataPointer<QXmppPresencePrivate> &d)
+{
+    QXmppPresencePrivate *data = const_cast<QXmppPresencePrivate*>(d.constData());
+    if (!data->decodeState.testAndSetAcquire(Decoded, Decoded)) {
+        if (data->decodeState.testAndSetAcquire(DecodePending, Decoding)) {
+            data->decode();
+            data->decodeState.fetchAndStoreRelease(Decoded);
+        } else {
+            while (!data->decodeState.testAndSetAcquire(Decoded, Decoded))
+                QThread::yieldCurrentThread();
+        }
+    }
+    return data;
+}
+
 /// Constructs a QXmppPresence.
 ///
 /// \param type
@@ -117,13 +210,14 @@ QXmppPresence &QXmppPresence::operator=(const QXmppPresence &other)
 
 QXmppPresence::AvailableStatusType QXmppPresence::availableStatusType() const
 {
-    return static_cast<QXmppPresence::AvailableStatusType>(d->status.type());
+    return static_cast<QXmppPresence::AvailableStatusType>(decoded(d)->status.type());
 }
 
 /// Sets the availability status type, for instance busy or away.
 
 void QXmppPresence::setAvailableStatusType(AvailableStatusType type)
 {
+    decoded(d);
     d->status.setType(static_cast<QXmppPresence::Status::Type>(type));
 }
 
@@ -131,13 +225,14 @@ void QXmppPresence::setAvailableStatusType(AvailableStatusType type)
 
 int QXmppPresence::priority() const
 {
-    return d->status.priority();
+    return decoded(d)->status.priority();
 }
 
 /// Sets the \a priority level of the resource.
 
 void QXmppPresence::setPriority(int priority)
 {
+    decoded(d);
     d->status.setPriority(priority);
 }
 
@@ -145,7 +240,7 @@ void QXmppPresence::setPriority(int priority)
 
 QString QXmppPresence::statusText() const
 {
-    return d->status.statusText();
+    return decoded(d)->status.statusText();
 }
 
 /// Sets the status text, a textual description of the user's status.
@@ -154,6 +249,7 @@ QString QXmppPresence::statusText() const
 
 void QXmppPresence::setStatusText(const QString& statusText)
 {
+    decoded(d);
     d->status.setStatusText(statusText);
 }
 
@@ -175,6 +271,7 @@ QXmppPresence::Type QXmppPresence::type() const
 
 void QXmppPresence::setType(QXmppPresence::Type type)
 {
+    decoded(d);
     d->type = type;
 }
 
@@ -183,6 +280,7 @@ void QXmppPresence::parse(const QDomElement &element)
 {
     QXmppStanza::parse(element);
 
+    decoded(d);
     const QString type = element.attribute("type");
     for (int i = Error; i <= Probe; i++) {
         if (type == presence_types[i]) {
@@ -190,62 +288,28 @@ void QXmppPresence::parse(const QDomElement &element)
             break;
         }
     }
-    d->status.parse(element);
+
+    // the payload is only decoded when first accessed, the document
+    // is kept so that the element stays valid until then
+    d->document = element.ownerDocument();
+    d->element = element;
+    d->decodeState.fetchAndStoreRelease(DecodePending);
 
     QXmppElementList extensions;
     QDomElement xElement = element.firstChildElement();
-    d->vCardUpdateType = VCardUpdateNone;
     while(!xElement.isNull())
     {
-        // XEP-0045: Multi-User Chat
-        if(xElement.namespaceURI() == ns_muc_user)
-        {
-            QDomElement itemElement = xElement.firstChildElement("item");
-            d->mucItem.parse(itemElement);
-            QDomElement statusElement = xElement.firstChildElement("status");
-            d->mucStatusCodes.clear();
-            while (!statusElement.isNull()) {
-                d->mucStatusCodes << statusElement.attribute("code").toInt();
-                statusElement = statusElement.nextSiblingElement("status");
-            }
-        }
-        // XEP-0153: vCard-Based Avatars
-        else if(xElement.namespaceURI() == ns_vcard_update)
-        {
-            QDomElement photoElement = xElement.firstChildElement("photo");
-            if(!photoElement.isNull())
-            {
-                d->photoHash = QByteArray::fromHex(photoElement.text().toAscii());
-                if(d->photoHash.isEmpty())
-                    d->vCardUpdateType = VCardUpdateNoPhoto;
-                else
-                    d->vCardUpdateType = VCardUpdateValidPhoto;
-            }
-            else
-            {
-                d->photoHash = QByteArray();
-                d->vCardUpdateType = VCardUpdateNotReady;
-            }
-        }
-        // XEP-0115: Entity Capabilities
-        else if(xElement.tagName() == "c" && xElement.namespaceURI() == ns_capabilities)
-        {
-            d->capabilityNode = xElement.attribute("node");
-            d->capabilityVer = QByteArray::fromBase64(xElement.attribute("ver").toAscii());
-            d->capabilityHash = xElement.attribute("hash");
-            d->capabilityExt = xElement.attribute("ext").split(" ", QString::SkipEmptyParts);
-        }
-        else if (xElement.tagName() == "error")
-        {
-        }
-        else if (xElement.tagName() == "show")
-        {
-        }
-        else if (xElement.tagName() == "status")
-        {
-        }
-        else if (xElement.tagName() == "priority")
+        const QString ns = xElement.namespaceURI();
+        const QString tagName = xElement.tagName();
+        if (ns == ns_muc_user ||
+            ns == ns_vcard_update ||
+            (tagName == "c" && ns == ns_capabilities) ||
+            tagName == "error" ||
+            tagName == "show" ||
+            tagName == "status" ||
+            tagName == "priority")
         {
+            // handled by decode()
         }
         else
         {
@@ -259,6 +323,8 @@ void QXmppPresence::parse(const QDomElement &element)
 
 void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
 {
+    decoded(d);
+
     xmlWriter->writeStartElement("presence");
     helperToXmlAddAttribute(xmlWriter,"xml:lang", lang());
     helperToXmlAddAttribute(xmlWriter,"id", id());
@@ -329,7 +395,7 @@ void QXmppPresence::toXml(QXmlStreamWriter *xmlWriter) const
 
 QByteArray QXmppPresence::photoHash() const
 {
-    return d->photoHash;
+    return decoded(d)->photoHash;
 }
 
 /// Sets the photo-hash of the VCardUpdate.
@@ -338,6 +404,7 @@ QByteArray QXmppPresence::photoHash() const
 
 void QXmppPresence::setPhotoHash(const QByteArray& photoHash)
 {
+    decoded(d);
     d->photoHash = photoHash;
 }
 
@@ -347,7 +414,7 @@ void QXmppPresence::setPhotoHash(const QByteArray& photoHash)
 
 QXmppPresence::VCardUpdateType QXmppPresence::vCardUpdateType() const
 {
-    return d->vCardUpdateType;
+    return decoded(d)->vCardUpdateType;
 }
 
 /// Sets the type of VCardUpdate
@@ -356,56 +423,60 @@ QXmppPresence::VCardUpdateType QXmppPresence::vCardUpdateType() const
 
 void QXmppPresence::setVCardUpdateType(VCardUpdateType type)
 {
+    decoded(d);
     d->vCardUpdateType = type;
 }
 
 /// XEP-0115: Entity Capabilities
 QString QXmppPresence::capabilityHash() const
 {
-    return d->capabilityHash;
+    return decoded(d)->capabilityHash;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityHash(const QString& hash)
 {
+    decoded(d);
     d->capabilityHash = hash;
 }
 
 /// XEP-0115: Entity Capabilities
 QString QXmppPresence::capabilityNode() const
 {
-    return d->capabilityNode;
+    return decoded(d)->capabilityNode;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityNode(const QString& node)
 {
+    decoded(d);
     d->capabilityNode = node;
 }
 
 /// XEP-0115: Entity Capabilities
 QByteArray QXmppPresence::capabilityVer() const
 {
-    return d->capabilityVer;
+    return decoded(d)->capabilityVer;
 }
 
 /// XEP-0115: Entity Capabilities
 void QXmppPresence::setCapabilityVer(const QByteArray& ver)
 {
+    decoded(d);
     d->capabilityVer = ver;
 }
 
 /// Legacy XEP-0115: Entity Capabilities
 QStringList QXmppPresence::capabilityExt() const
 {
-    return d->capabilityExt;
+    return decoded(d)->capabilityExt;
 }
 
 /// Returns the MUC item.
 
 QXmppMucItem QXmppPresence::mucItem() const
 {
-    return d->mucItem;
+    return decoded(d)->mucItem;
 }
 
 /// Sets the MUC item.
@@ -414,6 +485,7 @@ QXmppMucItem QXmppPresence::mucItem() const
 
 void QXmppPresence::setMucItem(const QXmppMucItem &item)
 {
+    decoded(d);
     d->mucItem = item;
 }
 
@@ -421,7 +493,7 @@ void QXmppPresence::setMucItem(const QXmppMucItem &item)
 
 QList<int> QXmppPresence::mucStatusCodes() const
 {
-    return d->mucStatusCodes;
+    return decoded(d)->mucStatusCodes;
 }
 
 /// Sets the MUC status codes.
@@ -430,22 +502,25 @@ QList<int> QXmppPresence::mucStatusCodes() const
 
 void QXmppPresence::setMucStatusCodes(const QList<int> &codes)
 {
+    decoded(d);
     d->mucStatusCodes = codes;
 }
 
 /// \cond
 const QXmppPresence::Status& QXmppPresence::status() const
 {
-    return d->status;
+    return decoded(d)->status;
 }
 
 QXmppPresence::Status& QXmppPresence::status()
 {
+    decoded(d);
     return d->status;
 }
 
 void QXmppPresence::setStatus(const QXmppPresence::Status& status)
 {
+    decoded(d);
     d->status = status;
 }
 
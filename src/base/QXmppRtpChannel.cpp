@@ -24,12 +24,18 @@
 #include <cmath>
 
 #include <QDataStream>
+#include <QDateTime>
+#include <QtEndian>
 #include <QMetaType>
+#include <QPointer>
+#include <QSet>
 #include <QTimer>
+#include <QVector>
 
 #include "QXmppCodec_p.h"
 #include "QXmppJingleIq.h"
 #include "QXmppRtpChannel.h"
+#include "QXmppRtpChannel_p.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -39,69 +45,368 @@
 //#define QXMPP_DEBUG_RTP_BUFFER
 #define SAMPLE_BYTES 2
 
+// number of sent video packets kept for retransmission, must divide 65536
+#define RTP_HISTORY_SIZE 256
+// maximum number of lost packets tracked by the receiver
+#define RTP_NACK_MAXIMUM 64
+// interval between NACK retries in milliseconds
+#define RTP_NACK_INTERVAL 100
+// number of times a lost packet is reported
+#define RTP_NACK_TRIES 3
+// number of sent video packets over which losses are measured
+#define RTP_LOSS_WINDOW 100
+// interval between RTCP sender reports in milliseconds
+#define RTP_REPORT_INTERVAL 1000
+// audio / video offset in milliseconds which is considered in sync
+#define RTP_SYNC_TOLERANCE 40
+// maximum delay in milliseconds applied to a stream for synchronisation
+#define RTP_SYNC_MAXIMUM 1000
+
 const quint8 RTP_VERSION = 0x02;
+const quint32 RTP_VIDEO_CLOCKRATE = 90000;
 
-/// Parses an RTP packet.
+// seconds between the NTP epoch (1900) and the Unix epoch (1970)
+const qint64 NTP_EPOCH_OFFSET = Q_INT64_C(2208988800);
+
+// RFC 5285: header extension profiles
+const quint16 RTP_EXTENSION_ONE_BYTE = 0xbede;
+const quint16 RTP_EXTENSION_TWO_BYTE = 0x1000;
+
+// RFC 6464: level (in -dBov) below which a packet is flagged as voice
+#define RTP_AUDIO_LEVEL_VOICE 50
+
+static const char *rtp_hdrext_audio_level = "urn:ietf:params:rtp-hdrext:ssrc-audio-level";
+static const char *rtp_hdrext_abs_send_time = "http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time";
+static const char *rtp_hdrext_transport_sequence = "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01";
+
+// Finds the next RFC 5285 element in a header extension, starting at pos.
+static bool nextExtensionElement(const uchar *data, int size, quint16 profile, int &pos, quint8 &id, int &offset, int &length)
+{
+    const bool twoByte = (profile & 0xfff0) == RTP_EXTENSION_TWO_BYTE;
+    if (!twoByte && profile != RTP_EXTENSION_ONE_BYTE)
+        return false;
+
+    while (pos < size) {
+        // skip padding
+        if (!data[pos]) {
+            pos++;
+            continue;
+        }
+        if (twoByte) {
+            if (pos + 2 > size)
+                return false;
+            id = data[pos];
+            length = data[pos + 1];
+            offset = pos + 2;
+        } else {
+            // identifier 15 is reserved and stops processing
+            id = data[pos] >> 4;
+            if (id == 15)
+                return false;
+            length = (data[pos] & 0xf) + 1;
+            offset = pos + 1;
+        }
+        if (offset + length > size)
+            return false;
+        pos = offset + length;
+        return true;
+    }
+    return false;
+}
+
+// Returns the RFC 6464 audio level of 16-bit PCM samples, in -dBov.
+static int audioLevel(const QByteArray &chunk)
+{
+    const int count = chunk.size() / SAMPLE_BYTES;
+    if (!count)
+        return 127;
+
+    const uchar *ptr = reinterpret_cast<const uchar*>(chunk.constData());
+    qreal sum = 0;
+    for (int i = 0; i < count; ++i, ptr += SAMPLE_BYTES) {
+        const qint16 sample = qFromLittleEndian<qint16>(ptr);
+        sum += qreal(sample) * sample;
+    }
+    const qreal rms = sqrt(sum / count) / 32768.0;
+    if (rms <= 0)
+        return 127;
+    return qBound(0, qRound(-20.0 * log10(rms)), 127);
+}
+
+// Encodes an RTP packet into a reusable datagram buffer.
+static const QByteArray &encodePacket(QByteArray &buffer, const QXmppRtpPacket &packet)
+{
+    buffer.resize(packet.encodedSize());
+    packet.encode(buffer.data(), buffer.size());
+    return buffer;
+}
+
+/// Constructs an empty RTP header.
+
+QXmppRtpHeader::QXmppRtpHeader()
+    : version(RTP_VERSION),
+    marker(false),
+    type(0),
+    sequence(0),
+    stamp(0),
+    ssrc(0),
+    csrcCount(0),
+    csrcOffset(12),
+    extensionProfile(0),
+    extensionOffset(0),
+    extensionLength(0),
+    payloadOffset(12),
+    payloadLength(0),
+    paddingLength(0)
+{
+}
+
+/// Parses the header of an RTP packet, without copying its data.
 ///
-/// \param ba
+/// \param data
+/// \param size
 
-bool QXmppRtpPacket::decode(const QByteArray &ba)
+bool QXmppRtpHeader::parse(const char *data, int size)
 {
-    if (ba.isEmpty())
+    const uchar *ptr = reinterpret_cast<const uchar*>(data);
+    if (size < 12)
         return false;
 
     // fixed header
-    quint8 tmp;
-    QDataStream stream(ba);
-    stream >> tmp;
-    version = (tmp >> 6);
-    const quint8 cc = (tmp >> 1) & 0xf;
-    const int hlen = 12 + 4 * cc;
-    if (version != RTP_VERSION || ba.size() < hlen)
+    version = (ptr[0] >> 6);
+    const bool hasPadding = (ptr[0] >> 5) & 0x1;
+    const bool hasExtension = (ptr[0] >> 4) & 0x1;
+    csrcCount = ptr[0] & 0xf;
+    int hlen = 12 + 4 * csrcCount;
+    if (version != RTP_VERSION || size < hlen)
         return false;
-    stream >> tmp;
-    marker = (tmp >> 7);
-    type = tmp & 0x7f;
-    stream >> sequence;
-    stream >> stamp;
-    stream >> ssrc;
+    marker = (ptr[1] >> 7);
+    type = ptr[1] & 0x7f;
+    sequence = qFromBigEndian<quint16>(ptr + 2);
+    stamp = qFromBigEndian<quint32>(ptr + 4);
+    ssrc = qFromBigEndian<quint32>(ptr + 8);
+    csrcOffset = 12;
+
+    // header extension
+    extensionProfile = 0;
+    extensionOffset = hlen;
+    extensionLength = 0;
+    if (hasExtension) {
+        if (size < hlen + 4)
+            return false;
+        extensionProfile = qFromBigEndian<quint16>(ptr + hlen);
+        extensionLength = 4 * qFromBigEndian<quint16>(ptr + hlen + 2);
+        extensionOffset = hlen + 4;
+        hlen = extensionOffset + extensionLength;
+        if (size < hlen)
+            return false;
+    }
 
-    // contributing source IDs
-    csrc.clear();
-    quint32 src;
-    for (int i = 0; i < cc; ++i) {
-        stream >> src;
-        csrc << src;
+    // padding
+    paddingLength = 0;
+    if (hasPadding) {
+        paddingLength = ptr[size - 1];
+        if (!paddingLength || size - hlen < paddingLength)
+            return false;
+    }
+
+    payloadOffset = hlen;
+    payloadLength = size - hlen - paddingLength;
+    return true;
+}
+
+/// Looks up an RFC 5285 header extension element in the parsed packet.
+///
+/// Returns the element's offset in \a data and stores its size in
+/// \a length, or returns -1 if the element is not present.
+///
+/// \param data
+/// \param id
+/// \param length
+
+int QXmppRtpHeader::findExtensionElement(const char *data, quint8 id, int *length) const
+{
+    const uchar *ptr = reinterpret_cast<const uchar*>(data) + extensionOffset;
+    int pos = 0, offset, size;
+    quint8 elementId;
+    while (nextExtensionElement(ptr, extensionLength, extensionProfile, pos, elementId, offset, size)) {
+        if (elementId == id) {
+            if (length)
+                *length = size;
+            return extensionOffset + offset;
+        }
     }
+    return -1;
+}
+
+/// Constructs an empty RTP packet.
+
+QXmppRtpPacket::QXmppRtpPacket()
+    : version(RTP_VERSION),
+    marker(false),
+    type(0),
+    ssrc(0),
+    sequence(0),
+    stamp(0),
+    extensionProfile(0)
+{
+}
+
+// Fills in the fields of an RTP packet, except for its payload, from a
+// header parsed in place from the given data.
+
+static void copyHeader(QXmppRtpPacket &packet, const QXmppRtpHeader &header, const char *data)
+{
+    packet.version = header.version;
+    packet.marker = header.marker;
+    packet.type = header.type;
+    packet.sequence = header.sequence;
+    packet.stamp = header.stamp;
+    packet.ssrc = header.ssrc;
+
+    // contributing source IDs
+    packet.csrc.clear();
+    const uchar *ptr = reinterpret_cast<const uchar*>(data) + header.csrcOffset;
+    for (int i = 0; i < header.csrcCount; ++i, ptr += 4)
+        packet.csrc << qFromBigEndian<quint32>(ptr);
+
+    // header extension
+    packet.extensionProfile = header.extensionProfile;
+    if (header.extensionLength)
+        packet.extension = QByteArray(data + header.extensionOffset, header.extensionLength);
+    else
+        packet.extension.clear();
+}
+
+/// Parses an RTP packet.
+///
+/// \param ba
+
+bool QXmppRtpPacket::decode(const QByteArray &ba)
+{
+    QXmppRtpHeader header;
+    if (!header.parse(ba.constData(), ba.size()))
+        return false;
+
+    copyHeader(*this, header, ba.constData());
 
     // retrieve payload
-    payload = ba.right(ba.size() - hlen);
+    payload = ba.mid(header.payloadOffset, header.payloadLength);
     return true;
 }
 
 /// Encodes an RTP packet.
 
 QByteArray QXmppRtpPacket::encode() const
+{
+    QByteArray ba;
+    ba.resize(encodedSize());
+    encode(ba.data(), ba.size());
+    return ba;
+}
+
+/// Encodes an RTP packet into a preallocated buffer.
+///
+/// Returns the number of bytes written, or -1 if the buffer is too small.
+///
+/// \param data
+/// \param size
+
+int QXmppRtpPacket::encode(char *data, int size) const
 {
     Q_ASSERT(csrc.size() < 16);
 
+    const int length = encodedSize();
+    if (size < length)
+        return -1;
+
     // fixed header
-    QByteArray ba;
-    ba.resize(payload.size() + 12 + 4 * csrc.size());
-    QDataStream stream(&ba, QIODevice::WriteOnly);
-    stream << quint8(((version & 0x3) << 6) |
-                     ((csrc.size() & 0xf) << 1));
-    stream << quint8((type & 0x7f) | (marker << 7));
-    stream << sequence;
-    stream << stamp;
-    stream << ssrc;
+    const bool hasExtension = extensionProfile || !extension.isEmpty();
+    uchar *ptr = reinterpret_cast<uchar*>(data);
+    ptr[0] = ((version & 0x3) << 6) |
+             (hasExtension << 4) |
+             (csrc.size() & 0xf);
+    ptr[1] = (type & 0x7f) | (marker << 7);
+    qToBigEndian<quint16>(sequence, ptr + 2);
+    qToBigEndian<quint32>(stamp, ptr + 4);
+    qToBigEndian<quint32>(ssrc, ptr + 8);
+    ptr += 12;
 
     // contributing source ids
-    foreach (const quint32 &src, csrc)
-        stream << src;
+    foreach (const quint32 &src, csrc) {
+        qToBigEndian<quint32>(src, ptr);
+        ptr += 4;
+    }
 
-    stream.writeRawData(payload.constData(), payload.size());
-    return ba;
+    // header extension, zero-padded to a multiple of 32 bits
+    if (hasExtension) {
+        const int words = (extension.size() + 3) / 4;
+        qToBigEndian<quint16>(extensionProfile, ptr);
+        qToBigEndian<quint16>(words, ptr + 2);
+        memcpy(ptr + 4, extension.constData(), extension.size());
+        memset(ptr + 4 + extension.size(), 0, 4 * words - extension.size());
+        ptr += 4 + 4 * words;
+    }
+
+    memcpy(ptr, payload.constData(), payload.size());
+    return length;
+}
+
+/// Returns the size of the encoded RTP packet.
+
+int QXmppRtpPacket::encodedSize() const
+{
+    int length = 12 + 4 * csrc.size() + payload.size();
+    if (extensionProfile || !extension.isEmpty())
+        length += 4 + 4 * ((extension.size() + 3) / 4);
+    return length;
+}
+
+/// Returns the RFC 5285 header extension elements, keyed by identifier.
+
+QMap<quint8, QByteArray> QXmppRtpPacket::extensionElements() const
+{
+    QMap<quint8, QByteArray> elements;
+    const uchar *ptr = reinterpret_cast<const uchar*>(extension.constData());
+    int pos = 0, offset, length;
+    quint8 id;
+    while (nextExtensionElement(ptr, extension.size(), extensionProfile, pos, id, offset, length))
+        elements.insert(id, extension.mid(offset, length));
+    return elements;
+}
+
+/// Sets the RFC 5285 header extension elements, keyed by identifier.
+///
+/// The one-byte header form is used whenever the identifiers and sizes
+/// allow it, otherwise the two-byte form is used.
+///
+/// \param elements
+
+void QXmppRtpPacket::setExtensionElements(const QMap<quint8, QByteArray> &elements)
+{
+    bool oneByte = true;
+    QMap<quint8, QByteArray>::const_iterator it;
+    for (it = elements.constBegin(); it != elements.constEnd(); ++it) {
+        Q_ASSERT(it.key() > 0 && it.value().size() < 256);
+        if (it.key() > 14 || it.value().isEmpty() || it.value().size() > 16)
+            oneByte = false;
+    }
+
+    extension.clear();
+    if (elements.isEmpty()) {
+        extensionProfile = 0;
+        return;
+    }
+    extensionProfile = oneByte ? RTP_EXTENSION_ONE_BYTE : RTP_EXTENSION_TWO_BYTE;
+    for (it = elements.constBegin(); it != elements.constEnd(); ++it) {
+        if (oneByte) {
+            extension.append(char((it.key() << 4) | (it.value().size() - 1)));
+        } else {
+            extension.append(char(it.key()));
+            extension.append(char(it.value().size()));
+        }
+        extension.append(it.value());
+    }
 }
 
 /// Returns a string representation of the RTP header.
@@ -116,10 +421,239 @@ QString QXmppRtpPacket::toString() const
         QString::number(payload.size()));
 }
 
+/// Constructs an empty RTCP packet.
+
+QXmppRtcpPacket::QXmppRtcpPacket()
+    : version(RTP_VERSION),
+    count(0),
+    type(0),
+    ssrc(0)
+{
+}
+
+/// Parses an RTCP packet.
+///
+/// \param ba
+
+bool QXmppRtcpPacket::decode(const QByteArray &ba)
+{
+    if (ba.size() < 8)
+        return false;
+
+    // fixed header
+    quint8 tmp;
+    quint16 length;
+    QDataStream stream(ba);
+    stream >> tmp;
+    version = (tmp >> 6);
+    const bool padding = (tmp >> 5) & 0x1;
+    count = tmp & 0x1f;
+    stream >> type;
+    stream >> length;
+    const int size = 4 * (length + 1);
+    if (version != RTP_VERSION || size < 8 || ba.size() < size)
+        return false;
+    stream >> ssrc;
+
+    // retrieve payload
+    int payloadSize = size - 8;
+    if (padding) {
+        const quint8 padLength = ba.at(size - 1);
+        if (!padLength || padLength > payloadSize)
+            return false;
+        payloadSize -= padLength;
+    }
+    payload = ba.mid(8, payloadSize);
+    return true;
+}
+
+/// Parses a compound RTCP packet and returns the individual packets.
+///
+/// \param ba
+
+QList<QXmppRtcpPacket> QXmppRtcpPacket::decodeCompound(const QByteArray &ba)
+{
+    QList<QXmppRtcpPacket> packets;
+    int pos = 0;
+    while (ba.size() - pos >= 8) {
+        const int size = 4 * ((quint8(ba.at(pos + 2)) << 8 | quint8(ba.at(pos + 3))) + 1);
+        QXmppRtcpPacket packet;
+        if (!packet.decode(ba.mid(pos, size)))
+            break;
+        packets << packet;
+        pos += size;
+    }
+    return packets;
+}
+
+/// Encodes an RTCP packet.
+
+QByteArray QXmppRtcpPacket::encode() const
+{
+    const int padLength = (4 - payload.size() % 4) % 4;
+    const int size = 8 + payload.size() + padLength;
+
+    QByteArray ba;
+    ba.reserve(size);
+    QDataStream stream(&ba, QIODevice::WriteOnly);
+    stream << quint8(((version & 0x3) << 6) |
+                     ((padLength ? 1 : 0) << 5) |
+                     (count & 0x1f));
+    stream << type;
+    stream << quint16(size / 4 - 1);
+    stream << ssrc;
+    stream.writeRawData(payload.constData(), payload.size());
+    if (padLength) {
+        const QByteArray padding(padLength - 1, 0);
+        stream.writeRawData(padding.constData(), padding.size());
+        stream << quint8(padLength);
+    }
+    return ba;
+}
+
+/// Returns the NTP timestamp of a sender report.
+
+quint64 QXmppRtcpPacket::ntpStamp() const
+{
+    if (type != SenderReport || payload.size() < 20)
+        return 0;
+    return qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(payload.constData()));
+}
+
+/// Returns the RTP timestamp of a sender report, which corresponds to
+/// the same instant as its NTP timestamp.
+
+quint32 QXmppRtcpPacket::rtpStamp() const
+{
+    if (type != SenderReport || payload.size() < 20)
+        return 0;
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()) + 8);
+}
+
+/// Returns the number of RTP packets sent, according to a sender report.
+
+quint32 QXmppRtcpPacket::senderPacketCount() const
+{
+    if (type != SenderReport || payload.size() < 20)
+        return 0;
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()) + 12);
+}
+
+/// Returns the number of payload octets sent, according to a sender report.
+
+quint32 QXmppRtcpPacket::senderOctetCount() const
+{
+    if (type != SenderReport || payload.size() < 20)
+        return 0;
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData()) + 16);
+}
+
+/// Makes this packet a sender report without any reception report blocks.
+///
+/// \param ntpStamp
+/// \param rtpStamp
+/// \param packetCount
+/// \param octetCount
+
+void QXmppRtcpPacket::setSenderInfo(quint64 ntpStamp, quint32 rtpStamp, quint32 packetCount, quint32 octetCount)
+{
+    type = SenderReport;
+    count = 0;
+    payload.resize(20);
+
+    uchar *ptr = reinterpret_cast<uchar*>(payload.data());
+    qToBigEndian<quint64>(ntpStamp, ptr);
+    qToBigEndian<quint32>(rtpStamp, ptr + 8);
+    qToBigEndian<quint32>(packetCount, ptr + 12);
+    qToBigEndian<quint32>(octetCount, ptr + 16);
+}
+
+/// Returns the SSRC of the media source a feedback packet refers to.
+
+quint32 QXmppRtcpPacket::mediaSsrc() const
+{
+    if (payload.size() < 4)
+        return 0;
+    quint32 source;
+    QDataStream stream(payload);
+    stream >> source;
+    return source;
+}
+
+/// Returns the sequence numbers reported as lost by a generic NACK.
+
+QList<quint16> QXmppRtcpPacket::nackSequences() const
+{
+    QList<quint16> sequences;
+    if (type != RtpFeedback || count != 1)
+        return sequences;
+
+    QDataStream stream(payload);
+    stream.skipRawData(4);
+    quint16 pid, blp;
+    for (int i = 4; i + 4 <= payload.size(); i += 4) {
+        stream >> pid;
+        stream >> blp;
+        sequences << pid;
+        for (int bit = 0; bit < 16; ++bit) {
+            if (blp & (1 << bit))
+                sequences << quint16(pid + bit + 1);
+        }
+    }
+    return sequences;
+}
+
+/// Makes this packet a generic NACK reporting the given \a sequences as
+/// lost for the given \a mediaSsrc.
+///
+/// The sequence numbers must be given in transmission order.
+///
+/// \param mediaSsrc
+/// \param sequences
+
+void QXmppRtcpPacket::setNackSequences(quint32 mediaSsrc, const QList<quint16> &sequences)
+{
+    type = RtpFeedback;
+    count = 1;
+    payload.clear();
+
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << mediaSsrc;
+    int i = 0;
+    while (i < sequences.size()) {
+        const quint16 pid = sequences[i++];
+        quint16 blp = 0;
+        while (i < sequences.size()) {
+            const quint16 delta = sequences[i] - pid;
+            if (!delta || delta > 16)
+                break;
+            blp |= (1 << (delta - 1));
+            i++;
+        }
+        stream << pid;
+        stream << blp;
+    }
+}
+
+/// Returns a string representation of the RTCP header.
+
+QString QXmppRtcpPacket::toString() const
+{
+    return QString("RTCP packet type %1 count %2 ssrc %3 size %4").arg(
+        QString::number(type),
+        QString::number(count),
+        QString::number(ssrc),
+        QString::number(payload.size()));
+}
+
 /// Creates a new RTP channel.
 
 QXmppRtpChannel::QXmppRtpChannel()
-    : m_outgoingPayloadNumbered(false)
+    : m_outgoingPayloadNumbered(false),
+    m_audioLevelId(0),
+    m_absSendTimeId(0),
+    m_transportSequenceId(0),
+    m_outgoingTransportSequence(0)
 {
 }
 
@@ -182,6 +716,143 @@ void QXmppRtpChannel::setRemotePayloadTypes(const QList<QXmppJinglePayloadType>
     payloadTypesChanged();
 }
 
+/// Returns the local RTP header extensions, mapping their identifier
+/// to their URI.
+
+QMap<int, QString> QXmppRtpChannel::localHeaderExtensions() const
+{
+    return m_headerExtensions;
+}
+
+/// Sets the remote RTP header extensions, mapping their identifier
+/// to their URI.
+///
+/// Only the extensions supported by both parties are kept, using the
+/// remote party's identifiers. Extensions are only sent once they
+/// have been negotiated.
+///
+/// \param remoteHeaderExtensions
+
+void QXmppRtpChannel::setRemoteHeaderExtensions(const QMap<int, QString> &remoteHeaderExtensions)
+{
+    QMap<int, QString> commonExtensions;
+    QMap<int, QString>::const_iterator it;
+    for (it = remoteHeaderExtensions.constBegin(); it != remoteHeaderExtensions.constEnd(); ++it) {
+        if (it.key() > 0 && it.key() < 256 && m_headerExtensions.values().contains(it.value()))
+            commonExtensions.insert(it.key(), it.value());
+    }
+    m_headerExtensions = commonExtensions;
+    m_audioLevelId = m_headerExtensions.key(rtp_hdrext_audio_level);
+    m_absSendTimeId = m_headerExtensions.key(rtp_hdrext_abs_send_time);
+    m_transportSequenceId = m_headerExtensions.key(rtp_hdrext_transport_sequence);
+}
+
+/// Adds the negotiated RTP header extensions to an outgoing packet.
+///
+/// \param packet
+/// \param audioLevel The RFC 6464 audio level in -dBov, or -1 if not applicable.
+
+void QXmppRtpChannel::addHeaderExtensions(QXmppRtpPacket &packet, int audioLevel)
+{
+    QMap<quint8, QByteArray> elements;
+
+    // RFC 6464: client-to-mixer audio level
+    if (m_audioLevelId && audioLevel >= 0) {
+        const bool voice = audioLevel < RTP_AUDIO_LEVEL_VOICE;
+        elements.insert(m_audioLevelId, QByteArray(1, char((voice << 7) | (audioLevel & 0x7f))));
+    }
+
+    // absolute send time, as 6.18 fixed point seconds
+    if (m_absSendTimeId) {
+        const quint32 sendTime = ((QDateTime::currentMSecsSinceEpoch() << 18) / 1000) & 0xffffff;
+        uchar buffer[4];
+        qToBigEndian<quint32>(sendTime, buffer);
+        elements.insert(m_absSendTimeId, QByteArray(reinterpret_cast<char*>(buffer) + 1, 3));
+    }
+
+    // transport-wide sequence number
+    if (m_transportSequenceId) {
+        uchar buffer[2];
+        qToBigEndian<quint16>(m_outgoingTransportSequence++, buffer);
+        elements.insert(m_transportSequenceId, QByteArray(reinterpret_cast<char*>(buffer), 2));
+    }
+
+    packet.setExtensionElements(elements);
+}
+
+QXmppRtpSenderClock::QXmppRtpSenderClock()
+    : m_clockrate(0),
+    m_valid(false),
+    m_stamp(0),
+    m_time(0)
+{
+}
+
+/// Forgets the current mapping.
+
+void QXmppRtpSenderClock::clear()
+{
+    m_valid = false;
+}
+
+/// Sets the clock rate of the source's RTP timestamps.
+
+void QXmppRtpSenderClock::setClockrate(quint32 clockrate)
+{
+    m_clockrate = clockrate;
+}
+
+/// Updates the mapping from a sender \a report.
+
+void QXmppRtpSenderClock::update(const QXmppRtcpPacket &report)
+{
+    m_stamp = report.rtpStamp();
+    m_time = msecsFromNtp(report.ntpStamp());
+    m_valid = true;
+}
+
+/// Returns the time in milliseconds since the epoch at which the source
+/// captured the given RTP \a stamp, or -1 if it is not known yet.
+
+qint64 QXmppRtpSenderClock::wallTime(quint32 stamp) const
+{
+    if (!m_valid || !m_clockrate)
+        return -1;
+    const qint32 delta = qint32(stamp - m_stamp);
+    return m_time + (qint64(delta) * 1000) / m_clockrate;
+}
+
+/// Converts milliseconds since the Unix epoch to a 64-bit NTP timestamp.
+
+quint64 QXmppRtpSenderClock::ntpFromMsecs(qint64 msecs)
+{
+    const quint64 seconds = msecs / 1000 + NTP_EPOCH_OFFSET;
+    const quint64 fraction = (quint64(msecs % 1000) << 32) / 1000;
+    return (seconds << 32) | fraction;
+}
+
+/// Converts a 64-bit NTP timestamp to milliseconds since the Unix epoch.
+
+qint64 QXmppRtpSenderClock::msecsFromNtp(quint64 ntp)
+{
+    const qint64 seconds = qint64(ntp >> 32) - NTP_EPOCH_OFFSET;
+    const qint64 msecs = ((ntp & 0xffffffff) * 1000 + 0x80000000) >> 32;
+    return seconds * 1000 + msecs;
+}
+
+// Builds an RTCP sender report for a source which sent the given RTP
+// stamp at the given wall clock time.
+static QByteArray senderReport(quint32 ssrc, quint32 stamp, qint64 stampTime, quint32 clockrate, quint32 packets, quint32 octets)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QXmppRtcpPacket packet;
+    packet.ssrc = ssrc;
+    packet.setSenderInfo(QXmppRtpSenderClock::ntpFromMsecs(now),
+                         stamp + quint32(((now - stampTime) * clockrate) / 1000),
+                         packets, octets);
+    return packet.encode();
+}
+
 enum CodecId {
     G711u = 0,
     GSM = 3,
@@ -246,6 +917,7 @@ class QXmppRtpAudioChannelPrivate
 public:
     QXmppRtpAudioChannelPrivate(QXmppRtpAudioChannel *qq);
     QXmppCodec *codecForPayloadType(const QXmppJinglePayloadType &payloadType);
+    void packetSent(const QXmppRtpPacket &packet);
 
     // signals
     bool signalsEmitted;
@@ -263,10 +935,15 @@ public:
     // position of the head of the incoming buffer, in bytes
     qint64 incomingPos;
     quint16 incomingSequence;
+    quint32 incomingSsrc;
+    QXmppRtpSenderClock incomingClock;
+    // playout delay added for synchronisation, in bytes
+    qint64 incomingDelay;
 
     QByteArray outgoingBuffer;
     quint16 outgoingChunk;
     QXmppCodec *outgoingCodec;
+    QByteArray outgoingDatagram;
     bool outgoingMarker;
     bool outgoingPayloadNumbered;
     quint16 outgoingSequence;
@@ -276,6 +953,11 @@ public:
     QXmppJinglePayloadType outgoingTonesType;
 
     quint32 outgoingSsrc;
+    quint32 outgoingPackets;
+    quint32 outgoingOctets;
+    quint32 outgoingReportStamp;
+    qint64 outgoingReportTime;
+    QTimer *reportTimer;
     QXmppJinglePayloadType payloadType;
 
 private:
@@ -290,18 +972,38 @@ QXmppRtpAudioChannelPrivate::QXmppRtpAudioChannelPrivate(QXmppRtpAudioChannel *q
     incomingMaximum(0),
     incomingPos(0),
     incomingSequence(0),
+    incomingSsrc(0),
+    incomingDelay(0),
     outgoingCodec(0),
     outgoingMarker(true),
     outgoingPayloadNumbered(false),
     outgoingSequence(1),
     outgoingStamp(0),
     outgoingSsrc(0),
+    outgoingPackets(0),
+    outgoingOctets(0),
+    outgoingReportStamp(0),
+    outgoingReportTime(0),
+    reportTimer(0),
     q(qq)
 {
     qRegisterMetaType<QXmppRtpAudioChannel::Tone>("QXmppRtpAudioChannel::Tone");
     outgoingSsrc = qrand();
 }
 
+/// Updates the sender statistics after a packet was sent.
+///
+/// The outgoing stamp is used for the RTCP sender reports as telephony
+/// events carry the stamp at which the event started.
+
+void QXmppRtpAudioChannelPrivate::packetSent(const QXmppRtpPacket &packet)
+{
+    outgoingPackets++;
+    outgoingOctets += packet.payload.size();
+    outgoingReportStamp = outgoingStamp;
+    outgoingReportTime = QDateTime::currentMSecsSinceEpoch();
+}
+
 /// Returns the audio codec for the given payload type.
 ///
 
@@ -331,6 +1033,9 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     }
     d->outgoingTimer = new QTimer(this);
     connect(d->outgoingTimer, SIGNAL(timeout()), this, SLOT(writeDatagram()));
+    d->reportTimer = new QTimer(this);
+    d->reportTimer->setInterval(RTP_REPORT_INTERVAL);
+    connect(d->reportTimer, SIGNAL(timeout()), this, SLOT(sendSenderReport()));
 
     // set supported codecs
     QXmppJinglePayloadType payload;
@@ -363,6 +1068,11 @@ QXmppRtpAudioChannel::QXmppRtpAudioChannel(QObject *parent)
     payload.setClockrate(8000);
     payload.setParameters(parameters);
     m_outgoingPayloadTypes << payload;
+
+    // RFC 5285: header extensions
+    m_headerExtensions.insert(1, rtp_hdrext_audio_level);
+    m_headerExtensions.insert(2, rtp_hdrext_abs_send_time);
+    m_headerExtensions.insert(3, rtp_hdrext_transport_sequence);
 }
 
 /// Destroys an RTP audio channel.
@@ -389,6 +1099,7 @@ qint64 QXmppRtpAudioChannel::bytesAvailable() const
 void QXmppRtpAudioChannel::close()
 {
     d->outgoingTimer->stop();
+    d->reportTimer->stop();
     QIODevice::close();
 }
 
@@ -398,12 +1109,17 @@ void QXmppRtpAudioChannel::close()
 
 void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
 {
-    QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    QXmppRtpHeader packet;
+    if (!packet.parse(ba.constData(), ba.size()))
         return;
 
 #ifdef QXMPP_DEBUG_RTP
-    logReceived(packet.toString());
+    logReceived(QString("RTP packet seq %1 stamp %2 marker %3 type %4 size %5").arg(
+        QString::number(packet.sequence),
+        QString::number(packet.stamp),
+        QString::number(packet.marker),
+        QString::number(packet.type),
+        QString::number(packet.payloadLength)));
 #endif
 
     // check sequence number
@@ -414,6 +1130,7 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
                 .arg(QString::number(d->incomingSequence)));
 #endif
     d->incomingSequence = packet.sequence;
+    d->incomingSsrc = packet.ssrc;
 
     // get or create codec
     QXmppCodec *codec = 0;
@@ -437,7 +1154,7 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
     // determine packet's position in the buffer (in bytes)
     qint64 packetOffset = 0;
     if (!d->incomingBuffer.isEmpty()) {
-        packetOffset = packet.stamp * SAMPLE_BYTES - d->incomingPos;
+        packetOffset = qint64(packet.stamp) * SAMPLE_BYTES - d->incomingPos;
         if (packetOffset < 0) {
 #ifdef QXMPP_DEBUG_RTP_BUFFER
             warning(QString("RTP packet stamp %1 is too old, buffer start is %2")
@@ -447,15 +1164,18 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
             return;
         }
     } else {
-        d->incomingPos = packet.stamp * SAMPLE_BYTES + (d->incomingPos % SAMPLE_BYTES);
+        // leave room for the playout delay
+        d->incomingPos = qint64(packet.stamp) * SAMPLE_BYTES - d->incomingDelay + (d->incomingPos % SAMPLE_BYTES);
+        packetOffset = d->incomingDelay;
     }
 
     // allocate space for new packet
     // FIXME: this is wrong, we want the decoded data size!
-    qint64 packetLength = packet.payload.size();
+    qint64 packetLength = packet.payloadLength;
     if (packetOffset + packetLength > d->incomingBuffer.size())
         d->incomingBuffer += QByteArray(packetOffset + packetLength - d->incomingBuffer.size(), 0);
-    QDataStream input(packet.payload);
+    const QByteArray payload = QByteArray::fromRawData(ba.constData() + packet.payloadOffset, packet.payloadLength);
+    QDataStream input(payload);
     QDataStream output(&d->incomingBuffer, QIODevice::WriteOnly);
     output.device()->seek(packetOffset);
     output.setByteOrder(QDataStream::LittleEndian);
@@ -482,6 +1202,75 @@ void QXmppRtpAudioChannel::datagramReceived(const QByteArray &ba)
         emit readyRead();
 }
 
+/// Processes an incoming RTCP packet.
+///
+/// \param ba
+
+void QXmppRtpAudioChannel::rtcpDatagramReceived(const QByteArray &ba)
+{
+    foreach (const QXmppRtcpPacket &packet, QXmppRtcpPacket::decodeCompound(ba)) {
+#ifdef QXMPP_DEBUG_RTP
+        logReceived(packet.toString());
+#endif
+        if (packet.type == QXmppRtcpPacket::SenderReport && packet.ssrc == d->incomingSsrc)
+            d->incomingClock.update(packet);
+    }
+}
+
+void QXmppRtpAudioChannel::sendSenderReport()
+{
+    if (!d->outgoingPackets)
+        return;
+
+    emit sendRtcpDatagram(senderReport(d->outgoingSsrc,
+        d->outgoingReportStamp, d->outgoingReportTime,
+        d->payloadType.clockrate(),
+        d->outgoingPackets, d->outgoingOctets));
+}
+
+/// Returns the time at which the next sample returned by read() was
+/// captured, in milliseconds since the epoch on the remote party's clock.
+///
+/// Returns -1 if no RTCP sender report was received yet.
+
+qint64 QXmppRtpAudioChannel::playoutTime() const
+{
+    return d->incomingClock.wallTime(d->incomingPos / SAMPLE_BYTES);
+}
+
+/// Returns the delay added to the audio playout, in milliseconds.
+
+int QXmppRtpAudioChannel::playoutDelay() const
+{
+    const quint32 clockrate = d->payloadType.clockrate();
+    if (!clockrate)
+        return 0;
+    return (d->incomingDelay / SAMPLE_BYTES) * 1000 / clockrate;
+}
+
+/// Sets the delay added to the audio playout, in milliseconds.
+///
+/// Increasing the delay inserts silence, decreasing it drops samples.
+///
+/// \param msecs
+
+void QXmppRtpAudioChannel::setPlayoutDelay(int msecs)
+{
+    const qint64 delay = SAMPLE_BYTES * ((qint64(msecs) * d->payloadType.clockrate()) / 1000);
+    const qint64 delta = delay - d->incomingDelay;
+    if (delta > 0) {
+        d->incomingBuffer.prepend(QByteArray(delta, 0));
+        d->incomingPos -= delta;
+    } else if (delta < 0) {
+        const qint64 removed = qMin(-delta, qint64(d->incomingBuffer.size()));
+        d->incomingBuffer.remove(0, removed);
+        d->incomingPos += removed;
+    }
+    d->incomingMinimum += delta;
+    d->incomingMaximum += delta;
+    d->incomingDelay = delay;
+}
+
 void QXmppRtpAudioChannel::emitSignals()
 {
     emit bytesWritten(d->writtenSinceLastEmit);
@@ -585,10 +1374,12 @@ void QXmppRtpAudioChannel::payloadTypesChanged()
     d->outgoingChunk = SAMPLE_BYTES * d->payloadType.ptime() * d->payloadType.clockrate() / 1000;
     d->outgoingTimer->setInterval(d->payloadType.ptime());
 
-    d->incomingMinimum = d->outgoingChunk * 5;
-    d->incomingMaximum = d->outgoingChunk * 15;
+    d->incomingMinimum = d->outgoingChunk * 5 + d->incomingDelay;
+    d->incomingMaximum = d->outgoingChunk * 15 + d->incomingDelay;
+    d->incomingClock.setClockrate(d->payloadType.clockrate());
 
     open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+    d->reportTimer->start();
 }
 /// \endcond
 
@@ -696,10 +1487,12 @@ void QXmppRtpAudioChannel::writeDatagram()
             output << quint8(info.tone);
             output << quint8(info.finished ? 0x80 : 0x00);
             output << quint16(d->outgoingStamp + packetTicks - info.outgoingStart);
+            addHeaderExtensions(packet);
 #ifdef QXMPP_DEBUG_RTP
             logSent(packet.toString());
 #endif
-            emit sendDatagram(packet.encode());
+            emit sendDatagram(encodePacket(d->outgoingDatagram, packet));
+            d->packetSent(packet);
             d->outgoingSequence++;
             d->outgoingStamp += packetTicks;
 
@@ -735,11 +1528,14 @@ void QXmppRtpAudioChannel::writeDatagram()
         input.setByteOrder(QDataStream::LittleEndian);
         QDataStream output(&packet.payload, QIODevice::WriteOnly);
         const qint64 packetTicks = d->outgoingCodec->encode(input, output);
+        // the audio level is only computed if the extension was negotiated
+        addHeaderExtensions(packet, m_audioLevelId ? audioLevel(chunk) : -1);
 
 #ifdef QXMPP_DEBUG_RTP
         logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
+        emit sendDatagram(encodePacket(d->outgoingDatagram, packet));
+        d->packetSent(packet);
         d->outgoingSequence++;
         d->outgoingStamp += packetTicks;
     }
@@ -752,30 +1548,406 @@ void QXmppRtpAudioChannel::writeDatagram()
     }
 }
 
+QXmppRtpPacketHistory::QXmppRtpPacketHistory()
+    : m_packets(RTP_HISTORY_SIZE),
+    m_valid(RTP_HISTORY_SIZE, false)
+{
+}
+
+void QXmppRtpPacketHistory::clear()
+{
+    m_packets = QVector<QXmppRtpPacket>(RTP_HISTORY_SIZE);
+    m_valid.fill(false);
+}
+
+void QXmppRtpPacketHistory::insert(const QXmppRtpPacket &packet)
+{
+    const int index = packet.sequence % RTP_HISTORY_SIZE;
+    m_packets[index] = packet;
+    m_valid[index] = true;
+}
+
+bool QXmppRtpPacketHistory::find(quint16 sequence, QXmppRtpPacket &packet) const
+{
+    const int index = sequence % RTP_HISTORY_SIZE;
+    if (!m_valid[index] || m_packets[index].sequence != sequence)
+        return false;
+    packet = m_packets[index];
+    return true;
+}
+
+QXmppRtpFecEncoder::QXmppRtpFecEncoder()
+    : m_blockSize(0),
+    m_depth(0),
+    m_count(0),
+    m_currentSize(0),
+    m_currentDepth(0),
+    m_blockBase(0)
+{
+}
+
+/// Returns the number of media packets protected by a block of FEC packets.
+
+int QXmppRtpFecEncoder::blockSize() const
+{
+    return m_blockSize;
+}
+
+/// Returns the number of FEC packets generated for each block, 0 if FEC
+/// is disabled.
+
+int QXmppRtpFecEncoder::depth() const
+{
+    return m_depth;
+}
+
+/// Sets the protection level. Changes take effect at the next block.
+
+void QXmppRtpFecEncoder::setLevel(int blockSize, int depth)
+{
+    m_blockSize = qBound(0, blockSize, 16);
+    m_depth = qBound(0, depth, m_blockSize);
+    if (!m_depth)
+        m_count = 0;
+}
+
+/// Adds an encoded media packet to the current block and returns the FEC
+/// payloads which need to be sent once the block is complete.
+///
+/// \param sequence The sequence number of the media packet.
+/// \param datagram The media packet, as it was sent on the wire.
+
+QList<QByteArray> QXmppRtpFecEncoder::handlePacket(quint16 sequence, const QByteArray &datagram)
+{
+    QList<QByteArray> payloads;
+
+    // a gap in the sequence numbers cannot be expressed by the mask
+    if (m_count && sequence != quint16(m_blockBase + m_count))
+        m_count = 0;
+
+    if (!m_count) {
+        if (!m_depth || datagram.size() < 12)
+            return payloads;
+
+        // start a new block with the current protection level
+        m_blockBase = sequence;
+        m_currentSize = m_blockSize;
+        m_currentDepth = m_depth;
+        m_parity.resize(m_currentDepth);
+        for (int offset = 0; offset < m_currentDepth; ++offset) {
+            Parity &parity = m_parity[offset];
+            parity.header = QByteArray(10, 0);
+            parity.body.clear();
+            parity.mask = 0;
+            parity.lengthRecovery = 0;
+        }
+    }
+
+    // fold the packet into the FEC packet covering its offset
+    Parity &parity = m_parity[m_count % m_currentDepth];
+    const int length = datagram.size() - 12;
+
+    // P, X, CC, M, PT and timestamp recovery
+    char *header = parity.header.data();
+    header[0] ^= datagram[0];
+    header[1] ^= datagram[1];
+    for (int j = 4; j < 8; ++j)
+        header[j] ^= datagram[j];
+    parity.lengthRecovery ^= length;
+
+    if (parity.body.size() < length)
+        parity.body.append(QByteArray(length - parity.body.size(), 0));
+    char *out = parity.body.data();
+    const char *in = datagram.constData() + 12;
+    for (int j = 0; j < length; ++j)
+        out[j] ^= in[j];
+    parity.mask |= (0x8000 >> m_count);
+
+    if (++m_count < m_currentSize)
+        return payloads;
+
+    for (int offset = 0; offset < m_currentDepth; ++offset) {
+        const Parity &parity = m_parity.at(offset);
+
+        // E and L bits are cleared, SN base and length recovery
+        QByteArray header = parity.header;
+        header[0] = header[0] & 0x3f;
+        header[2] = m_blockBase >> 8;
+        header[3] = m_blockBase & 0xff;
+        header[8] = parity.lengthRecovery >> 8;
+        header[9] = parity.lengthRecovery & 0xff;
+
+        QByteArray payload;
+        payload.reserve(14 + parity.body.size());
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.writeRawData(header.constData(), header.size());
+        stream << quint16(parity.body.size());
+        stream << parity.mask;
+        stream.writeRawData(parity.body.constData(), parity.body.size());
+        payloads << payload;
+    }
+    m_count = 0;
+    return payloads;
+}
+
+/// Tries to recover the single missing packet protected by the \a fec
+/// payload from the \a received packets.
+
+bool QXmppRtpFecDecoder::recover(const QByteArray &fec, quint32 ssrc, const QXmppRtpPacketHistory &received, QXmppRtpPacket &packet)
+{
+    // we only support the short (16-bit) mask
+    if (fec.size() < 14 || (fec[0] & 0xc0))
+        return false;
+
+    const char *data = fec.constData();
+    const quint16 base = (quint8(data[2]) << 8) | quint8(data[3]);
+    const quint16 protectionLength = (quint8(data[10]) << 8) | quint8(data[11]);
+    const quint16 mask = (quint8(data[12]) << 8) | quint8(data[13]);
+    if (fec.size() < 14 + protectionLength)
+        return false;
+
+    QByteArray header(fec.left(10));
+    QByteArray body(fec.mid(14, protectionLength));
+    bool missingFound = false;
+    quint16 missing = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (!(mask & (0x8000 >> i)))
+            continue;
+
+        const quint16 sequence = base + i;
+        QXmppRtpPacket protectedPacket;
+        if (!received.find(sequence, protectedPacket)) {
+            if (missingFound)
+                return false;
+            missingFound = true;
+            missing = sequence;
+            continue;
+        }
+
+        const QByteArray datagram = protectedPacket.encode();
+        const int length = datagram.size() - 12;
+        if (length > body.size())
+            return false;
+        header[0] = header[0] ^ datagram[0];
+        header[1] = header[1] ^ datagram[1];
+        for (int j = 4; j < 8; ++j)
+            header[j] = header[j] ^ datagram[j];
+        header[8] = header[8] ^ char(length >> 8);
+        header[9] = header[9] ^ char(length & 0xff);
+        char *out = body.data();
+        const char *in = datagram.constData() + 12;
+        for (int j = 0; j < length; ++j)
+            out[j] ^= in[j];
+    }
+    if (!missingFound)
+        return false;
+
+    // rebuild the missing packet
+    const quint16 length = (quint8(header[8]) << 8) | quint8(header[9]);
+    if (length > body.size())
+        return false;
+    QByteArray datagram;
+    datagram.reserve(12 + length);
+    QDataStream stream(&datagram, QIODevice::WriteOnly);
+    stream << quint8((RTP_VERSION << 6) | (header[0] & 0x3f));
+    stream << quint8(header[1]);
+    stream << missing;
+    stream.writeRawData(header.constData() + 4, 4);
+    stream << ssrc;
+    stream.writeRawData(body.constData(), length);
+    return packet.decode(datagram);
+}
+
 class QXmppRtpVideoChannelPrivate
 {
 public:
+    struct LostPacket {
+        quint16 sequence;
+        int tries;
+    };
+
     QXmppRtpVideoChannelPrivate();
+    void handleNack(QXmppRtpVideoChannel *q, const QXmppRtcpPacket &packet);
+    void handleSequence(QXmppRtpVideoChannel *q, const QXmppRtpPacket &packet);
+    void updateFecLevel();
+
     QMap<int, QXmppVideoDecoder*> decoders;
     QXmppVideoEncoder *encoder;
     QList<AVFrame*> frames;
 
+    // remote
+    bool incomingSequenceValid;
+    quint16 incomingSequence;
+    quint32 incomingSsrc;
+    quint8 incomingRtxId;
+    quint8 incomingRtxApt;
+    quint8 incomingFecId;
+    QXmppRtpPacketHistory incomingHistory;
+    QList<LostPacket> incomingLost;
+    QTimer *nackTimer;
+    QXmppRtpSenderClock incomingClock;
+
     // local
     QXmppVideoFormat outgoingFormat;
     quint8 outgoingId;
     quint16 outgoingSequence;
     quint32 outgoingStamp;
     quint32 outgoingSsrc;
+    bool outgoingPtsValid;
+    int64_t outgoingPtsBase;
+    quint32 outgoingStampBase;
+    quint32 outgoingPackets;
+    quint32 outgoingOctets;
+    quint32 outgoingReportStamp;
+    qint64 outgoingReportTime;
+    QTimer *reportTimer;
+    QByteArray outgoingDatagram;
+    QXmppRtpPacketHistory outgoingHistory;
+    quint8 outgoingRtxId;
+    quint16 outgoingRtxSequence;
+    quint32 outgoingRtxSsrc;
+    QXmppRtpFecEncoder outgoingFec;
+    quint8 outgoingFecId;
+    quint16 outgoingFecSequence;
+    quint32 outgoingFecSsrc;
+
+    // loss measured from NACKs
+    qreal outgoingLoss;
+    int outgoingLossPackets;
+    QSet<quint16> outgoingLossNacked;
 };
 
 QXmppRtpVideoChannelPrivate::QXmppRtpVideoChannelPrivate()
     : encoder(0),
+    incomingSequenceValid(false),
+    incomingSequence(0),
+    incomingSsrc(0),
+    incomingRtxId(0),
+    incomingRtxApt(0),
+    incomingFecId(0),
+    nackTimer(0),
     outgoingId(0),
     outgoingSequence(1),
     outgoingStamp(0),
-    outgoingSsrc(0)
+    outgoingSsrc(0),
+    outgoingPtsValid(false),
+    outgoingPtsBase(0),
+    outgoingStampBase(0),
+    outgoingPackets(0),
+    outgoingOctets(0),
+    outgoingReportStamp(0),
+    outgoingReportTime(0),
+    reportTimer(0),
+    outgoingRtxId(0),
+    outgoingRtxSequence(1),
+    outgoingRtxSsrc(0),
+    outgoingFecId(0),
+    outgoingFecSequence(1),
+    outgoingFecSsrc(0),
+    outgoingLoss(0),
+    outgoingLossPackets(0)
 {
     outgoingSsrc = qrand();
+    outgoingRtxSsrc = qrand();
+    outgoingFecSsrc = qrand();
+}
+
+/// Retransmits the packets listed in a generic NACK, either as is or
+/// wrapped in RFC 4588 retransmission packets if an "rtx" payload type
+/// was negotiated.
+
+void QXmppRtpVideoChannelPrivate::handleNack(QXmppRtpVideoChannel *q, const QXmppRtcpPacket &nack)
+{
+    if (nack.mediaSsrc() != outgoingSsrc)
+        return;
+
+    QXmppRtpPacket packet;
+    foreach (quint16 sequence, nack.nackSequences()) {
+        // the loss rate is only used to pick the FEC level, and is reset
+        // every RTP_LOSS_WINDOW packets sent with FEC
+        if (outgoingFecId)
+            outgoingLossNacked << sequence;
+        if (!outgoingHistory.find(sequence, packet))
+            continue;
+
+        if (outgoingRtxId) {
+            QXmppRtpPacket rtx;
+            rtx.version = RTP_VERSION;
+            rtx.marker = packet.marker;
+            rtx.type = outgoingRtxId;
+            rtx.ssrc = outgoingRtxSsrc;
+            rtx.sequence = outgoingRtxSequence++;
+            rtx.stamp = packet.stamp;
+            QDataStream stream(&rtx.payload, QIODevice::WriteOnly);
+            stream << packet.sequence;
+            stream.writeRawData(packet.payload.constData(), packet.payload.size());
+            q->addHeaderExtensions(rtx);
+            emit q->sendDatagram(encodePacket(outgoingDatagram, rtx));
+        } else {
+            emit q->sendDatagram(encodePacket(outgoingDatagram, packet));
+        }
+    }
+}
+
+/// Tracks the sequence numbers of incoming media packets and schedules
+/// NACKs for any gap.
+
+void QXmppRtpVideoChannelPrivate::handleSequence(QXmppRtpVideoChannel *q, const QXmppRtpPacket &packet)
+{
+    incomingSsrc = packet.ssrc;
+    if (!incomingSequenceValid) {
+        incomingSequence = packet.sequence;
+        incomingSequenceValid = true;
+        return;
+    }
+
+    const qint16 delta = packet.sequence - incomingSequence;
+    if (delta <= 0) {
+        // late or retransmitted packet
+        for (int i = 0; i < incomingLost.size(); ++i) {
+            if (incomingLost[i].sequence == packet.sequence) {
+                incomingLost.removeAt(i);
+                break;
+            }
+        }
+        return;
+    }
+
+    // record gap, unless it is too large to be repaired
+    if (delta > 1 && delta <= RTP_HISTORY_SIZE) {
+        for (quint16 sequence = incomingSequence + 1; sequence != packet.sequence; ++sequence) {
+            LostPacket lost;
+            lost.sequence = sequence;
+            lost.tries = 0;
+            incomingLost << lost;
+        }
+        while (incomingLost.size() > RTP_NACK_MAXIMUM)
+            incomingLost.removeFirst();
+        q->sendNack();
+    }
+    incomingSequence = packet.sequence;
+}
+
+/// Adjusts the FEC protection level to the loss rate reported by the
+/// remote party.
+
+void QXmppRtpVideoChannelPrivate::updateFecLevel()
+{
+    const qreal loss = qMin(qreal(1.0), qreal(outgoingLossNacked.size()) / outgoingLossPackets);
+    outgoingLoss = 0.75 * outgoingLoss + 0.25 * loss;
+    outgoingLossNacked.clear();
+    outgoingLossPackets = 0;
+
+    if (outgoingLoss < 0.01)
+        outgoingFec.setLevel(0, 0);
+    else if (outgoingLoss < 0.05)
+        outgoingFec.setLevel(10, 1);
+    else if (outgoingLoss < 0.10)
+        outgoingFec.setLevel(8, 2);
+    else if (outgoingLoss < 0.20)
+        outgoingFec.setLevel(6, 2);
+    else
+        outgoingFec.setLevel(4, 2);
 }
 
 /// Constructs a new RTP video channel with the given \a parent.
@@ -784,7 +1956,22 @@ QXmppRtpVideoChannelPrivate::QXmppRtpVideoChannelPrivate()
 QXmppRtpVideoChannel::QXmppRtpVideoChannel(QList<CodecID> codecs, QObject *parent)
     : QXmppLoggable(parent)
 {
+    bool check;
+    Q_UNUSED(check);
+
     d = new QXmppRtpVideoChannelPrivate;
+    d->nackTimer = new QTimer(this);
+    d->nackTimer->setInterval(RTP_NACK_INTERVAL);
+    check = connect(d->nackTimer, SIGNAL(timeout()),
+                    this, SLOT(sendNack()));
+    Q_ASSERT(check);
+
+    d->reportTimer = new QTimer(this);
+    d->reportTimer->setInterval(RTP_REPORT_INTERVAL);
+    check = connect(d->reportTimer, SIGNAL(timeout()),
+                    this, SLOT(sendSenderReport()));
+    Q_ASSERT(check);
+
     d->outgoingFormat.setFrameRate(15.0);
     d->outgoingFormat.setFrameSize(QSize(320, 240));
     d->outgoingFormat.setPixelFormat(PIX_FMT_YUYV422);
@@ -808,6 +1995,28 @@ QXmppRtpVideoChannel::QXmppRtpVideoChannel(QList<CodecID> codecs, QObject *paren
        m_outgoingPayloadTypes << payload;
        delete encoder;
     }
+
+    if (!codecs.isEmpty()) {
+        // RFC 4588: RTP retransmission payload format
+        QMap<QString, QString> parameters;
+        parameters.insert("apt", "96");
+        payload.setId(97);
+        payload.setName("rtx");
+        payload.setClockrate(90000);
+        payload.setParameters(parameters);
+        m_outgoingPayloadTypes << payload;
+
+        // RFC 5109: RTP payload format for generic FEC
+        payload.setId(98);
+        payload.setName("ulpfec");
+        payload.setClockrate(90000);
+        payload.setParameters(QMap<QString, QString>());
+        m_outgoingPayloadTypes << payload;
+    }
+
+    // RFC 5285: header extensions
+    m_headerExtensions.insert(2, rtp_hdrext_abs_send_time);
+    m_headerExtensions.insert(3, rtp_hdrext_transport_sequence);
 }
 
 QXmppRtpVideoChannel::~QXmppRtpVideoChannel()
@@ -823,6 +2032,12 @@ QXmppRtpVideoChannel::~QXmppRtpVideoChannel()
 
 void QXmppRtpVideoChannel::close()
 {
+    d->nackTimer->stop();
+    d->reportTimer->stop();
+    d->incomingClock.clear();
+    d->incomingLost.clear();
+    d->incomingHistory.clear();
+    d->outgoingHistory.clear();
 }
 
 /// Processes an incoming RTP video packet.
@@ -831,19 +2046,84 @@ void QXmppRtpVideoChannel::close()
 
 void QXmppRtpVideoChannel::datagramReceived(const QByteArray &ba)
 {
-    QXmppRtpPacket packet;
-    if (!packet.decode(ba))
+    // parse the header in place, the payload is copied at most once
+    QXmppRtpHeader header;
+    if (!header.parse(ba.constData(), ba.size()))
         return;
 
 #ifdef QXMPP_DEBUG_RTP
-    logReceived(packet.toString());
+    logReceived(QString("RTP packet seq %1 stamp %2 marker %3 type %4 size %5").arg(
+        QString::number(header.sequence),
+        QString::number(header.stamp),
+        QString::number(header.marker),
+        QString::number(header.type),
+        QString::number(header.payloadLength)));
 #endif
 
+    const char *payload = ba.constData() + header.payloadOffset;
+    QXmppRtpPacket packet;
+    if (d->incomingFecId && header.type == d->incomingFecId) {
+        // try to recover a lost packet, the FEC payload is not copied
+        const QByteArray fec = QByteArray::fromRawData(payload, header.payloadLength);
+        if (!QXmppRtpFecDecoder::recover(fec, d->incomingSsrc, d->incomingHistory, packet))
+            return;
+#ifdef QXMPP_DEBUG_RTP
+        debug(QString("Recovered RTP packet seq %1").arg(QString::number(packet.sequence)));
+#endif
+    } else if (d->incomingRtxId && header.type == d->incomingRtxId) {
+        // unwrap retransmitted packet
+        if (header.payloadLength < 2)
+            return;
+        copyHeader(packet, header, ba.constData());
+        packet.sequence = (quint8(payload[0]) << 8) | quint8(payload[1]);
+        packet.type = d->incomingRtxApt;
+        packet.ssrc = d->incomingSsrc;
+        packet.payload = QByteArray(payload + 2, header.payloadLength - 2);
+    } else {
+        // the packet is kept in the history, so its payload is copied
+        copyHeader(packet, header, ba.constData());
+        packet.payload = QByteArray(payload, header.payloadLength);
+    }
+    d->handleSequence(this, packet);
+    d->incomingHistory.insert(packet);
+
     // get codec
     QXmppVideoDecoder *decoder = d->decoders.value(packet.type);
     if (!decoder)
         return;
-    d->frames << decoder->handlePacket(packet);
+    foreach (AVFrame *frame, decoder->handlePacket(packet)) {
+        const qint64 time = d->incomingClock.wallTime(packet.stamp);
+        frame->pts = (time < 0) ? AV_NOPTS_VALUE : time;
+        d->frames << frame;
+    }
+}
+
+/// Processes an incoming RTCP packet.
+///
+/// \param ba
+
+void QXmppRtpVideoChannel::rtcpDatagramReceived(const QByteArray &ba)
+{
+    foreach (const QXmppRtcpPacket &packet, QXmppRtcpPacket::decodeCompound(ba)) {
+#ifdef QXMPP_DEBUG_RTP
+        logReceived(packet.toString());
+#endif
+        if (packet.type == QXmppRtcpPacket::RtpFeedback && packet.count == 1)
+            d->handleNack(this, packet);
+        else if (packet.type == QXmppRtcpPacket::SenderReport && packet.ssrc == d->incomingSsrc)
+            d->incomingClock.update(packet);
+    }
+}
+
+void QXmppRtpVideoChannel::sendSenderReport()
+{
+    if (!d->outgoingPackets)
+        return;
+
+    emit sendRtcpDatagram(senderReport(d->outgoingSsrc,
+        d->outgoingReportStamp, d->outgoingReportTime,
+        RTP_VIDEO_CLOCKRATE,
+        d->outgoingPackets, d->outgoingOctets));
 }
 
 /// Returns the video format used by the encoder.
@@ -870,6 +2150,9 @@ void QXmppRtpVideoChannel::setEncoderFormat(const QXmppVideoFormat &format)
     if (d->encoder && !d->encoder->setFormat(format))
         return;
     d->outgoingFormat = format;
+
+    // the encoder's time base follows its frame rate
+    d->outgoingPtsValid = false;
 }
 
 /// Returns the mode in which the channel has been opened.
@@ -884,6 +2167,34 @@ QIODevice::OpenMode QXmppRtpVideoChannel::openMode() const
     return mode;
 }
 
+/// Sends a generic NACK for the packets which are still missing.
+
+void QXmppRtpVideoChannel::sendNack()
+{
+    QList<quint16> sequences;
+    for (int i = d->incomingLost.size() - 1; i >= 0; --i) {
+        if (d->incomingLost[i].tries++ < RTP_NACK_TRIES)
+            sequences.prepend(d->incomingLost[i].sequence);
+        else
+            d->incomingLost.removeAt(i);
+    }
+    if (sequences.isEmpty()) {
+        d->nackTimer->stop();
+        return;
+    }
+
+    QXmppRtcpPacket packet;
+    packet.ssrc = d->outgoingSsrc;
+    packet.setNackSequences(d->incomingSsrc, sequences);
+#ifdef QXMPP_DEBUG_RTP
+    logSent(packet.toString());
+#endif
+    emit sendRtcpDatagram(packet.encode());
+
+    if (!d->nackTimer->isActive())
+        d->nackTimer->start();
+}
+
 /// \cond
 void QXmppRtpVideoChannel::payloadTypesChanged()
 {
@@ -908,6 +2219,29 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
         }
     }
 
+    // check for incoming retransmissions
+    d->incomingRtxId = 0;
+    foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
+        if (payload.name().toLower() == "rtx") {
+            const int apt = payload.parameters().value("apt").toInt();
+            if (d->decoders.contains(apt)) {
+                d->incomingRtxId = payload.id();
+                d->incomingRtxApt = apt;
+            }
+            break;
+        }
+    }
+
+    // check for incoming forward error correction
+    d->incomingFecId = 0;
+    d->incomingHistory.clear();
+    foreach (const QXmppJinglePayloadType &payload, m_incomingPayloadTypes) {
+        if (payload.name().toLower() == "ulpfec") {
+            d->incomingFecId = payload.id();
+            break;
+        }
+    }
+
     // refresh encoder
     if (d->encoder) {
         delete d->encoder;
@@ -931,10 +2265,48 @@ void QXmppRtpVideoChannel::payloadTypesChanged()
             break;
         }
     }
+
+    // check for outgoing retransmissions
+    d->outgoingRtxId = 0;
+    d->outgoingHistory.clear();
+    for (int i = 0; i < m_outgoingPayloadTypes.size(); ++i) {
+        if (m_outgoingPayloadTypes[i].name().toLower() == "rtx") {
+            if (d->encoder) {
+                QMap<QString, QString> parameters;
+                parameters.insert("apt", QString::number(d->outgoingId));
+                m_outgoingPayloadTypes[i].setParameters(parameters);
+                d->outgoingRtxId = m_outgoingPayloadTypes[i].id();
+            }
+            break;
+        }
+    }
+
+    // check for outgoing forward error correction
+    d->outgoingFecId = 0;
+    d->outgoingFec.setLevel(0, 0);
+    d->outgoingLoss = 0;
+    d->outgoingLossPackets = 0;
+    d->outgoingLossNacked.clear();
+    foreach (const QXmppJinglePayloadType &payload, m_outgoingPayloadTypes) {
+        if (payload.name().toLower() == "ulpfec") {
+            if (d->encoder) {
+                d->outgoingFecId = payload.id();
+                d->outgoingFec.setLevel(10, 1);
+            }
+            break;
+        }
+    }
+
+    d->incomingClock.setClockrate(RTP_VIDEO_CLOCKRATE);
+    d->reportTimer->start();
 }
 /// \endcond
 
 /// Decodes buffered RTP packets and returns a list of video frames.
+///
+/// The pts of each frame is set to the time at which the remote party
+/// captured it, in milliseconds since the epoch on the remote party's
+/// clock, or AV_NOPTS_VALUE if no RTCP sender report was received yet.
 
 QList<AVFrame*> QXmppRtpVideoChannel::readFrames()
 {
@@ -944,6 +2316,10 @@ QList<AVFrame*> QXmppRtpVideoChannel::readFrames()
 }
 
 /// Encodes a video \a frame and sends RTP packets.
+///
+/// The frame's pts is expressed in the encoder's time base, which is the
+/// inverse of its frame rate. If the frame has no pts, a constant frame
+/// rate is assumed.
 
 void QXmppRtpVideoChannel::writeFrame(AVFrame *frame)
 {
@@ -952,6 +2328,20 @@ void QXmppRtpVideoChannel::writeFrame(AVFrame *frame)
         return;
     }
 
+    // convert the presentation time to 90 kHz ticks
+    const qreal frameRate = d->outgoingFormat.frameRate();
+    if (frame->pts != AV_NOPTS_VALUE) {
+        if (!d->outgoingPtsValid) {
+            d->outgoingPtsBase = frame->pts;
+            d->outgoingStampBase = d->outgoingStamp;
+            d->outgoingPtsValid = true;
+        }
+        d->outgoingStamp = d->outgoingStampBase +
+            quint32(qRound64((frame->pts - d->outgoingPtsBase) * RTP_VIDEO_CLOCKRATE / frameRate));
+    }
+    d->outgoingReportStamp = d->outgoingStamp;
+    d->outgoingReportTime = QDateTime::currentMSecsSinceEpoch();
+
     QXmppRtpPacket packet;
     packet.version = RTP_VERSION;
     packet.marker = false;
@@ -961,11 +2351,119 @@ void QXmppRtpVideoChannel::writeFrame(AVFrame *frame)
         packet.sequence = d->outgoingSequence++;
         packet.stamp = d->outgoingStamp;
         packet.payload = payload;
+        addHeaderExtensions(packet);
 #ifdef QXMPP_DEBUG_RTP
         logSent(packet.toString());
 #endif
-        emit sendDatagram(packet.encode());
+        d->outgoingHistory.insert(packet);
+        const QByteArray &datagram = encodePacket(d->outgoingDatagram, packet);
+        emit sendDatagram(datagram);
+        d->outgoingPackets++;
+        d->outgoingOctets += packet.payload.size();
+
+        // send forward error correction, the datagram buffer is reused
+        // once the FEC payloads have been computed
+        if (d->outgoingFecId) {
+            foreach (const QByteArray &fecPayload, d->outgoingFec.handlePacket(packet.sequence, datagram)) {
+                QXmppRtpPacket fec;
+                fec.version = RTP_VERSION;
+                fec.marker = false;
+                fec.type = d->outgoingFecId;
+                fec.ssrc = d->outgoingFecSsrc;
+                fec.sequence = d->outgoingFecSequence++;
+                fec.stamp = packet.stamp;
+                fec.payload = fecPayload;
+                addHeaderExtensions(fec);
+                emit sendDatagram(encodePacket(d->outgoingDatagram, fec));
+            }
+            if (++d->outgoingLossPackets >= RTP_LOSS_WINDOW)
+                d->updateFecLevel();
+        }
     }
-    d->outgoingStamp += 1;
+    if (frame->pts == AV_NOPTS_VALUE)
+        d->outgoingStamp += qRound(RTP_VIDEO_CLOCKRATE / frameRate);
 }
 
+/// Releases the queued video frames which are due at the given
+/// \a audioTime and adjusts the audio \a delay to keep both streams in sync.
+///
+/// \param audioTime The sender wall clock time of the audio being played, or
+/// -1 if it is not known.
+/// \param delay The audio playout delay in milliseconds.
+
+QList<AVFrame*> QXmppRtpPlayoutSchedulerPrivate::takeFrames(qint64 audioTime, int &delay)
+{
+    QList<AVFrame*> due;
+    qint64 lag = 0;
+    qint64 lead = 0;
+    while (!frames.isEmpty()) {
+        AVFrame *frame = frames.first();
+        if (audioTime >= 0 && frame->pts != AV_NOPTS_VALUE) {
+            const qint64 frameLead = frame->pts - audioTime;
+
+            // the video is ahead of the audio, hold the frame back
+            if (frameLead > RTP_SYNC_TOLERANCE && frameLead < RTP_SYNC_MAXIMUM) {
+                lead = frameLead;
+                break;
+            }
+
+            // the video is behind the audio
+            if (frameLead < -RTP_SYNC_TOLERANCE)
+                lag = qMax(lag, -frameLead);
+        }
+        due << frames.takeFirst();
+    }
+
+    if (lag) {
+        // delay the audio to let the video catch up
+        delay = qMin(qint64(RTP_SYNC_MAXIMUM), delay + lag);
+    } else if (lead && delay > 0) {
+        // the video caught up, give back the delay added to the audio
+        delay = qMax(qint64(0), delay - (lead - RTP_SYNC_TOLERANCE));
+    }
+    return due;
+}
+
+/// Constructs a playout scheduler for the given audio and video channels.
+///
+/// \param audioChannel
+/// \param videoChannel
+
+QXmppRtpPlayoutScheduler::QXmppRtpPlayoutScheduler(QXmppRtpAudioChannel *audioChannel, QXmppRtpVideoChannel *videoChannel)
+{
+    d = new QXmppRtpPlayoutSchedulerPrivate;
+    d->audioChannel = audioChannel;
+    d->videoChannel = videoChannel;
+}
+
+/// Destroys the playout scheduler, freeing any frames it still holds.
+
+QXmppRtpPlayoutScheduler::~QXmppRtpPlayoutScheduler()
+{
+    foreach (AVFrame *frame, d->frames)
+        av_free(frame);
+    delete d;
+}
+
+/// Returns the video frames which are due for display.
+///
+/// You should call this method instead of QXmppRtpVideoChannel::readFrames().
+
+QList<AVFrame*> QXmppRtpPlayoutScheduler::readFrames()
+{
+    if (!d->videoChannel)
+        return QList<AVFrame*>();
+    d->frames << d->videoChannel->readFrames();
+
+    if (!d->audioChannel) {
+        int delay = 0;
+        return d->takeFrames(-1, delay);
+    }
+
+    const int oldDelay = d->audioChannel->playoutDelay();
+    int delay = oldDelay;
+    const QList<AVFrame*> frames = d->takeFrames(d->audioChannel->playoutTime(), delay);
+    if (delay != oldDelay)
+        d->audioChannel->setPlayoutDelay(delay);
+    return frames;
+}
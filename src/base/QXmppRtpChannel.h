@@ -37,18 +37,56 @@ extern "C" {
 class QXmppCodec;
 class QXmppJinglePayloadType;
 class QXmppRtpAudioChannelPrivate;
+class QXmppRtpPlayoutSchedulerPrivate;
 class QXmppRtpVideoChannelPrivate;
 
+/// \brief The QXmppRtpHeader class parses the header of an RTP packet in
+/// place, without copying any of the packet's data.
+///
+/// The contributing sources, header extension and payload are described as
+/// offsets into the parsed buffer, which must outlive the header.
+
+class QXMPP_EXPORT QXmppRtpHeader
+{
+public:
+    QXmppRtpHeader();
+    bool parse(const char *data, int size);
+    int findExtensionElement(const char *data, quint8 id, int *length) const;
+
+    quint8 version;
+    bool marker;
+    quint8 type;
+    quint16 sequence;
+    quint32 stamp;
+    quint32 ssrc;
+    quint8 csrcCount;
+    int csrcOffset;
+    quint16 extensionProfile;
+    int extensionOffset;
+    int extensionLength;
+    int payloadOffset;
+    int payloadLength;
+    int paddingLength;
+};
+
 /// \brief The QXmppRtpPacket class represents an RTP packet.
 ///
 
 class QXMPP_EXPORT QXmppRtpPacket
 {
 public:
+    QXmppRtpPacket();
+
     bool decode(const QByteArray &ba);
     QByteArray encode() const;
+    int encode(char *data, int size) const;
+    int encodedSize() const;
     QString toString() const;
 
+    // RFC 5285: header extension elements
+    QMap<quint8, QByteArray> extensionElements() const;
+    void setExtensionElements(const QMap<quint8, QByteArray> &elements);
+
     quint8 version;
     bool marker;
     quint8 type;
@@ -56,6 +94,51 @@ public:
     QList<quint32> csrc;
     quint16 sequence;
     quint32 stamp;
+    quint16 extensionProfile;
+    QByteArray extension;
+    QByteArray payload;
+};
+
+/// \brief The QXmppRtcpPacket class represents an RTCP packet.
+///
+
+class QXMPP_EXPORT QXmppRtcpPacket
+{
+public:
+    /// This enum is used to describe the type of an RTCP packet.
+    enum Type {
+        SenderReport = 200,         ///< Sender report (RFC 3550).
+        ReceiverReport = 201,       ///< Receiver report (RFC 3550).
+        SourceDescription = 202,    ///< Source description (RFC 3550).
+        Goodbye = 203,              ///< Goodbye (RFC 3550).
+        RtpFeedback = 205,          ///< Transport layer feedback (RFC 4585).
+        PayloadFeedback = 206,      ///< Payload-specific feedback (RFC 4585).
+    };
+
+    QXmppRtcpPacket();
+
+    bool decode(const QByteArray &ba);
+    QByteArray encode() const;
+    QString toString() const;
+
+    static QList<QXmppRtcpPacket> decodeCompound(const QByteArray &ba);
+
+    // RFC 3550: sender report
+    quint64 ntpStamp() const;
+    quint32 rtpStamp() const;
+    quint32 senderPacketCount() const;
+    quint32 senderOctetCount() const;
+    void setSenderInfo(quint64 ntpStamp, quint32 rtpStamp, quint32 packetCount, quint32 octetCount);
+
+    // RFC 4585: generic NACK
+    quint32 mediaSsrc() const;
+    QList<quint16> nackSequences() const;
+    void setNackSequences(quint32 mediaSsrc, const QList<quint16> &sequences);
+
+    quint8 version;
+    quint8 count;
+    quint8 type;
+    quint32 ssrc;
     QByteArray payload;
 };
 
@@ -69,12 +152,22 @@ public:
     QList<QXmppJinglePayloadType> localPayloadTypes();
     void setRemotePayloadTypes(const QList<QXmppJinglePayloadType> &remotePayloadTypes);
 
+    QMap<int, QString> localHeaderExtensions() const;
+    void setRemoteHeaderExtensions(const QMap<int, QString> &remoteHeaderExtensions);
+
 protected:
     virtual void payloadTypesChanged() = 0;
+    void addHeaderExtensions(QXmppRtpPacket &packet, int audioLevel = -1);
 
     QList<QXmppJinglePayloadType> m_incomingPayloadTypes;
     QList<QXmppJinglePayloadType> m_outgoingPayloadTypes;
     bool m_outgoingPayloadNumbered;
+
+    QMap<int, QString> m_headerExtensions;
+    quint8 m_audioLevelId;
+    quint8 m_absSendTimeId;
+    quint8 m_transportSequenceId;
+    quint16 m_outgoingTransportSequence;
 };
 
 /// \brief The QXmppRtpAudioChannel class represents an RTP audio channel to a remote party.
@@ -115,6 +208,10 @@ public:
 
     QXmppJinglePayloadType payloadType() const;
 
+    qint64 playoutTime() const;
+    int playoutDelay() const;
+    void setPlayoutDelay(int msecs);
+
     /// \cond
     qint64 bytesAvailable() const;
     void close();
@@ -128,11 +225,15 @@ signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
 
+    /// \brief This signal is emitted when an RTCP datagram needs to be sent.
+    void sendRtcpDatagram(const QByteArray &ba);
+
     /// \brief This signal is emitted to send logging messages.
     void logMessage(QXmppLogger::MessageType type, const QString &msg);
 
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void rtcpDatagramReceived(const QByteArray &ba);
     void startTone(QXmppRtpAudioChannel::Tone tone);
     void stopTone(QXmppRtpAudioChannel::Tone tone);
 
@@ -165,6 +266,7 @@ protected:
 
 private slots:
     void emitSignals();
+    void sendSenderReport();
     void writeDatagram();
 
 private:
@@ -254,17 +356,46 @@ signals:
     /// \brief This signal is emitted when a datagram needs to be sent.
     void sendDatagram(const QByteArray &ba);
 
+    /// \brief This signal is emitted when an RTCP datagram needs to be sent.
+    void sendRtcpDatagram(const QByteArray &ba);
+
 public slots:
     void datagramReceived(const QByteArray &ba);
+    void rtcpDatagramReceived(const QByteArray &ba);
 
 protected:
     /// cond
     void payloadTypesChanged();
     /// \endcond
 
+private slots:
+    void sendNack();
+    void sendSenderReport();
+
 private:
     friend class QXmppRtpVideoChannelPrivate;
     QXmppRtpVideoChannelPrivate * d;
 };
 
+/// \brief The QXmppRtpPlayoutScheduler class synchronises the playout of
+/// an RTP audio channel and an RTP video channel.
+///
+/// Both streams are placed on the sender's wall clock using RTCP sender
+/// reports. Video frames which are ahead of the audio are held back, and if
+/// the video lags behind the audio, the audio playout is delayed.
+///
+/// \note THIS API IS NOT FINALIZED YET
+
+class QXMPP_EXPORT QXmppRtpPlayoutScheduler
+{
+public:
+    QXmppRtpPlayoutScheduler(QXmppRtpAudioChannel *audioChannel, QXmppRtpVideoChannel *videoChannel);
+    ~QXmppRtpPlayoutScheduler();
+
+    QList<AVFrame*> readFrames();
+
+private:
+    QXmppRtpPlayoutSchedulerPrivate * d;
+};
+
 #endif
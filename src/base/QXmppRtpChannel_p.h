@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPRTPCHANNEL_P_H
+#define QXMPPRTPCHANNEL_P_H
+
+#include <QList>
+#include <QPointer>
+#include <QVector>
+
+#include "QXmppRtpChannel.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppRtpChannel classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// The QXmppRtpSenderClock class maps the RTP timestamps of a remote source
+/// to the source's wall clock, using the NTP / RTP timestamp pairs carried
+/// by its RTCP sender reports.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtpSenderClock
+{
+public:
+    QXmppRtpSenderClock();
+    void clear();
+    void setClockrate(quint32 clockrate);
+    void update(const QXmppRtcpPacket &report);
+    qint64 wallTime(quint32 stamp) const;
+
+    static quint64 ntpFromMsecs(qint64 msecs);
+    static qint64 msecsFromNtp(quint64 ntp);
+
+private:
+    quint32 m_clockrate;
+    bool m_valid;
+    quint32 m_stamp;
+    qint64 m_time;
+};
+
+/// The QXmppRtpPacketHistory class holds the most recently sent RTP packets
+/// of a source, indexed by sequence number, so that they can be
+/// retransmitted when the remote party reports them as lost.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtpPacketHistory
+{
+public:
+    QXmppRtpPacketHistory();
+    void clear();
+    void insert(const QXmppRtpPacket &packet);
+    bool find(quint16 sequence, QXmppRtpPacket &packet) const;
+
+private:
+    QVector<QXmppRtpPacket> m_packets;
+    QVector<bool> m_valid;
+};
+
+/// The QXmppRtpFecEncoder class generates XOR-based forward error correction
+/// packets as described by RFC 5109 (RTP Payload Format for Generic Forward
+/// Error Correction).
+///
+/// Media packets are grouped in blocks of up to 16 packets. Each block is
+/// protected by \a depth FEC packets, the n-th FEC packet covering every
+/// depth-th media packet starting at offset n, so that a burst of up to
+/// \a depth consecutive losses can be repaired.
+///
+/// Packets are folded into the FEC packets as they are sent, so the encoder
+/// does not keep a copy of the block.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtpFecEncoder
+{
+public:
+    QXmppRtpFecEncoder();
+
+    int blockSize() const;
+    int depth() const;
+    void setLevel(int blockSize, int depth);
+
+    QList<QByteArray> handlePacket(quint16 sequence, const QByteArray &datagram);
+
+private:
+    class Parity
+    {
+    public:
+        QByteArray header;
+        QByteArray body;
+        quint16 mask;
+        quint16 lengthRecovery;
+    };
+
+    int m_blockSize;
+    int m_depth;
+
+    // current block
+    int m_count;
+    int m_currentSize;
+    int m_currentDepth;
+    quint16 m_blockBase;
+    QVector<Parity> m_parity;
+};
+
+/// The QXmppRtpFecDecoder class recovers a lost media packet from an
+/// RFC 5109 FEC packet and the other packets it protects.
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtpFecDecoder
+{
+public:
+    static bool recover(const QByteArray &fec, quint32 ssrc, const QXmppRtpPacketHistory &received, QXmppRtpPacket &packet);
+};
+
+class QXMPP_AUTOTEST_EXPORT QXmppRtpPlayoutSchedulerPrivate
+{
+public:
+    QList<AVFrame*> takeFrames(qint64 audioTime, int &delay);
+
+    QPointer<QXmppRtpAudioChannel> audioChannel;
+    QPointer<QXmppRtpVideoChannel> videoChannel;
+    QList<AVFrame*> frames;
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppStanza.h"
+#include "QXmppStanzaWriter_p.h"
+
+static const int initialCapacity = 4096;
+
+QXmppStanzaWriter::QXmppStanzaWriter()
+    : m_writer(&m_string)
+{
+    m_string.reserve(initialCapacity);
+    m_data.reserve(3 * initialCapacity);
+}
+
+/// Discards any pending output, keeping the allocated buffers.
+
+void QXmppStanzaWriter::clear()
+{
+    m_string.resize(0);
+}
+
+/// Returns the pending output, encoded as UTF-8.
+///
+/// The returned byte array shares the writer's buffer, which is only
+/// reallocated by the next call if the byte array is still referenced.
+
+QByteArray QXmppStanzaWriter::data()
+{
+    const ushort *src = reinterpret_cast<const ushort*>(m_string.constData());
+    const int length = m_string.size();
+
+    // each UTF-16 code unit takes at most three bytes
+    m_data.resize(3 * length);
+    uchar *start = reinterpret_cast<uchar*>(m_data.data());
+    uchar *dst = start;
+    for (int i = 0; i < length; ++i) {
+        const ushort u = src[i];
+        if (u < 0x80) {
+            *dst++ = u;
+        } else if (u < 0x800) {
+            *dst++ = 0xc0 | (u >> 6);
+            *dst++ = 0x80 | (u & 0x3f);
+        } else if ((u & 0xfc00) == 0xd800 && i + 1 < length && (src[i + 1] & 0xfc00) == 0xdc00) {
+            // surrogate pair
+            const uint ucs4 = 0x10000 + (((u & 0x3ff) << 10) | (src[++i] & 0x3ff));
+            *dst++ = 0xf0 | (ucs4 >> 18);
+            *dst++ = 0x80 | ((ucs4 >> 12) & 0x3f);
+            *dst++ = 0x80 | ((ucs4 >> 6) & 0x3f);
+            *dst++ = 0x80 | (ucs4 & 0x3f);
+        } else if ((u & 0xf800) == 0xd800) {
+            // unpaired surrogate, emit U+FFFD
+            *dst++ = 0xef;
+            *dst++ = 0xbf;
+            *dst++ = 0xbd;
+        } else {
+            *dst++ = 0xe0 | (u >> 12);
+            *dst++ = 0x80 | ((u >> 6) & 0x3f);
+            *dst++ = 0x80 | (u & 0x3f);
+        }
+    }
+    m_data.resize(dst - start);
+    return m_data;
+}
+
+/// Returns the QXmlStreamWriter to use for the pending output.
+
+QXmlStreamWriter *QXmppStanzaWriter::xmlWriter()
+{
+    return &m_writer;
+}
+
+/// Serializes the given stanza and returns it encoded as UTF-8.
+///
+/// \param stanza
+
+QByteArray QXmppStanzaWriter::write(const QXmppStanza &stanza)
+{
+    clear();
+    stanza.toXml(&m_writer);
+    return data();
+}
+
+/// Constructs a template from a serialized stanza.
+///
+/// \param data the stanza as serialized by QXmppStanzaWriter
+
+QXmppStanzaTemplate::QXmppStanzaTemplate(const QByteArray &data)
+{
+    // find the end of the start tag and of the element's name
+    int end = data.indexOf('>');
+    if (end < 0)
+        end = data.size();
+    int nameEnd = 1;
+    while (nameEnd < end && data[nameEnd] != ' ' && data[nameEnd] != '/')
+        ++nameEnd;
+
+    // attribute values are escaped, so they never contain a double quote
+    const int attributeStart = data.indexOf(" to=\"", nameEnd);
+    if (attributeStart >= 0 && attributeStart < end) {
+        const int valueStart = attributeStart + 5;
+        const int valueEnd = data.indexOf('"', valueStart);
+        m_head = data.left(valueStart);
+        m_tail = data.mid(valueEnd);
+    } else {
+        m_head = data.left(nameEnd) + " to=\"";
+        m_tail = '"' + data.mid(nameEnd);
+    }
+}
+
+/// Returns the stanza addressed to the given recipient.
+///
+/// \param to
+
+QByteArray QXmppStanzaTemplate::data(const QString &to) const
+{
+    const QByteArray value = to.toUtf8();
+
+    QByteArray data;
+    data.reserve(m_head.size() + value.size() + m_tail.size());
+    data += m_head;
+    for (int i = 0; i < value.size(); ++i) {
+        const char c = value[i];
+        if (c == '&')
+            data += "&amp;";
+        else if (c == '<')
+            data += "&lt;";
+        else if (c == '>')
+            data += "&gt;";
+        else if (c == '"')
+            data += "&quot;";
+        else
+            data += c;
+    }
+    data += m_tail;
+    return data;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTANZAWRITER_P_H
+#define QXMPPSTANZAWRITER_P_H
+
+#include <QByteArray>
+#include <QString>
+#include <QXmlStreamWriter>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream and QXmppServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXmppStanza;
+
+/// The QXmppStanzaWriter class serializes outgoing stanzas to UTF-8.
+///
+/// The QXmlStreamWriter writes into a string, which avoids going through
+/// a QTextCodec, and the string is then encoded into a byte array. Both
+/// buffers are kept between stanzas so that they only grow as needed.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaWriter
+{
+public:
+    QXmppStanzaWriter();
+
+    void clear();
+    QByteArray data();
+    QXmlStreamWriter *xmlWriter();
+
+    QByteArray write(const QXmppStanza &stanza);
+
+private:
+    Q_DISABLE_COPY(QXmppStanzaWriter)
+
+    QString m_string;
+    QByteArray m_data;
+    QXmlStreamWriter m_writer;
+};
+
+/// The QXmppStanzaTemplate class holds a serialized stanza whose "to"
+/// attribute can be replaced, so that a stanza sent to many recipients
+/// only needs to be serialized once.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaTemplate
+{
+public:
+    QXmppStanzaTemplate(const QByteArray &data);
+
+    QByteArray data(const QString &to) const;
+
+private:
+    QByteArray m_head;
+    QByteArray m_tail;
+};
+
+#endif
@@ -23,41 +23,146 @@
  */
 
 
+#include "QXmppAtom_p.h"
+#include "QXmppCompressor_p.h"
 #include "QXmppConstants.h"
 #include "QXmppLogger.h"
 #include "QXmppStanza.h"
+#include "QXmppStanzaWriter_p.h"
 #include "QXmppStream.h"
+#include "QXmppStreamParser_p.h"
 #include "QXmppUtils.h"
 
 #include <QBuffer>
 #include <QDomDocument>
 #include <QHostAddress>
-#include <QRegExp>
 #include <QSslSocket>
 #include <QStringList>
 #include <QTime>
+#include <QTimer>
 #include <QXmlStreamWriter>
 
 static bool randomSeeded = false;
 static const QByteArray streamRootElementEnd = "</stream:stream>";
 
+// XEP-0198: acknowledgements are requested once this many stanzas are
+// pending, or after this delay in milliseconds
+static const int ackRequestBatch = 5;
+static const int ackRequestDelay = 1000;
+
+// XEP-0138: a single read may not inflate to more than this many bytes
+static const int maximumInflatedSize = 4 * 1024 * 1024;
+
+static bool isStanza(const QByteArray &data)
+{
+    static const char *names[] = {"iq", "message", "presence", 0};
+    if (!data.startsWith('<'))
+        return false;
+    for (int i = 0; names[i]; ++i) {
+        const int length = qstrlen(names[i]);
+        if (data.size() > length + 1 && !qstrncmp(data.constData() + 1, names[i], length)) {
+            const char c = data.at(length + 1);
+            return c == ' ' || c == '/' || c == '>';
+        }
+    }
+    return false;
+}
+
+static bool isStanza(const QXmppStanzaElement &element)
+{
+    const int ns = element.namespaceAtom();
+    const int name = element.nameAtom();
+    return (ns == QXmppAtom::NsClient || ns == QXmppAtom::NsServer) &&
+           (name == QXmppAtom::Iq || name == QXmppAtom::Message || name == QXmppAtom::Presence);
+}
+
 class QXmppStreamPrivate
 {
 public:
     QXmppStreamPrivate();
+    void acknowledge(quint32 handled);
+    void stopCompression();
+    bool write(const QByteArray &data);
 
-    QByteArray dataBuffer;
     QSslSocket* socket;
 
     // stream state
-    QByteArray streamStart;
+    QXmppStreamParser parser;
+    QXmppStanzaWriter writer;
+
+    // XEP-0198: Stream Management
+    bool smInboundEnabled;
+    bool smOutboundEnabled;
+    quint32 smInboundCount;
+    quint32 smOutboundAcked;
+    int smUnrequested;
+    QList<QByteArray> smUnacked;
+    QTimer *smRequestTimer;
+
+    // XEP-0138: Stream Compression
+#ifdef QXMPP_USE_ZLIB
+    QXmppCompressor *compressor;
+    QXmppDecompressor *decompressor;
+#endif
+    QTimer *compressionTimer;
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate()
     : socket(0)
+    , smInboundEnabled(false)
+    , smOutboundEnabled(false)
+    , smInboundCount(0)
+    , smOutboundAcked(0)
+    , smUnrequested(0)
+    , smRequestTimer(0)
+#ifdef QXMPP_USE_ZLIB
+    , compressor(0)
+    , decompressor(0)
+#endif
+    , compressionTimer(0)
 {
 }
 
+/// Drops the queued stanzas which the peer reports as handled.
+///
+/// \param handled the peer's count of handled stanzas, which wraps at 2^32
+
+void QXmppStreamPrivate::acknowledge(quint32 handled)
+{
+    const quint32 count = qMin(handled - smOutboundAcked, quint32(smUnacked.size()));
+    for (quint32 i = 0; i < count; ++i)
+        smUnacked.removeFirst();
+    smOutboundAcked += count;
+}
+
+void QXmppStreamPrivate::stopCompression()
+{
+#ifdef QXMPP_USE_ZLIB
+    delete compressor;
+    compressor = 0;
+    delete decompressor;
+    decompressor = 0;
+#endif
+    compressionTimer->stop();
+}
+
+/// Writes data to the socket, compressing it if needed.
+
+bool QXmppStreamPrivate::write(const QByteArray &data)
+{
+#ifdef QXMPP_USE_ZLIB
+    if (compressor) {
+        // the sync flush is deferred so that all the data sent during this
+        // event loop iteration is flushed at once
+        if (!compressionTimer->isActive())
+            compressionTimer->start();
+        const QByteArray compressed = compressor->compress(data);
+        return socket->write(compressed) == compressed.size();
+    }
+#endif
+    return socket->write(data) == data.size();
+}
+
 /// Constructs a base XMPP stream.
 ///
 /// \param parent
@@ -66,18 +171,38 @@ QXmppStream::QXmppStream(QObject *parent)
     : QXmppLoggable(parent),
     d(new QXmppStreamPrivate)
 {
+    bool check;
+    Q_UNUSED(check);
+
     // Make sure the random number generator is seeded
     if (!randomSeeded)
     {
         qsrand(QTime(0,0,0).msecsTo(QTime::currentTime()) ^ reinterpret_cast<quintptr>(this));
         randomSeeded = true;
     }
+
+    // XEP-0198: Stream Management
+    d->smRequestTimer = new QTimer(this);
+    d->smRequestTimer->setInterval(ackRequestDelay);
+    d->smRequestTimer->setSingleShot(true);
+    check = connect(d->smRequestTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_requestAcknowledgement()));
+    Q_ASSERT(check);
+
+    // XEP-0138: Stream Compression
+    d->compressionTimer = new QTimer(this);
+    d->compressionTimer->setInterval(0);
+    d->compressionTimer->setSingleShot(true);
+    check = connect(d->compressionTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flushCompression()));
+    Q_ASSERT(check);
 }
 
 /// Destroys a base XMPP stream.
 
 QXmppStream::~QXmppStream()
 {
+    d->stopCompression();
     delete d;
 }
 
@@ -86,9 +211,13 @@ QXmppStream::~QXmppStream()
 
 void QXmppStream::disconnectFromHost()
 {
+    // closing the stream ends the stream management session
+    resetStreamManagement();
+
     sendData(streamRootElementEnd);
     if (d->socket)
     {
+        _q_flushCompression();
         d->socket->flush();
         d->socket->disconnectFromHost();
     }
@@ -101,8 +230,19 @@ void QXmppStream::disconnectFromHost()
 
 void QXmppStream::handleStart()
 {
-    d->dataBuffer.clear();
-    d->streamStart.clear();
+    d->parser.clear();
+}
+
+/// Handles an incoming top-level element.
+///
+/// The default implementation calls handleStanza() with the element's
+/// QDomElement.
+///
+/// \param element
+
+void QXmppStream::handleElement(const QXmppStanzaElement &element)
+{
+    handleStanza(element.toDomElement());
 }
 
 /// Returns true if the stream is connected.
@@ -123,7 +263,17 @@ bool QXmppStream::sendData(const QByteArray &data)
     logSent(QString::fromUtf8(data));
     if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
         return false;
-    return d->socket->write(data) == data.size();
+    const bool written = d->write(data);
+
+    // XEP-0198: keep stanzas until the peer acknowledges them
+    if (d->smOutboundEnabled && isStanza(data)) {
+        d->smUnacked << data;
+        if (++d->smUnrequested >= ackRequestBatch)
+            _q_requestAcknowledgement();
+        else if (!d->smRequestTimer->isActive())
+            d->smRequestTimer->start();
+    }
+    return written;
 }
 
 /// Sends an XMPP packet to the peer.
@@ -132,13 +282,121 @@ bool QXmppStream::sendData(const QByteArray &data)
 
 bool QXmppStream::sendPacket(const QXmppStanza &packet)
 {
-    // prepare packet
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
-    packet.toXml(&xmlStream);
-
     // send packet
-    return sendData(data);
+    return sendData(d->writer.write(packet));
+}
+
+/// Starts counting the stanzas received from the peer and answering its
+/// acknowledgement requests, as per XEP-0198: Stream Management.
+
+void QXmppStream::enableStanzaCount()
+{
+    d->smInboundEnabled = true;
+    d->smInboundCount = 0;
+}
+
+/// Starts queueing the stanzas sent to the peer until it acknowledges them,
+/// as per XEP-0198: Stream Management.
+
+void QXmppStream::enableStanzaQueue()
+{
+    d->smOutboundEnabled = true;
+    d->smOutboundAcked = 0;
+    d->smUnrequested = 0;
+    d->smUnacked.clear();
+}
+
+/// Returns the number of stanzas received from the peer since
+/// enableStanzaCount() was called, modulo 2^32.
+
+quint32 QXmppStream::handledStanzaCount() const
+{
+    return d->smInboundCount;
+}
+
+/// Resumes a stream management session on a new stream: the stanzas
+/// handled by the peer are dropped and the others are sent again.
+///
+/// \param handled the peer's count of handled stanzas
+
+void QXmppStream::resumeStanzaQueue(quint32 handled)
+{
+    d->acknowledge(handled);
+    d->smInboundEnabled = true;
+    d->smOutboundEnabled = true;
+    d->smUnrequested = 0;
+
+    const QList<QByteArray> unacked = d->smUnacked;
+    d->smUnacked.clear();
+    if (!unacked.isEmpty())
+        info(QString("Resending %1 unacknowledged stanza(s)").arg(unacked.size()));
+    foreach (const QByteArray &data, unacked)
+        sendData(data);
+}
+
+/// Ends the stream management session and drops the unacknowledged stanzas.
+
+void QXmppStream::resetStreamManagement()
+{
+    if (!d->smUnacked.isEmpty())
+        warning(QString("Dropping %1 unacknowledged stanza(s)").arg(d->smUnacked.size()));
+    d->smInboundEnabled = false;
+    d->smOutboundEnabled = false;
+    d->smInboundCount = 0;
+    d->smOutboundAcked = 0;
+    d->smUnrequested = 0;
+    d->smUnacked.clear();
+    d->smRequestTimer->stop();
+}
+
+/// Returns the stream compression methods supported by QXmpp, as per
+/// XEP-0138: Stream Compression.
+
+QStringList QXmppStream::availableCompressionMethods()
+{
+    QStringList methods;
+#ifdef QXMPP_USE_ZLIB
+    methods << "zlib";
+#endif
+    return methods;
+}
+
+/// Returns true if the stream is compressed.
+
+bool QXmppStream::isCompressed() const
+{
+#ifdef QXMPP_USE_ZLIB
+    return d->compressor != 0;
+#else
+    return false;
+#endif
+}
+
+/// Starts compressing the data sent and received on the stream.
+///
+/// Returns false if the method is not supported.
+///
+/// \param method
+
+bool QXmppStream::startCompression(const QString &method)
+{
+#ifdef QXMPP_USE_ZLIB
+    if (method == QLatin1String("zlib") && !d->compressor) {
+        QXmppCompressor *compressor = new QXmppCompressor;
+        QXmppDecompressor *decompressor = new QXmppDecompressor(maximumInflatedSize);
+        if (compressor->isValid() && decompressor->isValid()) {
+            debug("Stream compression enabled");
+            d->compressor = compressor;
+            d->decompressor = decompressor;
+            return true;
+        }
+        delete compressor;
+        delete decompressor;
+    }
+#else
+    Q_UNUSED(method);
+#endif
+    return false;
 }
 
 /// Returns the QSslSocket used for this stream.
@@ -198,6 +456,13 @@ void QXmppStream::_q_socketConnected()
 void QXmppStream::_q_socketDisconnected()
 {
     debug("Socket disconnected");
+
+    // XEP-0198: suspend the session, it may be resumed on a new stream
+    d->smInboundEnabled = false;
+    d->smOutboundEnabled = false;
+    d->smRequestTimer->stop();
+
+    d->stopCompression();
 }
 
 void QXmppStream::_q_socketEncrypted()
@@ -212,54 +477,82 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
     warning(QString("Socket error: " + socket()->errorString()));
 }
 
+void QXmppStream::_q_requestAcknowledgement()
+{
+    d->smRequestTimer->stop();
+    d->smUnrequested = 0;
+    sendData(QByteArray("<r xmlns='") + ns_stream_management + "'/>");
+}
+
+void QXmppStream::_q_flushCompression()
+{
+#ifdef QXMPP_USE_ZLIB
+    if (d->compressor && d->socket)
+        d->socket->write(d->compressor->flush());
+#endif
+    d->compressionTimer->stop();
+}
+
 void QXmppStream::_q_socketReadyRead()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    QByteArray data = d->socket->readAll();
+
+#ifdef QXMPP_USE_ZLIB
+    if (d->decompressor) {
+        QByteArray inflated;
+        if (!d->decompressor->decompress(data, inflated)) {
+            warning("Received invalid compressed data");
+            disconnectFromHost();
+            return;
+        }
+        data = inflated;
+    }
+#endif
 
     // handle whitespace pings
-    if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
-        d->dataBuffer.clear();
+    if (!data.isEmpty() && d->parser.depth() <= 1 && data.trimmed().isEmpty()) {
         handleStanza(QDomElement());
-    }
-
-    // FIXME : maybe these QRegExps could be static?
-    QRegExp startStreamRegex("^(<\\?xml.*\\?>)?\\s*<stream:stream.*>");
-    startStreamRegex.setMinimal(true);
-    QRegExp endStreamRegex("</stream:stream>$");
-    endStreamRegex.setMinimal(true);
-
-    // check whether we need to add stream start / end elements
-    QByteArray completeXml = d->dataBuffer;
-    const QString strData = QString::fromUtf8(d->dataBuffer);
-    bool streamStart = false;
-    if (d->streamStart.isEmpty() && strData.contains(startStreamRegex))
-        streamStart = true;
-    else
-        completeXml.prepend(d->streamStart);
-    if (!strData.contains(endStreamRegex))
-        completeXml.append(streamRootElementEnd);
-
-    // check whether we have a valid XML document
-    QDomDocument doc;
-    if (!doc.setContent(completeXml, true))
         return;
+    }
 
-    // remove data from buffer
-    logReceived(strData);
-    d->dataBuffer.clear();
-    if (streamStart)
-        d->streamStart = startStreamRegex.cap(0).toUtf8();
-
-    // process stream start
-    if (streamStart)
-        handleStream(doc.documentElement());
-
-    // process stanzas
-    QDomElement nodeRecv = doc.documentElement().firstChildElement();
-    while (!nodeRecv.isNull()) {
-        handleStanza(nodeRecv);
-        nodeRecv = nodeRecv.nextSiblingElement();
+    // the parser keeps its state between reads, so each byte is only
+    // parsed once however the stanzas are split
+    logReceived(QString::fromUtf8(data));
+    d->parser.addData(data);
+
+    forever {
+        const QXmppStreamParser::Token token = d->parser.readNext();
+        if (token == QXmppStreamParser::StreamStart) {
+            handleStream(d->parser.element().toDomElement());
+        } else if (token == QXmppStreamParser::Stanza) {
+            // XEP-0198: answer acknowledgement requests and process
+            // acknowledgements, count every other stanza once handled
+            const QXmppStanzaElement element = d->parser.element();
+            if (d->smInboundEnabled &&
+                element.namespaceAtom() == QXmppAtom::NsStreamManagement &&
+                element.nameAtom() == QXmppAtom::R) {
+                sendData(QString("<a xmlns='%1' h='%2'/>").arg(
+                    ns_stream_management,
+                    QString::number(d->smInboundCount)).toUtf8());
+            } else if (d->smOutboundEnabled &&
+                       element.namespaceAtom() == QXmppAtom::NsStreamManagement &&
+                       element.nameAtom() == QXmppAtom::A) {
+                d->acknowledge(element.attribute("h").toUInt());
+            } else {
+                handleElement(element);
+                if (d->smInboundEnabled && isStanza(element))
+                    ++d->smInboundCount;
+            }
+        } else if (token == QXmppStreamParser::StreamEnd) {
+            // the peer closed the stream, the socket will follow
+            continue;
+        } else {
+            // wait for more data unless the stream is not well-formed
+            if (token == QXmppStreamParser::Error) {
+                warning(QString("Received invalid XML: %1").arg(d->parser.errorString()));
+                disconnectFromHost();
+            }
+            break;
+        }
     }
 }
-
-
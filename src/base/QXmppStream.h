@@ -28,11 +28,13 @@
 
 #include <QAbstractSocket>
 #include <QObject>
+#include <QStringList>
 #include "QXmppLogger.h"
 
 class QDomElement;
 class QSslSocket;
 class QXmppStanza;
+class QXmppStanzaElement;
 class QXmppStreamPrivate;
 
 /// \brief The QXmppStream class is the base class for all XMPP streams.
@@ -63,6 +65,7 @@ protected:
 
     // Overridable methods
     virtual void handleStart();
+    virtual void handleElement(const QXmppStanzaElement &element);
 
     /// Handles an incoming XMPP stanza.
     ///
@@ -74,6 +77,18 @@ protected:
     /// \param element
     virtual void handleStream(const QDomElement &element) = 0;
 
+    // XEP-0198: Stream Management
+    void enableStanzaCount();
+    void enableStanzaQueue();
+    quint32 handledStanzaCount() const;
+    void resumeStanzaQueue(quint32 handled);
+    void resetStreamManagement();
+
+    // XEP-0138: Stream Compression
+    static QStringList availableCompressionMethods();
+    bool isCompressed() const;
+    bool startCompression(const QString &method);
+
 public slots:
     virtual void disconnectFromHost();
     virtual bool sendData(const QByteArray&);
@@ -84,6 +99,8 @@ private slots:
     void _q_socketEncrypted();
     void _q_socketError(QAbstractSocket::SocketError error);
     void _q_socketReadyRead();
+    void _q_requestAcknowledgement();
+    void _q_flushCompression();
 
 private:
     QXmppStreamPrivate * const d;
@@ -30,7 +30,8 @@ QXmppStreamFeatures::QXmppStreamFeatures()
     : m_bindMode(Disabled),
     m_sessionMode(Disabled),
     m_nonSaslAuthMode(Disabled),
-    m_tlsMode(Disabled)
+    m_tlsMode(Disabled),
+    m_streamManagementMode(Disabled)
 {
 }
 
@@ -94,6 +95,16 @@ void QXmppStreamFeatures::setTlsMode(QXmppStreamFeatures::Mode mode)
     m_tlsMode = mode;
 }
 
+QXmppStreamFeatures::Mode QXmppStreamFeatures::streamManagementMode() const
+{
+    return m_streamManagementMode;
+}
+
+void QXmppStreamFeatures::setStreamManagementMode(QXmppStreamFeatures::Mode mode)
+{
+    m_streamManagementMode = mode;
+}
+
 /// \cond
 bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
 {
@@ -121,6 +132,7 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
     m_sessionMode = readFeature(element, "session", ns_session);
     m_nonSaslAuthMode = readFeature(element, "auth", ns_authFeature);
     m_tlsMode = readFeature(element, "starttls", ns_tls);
+    m_streamManagementMode = readFeature(element, "sm", ns_stream_management);
 
     // parse advertised compression methods
     QDomElement compression = element.firstChildElement("compression");
@@ -165,6 +177,7 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
     writeFeature(writer, "session", ns_session, m_sessionMode);
     writeFeature(writer, "auth", ns_authFeature, m_nonSaslAuthMode);
     writeFeature(writer, "starttls", ns_tls, m_tlsMode);
+    writeFeature(writer, "sm", ns_stream_management, m_streamManagementMode);
 
     if (!m_compressionMethods.isEmpty())
     {
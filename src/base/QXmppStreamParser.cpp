@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppAtom_p.h"
+#include "QXmppStreamParser_p.h"
+
+// maximum number of interned names and namespaces per stream
+#define INTERN_MAX 1024
+
+static uint hashString(const QChar *p, int n)
+{
+    uint h = 0;
+    while (n--) {
+        h = (h << 4) + (*p++).unicode();
+        h ^= (h & 0xf0000000) >> 23;
+        h &= 0x0fffffff;
+    }
+    return h;
+}
+
+/// Appends a node to the tree and links it to its parent.
+///
+/// Returns the index of the new node.
+
+int QXmppStanzaTree::addNode(const Node &node)
+{
+    const int index = nodes.size();
+    nodes.append(node);
+
+    Node &child = nodes[index];
+    child.firstChild = -1;
+    child.lastChild = -1;
+    child.nextSibling = -1;
+    if (child.parent >= 0) {
+        Node &parent = nodes[child.parent];
+        if (parent.lastChild >= 0)
+            nodes[parent.lastChild].nextSibling = index;
+        else
+            parent.firstChild = index;
+        parent.lastChild = index;
+    }
+    return index;
+}
+
+/// Returns a QDomElement for the given element node.
+///
+/// The DOM is only built the first time it is requested.
+
+QDomElement QXmppStanzaTree::domElement(int index)
+{
+    if (m_domElements.isEmpty()) {
+        m_domElements.resize(nodes.size());
+        m_document.appendChild(createDomElement(0));
+    }
+    return m_domElements.value(index);
+}
+
+QDomElement QXmppStanzaTree::createDomElement(int index)
+{
+    const Node &node = nodes[index];
+    QDomElement element = m_document.createElementNS(node.namespaceUri, node.qualifiedName);
+    for (int i = node.firstAttribute; i < node.firstAttribute + node.attributeCount; ++i) {
+        const Attribute &attribute = attributes[i];
+        if (attribute.namespaceUri.isEmpty())
+            element.setAttribute(attribute.name, attribute.value);
+        else
+            element.setAttributeNS(attribute.namespaceUri, attribute.name, attribute.value);
+    }
+
+    for (int child = node.firstChild; child >= 0; child = nodes[child].nextSibling) {
+        const Node &childNode = nodes[child];
+        if (childNode.type == ElementNode)
+            element.appendChild(createDomElement(child));
+        else if (childNode.type == CDATASectionNode)
+            element.appendChild(m_document.createCDATASection(childNode.text));
+        else
+            element.appendChild(m_document.createTextNode(childNode.text));
+    }
+
+    m_domElements[index] = element;
+    return element;
+}
+
+/// Constructs a null element.
+
+QXmppStanzaElement::QXmppStanzaElement()
+    : m_index(-1)
+{
+}
+
+QXmppStanzaElement::QXmppStanzaElement(QXmppStanzaTree *tree, int index)
+    : m_tree(tree),
+    m_index(index)
+{
+}
+
+/// Returns true if this is a null element.
+
+bool QXmppStanzaElement::isNull() const
+{
+    return !m_tree || m_index < 0;
+}
+
+/// Returns the element's local name.
+
+QString QXmppStanzaElement::tagName() const
+{
+    return isNull() ? QString() : node().name;
+}
+
+/// Returns the element's namespace URI.
+
+QString QXmppStanzaElement::namespaceURI() const
+{
+    return isNull() ? QString() : node().namespaceUri;
+}
+
+/// Returns the QXmppAtom for the element's local name.
+
+int QXmppStanzaElement::nameAtom() const
+{
+    return isNull() ? int(QXmppAtom::Unknown) : node().nameAtom;
+}
+
+/// Returns the QXmppAtom for the element's namespace URI.
+
+int QXmppStanzaElement::namespaceAtom() const
+{
+    return isNull() ? int(QXmppAtom::Unknown) : node().namespaceAtom;
+}
+
+/// Returns the value of the attribute with the given qualified \a name,
+/// or \a defValue if there is no such attribute.
+///
+/// \param name
+/// \param defValue
+
+QString QXmppStanzaElement::attribute(const QString &name, const QString &defValue) const
+{
+    if (isNull())
+        return defValue;
+
+    const QXmppStanzaTree::Node &n = node();
+    for (int i = n.firstAttribute; i < n.firstAttribute + n.attributeCount; ++i) {
+        const QXmppStanzaTree::Attribute &attribute = m_tree->attributes.at(i);
+        if (attribute.name == name)
+            return attribute.value;
+    }
+    return defValue;
+}
+
+/// Returns true if the element has an attribute with the given qualified
+/// \a name.
+///
+/// \param name
+
+bool QXmppStanzaElement::hasAttribute(const QString &name) const
+{
+    if (isNull())
+        return false;
+
+    const QXmppStanzaTree::Node &n = node();
+    for (int i = n.firstAttribute; i < n.firstAttribute + n.attributeCount; ++i) {
+        if (m_tree->attributes.at(i).name == name)
+            return true;
+    }
+    return false;
+}
+
+/// Returns the first child element with the given \a tagName, or the first
+/// child element if \a tagName is empty.
+///
+/// \param tagName
+
+QXmppStanzaElement QXmppStanzaElement::firstChildElement(const QString &tagName) const
+{
+    if (isNull())
+        return QXmppStanzaElement();
+    return nextElement(node().firstChild, tagName);
+}
+
+/// Returns the next sibling element with the given \a tagName, or the next
+/// sibling element if \a tagName is empty.
+///
+/// \param tagName
+
+QXmppStanzaElement QXmppStanzaElement::nextSiblingElement(const QString &tagName) const
+{
+    if (isNull())
+        return QXmppStanzaElement();
+    return nextElement(node().nextSibling, tagName);
+}
+
+/// Returns the text contained in the element and its descendants.
+
+QString QXmppStanzaElement::text() const
+{
+    if (isNull())
+        return QString();
+
+    // walk the subtree in document order
+    QString result;
+    const QVector<QXmppStanzaTree::Node> &nodes = m_tree->nodes;
+    int index = nodes.at(m_index).firstChild;
+    while (index >= 0) {
+        const QXmppStanzaTree::Node &n = nodes.at(index);
+        if (n.type != QXmppStanzaTree::ElementNode)
+            result += n.text;
+        if (n.firstChild >= 0) {
+            index = n.firstChild;
+            continue;
+        }
+        while (index != m_index && nodes.at(index).nextSibling < 0)
+            index = nodes.at(index).parent;
+        index = (index == m_index) ? -1 : nodes.at(index).nextSibling;
+    }
+    return result;
+}
+
+/// Returns the QDomElement corresponding to this element.
+///
+/// The DOM for the whole stanza is built on the first call and shared by
+/// the following ones.
+
+QDomElement QXmppStanzaElement::toDomElement() const
+{
+    if (isNull())
+        return QDomElement();
+    return m_tree->domElement(m_index);
+}
+
+QXmppStanzaElement QXmppStanzaElement::nextElement(int index, const QString &tagName) const
+{
+    const QVector<QXmppStanzaTree::Node> &nodes = m_tree->nodes;
+    for (; index >= 0; index = nodes.at(index).nextSibling) {
+        const QXmppStanzaTree::Node &n = nodes.at(index);
+        if (n.type == QXmppStanzaTree::ElementNode && (tagName.isEmpty() || n.name == tagName))
+            return QXmppStanzaElement(m_tree.data(), index);
+    }
+    return QXmppStanzaElement();
+}
+
+const QXmppStanzaTree::Node &QXmppStanzaElement::node() const
+{
+    return m_tree->nodes.at(m_index);
+}
+
+/// Constructs a new stream parser.
+
+QXmppStreamParser::QXmppStreamParser()
+    : m_current(-1),
+    m_depth(0),
+    m_textIsCDATA(false)
+{
+}
+
+/// Adds more data for the parser to read.
+///
+/// \param data
+
+void QXmppStreamParser::addData(const QByteArray &data)
+{
+    m_reader.addData(data);
+}
+
+/// Discards the parser state, for instance when the stream restarts.
+
+void QXmppStreamParser::clear()
+{
+    m_reader.clear();
+    m_tree = 0;
+    m_current = -1;
+    m_depth = 0;
+    m_element = QXmppStanzaElement();
+    m_text.clear();
+    m_textIsCDATA = false;
+}
+
+/// Returns the depth of the current element, 1 being the stream element.
+
+int QXmppStreamParser::depth() const
+{
+    return m_depth;
+}
+
+/// Returns the element for the last StreamStart or Stanza token.
+
+QXmppStanzaElement QXmppStreamParser::element() const
+{
+    return m_element;
+}
+
+/// Returns the description of the last error.
+
+QString QXmppStreamParser::errorString() const
+{
+    return m_reader.errorString();
+}
+
+/// Reads until the stream element or a top-level stanza is complete.
+///
+/// Returns NoToken if more data is needed. The reader keeps its state
+/// between calls, so data is only parsed once however it is split.
+
+QXmppStreamParser::Token QXmppStreamParser::readNext()
+{
+    forever {
+        switch (m_reader.readNext()) {
+        case QXmlStreamReader::StartElement:
+            addText();
+            if (m_depth <= 1) {
+                m_tree = new QXmppStanzaTree;
+                m_current = -1;
+            }
+            m_current = addElement();
+            if (++m_depth == 1) {
+                m_element = QXmppStanzaElement(m_tree.data(), 0);
+                m_tree = 0;
+                m_current = -1;
+                return StreamStart;
+            }
+            break;
+
+        case QXmlStreamReader::EndElement:
+            addText();
+            if (--m_depth == 0) {
+                return StreamEnd;
+            } else if (m_depth == 1) {
+                m_element = QXmppStanzaElement(m_tree.data(), 0);
+                m_tree = 0;
+                m_current = -1;
+                return Stanza;
+            }
+            m_current = m_tree->nodes.at(m_current).parent;
+            break;
+
+        case QXmlStreamReader::Characters:
+            if (m_depth > 1) {
+                m_text += m_reader.text();
+                m_textIsCDATA = m_reader.isCDATA();
+            }
+            break;
+
+        case QXmlStreamReader::Invalid:
+            if (m_reader.error() == QXmlStreamReader::PrematureEndOfDocumentError)
+                return NoToken;
+            return Error;
+
+        case QXmlStreamReader::EndDocument:
+            return NoToken;
+
+        default:
+            break;
+        }
+    }
+}
+
+/// Adds the reader's current start element as a child of the current
+/// element.
+
+int QXmppStreamParser::addElement()
+{
+    QXmppStanzaTree::Node node;
+    node.type = QXmppStanzaTree::ElementNode;
+    node.name = intern(m_reader.name(), &node.nameAtom);
+    node.qualifiedName = intern(m_reader.qualifiedName());
+    node.namespaceUri = intern(m_reader.namespaceUri(), &node.namespaceAtom);
+    node.parent = m_current;
+
+    const QXmlStreamAttributes attributes = m_reader.attributes();
+    node.firstAttribute = m_tree->attributes.size();
+    node.attributeCount = attributes.size();
+    foreach (const QXmlStreamAttribute &streamAttribute, attributes) {
+        QXmppStanzaTree::Attribute attribute;
+        attribute.name = intern(streamAttribute.qualifiedName());
+        attribute.namespaceUri = intern(streamAttribute.namespaceUri());
+        attribute.value = streamAttribute.value().toString();
+        m_tree->attributes.append(attribute);
+    }
+    return m_tree->addNode(node);
+}
+
+/// Adds the pending character data to the current element.
+///
+/// Whitespace-only text is dropped, like QDomDocument::setContent() does.
+
+void QXmppStreamParser::addText()
+{
+    if (m_text.isEmpty())
+        return;
+
+    if (!m_text.trimmed().isEmpty()) {
+        QXmppStanzaTree::Node node;
+        node.type = m_textIsCDATA ? QXmppStanzaTree::CDATASectionNode : QXmppStanzaTree::TextNode;
+        node.text = m_text;
+        node.nameAtom = QXmppAtom::Unknown;
+        node.namespaceAtom = QXmppAtom::Unknown;
+        node.parent = m_current;
+        node.firstAttribute = 0;
+        node.attributeCount = 0;
+        m_tree->addNode(node);
+    }
+    m_text.clear();
+    m_textIsCDATA = false;
+}
+
+/// Returns a shared copy of the given string, so that element names and
+/// namespaces which occur repeatedly are only allocated once per stream.
+///
+/// If \a atom is not null, it receives the string's QXmppAtom, which is
+/// only looked up the first time the string is seen.
+
+QString QXmppStreamParser::intern(const QStringRef &string, int *atom)
+{
+    if (string.isEmpty()) {
+        if (atom)
+            *atom = QXmppAtom::Unknown;
+        return QString();
+    }
+
+    const uint hash = hashString(string.unicode(), string.size());
+    QHash<uint, InternedString>::const_iterator it = m_strings.constFind(hash);
+    if (it != m_strings.constEnd() && it.value().string == string) {
+        if (atom)
+            *atom = it.value().atom;
+        return it.value().string;
+    }
+
+    InternedString interned;
+    interned.string = string.toString();
+    interned.atom = QXmppAtom::lookup(interned.string);
+    if (it == m_strings.constEnd() && m_strings.size() < INTERN_MAX)
+        m_strings.insert(hash, interned);
+    if (atom)
+        *atom = interned.atom;
+    return interned.string;
+}
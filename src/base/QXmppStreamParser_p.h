@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTREAMPARSER_P_H
+#define QXMPPSTREAMPARSER_P_H
+
+#include <QDomElement>
+#include <QHash>
+#include <QSharedData>
+#include <QVector>
+#include <QXmlStreamReader>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppStream class.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXmppStreamParser;
+
+/// The QXmppStanzaTree class holds all the nodes of a received stanza.
+///
+/// Nodes and attributes are stored in two arrays and refer to each other
+/// by index, so a stanza only needs a couple of allocations.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaTree : public QSharedData
+{
+public:
+    enum NodeType {
+        ElementNode,
+        TextNode,
+        CDATASectionNode,
+    };
+
+    class Attribute
+    {
+    public:
+        QString name;
+        QString namespaceUri;
+        QString value;
+    };
+
+    class Node
+    {
+    public:
+        NodeType type;
+        QString name;
+        QString qualifiedName;
+        QString namespaceUri;
+        QString text;
+        int nameAtom;
+        int namespaceAtom;
+        int parent;
+        int firstChild;
+        int lastChild;
+        int nextSibling;
+        int firstAttribute;
+        int attributeCount;
+    };
+
+    int addNode(const Node &node);
+    QDomElement domElement(int index);
+
+    QVector<Node> nodes;
+    QVector<Attribute> attributes;
+
+private:
+    QDomElement createDomElement(int index);
+
+    QDomDocument m_document;
+    QVector<QDomElement> m_domElements;
+};
+
+/// The QXmppStanzaElement class is a lightweight handle to an element of
+/// a QXmppStanzaTree, with a subset of the QDomElement API.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStanzaElement
+{
+public:
+    QXmppStanzaElement();
+
+    bool isNull() const;
+    QString tagName() const;
+    QString namespaceURI() const;
+    int nameAtom() const;
+    int namespaceAtom() const;
+
+    QString attribute(const QString &name, const QString &defValue = QString()) const;
+    bool hasAttribute(const QString &name) const;
+
+    QXmppStanzaElement firstChildElement(const QString &tagName = QString()) const;
+    QXmppStanzaElement nextSiblingElement(const QString &tagName = QString()) const;
+    QString text() const;
+
+    QDomElement toDomElement() const;
+
+private:
+    QXmppStanzaElement(QXmppStanzaTree *tree, int index);
+    QXmppStanzaElement nextElement(int index, const QString &tagName) const;
+    const QXmppStanzaTree::Node &node() const;
+
+    QExplicitlySharedDataPointer<QXmppStanzaTree> m_tree;
+    int m_index;
+
+    friend class QXmppStreamParser;
+};
+
+/// The QXmppStreamParser class parses an XMPP stream incrementally and
+/// returns the stream element and each top-level stanza as they complete.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStreamParser
+{
+public:
+    enum Token {
+        NoToken,
+        StreamStart,
+        StreamEnd,
+        Stanza,
+        Error
+    };
+
+    QXmppStreamParser();
+
+    void addData(const QByteArray &data);
+    void clear();
+    int depth() const;
+    QXmppStanzaElement element() const;
+    QString errorString() const;
+    Token readNext();
+
+private:
+    int addElement();
+    void addText();
+    QString intern(const QStringRef &string, int *atom = 0);
+
+    class InternedString
+    {
+    public:
+        QString string;
+        int atom;
+    };
+
+    QXmlStreamReader m_reader;
+    QExplicitlySharedDataPointer<QXmppStanzaTree> m_tree;
+    int m_current;
+    int m_depth;
+    QXmppStanzaElement m_element;
+    QString m_text;
+    bool m_textIsCDATA;
+    QHash<uint, InternedString> m_strings;
+};
+
+#endif
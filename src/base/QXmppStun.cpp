@@ -23,18 +23,40 @@
 
 #define QXMPP_DEBUG_STUN
 
+#include <string.h>
+
 #include <QCryptographicHash>
 #include <QHostInfo>
 #include <QNetworkInterface>
+#include <QSslSocket>
 #include <QUdpSocket>
 #include <QTimer>
+#include <QtEndian>
 
 #include "QXmppStun.h"
+#include "QXmppStun_p.h"
 #include "QXmppUtils.h"
+#include "QXmppUtils_p.h"
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#define QXMPP_USE_MMSG
+#endif
 
 #define ID_SIZE 12
 #define STUN_RTO_INTERVAL 500
 #define STUN_RTO_MAX      7
+// transaction timeout over TCP or TLS (Ti)
+#define STUN_RELIABLE_TIMEOUT 39500
+// pacing interval between connectivity checks (Ta)
+#define ICE_PACING_INTERVAL 20
+// maximum number of datagrams read or written in one system call
+#define UDP_BATCH_SIZE 16
+// size of the receive buffer for each datagram in a batch
+#define UDP_BUFFER_SIZE 4096
 
 static const quint32 STUN_MAGIC = 0x2112A442;
 static const quint16 STUN_HEADER = 20;
@@ -102,6 +124,59 @@ static bool isIPv6LinkLocalAddress(const QHostAddress &addr)
     return (((ipv6addr[0] << 8) + ipv6addr[1]) & 0xffc0) == 0xfe80;
 }
 
+#ifdef QXMPP_USE_MMSG
+static socklen_t toSockAddr(const QHostAddress &host, quint16 port, struct sockaddr_storage *storage)
+{
+    memset(storage, 0, sizeof(*storage));
+    if (host.protocol() == QAbstractSocket::IPv6Protocol) {
+        struct sockaddr_in6 *sa = reinterpret_cast<struct sockaddr_in6*>(storage);
+        sa->sin6_family = AF_INET6;
+        sa->sin6_port = htons(port);
+        const Q_IPV6ADDR addr = host.toIPv6Address();
+        memcpy(sa->sin6_addr.s6_addr, &addr, sizeof(addr));
+        if (!host.scopeId().isEmpty())
+            sa->sin6_scope_id = if_nametoindex(host.scopeId().toLatin1().constData());
+        return sizeof(struct sockaddr_in6);
+    } else {
+        struct sockaddr_in *sa = reinterpret_cast<struct sockaddr_in*>(storage);
+        sa->sin_family = AF_INET;
+        sa->sin_port = htons(port);
+        sa->sin_addr.s_addr = htonl(host.toIPv4Address());
+        return sizeof(struct sockaddr_in);
+    }
+}
+
+static void fromSockAddr(const struct sockaddr_storage *storage, QHostAddress &host, quint16 &port)
+{
+    host.setAddress(reinterpret_cast<const struct sockaddr*>(storage));
+    if (storage->ss_family == AF_INET6)
+        port = ntohs(reinterpret_cast<const struct sockaddr_in6*>(storage)->sin6_port);
+    else
+        port = ntohs(reinterpret_cast<const struct sockaddr_in*>(storage)->sin_port);
+}
+#endif
+
+/// Returns the raw bytes of an address for use in hash keys, IPv4
+/// addresses being mapped to IPv6.
+
+static Q_IPV6ADDR rawAddress(const QHostAddress &host)
+{
+    Q_IPV6ADDR address;
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+        const quint32 ipv4 = host.toIPv4Address();
+        memset(&address, 0, sizeof(address));
+        address[10] = 0xff;
+        address[11] = 0xff;
+        address[12] = (ipv4 >> 24) & 0xff;
+        address[13] = (ipv4 >> 16) & 0xff;
+        address[14] = (ipv4 >> 8) & 0xff;
+        address[15] = ipv4 & 0xff;
+    } else {
+        address = host.toIPv6Address();
+    }
+    return address;
+}
+
 static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
 {
     if (a_length < 4)
@@ -328,6 +403,13 @@ void QXmppStunMessage::setData(const QByteArray &data)
     m_attributes << DataAttr;
 }
 
+/// Returns true if the message has a LIFETIME attribute.
+
+bool QXmppStunMessage::hasLifetime() const
+{
+    return m_attributes.contains(Lifetime);
+}
+
 /// Returns the LIFETIME attribute, indicating the duration in seconds for
 /// which the server will maintain an allocation.
 
@@ -480,6 +562,15 @@ void QXmppStunMessage::setUsername(const QString &username)
 /// \param errors
 
 bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, QStringList *errors)
+{
+    if (key.isEmpty())
+        return decode(buffer, static_cast<const QXmppHmacSha1*>(0), errors);
+
+    const QXmppHmacSha1 integrity(key);
+    return decode(buffer, &integrity, errors);
+}
+
+bool QXmppStunMessage::decode(const QByteArray &buffer, const QXmppHmacSha1 *integrity, QStringList *errors)
 {
     QStringList silent;
     if (!errors)
@@ -703,15 +794,22 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // MESSAGE-INTEGRITY
             if (a_length != 20)
                 return false;
-            QByteArray integrity(20, 0);
-            stream.readRawData(integrity.data(), integrity.size());
+            QByteArray digest(20, 0);
+            stream.readRawData(digest.data(), digest.size());
 
             // check HMAC-SHA1
-            if (!key.isEmpty())
+            if (integrity)
             {
-                QByteArray copy = buffer.left(STUN_HEADER + done);
-                setBodyLength(copy, done + 24);
-                if (integrity != QXmppUtils::generateHmacSha1(key, copy))
+                // sign the header with the adjusted length, then the
+                // attributes in place
+                uchar header[STUN_HEADER];
+                memcpy(header, buffer.constData(), STUN_HEADER);
+                qToBigEndian(quint16(done + 24), header + 2);
+
+                QXmppHmacSha1 hmac = *integrity;
+                hmac.addData(reinterpret_cast<const char*>(header), STUN_HEADER);
+                hmac.addData(buffer.constData() + STUN_HEADER, done);
+                if (digest != hmac.result())
                 {
                     *errors << QLatin1String("Bad message integrity");
                     return false;
@@ -720,6 +818,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 
             // from here onwards, only FINGERPRINT is allowed
             after_integrity = true;
+            m_attributes << MessageIntegrity;
 
         } else if (a_type == Fingerprint) {
 
@@ -729,10 +828,13 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             quint32 fingerprint;
             stream >> fingerprint;
 
-            // check CRC32
-            QByteArray copy = buffer.left(STUN_HEADER + done);
-            setBodyLength(copy, done + 8);
-            const quint32 expected = QXmppUtils::generateCrc32(copy) ^ 0x5354554eL;
+            // check CRC32 over the header with the adjusted length, then
+            // the attributes in place
+            uchar header[STUN_HEADER];
+            memcpy(header, buffer.constData(), STUN_HEADER);
+            qToBigEndian(quint16(done + 8), header + 2);
+            quint32 expected = QXmppUtils::generateCrc32(reinterpret_cast<const char*>(header), STUN_HEADER);
+            expected = QXmppUtils::generateCrc32(buffer.constData() + STUN_HEADER, done, expected) ^ 0x5354554eL;
             if (fingerprint != expected)
             {
                 *errors << QLatin1String("Bad fingerprint");
@@ -771,6 +873,14 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
     return true;
 }
 
+/// Returns true if the decoded message carried a MESSAGE-INTEGRITY
+/// attribute.
+
+bool QXmppStunMessage::hasMessageIntegrity() const
+{
+    return m_attributes.contains(MessageIntegrity);
+}
+
 /// Encodes the current QXmppStunMessage, optionally calculating the
 /// message integrity attribute using the given key.
 ///
@@ -778,6 +888,15 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 /// \param addFingerprint
 
 QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint) const
+{
+    if (key.isEmpty())
+        return encode(static_cast<const QXmppHmacSha1*>(0), addFingerprint);
+
+    const QXmppHmacSha1 integrity(key);
+    return encode(&integrity, addFingerprint);
+}
+
+QByteArray QXmppStunMessage::encode(const QXmppHmacSha1 *integrity, bool addFingerprint) const
 {
     QByteArray buffer;
     QDataStream stream(&buffer, QIODevice::WriteOnly);
@@ -929,13 +1048,15 @@ QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint)
     setBodyLength(buffer, buffer.size() - STUN_HEADER);
 
     // MESSAGE-INTEGRITY
-    if (!key.isEmpty())
+    if (integrity)
     {
         setBodyLength(buffer, buffer.size() - STUN_HEADER + 24);
-        QByteArray integrity = QXmppUtils::generateHmacSha1(key, buffer);
+        QXmppHmacSha1 hmac = *integrity;
+        hmac.addData(buffer);
+        const QByteArray digest = hmac.result();
         stream << quint16(MessageIntegrity);
-        stream << quint16(integrity.size());
-        stream.writeRawData(integrity.data(), integrity.size());
+        stream << quint16(digest.size());
+        stream.writeRawData(digest.data(), digest.size());
     }
 
     // FINGERPRINT
@@ -1066,13 +1187,19 @@ QString QXmppStunMessage::toString() const
 
 /// Constructs a new QXmppStunTransaction.
 ///
+/// Over a reliable transport such as TCP or TLS the request is sent once
+/// and the transaction times out after 39.5 seconds, otherwise the request
+/// is retransmitted as described in RFC 5389 section 7.2.
+///
 /// \param request
 /// \param receiver
+/// \param reliable
 
-QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObject *receiver)
+QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObject *receiver, bool reliable)
     : QXmppLoggable(receiver),
     m_request(request),
-    m_tries(0)
+    m_tries(0),
+    m_reliable(reliable)
 {
     bool check;
     Q_UNUSED(check);
@@ -1094,7 +1221,7 @@ QXmppStunTransaction::QXmppStunTransaction(const QXmppStunMessage &request, QObj
     // send packet immediately
     m_tries++;
     emit writeStun(m_request);
-    m_retryTimer->start(STUN_RTO_INTERVAL);
+    m_retryTimer->start(m_reliable ? STUN_RELIABLE_TIMEOUT : STUN_RTO_INTERVAL);
 }
 
 void QXmppStunTransaction::readStun(const QXmppStunMessage &response)
@@ -1122,7 +1249,7 @@ QXmppStunMessage QXmppStunTransaction::response() const
 
 void QXmppStunTransaction::retry()
 {
-    if (m_tries >= STUN_RTO_MAX) {
+    if (m_reliable || m_tries >= STUN_RTO_MAX) {
         m_response.setType(QXmppStunMessage::Error);
         m_response.errorPhrase = QLatin1String("Request timed out");
         emit finished();
@@ -1135,16 +1262,32 @@ void QXmppStunTransaction::retry()
     m_retryTimer->start(2 * m_retryTimer->interval());
 }
 
+QXmppTurnAllocation::AddressKey::AddressKey(const QHostAddress &host, quint16 port)
+    : address(rawAddress(host)),
+    port(port)
+{
+}
+
+bool QXmppTurnAllocation::AddressKey::operator==(const AddressKey &other) const
+{
+    return port == other.port &&
+           !memcmp(&address, &other.address, sizeof(address));
+}
+
 /// Constructs a new QXmppTurnAllocation.
 ///
 /// \param parent
 
 QXmppTurnAllocation::QXmppTurnAllocation(QObject *parent)
     : QXmppLoggable(parent),
+    m_streamSocket(0),
+    m_streamReader(new QXmppTurnStreamReader),
+    m_transport(UdpTransport),
     m_relayedPort(0),
     m_turnPort(0),
     m_channelNumber(0x4000),
     m_lifetime(600),
+    m_integrity(new QXmppHmacSha1),
     m_state(UnconnectedState)
 {
     bool check;
@@ -1175,30 +1318,79 @@ QXmppTurnAllocation::~QXmppTurnAllocation()
 {
     if (m_state == ConnectedState)
         disconnectFromHost();
+    delete m_integrity;
+    delete m_streamReader;
 }
 
 /// Allocates the TURN allocation.
 
 void QXmppTurnAllocation::connectToHost()
 {
+    bool check;
+    Q_UNUSED(check);
+
     if (m_state != UnconnectedState)
         return;
 
-    // start listening for UDP
-    if (socket->state() == QAbstractSocket::UnconnectedState) {
-        if (!socket->bind()) {
-            warning("Could not start listening for TURN");
-            return;
+    if (m_transport == UdpTransport) {
+        // start listening for UDP
+        if (socket->state() == QAbstractSocket::UnconnectedState) {
+            if (!socket->bind()) {
+                warning("Could not start listening for TURN");
+                return;
+            }
         }
+        sendAllocate();
+        return;
     }
 
+    // connect to the server over TCP or TLS
+    if (!m_streamSocket) {
+        if (m_transport == TlsTransport) {
+            // wait for the TLS handshake before sending the first request
+            m_streamSocket = new QSslSocket(this);
+            check = connect(m_streamSocket, SIGNAL(encrypted()),
+                            this, SLOT(streamConnected()));
+            Q_ASSERT(check);
+            check = connect(m_streamSocket, SIGNAL(sslErrors(QList<QSslError>)),
+                            this, SLOT(streamSslErrors(QList<QSslError>)));
+            Q_ASSERT(check);
+        } else {
+            m_streamSocket = new QTcpSocket(this);
+            check = connect(m_streamSocket, SIGNAL(connected()),
+                            this, SLOT(streamConnected()));
+            Q_ASSERT(check);
+        }
+        check = connect(m_streamSocket, SIGNAL(disconnected()),
+                        this, SLOT(streamDisconnected()));
+        Q_ASSERT(check);
+        check = connect(m_streamSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+                        this, SLOT(streamDisconnected()));
+        Q_ASSERT(check);
+        check = connect(m_streamSocket, SIGNAL(readyRead()),
+                        this, SLOT(streamReadyRead()));
+        Q_ASSERT(check);
+    }
+    m_streamReader->clear();
+    setState(ConnectingState);
+    if (m_transport == TlsTransport) {
+        // the server certificate is verified against the configured name,
+        // falling back to the address if no name was given
+        const QString name = m_turnName.isEmpty() ? m_turnHost.toString() : m_turnName;
+        static_cast<QSslSocket*>(m_streamSocket)->connectToHostEncrypted(m_turnHost.toString(), m_turnPort, name);
+    } else
+        m_streamSocket->connectToHost(m_turnHost, m_turnPort);
+}
+
+void QXmppTurnAllocation::sendAllocate()
+{
     // send allocate request
     QXmppStunMessage request;
     request.setType(QXmppStunMessage::Allocate | QXmppStunMessage::Request);
     request.setId(QXmppUtils::generateRandomBytes(12));
     request.setLifetime(m_lifetime);
     request.setRequestedTransport(0x11);
-    m_transactions << new QXmppStunTransaction(request, this);
+    m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
 
     // update state
     setState(ConnectingState);
@@ -1213,6 +1405,7 @@ void QXmppTurnAllocation::disconnectFromHost()
 
     // clear channels and any outstanding transactions
     m_channels.clear();
+    m_channelsByAddress.clear();
     foreach (QXmppStunTransaction *transaction, m_transactions)
         delete transaction;
     m_transactions.clear();
@@ -1226,11 +1419,15 @@ void QXmppTurnAllocation::disconnectFromHost()
         request.setRealm(m_realm);
         request.setUsername(m_username);
         request.setLifetime(0);
-        m_transactions << new QXmppStunTransaction(request, this);
+        m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
 
         setState(ClosingState);
     } else {
         setState(UnconnectedState);
+
+        // give up on a pending connection to the server
+        if (m_streamSocket)
+            m_streamSocket->abort();
     }
 }
 
@@ -1247,18 +1444,66 @@ void QXmppTurnAllocation::readyRead()
     }
 }
 
-void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
+void QXmppTurnAllocation::streamConnected()
+{
+    if (m_state == ConnectingState)
+        sendAllocate();
+}
+
+void QXmppTurnAllocation::streamDisconnected()
+{
+    if (m_state == UnconnectedState)
+        return;
+
+    if (m_state != ClosingState)
+        warning("Lost connection to TURN server");
+    m_channelTimer->stop();
+    m_channels.clear();
+    m_channelsByAddress.clear();
+    foreach (QXmppStunTransaction *transaction, m_transactions)
+        delete transaction;
+    m_transactions.clear();
+    setState(UnconnectedState);
+}
+
+/// Reads STUN messages and ChannelData frames from the TCP or TLS
+/// connection.
+
+void QXmppTurnAllocation::streamReadyRead()
+{
+    if (m_streamReader->readFrom(m_streamSocket) <= 0)
+        return;
+
+    QByteArray frame;
+    while (m_streamReader->readFrame(frame)) {
+        handleDatagram(frame, m_turnHost, m_turnPort);
+
+        // the connection may have been closed while handling the frame
+        if (m_state == UnconnectedState)
+            return;
+    }
+}
+
+void QXmppTurnAllocation::streamSslErrors(const QList<QSslError> &errors)
+{
+    // the errors are not ignored, so the connection is aborted and
+    // streamDisconnected() is called
+    foreach (const QSslError &error, errors)
+        warning(QString("TURN server certificate error: %1").arg(error.errorString()));
+}
+
+void QXmppTurnAllocation::handleDatagram(QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
 {
     // demultiplex channel data
     if (buffer.size() >= 4 && (buffer[0] & 0xc0) == 0x40) {
-        QDataStream stream(buffer);
-        quint16 channel, length;
-        stream >> channel;
-        stream >> length;
-        if (m_state == ConnectedState && m_channels.contains(channel) && length <= buffer.size() - 4) {
-            emit datagramReceived(buffer.mid(4, length), m_channels[channel].first,
-                m_channels[channel].second);
-        }
+        const uchar *header = reinterpret_cast<const uchar*>(buffer.constData());
+        const quint16 channel = qFromBigEndian<quint16>(header);
+        const quint16 length = qFromBigEndian<quint16>(header + 2);
+        if (m_state != ConnectedState || length > buffer.size() - 4)
+            return;
+        QHash<quint16, Address>::const_iterator it = m_channels.constFind(channel);
+        if (it != m_channels.constEnd())
+            emit datagramReceived(buffer.mid(4, length), it.value().first, it.value().second);
         return;
     }
 
@@ -1298,7 +1543,7 @@ void QXmppTurnAllocation::refresh()
     request.setNonce(m_nonce);
     request.setRealm(m_realm);
     request.setUsername(m_username);
-    m_transactions << new QXmppStunTransaction(request, this);
+    m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
 }
 
 /// Refresh channel bindings.
@@ -1315,7 +1560,7 @@ void QXmppTurnAllocation::refreshChannels()
         request.setChannelNumber(channel);
         request.xorPeerHost = m_channels[channel].first;
         request.xorPeerPort = m_channels[channel].second;
-        m_transactions << new QXmppStunTransaction(request, this);
+        m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
     }
 }
 
@@ -1355,6 +1600,26 @@ void QXmppTurnAllocation::setServer(const QHostAddress &host, quint16 port)
     m_turnPort = port;
 }
 
+/// Returns the name used to verify the TURN server's certificate.
+
+QString QXmppTurnAllocation::serverName() const
+{
+    return m_turnName;
+}
+
+/// Sets the name used to verify the TURN server's certificate when using
+/// TlsTransport. If no name is set, the server's address is used.
+///
+/// The certificate is checked against the default CA certificates, which
+/// can be changed using QSslSocket::setDefaultCaCertificates().
+///
+/// \param name
+
+void QXmppTurnAllocation::setServerName(const QString &name)
+{
+    m_turnName = name;
+}
+
 /// Sets the \a user used for authentication with the TURN server.
 ///
 /// \param user
@@ -1364,6 +1629,25 @@ void QXmppTurnAllocation::setUser(const QString &user)
     m_username = user;
 }
 
+/// Returns the transport used to reach the TURN server.
+
+QXmppTurnAllocation::Transport QXmppTurnAllocation::transport() const
+{
+    return m_transport;
+}
+
+/// Sets the transport used to reach the TURN server.
+///
+/// Using TCP or TLS allows relaying media when UDP is blocked, the relayed
+/// address allocated on the server is always UDP.
+///
+/// \param transport
+
+void QXmppTurnAllocation::setTransport(Transport transport)
+{
+    m_transport = transport;
+}
+
 /// Returns the current state of the allocation.
 ///
 
@@ -1381,6 +1665,8 @@ void QXmppTurnAllocation::setState(AllocationState state)
         emit connected();
     } else if (m_state == UnconnectedState) {
         m_timer->stop();
+        if (m_streamSocket)
+            m_streamSocket->disconnectFromHost();
         emit disconnected();
     }
 }
@@ -1395,8 +1681,9 @@ void QXmppTurnAllocation::transactionFinished()
     // handle authentication
     const QXmppStunMessage reply = transaction->response();
     if (reply.messageClass() == QXmppStunMessage::Error &&
-        reply.errorCode == 401 &&
-        (reply.nonce() != m_nonce && reply.realm() != m_realm))
+        ((reply.errorCode == 401 &&
+          reply.nonce() != m_nonce && reply.realm() != m_realm) ||
+         (reply.errorCode == 438 && !reply.nonce().isEmpty())))
     {
         // update long-term credentials
         m_nonce = reply.nonce();
@@ -1404,6 +1691,7 @@ void QXmppTurnAllocation::transactionFinished()
         QCryptographicHash hash(QCryptographicHash::Md5);
         hash.addData((m_username + ":" + m_realm + ":" + m_password).toUtf8());
         m_key = hash.result();
+        *m_integrity = QXmppHmacSha1(m_key);
 
         // retry request
         QXmppStunMessage request(transaction->request());
@@ -1411,7 +1699,7 @@ void QXmppTurnAllocation::transactionFinished()
         request.setNonce(m_nonce);
         request.setRealm(m_realm);
         request.setUsername(m_username);
-        m_transactions << new QXmppStunTransaction(request, this);
+        m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
         return;
     }
 
@@ -1449,7 +1737,9 @@ void QXmppTurnAllocation::transactionFinished()
                 QString::number(reply.errorCode), reply.errorPhrase));
 
             // remove channel
-            m_channels.remove(transaction->request().channelNumber());
+            const quint16 channel = transaction->request().channelNumber();
+            const Address addr = m_channels.take(channel);
+            m_channelsByAddress.remove(AddressKey(addr.first, addr.second));
             if (m_channels.isEmpty())
                 m_channelTimer->stop();
             return;
@@ -1481,12 +1771,13 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
     if (m_state != ConnectedState)
         return -1;
 
-    const Address addr = qMakePair(host, port);
-    quint16 channel = m_channels.key(addr);
+    const AddressKey key(host, port);
+    quint16 channel = m_channelsByAddress.value(key);
 
     if (!channel) {
         channel = m_channelNumber++;
-        m_channels.insert(channel, addr);
+        m_channels.insert(channel, qMakePair(host, port));
+        m_channelsByAddress.insert(key, channel);
 
         // bind channel
         QXmppStunMessage request;
@@ -1498,29 +1789,41 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
         request.setChannelNumber(channel);
         request.xorPeerHost = host;
         request.xorPeerPort = port;
-        m_transactions << new QXmppStunTransaction(request, this);
+        m_transactions << new QXmppStunTransaction(request, this, m_transport != UdpTransport);
 
         // schedule refresh
         if (!m_channelTimer->isActive())
             m_channelTimer->start();
     }
 
-    // send data
-    QByteArray channelData;
-    channelData.reserve(4 + data.size());
-    QDataStream stream(&channelData, QIODevice::WriteOnly);
-    stream << channel;
-    stream << quint16(data.size());
-    stream.writeRawData(data.data(), data.size());
-    if (socket->writeDatagram(channelData, m_turnHost, m_turnPort) == channelData.size())
+    // send data, the ChannelData buffer is reused for every datagram and
+    // padded to a multiple of 4 bytes over TCP and TLS
+    const int size = (m_transport == UdpTransport) ? 4 + data.size() : 4 + ((data.size() + 3) & ~3);
+    m_channelBuffer.resize(size);
+    uchar *header = reinterpret_cast<uchar*>(m_channelBuffer.data());
+    qToBigEndian(channel, header);
+    qToBigEndian(quint16(data.size()), header + 2);
+    memcpy(m_channelBuffer.data() + 4, data.constData(), data.size());
+    memset(m_channelBuffer.data() + 4 + data.size(), 0, size - 4 - data.size());
+    if (writePacket(m_channelBuffer) == m_channelBuffer.size())
         return data.size();
     else
         return -1;
 }
 
+qint64 QXmppTurnAllocation::writePacket(const QByteArray &packet)
+{
+    if (m_transport == UdpTransport)
+        return socket->writeDatagram(packet, m_turnHost, m_turnPort);
+    else if (m_streamSocket)
+        return m_streamSocket->write(packet);
+    else
+        return -1;
+}
+
 void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 {
-    socket->writeDatagram(message.encode(m_key), m_turnHost, m_turnPort);
+    writePacket(QXmppStunCodec::encode(message, m_key.isEmpty() ? 0 : m_integrity));
 #ifdef QXMPP_DEBUG_STUN
     logSent(QString("TURN packet to %1 port %2\n%3").arg(
             m_turnHost.toString(),
@@ -1531,11 +1834,14 @@ void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 
 QXmppIceComponent::Pair::Pair(int component, bool controlling)
     : checked(QIODevice::NotOpen),
+    state(WaitingState),
+    nominating(false),
+    nominated(false),
+    tries(0),
     socket(0),
     m_component(component),
     m_controlling(controlling)
 {
-    transaction = QXmppUtils::generateRandomBytes(ID_SIZE);
 }
 
 quint64 QXmppIceComponent::Pair::priority() const
@@ -1563,6 +1869,20 @@ QString QXmppIceComponent::Pair::toString() const
     return str;
 }
 
+QXmppIceComponent::PairKey::PairKey(const QHostAddress &host, quint16 port, QUdpSocket *socket)
+    : address(rawAddress(host)),
+    port(port),
+    socket(socket)
+{
+}
+
+bool QXmppIceComponent::PairKey::operator==(const PairKey &other) const
+{
+    return port == other.port &&
+           socket == other.socket &&
+           !memcmp(&address, &other.address, sizeof(address));
+}
+
 /// Constructs a new QXmppIceComponent.
 ///
 /// \param parent
@@ -1573,7 +1893,11 @@ QXmppIceComponent::QXmppIceComponent(QObject *parent)
     m_activePair(0),
     m_fallbackPair(0),
     m_iceControlling(false),
+    m_aggressiveNomination(true),
+    m_checking(false),
+    m_nominatedPair(0),
     m_peerReflexivePriority(0),
+    m_multiplexer(0),
     m_stunPort(0),
     m_stunTries(0),
     m_turnConfigured(false)
@@ -1582,10 +1906,13 @@ QXmppIceComponent::QXmppIceComponent(QObject *parent)
     Q_UNUSED(check);
 
     m_localUser = QXmppUtils::generateStanzaHash(4);
-    m_localPassword = QXmppUtils::generateStanzaHash(22);
+    m_localPassword = QXmppUtils::generateStanzaHash(22).toUtf8();
+    m_localIntegrity = new QXmppHmacSha1(m_localPassword);
+    m_remoteIntegrity = new QXmppHmacSha1;
+    m_udp = new QXmppUdpBatch;
 
     m_timer = new QTimer(this);
-    m_timer->setInterval(500);
+    m_timer->setInterval(ICE_PACING_INTERVAL);
     check = connect(m_timer, SIGNAL(timeout()),
                     this, SLOT(checkCandidates()));
     Q_ASSERT(check);
@@ -1609,8 +1936,13 @@ QXmppIceComponent::QXmppIceComponent(QObject *parent)
 
 QXmppIceComponent::~QXmppIceComponent()
 {
+    if (m_multiplexer)
+        m_multiplexer->removeComponent(this);
     foreach (Pair *pair, m_pairs)
         delete pair;
+    delete m_localIntegrity;
+    delete m_remoteIntegrity;
+    delete m_udp;
 }
 
 /// Returns the component id for the current socket, e.g. 1 for RTP
@@ -1640,30 +1972,167 @@ void QXmppIceComponent::setComponent(int component)
     setObjectName(QString("STUN(%1)").arg(QString::number(m_component)));
 }
 
+/// Performs the next connectivity check, this is called every Ta.
+///
+/// See RFC 5245 - 5.8. Scheduling Checks
+
 void QXmppIceComponent::checkCandidates()
 {
-    debug("Checking remote candidates");
-    foreach (Pair *pair, m_pairs)
-    {
-        if (m_remoteUser.isEmpty())
-            continue;
+    if (m_remoteUser.isEmpty())
+        return;
 
-        // send a binding request
-        QXmppStunMessage message;
-        message.setId(pair->transaction);
-        message.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
-        message.setPriority(m_peerReflexivePriority);
-        message.setUsername(QString("%1:%2").arg(m_remoteUser, m_localUser));
-        if (m_iceControlling)
-        {
-            message.iceControlling = QByteArray(8, 0);
-            message.useCandidate = true;
-        } else {
-            message.iceControlled = QByteArray(8, 0);
+    // triggered checks come first
+    Pair *pair = 0;
+    if (!m_triggeredPairs.isEmpty())
+        pair = m_triggeredPairs.takeFirst();
+
+    // then the highest priority waiting pair, then the highest priority
+    // frozen pair, the check list being sorted by priority
+    if (!pair) {
+        foreach (Pair *ptr, m_pairs) {
+            if (ptr->state == Pair::WaitingState) {
+                pair = ptr;
+                break;
+            }
         }
-        writeStun(message, pair);
     }
+    if (!pair) {
+        foreach (Pair *ptr, m_pairs) {
+            if (ptr->state == Pair::FrozenState) {
+                pair = ptr;
+                break;
+            }
+        }
+    }
+
+    // then retransmit checks which did not get a response
+    bool pending = false;
+    bool retransmit = false;
+    if (!pair) {
+        foreach (Pair *ptr, m_pairs) {
+            if (ptr->state != Pair::InProgressState)
+                continue;
+            if (ptr->tries >= STUN_RTO_MAX) {
+                debug(QString("ICE check failed %1").arg(ptr->toString()));
+                ptr->state = Pair::FailedState;
+
+                // the nominating check failed, nominate another pair
+                if (ptr == m_nominatedPair) {
+                    ptr->nominating = false;
+                    m_nominatedPair = 0;
+                }
+                continue;
+            }
+            pending = true;
+            if (!pair && ptr->lastCheck.elapsed() >= (STUN_RTO_INTERVAL << (ptr->tries - 1))) {
+                pair = ptr;
+                retransmit = true;
+            }
+        }
+    }
+
+    // once all checks have completed, nominate a pair
+    if (!pair && !pending)
+        pair = nominatePair();
+
+    if (pair)
+        sendCheck(pair, retransmit);
+    else if (!pending)
+        m_timer->stop();
+}
+
+/// Selects the pair to nominate when using regular nomination, that is the
+/// highest priority valid pair provided no better pair is still being
+/// checked. Returns the pair if it needs to be checked again with the
+/// USE-CANDIDATE attribute.
+///
+/// See RFC 5245 - 8.1.1.1. Regular Nomination
+
+QXmppIceComponent::Pair *QXmppIceComponent::nominatePair()
+{
+    if (!m_iceControlling || m_aggressiveNomination || m_nominatedPair)
+        return 0;
+
+    foreach (Pair *pair, m_pairs) {
+        if (pair->state == Pair::SucceededState) {
+            debug(QString("ICE nominating pair %1").arg(pair->toString()));
+            m_nominatedPair = pair;
+            m_triggeredPairs.removeAll(pair);
+            pair->state = Pair::WaitingState;
+            return pair;
+        } else if (pair->state != Pair::FailedState) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/// Sends a connectivity check for the given pair.
+///
+/// Every new check uses a new transaction, which replaces any check still
+/// in progress for the pair, so that a response can only be matched to the
+/// request it answers. Retransmissions reuse the current transaction.
+
+void QXmppIceComponent::sendCheck(Pair *pair, bool retransmit)
+{
+    if (!retransmit) {
+        if (!pair->transaction.isEmpty()) {
+            m_pairsByTransaction.remove(pair->transaction);
+            if (m_multiplexer)
+                m_multiplexer->removeTransaction(pair->transaction);
+        }
+        pair->transaction = QXmppUtils::generateRandomBytes(ID_SIZE);
+        m_pairsByTransaction.insert(pair->transaction, pair);
+        if (m_multiplexer && pair->socket)
+            m_multiplexer->addTransaction(pair->transaction, this);
+
+        pair->nominating = m_iceControlling && (m_aggressiveNomination || pair == m_nominatedPair);
+        pair->state = Pair::InProgressState;
+        pair->tries = 0;
+    }
+
+    QXmppStunMessage message;
+    message.setId(pair->transaction);
+    message.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+    message.setPriority(m_peerReflexivePriority);
+    message.setUsername(QString("%1:%2").arg(m_remoteUser, m_localUser));
+    if (m_iceControlling)
+    {
+        message.iceControlling = QByteArray(8, 0);
+        message.useCandidate = pair->nominating;
+    } else {
+        message.iceControlled = QByteArray(8, 0);
+    }
+    writeStun(message, pair);
+
+    pair->tries++;
+    pair->lastCheck.start();
+}
+
+/// Schedules a triggered check for the given pair, in response to a
+/// connectivity check from the remote party.
+
+void QXmppIceComponent::triggerCheck(Pair *pair)
+{
+    if (pair->state == Pair::SucceededState || m_triggeredPairs.contains(pair))
+        return;
+
+    if (pair->state != Pair::InProgressState)
+        pair->state = Pair::WaitingState;
+    m_triggeredPairs << pair;
+    if (m_checking && !m_timer->isActive())
+        m_timer->start();
+}
 
+/// Unfreezes the pairs which share the given foundation, following a
+/// successful check.
+
+void QXmppIceComponent::unfreezePairs(const QString &foundation)
+{
+    foreach (Pair *pair, m_pairs) {
+        if (pair->state == Pair::FrozenState && pair->foundation == foundation)
+            pair->state = Pair::WaitingState;
+    }
 }
 
 void QXmppIceComponent::checkStun()
@@ -1692,12 +2161,18 @@ void QXmppIceComponent::checkStun()
 
 void QXmppIceComponent::close()
 {
-    foreach (QUdpSocket *socket, m_sockets)
-        socket->close();
+    if (!m_multiplexer) {
+        foreach (QUdpSocket *socket, m_sockets)
+            socket->close();
+    }
     m_turnAllocation->disconnectFromHost();
     m_timer->stop();
     m_stunTimer->stop();
     m_activePair = 0;
+    m_checking = false;
+    m_nominatedPair = 0;
+    m_triggeredPairs.clear();
+    m_udp->clearQueue();
 }
 
 /// Starts ICE connectivity checks.
@@ -1707,6 +2182,7 @@ void QXmppIceComponent::connectToHost()
     if (m_activePair)
         return;
 
+    m_checking = true;
     checkCandidates();
     m_timer->start();
 }
@@ -1725,6 +2201,20 @@ void QXmppIceComponent::setIceControlling(bool controlling)
     m_iceControlling = controlling;
 }
 
+/// Sets whether the controlling agent uses aggressive nomination, that is
+/// whether it includes the USE-CANDIDATE attribute in every check. This is
+/// the default.
+///
+/// With regular nomination, the controlling agent lets the checks complete
+/// and then nominates the highest priority valid pair.
+///
+/// \param aggressive
+
+void QXmppIceComponent::setAggressiveNomination(bool aggressive)
+{
+    m_aggressiveNomination = aggressive;
+}
+
 /// Returns the list of local candidates.
 
 QList<QXmppJingleCandidate> QXmppIceComponent::localCandidates() const
@@ -1738,7 +2228,10 @@ QList<QXmppJingleCandidate> QXmppIceComponent::localCandidates() const
 
 void QXmppIceComponent::setLocalUser(const QString &user)
 {
+    const QString oldUser = m_localUser;
     m_localUser = user;
+    if (m_multiplexer)
+        m_multiplexer->setLocalUser(this, oldUser);
 }
 
 /// Sets the local password.
@@ -1747,7 +2240,8 @@ void QXmppIceComponent::setLocalUser(const QString &user)
 
 void QXmppIceComponent::setLocalPassword(const QString &password)
 {
-    m_localPassword = password;
+    m_localPassword = password.toUtf8();
+    *m_localIntegrity = QXmppHmacSha1(m_localPassword);
 }
 
 /// Adds a remote STUN candidate.
@@ -1784,7 +2278,7 @@ bool QXmppIceComponent::addRemoteCandidate(const QXmppJingleCandidate &candidate
             pair->remote.setHost(remoteHost);
         }
         pair->socket = socket;
-        m_pairs << pair;
+        addPair(pair);
 
         if (!m_fallbackPair)
             m_fallbackPair = pair;
@@ -1795,20 +2289,56 @@ bool QXmppIceComponent::addRemoteCandidate(const QXmppJingleCandidate &candidate
         Pair *pair = new Pair(m_component, m_iceControlling);
         pair->remote = candidate;
         pair->socket = 0;
-        m_pairs << pair;
+        addPair(pair);
     }
     return true;
 }
 
+/// Inserts a pair into the check list, which is kept sorted by
+/// decreasing priority.
+///
+/// See RFC 5245 - 5.7.4. Computing States
+
+void QXmppIceComponent::addPair(Pair *pair)
+{
+    const int localFoundation = pair->socket ? m_sockets.indexOf(pair->socket) : m_sockets.size();
+    pair->foundation = QString("%1:%2").arg(
+        QString::number(localFoundation),
+        QString::number(pair->remote.foundation()));
+
+    // only one pair per foundation is checked at first, the others are
+    // unfrozen when its check succeeds
+    pair->state = Pair::WaitingState;
+    foreach (Pair *other, m_pairs) {
+        if (other->foundation == pair->foundation &&
+            other->state != Pair::SucceededState &&
+            other->state != Pair::FailedState) {
+            pair->state = Pair::FrozenState;
+            break;
+        }
+    }
+
+    const quint64 priority = pair->priority();
+    int i = 0;
+    while (i < m_pairs.size() && m_pairs[i]->priority() >= priority)
+        i++;
+    m_pairs.insert(i, pair);
+    m_pairsByAddress.insert(PairKey(pair->remote.host(), pair->remote.port(), pair->socket), pair);
+
+    if (m_multiplexer && pair->socket)
+        m_multiplexer->addRemoteAddress(pair->remote.host(), pair->remote.port(), pair->socket, this);
+
+    if (m_checking && !m_activePair && !m_timer->isActive())
+        m_timer->start();
+}
+
 /// Adds a discovered peer-reflexive STUN candidate.
 
 QXmppIceComponent::Pair *QXmppIceComponent::addRemoteCandidate(QUdpSocket *socket, const QHostAddress &host, quint16 port, quint32 priority)
 {
-    foreach (Pair *pair, m_pairs)
-        if (pair->remote.host() == host &&
-            pair->remote.port() == port &&
-            pair->socket == socket)
-            return pair;
+    Pair *existing = m_pairsByAddress.value(PairKey(host, port, socket));
+    if (existing)
+        return existing;
 
     QXmppJingleCandidate candidate;
     candidate.setComponent(m_component);
@@ -1822,7 +2352,7 @@ QXmppIceComponent::Pair *QXmppIceComponent::addRemoteCandidate(QUdpSocket *socke
     Pair *pair = new Pair(m_component, m_iceControlling);
     pair->remote = candidate;
     pair->socket = socket;
-    m_pairs << pair;
+    addPair(pair);
 
     debug(QString("Added candidate %1").arg(pair->toString()));
     return pair;
@@ -1843,7 +2373,8 @@ void QXmppIceComponent::setRemoteUser(const QString &user)
 
 void QXmppIceComponent::setRemotePassword(const QString &password)
 {
-    m_remotePassword = password;
+    m_remotePassword = password.toUtf8();
+    *m_remoteIntegrity = QXmppHmacSha1(m_remotePassword);
 }
 
 /// Sets the list of sockets to use for this component.
@@ -1854,17 +2385,55 @@ void QXmppIceComponent::setSockets(QList<QUdpSocket*> sockets)
 {
     // clear previous candidates and sockets
     m_localCandidates.clear();
-    foreach (QUdpSocket *socket, m_sockets)
-        delete socket;
+    m_udp->clearQueue();
+    if (m_multiplexer) {
+        m_multiplexer->removeComponent(this);
+        m_multiplexer = 0;
+    } else {
+        foreach (QUdpSocket *socket, m_sockets)
+            delete socket;
+    }
     m_sockets.clear();
 
-    // store candidates
-    int foundation = 0;
     foreach (QUdpSocket *socket, sockets)
     {
         socket->setParent(this);
         connect(socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    }
+    addHostCandidates(sockets);
+}
 
+/// Sets the multiplexer whose sockets are used by this component.
+///
+/// The sockets remain owned by the multiplexer, which dispatches incoming
+/// datagrams to this component.
+///
+/// \param multiplexer
+
+void QXmppIceComponent::setMultiplexer(QXmppIceMultiplexer *multiplexer)
+{
+    // clear previous candidates and sockets
+    m_localCandidates.clear();
+    m_udp->clearQueue();
+    if (m_multiplexer) {
+        m_multiplexer->removeComponent(this);
+    } else {
+        foreach (QUdpSocket *socket, m_sockets)
+            delete socket;
+    }
+    m_sockets.clear();
+
+    m_multiplexer = multiplexer;
+    m_multiplexer->addComponent(this);
+    addHostCandidates(m_multiplexer->sockets());
+}
+
+void QXmppIceComponent::addHostCandidates(const QList<QUdpSocket*> &sockets)
+{
+    // store candidates
+    int foundation = 0;
+    foreach (QUdpSocket *socket, sockets)
+    {
         QXmppJingleCandidate candidate;
         candidate.setComponent(m_component);
         candidate.setFoundation(foundation++);
@@ -1908,16 +2477,22 @@ void QXmppIceComponent::setStunServer(const QHostAddress &host, quint16 port)
     m_stunHost = host;
     m_stunPort = port;
     m_stunId = QXmppUtils::generateRandomBytes(ID_SIZE);
+    if (m_multiplexer)
+        m_multiplexer->addTransaction(m_stunId, this);
 }
 
 /// Sets the TURN server to use to relay packets in double-NAT configurations.
 ///
 /// \param host The address of the TURN server.
 /// \param port The port of the TURN server.
+/// \param transport The transport used to reach the TURN server.
+/// \param name The name used to verify the TURN server's certificate.
 
-void QXmppIceComponent::setTurnServer(const QHostAddress &host, quint16 port)
+void QXmppIceComponent::setTurnServer(const QHostAddress &host, quint16 port, QXmppTurnAllocation::Transport transport, const QString &name)
 {
     m_turnAllocation->setServer(host, port);
+    m_turnAllocation->setServerName(name);
+    m_turnAllocation->setTransport(transport);
     m_turnConfigured = !host.isNull() && port;
 }
 
@@ -1945,17 +2520,19 @@ void QXmppIceComponent::readyRead()
     if (!socket)
         return;
 
-    QByteArray buffer;
-    QHostAddress remoteHost;
-    quint16 remotePort;
-    while (socket->hasPendingDatagrams()) {
-        const qint64 size = socket->pendingDatagramSize();
-        buffer.resize(size);
-        socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        handleDatagram(buffer, remoteHost, remotePort, socket);
+    while (m_udp->readDatagrams(socket)) {
+        foreach (const QXmppUdpDatagram &datagram, m_udp->datagrams())
+            handleDatagram(datagram.data, datagram.host, datagram.port, socket);
     }
 }
 
+/// Sends the queued outgoing datagrams.
+
+void QXmppIceComponent::flushDatagrams()
+{
+    m_udp->flush();
+}
+
 void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort, QUdpSocket *socket)
 {
     // if this is not a STUN message, emit it
@@ -1965,30 +2542,34 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     if (!messageType || messageCookie != STUN_MAGIC)
     {
         // use this as an opportunity to flag a potential pair
-        foreach (Pair *pair, m_pairs) {
-            if (pair->remote.host() == remoteHost &&
-                pair->remote.port() == remotePort) {
+        if (!m_activePair) {
+            Pair *pair = m_pairsByAddress.value(PairKey(remoteHost, remotePort, socket));
+            if (pair)
                 m_fallbackPair = pair;
-                break;
-            }
         }
-        emit datagramReceived(buffer);
+        // datagrams read from our sockets point into the receive buffer,
+        // which is reused for the next batch
+        if (socket)
+            emit datagramReceived(QByteArray(buffer.constData(), buffer.size()));
+        else
+            emit datagramReceived(buffer);
         return;
     }
 
     // determine password to use
-    QString messagePassword;
+    const QXmppHmacSha1 *integrity = 0;
     if (messageId != m_stunId)
     {
-        messagePassword = (messageType & 0xFF00) ? m_remotePassword : m_localPassword;
-        if (messagePassword.isEmpty())
+        const bool response = (messageType & 0xFF00);
+        if ((response ? m_remotePassword : m_localPassword).isEmpty())
             return;
+        integrity = response ? m_remoteIntegrity : m_localIntegrity;
     }
 
     // parse STUN message
     QXmppStunMessage message;
     QStringList errors;
-    if (!message.decode(buffer, messagePassword.toUtf8(), &errors))
+    if (!QXmppStunCodec::decode(message, buffer, integrity, &errors))
     {
         foreach (const QString &error, errors)
             warning(error);
@@ -2065,35 +2646,26 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         writeStun(response, pair);
 
         // update state
-        if (m_iceControlling || message.useCandidate)
-        {
-            debug(QString("ICE reverse check complete %1").arg(pair->toString()));
-            pair->checked |= QIODevice::ReadOnly;
+        debug(QString("ICE reverse check complete %1").arg(pair->toString()));
+        pair->checked |= QIODevice::ReadOnly;
+
+        // the controlling agent nominated the pair, which takes effect
+        // once our own check for it succeeds
+        //
+        // see RFC 5245 - 7.2.1.5. Updating the Nominated Flag
+        if (!m_iceControlling && message.useCandidate && !pair->nominated) {
+            debug(QString("ICE pair nominated by peer %1").arg(pair->toString()));
+            pair->nominated = true;
         }
 
-        if (!m_iceControlling && !m_activePair && !m_remoteUser.isEmpty())
-        {
-            // send a triggered connectivity test
-            QXmppStunMessage message;
-            message.setId(pair->transaction);
-            message.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
-            message.setPriority(m_peerReflexivePriority);
-            message.setUsername(QString("%1:%2").arg(m_remoteUser, m_localUser));
-            message.iceControlled = QByteArray(8, 0);
-            writeStun(message, pair);
-        }
+        // schedule a triggered connectivity check
+        if (!m_activePair && !m_remoteUser.isEmpty())
+            triggerCheck(pair);
 
     } else if (message.type() == (QXmppStunMessage::Binding | QXmppStunMessage::Response)) {
 
         // find the pair for this transaction
-        foreach (Pair *ptr, m_pairs)
-        {
-            if (ptr->transaction == message.id())
-            {
-                pair = ptr;
-                break;
-            }
-        }
+        pair = m_pairsByTransaction.value(message.id());
         if (!pair)
         {
             debug(QString("Unknown transaction %1").arg(QString::fromAscii(message.id().toHex())));
@@ -2114,10 +2686,21 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         // outgoing media can flow
         debug(QString("ICE forward check complete %1").arg(pair->toString()));
         pair->checked |= QIODevice::WriteOnly;
+        pair->state = Pair::SucceededState;
+        if (pair->nominating)
+            pair->nominated = true;
+        m_triggeredPairs.removeAll(pair);
+        unfreezePairs(pair->foundation);
+
+        // nominate a pair as soon as possible
+        Pair *nominated = nominatePair();
+        if (nominated)
+            triggerCheck(nominated);
     }
 
-    // signal completion
-    if (pair && pair->checked == QIODevice::ReadWrite)
+    // signal completion once a nominated pair has been checked in both
+    // directions
+    if (pair && pair->checked == QIODevice::ReadWrite && pair->nominated)
     {
         m_timer->stop();
         if (!m_activePair || pair->priority() > m_activePair->priority()) {
@@ -2261,8 +2844,20 @@ qint64 QXmppIceComponent::sendDatagram(const QByteArray &datagram)
     Pair *pair = m_activePair ? m_activePair : m_fallbackPair;
     if (!pair)
         return -1;
-    if (pair->socket)
+    if (pair->socket) {
+#ifdef QXMPP_USE_MMSG
+        // queue the datagram, all datagrams sent during this event loop
+        // iteration are written with a single system call
+        if (!m_udp->queuedDatagrams())
+            QMetaObject::invokeMethod(this, "flushDatagrams", Qt::QueuedConnection);
+        m_udp->queueDatagram(datagram, pair->remote.host(), pair->remote.port(), pair->socket);
+        if (m_udp->queuedDatagrams() >= UDP_BATCH_SIZE)
+            flushDatagrams();
+        return datagram.size();
+#else
         return pair->socket->writeDatagram(datagram, pair->remote.host(), pair->remote.port());
+#endif
+    }
     else if (m_turnAllocation->state() == QXmppTurnAllocation::ConnectedState)
         return m_turnAllocation->writeDatagram(datagram, pair->remote.host(), pair->remote.port());
     else
@@ -2274,15 +2869,18 @@ qint64 QXmppIceComponent::sendDatagram(const QByteArray &datagram)
 qint64 QXmppIceComponent::writeStun(const QXmppStunMessage &message, QXmppIceComponent::Pair *pair)
 {
     qint64 ret;
-    const QString messagePassword = (message.type() & 0xFF00) ? m_localPassword : m_remotePassword;
+    const bool response = (message.type() & 0xFF00);
+    const QXmppHmacSha1 *integrity = 0;
+    if (!(response ? m_localPassword : m_remotePassword).isEmpty())
+        integrity = response ? m_localIntegrity : m_remoteIntegrity;
     if (pair->socket)
         ret = pair->socket->writeDatagram(
-            message.encode(messagePassword.toUtf8()),
+            QXmppStunCodec::encode(message, integrity),
             pair->remote.host(),
             pair->remote.port());
     else if (m_turnAllocation->state() == QXmppTurnAllocation::ConnectedState)
         ret = m_turnAllocation->writeDatagram(
-            message.encode(messagePassword.toUtf8()),
+            QXmppStunCodec::encode(message, integrity),
             pair->remote.host(),
             pair->remote.port());
     else
@@ -2293,6 +2891,461 @@ qint64 QXmppIceComponent::writeStun(const QXmppStunMessage &message, QXmppIceCom
     return ret;
 }
 
+/// Constructs a new QXmppIceMultiplexer.
+///
+/// \param parent
+
+QXmppIceMultiplexer::QXmppIceMultiplexer(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    m_udp = new QXmppUdpBatch;
+}
+
+/// Destroys the QXmppIceMultiplexer.
+
+QXmppIceMultiplexer::~QXmppIceMultiplexer()
+{
+    foreach (QXmppIceComponent *component, m_components)
+        component->m_multiplexer = 0;
+    delete m_udp;
+}
+
+/// Binds one UDP socket on each of the given \a addresses.
+///
+/// \param addresses The addresses on which to listen.
+/// \param port The port to bind to, if 0 a free port is chosen.
+
+bool QXmppIceMultiplexer::bind(const QList<QHostAddress> &addresses, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QList<QUdpSocket*> sockets;
+    if (port)
+        sockets = reservePort(addresses, port, this);
+    else
+        sockets = QXmppIceComponent::reservePorts(addresses, 1, this);
+    if (sockets.isEmpty() && !addresses.isEmpty())
+        return false;
+
+    foreach (QUdpSocket *socket, sockets) {
+        check = connect(socket, SIGNAL(readyRead()),
+                        this, SLOT(readyRead()));
+        Q_ASSERT(check);
+    }
+    m_sockets += sockets;
+    return true;
+}
+
+/// Returns the sockets shared by the components.
+
+QList<QUdpSocket*> QXmppIceMultiplexer::sockets() const
+{
+    return m_sockets;
+}
+
+void QXmppIceMultiplexer::addComponent(QXmppIceComponent *component)
+{
+    m_components << component;
+    if (!component->m_localUser.isEmpty())
+        m_users.insert(component->m_localUser, component);
+    m_transactions.insert(component->m_stunId, component);
+}
+
+void QXmppIceMultiplexer::removeComponent(QXmppIceComponent *component)
+{
+    m_components.removeAll(component);
+    m_users.remove(component->m_localUser, component);
+
+    QMutableHashIterator<QXmppIceComponent::PairKey, QXmppIceComponent*> ait(m_addresses);
+    while (ait.hasNext()) {
+        if (ait.next().value() == component)
+            ait.remove();
+    }
+    QMutableHashIterator<QByteArray, QXmppIceComponent*> tit(m_transactions);
+    while (tit.hasNext()) {
+        if (tit.next().value() == component)
+            tit.remove();
+    }
+}
+
+void QXmppIceMultiplexer::addRemoteAddress(const QHostAddress &host, quint16 port, QUdpSocket *socket, QXmppIceComponent *component)
+{
+    // the remote address is shared by several components if the remote
+    // party multiplexes them too, so each one keeps its own entry
+    const QXmppIceComponent::PairKey key(host, port, socket);
+    if (!m_addresses.contains(key, component))
+        m_addresses.insert(key, component);
+}
+
+void QXmppIceMultiplexer::addTransaction(const QByteArray &id, QXmppIceComponent *component)
+{
+    m_transactions.insert(id, component);
+}
+
+void QXmppIceMultiplexer::removeTransaction(const QByteArray &id)
+{
+    m_transactions.remove(id);
+}
+
+void QXmppIceMultiplexer::setLocalUser(QXmppIceComponent *component, const QString &oldUser)
+{
+    m_users.remove(oldUser, component);
+    if (!component->m_localUser.isEmpty())
+        m_users.insert(component->m_localUser, component);
+}
+
+void QXmppIceMultiplexer::readyRead()
+{
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (!socket)
+        return;
+
+    while (m_udp->readDatagrams(socket)) {
+        foreach (const QXmppUdpDatagram &datagram, m_udp->datagrams())
+            handleDatagram(datagram.data, datagram.host, datagram.port, socket);
+    }
+}
+
+void QXmppIceMultiplexer::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort, QUdpSocket *socket)
+{
+    const QList<QXmppIceComponent*> addressComponents = m_addresses.values(QXmppIceComponent::PairKey(remoteHost, remotePort, socket));
+    QXmppIceComponent *component = addressComponents.size() == 1 ? addressComponents.first() : 0;
+    quint32 messageCookie;
+    QByteArray messageId;
+    const quint16 messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
+    if (messageType && messageCookie == STUN_MAGIC) {
+        // responses are dispatched by transaction
+        QXmppIceComponent *transactionComponent = m_transactions.value(messageId);
+        if (transactionComponent) {
+            component = transactionComponent;
+        } else if (messageType == (QXmppStunMessage::Binding | QXmppStunMessage::Request)) {
+            // requests are dispatched by USERNAME, then by the remote
+            // address if it is a known candidate
+            QXmppStunMessage message;
+            if (!message.decode(buffer))
+                return;
+            const QString user = message.username().split(QLatin1Char(':')).first();
+            if (!component || component->m_localUser != user) {
+                // the address is not a known candidate, the component ID
+                // is carried by the PRIORITY of the peer-reflexive candidate
+                //
+                // see RFC 5245 - 4.1.2.1. Recommended Formula
+                const QList<QXmppIceComponent*> components = m_users.values(user);
+                const int componentId = 256 - int(message.priority() & 0xff);
+                component = 0;
+                foreach (QXmppIceComponent *ptr, components) {
+                    if (ptr->component() == componentId) {
+                        component = ptr;
+                        break;
+                    }
+                }
+                if (!component && components.size() == 1)
+                    component = components.first();
+            }
+        }
+    } else if (addressComponents.size() > 1) {
+        // the remote party multiplexes RTP and RTCP, tell them apart
+        // using the RTCP packet types
+        //
+        // see RFC 5761 - 4. Distinguishable RTP and RTCP Packets
+        const quint8 packetType = buffer.size() >= 2 ? quint8(buffer.at(1)) : 0;
+        const int componentId = (packetType >= 192 && packetType <= 223) ? 2 : 1;
+        foreach (QXmppIceComponent *ptr, addressComponents) {
+            if (ptr->component() == componentId) {
+                component = ptr;
+                break;
+            }
+        }
+    }
+
+    if (component)
+        component->handleDatagram(buffer, remoteHost, remotePort, socket);
+    else
+        debug(QString("Dropping datagram from unknown host %1 port %2").arg(
+            remoteHost.toString(), QString::number(remotePort)));
+}
+
+/// Encodes the given STUN message, optionally calculating the message
+/// integrity attribute using the given HMAC context, which is not modified.
+///
+/// \param message
+/// \param integrity The HMAC context for the key, or 0 to omit the attribute.
+/// \param addFingerprint
+
+QByteArray QXmppStunCodec::encode(const QXmppStunMessage &message, const QXmppHmacSha1 *integrity, bool addFingerprint)
+{
+    return message.encode(integrity, addFingerprint);
+}
+
+/// Decodes a STUN message and checks its integrity using the given HMAC
+/// context, which is not modified.
+///
+/// \param message
+/// \param buffer
+/// \param integrity The HMAC context for the key, or 0 to skip the check.
+/// \param errors
+
+bool QXmppStunCodec::decode(QXmppStunMessage &message, const QByteArray &buffer, const QXmppHmacSha1 *integrity, QStringList *errors)
+{
+    return message.decode(buffer, integrity, errors);
+}
+
+QXmppUdpBatch::QXmppUdpBatch()
+#ifdef QXMPP_USE_MMSG
+    : m_systemBatching(true)
+#else
+    : m_systemBatching(false)
+#endif
+{
+}
+
+/// Reads a batch of up to UDP_BATCH_SIZE pending datagrams from \a socket.
+///
+/// Returns false if no datagram was read, in which case the socket's read
+/// notifier has been re-enabled and readyRead() will be emitted again once
+/// more datagrams arrive.
+
+bool QXmppUdpBatch::readDatagrams(QUdpSocket *socket)
+{
+    m_received.clear();
+    if (m_buffer.size() != UDP_BATCH_SIZE * UDP_BUFFER_SIZE)
+        m_buffer.resize(UDP_BATCH_SIZE * UDP_BUFFER_SIZE);
+
+    int slot = 0;
+#ifdef QXMPP_USE_MMSG
+    if (m_systemBatching) {
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        struct iovec iovecs[UDP_BATCH_SIZE];
+        struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < UDP_BATCH_SIZE; ++i) {
+            iovecs[i].iov_base = m_buffer.data() + i * UDP_BUFFER_SIZE;
+            iovecs[i].iov_len = UDP_BUFFER_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addresses[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        }
+
+        const int count = recvmmsg(socket->socketDescriptor(), msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, 0);
+        for (int i = 0; i < count; ++i) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                qWarning("QXmppUdpBatch received a truncated datagram");
+                continue;
+            }
+            QXmppUdpDatagram datagram;
+            datagram.data = QByteArray::fromRawData(m_buffer.constData() + i * UDP_BUFFER_SIZE, msgs[i].msg_len);
+            datagram.socket = socket;
+            fromSockAddr(&addresses[i], datagram.host, datagram.port);
+            m_received << datagram;
+        }
+        if (count == UDP_BATCH_SIZE)
+            return true;
+        else if (count < 0 && errno == ENOSYS)
+            m_systemBatching = false;
+
+        // if recvmmsg() is not available, all datagrams are read using
+        // QUdpSocket, otherwise the remaining slots are used to finish
+        slot = qMax(count, 0);
+    }
+#endif
+
+    // QUdpSocket disables its read notifier before emitting readyRead() and
+    // only enables it again from readDatagram(), so the batch always ends
+    // with a call to readDatagram(), unless it is full
+    for (; slot < UDP_BATCH_SIZE; ++slot) {
+        const qint64 pending = socket->pendingDatagramSize();
+        char *data = m_buffer.data() + slot * UDP_BUFFER_SIZE;
+        QXmppUdpDatagram datagram;
+        const qint64 size = socket->readDatagram(data, UDP_BUFFER_SIZE, &datagram.host, &datagram.port);
+        if (size < 0)
+            break;
+        if (pending > UDP_BUFFER_SIZE) {
+            qWarning("QXmppUdpBatch received a truncated datagram");
+            continue;
+        }
+        datagram.data = QByteArray::fromRawData(data, size);
+        datagram.socket = socket;
+        m_received << datagram;
+    }
+    return !m_received.isEmpty() || slot == UDP_BATCH_SIZE;
+}
+
+/// Returns the datagrams read by the last call to readDatagrams().
+
+QList<QXmppUdpDatagram> QXmppUdpBatch::datagrams() const
+{
+    return m_received;
+}
+
+/// Queues a datagram to be sent on the next call to flush().
+
+void QXmppUdpBatch::queueDatagram(const QByteArray &data, const QHostAddress &host, quint16 port, QUdpSocket *socket)
+{
+    QXmppUdpDatagram datagram;
+    datagram.data = data;
+    datagram.host = host;
+    datagram.port = port;
+    datagram.socket = socket;
+    m_queue << datagram;
+}
+
+/// Returns the number of queued datagrams.
+
+int QXmppUdpBatch::queuedDatagrams() const
+{
+    return m_queue.size();
+}
+
+/// Drops the queued datagrams.
+
+void QXmppUdpBatch::clearQueue()
+{
+    m_queue.clear();
+}
+
+/// Sends the queued datagrams, grouped by socket.
+
+void QXmppUdpBatch::flush()
+{
+    QList<QXmppUdpDatagram> batch;
+    while (!m_queue.isEmpty()) {
+        QUdpSocket *socket = m_queue.first().socket;
+        batch.clear();
+        while (!m_queue.isEmpty() && m_queue.first().socket == socket)
+            batch << m_queue.takeFirst();
+        writeDatagrams(batch);
+    }
+}
+
+/// Returns true if datagrams are read and written with a single system
+/// call per batch, which is only supported on Linux.
+
+bool QXmppUdpBatch::isSystemBatchingEnabled() const
+{
+    return m_systemBatching;
+}
+
+/// Sets whether datagrams are read and written with a single system call
+/// per batch. Disabling it makes the batch use the QUdpSocket API.
+///
+/// \param enabled
+
+void QXmppUdpBatch::setSystemBatchingEnabled(bool enabled)
+{
+#ifdef QXMPP_USE_MMSG
+    m_systemBatching = enabled;
+#else
+    Q_UNUSED(enabled);
+#endif
+}
+
+/// Writes the given \a datagrams, which must all use the same socket.
+
+void QXmppUdpBatch::writeDatagrams(const QList<QXmppUdpDatagram> &datagrams)
+{
+    int sent = 0;
+#ifdef QXMPP_USE_MMSG
+    const int fd = datagrams.first().socket->socketDescriptor();
+    while (m_systemBatching && sent < datagrams.size()) {
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        struct iovec iovecs[UDP_BATCH_SIZE];
+        struct sockaddr_storage addresses[UDP_BATCH_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+
+        const int count = qMin(datagrams.size() - sent, UDP_BATCH_SIZE);
+        for (int i = 0; i < count; ++i) {
+            const QXmppUdpDatagram &datagram = datagrams[sent + i];
+            iovecs[i].iov_base = const_cast<char*>(datagram.data.constData());
+            iovecs[i].iov_len = datagram.data.size();
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addresses[i];
+            msgs[i].msg_hdr.msg_namelen = toSockAddr(datagram.host, datagram.port, &addresses[i]);
+        }
+
+        const int ret = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+#endif
+
+    // send the remaining datagrams using QUdpSocket
+    for (int i = sent; i < datagrams.size(); ++i) {
+        const QXmppUdpDatagram &datagram = datagrams[i];
+        datagram.socket->writeDatagram(datagram.data, datagram.host, datagram.port);
+    }
+}
+
+QXmppTurnStreamReader::QXmppTurnStreamReader()
+    : m_pos(0)
+{
+}
+
+/// Appends the data available on the \a device to the receive buffer.
+///
+/// Returns the number of bytes read.
+
+qint64 QXmppTurnStreamReader::readFrom(QIODevice *device)
+{
+    const qint64 available = device->bytesAvailable();
+    if (available <= 0)
+        return 0;
+
+    // drop the frames which were already returned
+    if (m_pos) {
+        m_buffer.remove(0, m_pos);
+        m_pos = 0;
+    }
+
+    const int oldSize = m_buffer.size();
+    m_buffer.resize(oldSize + available);
+    const qint64 read = device->read(m_buffer.data() + oldSize, available);
+    m_buffer.resize(oldSize + qMax(read, qint64(0)));
+    return read;
+}
+
+/// Reads the next complete frame into \a frame.
+///
+/// The frame points into the receive buffer, so it is only valid until the
+/// next call to readFrom() or clear().
+///
+/// Returns false if no complete frame is available.
+
+bool QXmppTurnStreamReader::readFrame(QByteArray &frame)
+{
+    if (m_buffer.size() - m_pos < 4)
+        return false;
+
+    const uchar *header = reinterpret_cast<const uchar*>(m_buffer.constData() + m_pos);
+    const quint16 length = qFromBigEndian<quint16>(header + 2);
+    int frameSize;
+    int dataSize;
+    if ((header[0] & 0xc0) == 0x40) {
+        // ChannelData, padded to a multiple of 4 bytes
+        dataSize = 4 + length;
+        frameSize = 4 + ((length + 3) & ~3);
+    } else {
+        dataSize = frameSize = STUN_HEADER + length;
+    }
+    if (m_buffer.size() - m_pos < frameSize)
+        return false;
+
+    frame = QByteArray::fromRawData(m_buffer.constData() + m_pos, dataSize);
+    m_pos += frameSize;
+    return true;
+}
+
+/// Discards any buffered data.
+
+void QXmppTurnStreamReader::clear()
+{
+    m_buffer.clear();
+    m_pos = 0;
+}
+
 /// Constructs a new ICE connection.
 ///
 /// \param parent
@@ -2300,7 +3353,10 @@ qint64 QXmppIceComponent::writeStun(const QXmppStunMessage &message, QXmppIceCom
 QXmppIceConnection::QXmppIceConnection(QObject *parent)
     : QXmppLoggable(parent),
     m_iceControlling(false),
-    m_stunPort(0)
+    m_aggressiveNomination(true),
+    m_stunPort(0),
+    m_turnPort(0),
+    m_turnTransport(QXmppTurnAllocation::UdpTransport)
 {
     bool check;
 
@@ -2345,10 +3401,11 @@ void QXmppIceConnection::addComponent(int component)
     QXmppIceComponent *socket = new QXmppIceComponent(this);
     socket->setComponent(component);
     socket->setIceControlling(m_iceControlling);
+    socket->setAggressiveNomination(m_aggressiveNomination);
     socket->setLocalUser(m_localUser);
     socket->setLocalPassword(m_localPassword);
     socket->setStunServer(m_stunHost, m_stunPort);
-    socket->setTurnServer(m_turnHost, m_turnPort);
+    socket->setTurnServer(m_turnHost, m_turnPort, m_turnTransport, m_turnName);
     socket->setTurnUser(m_turnUser);
     socket->setTurnPassword(m_turnPassword);
 
@@ -2402,6 +3459,17 @@ bool QXmppIceConnection::bind(const QList<QHostAddress> &addresses)
     return true;
 }
 
+/// Makes the components use the sockets of the given \a multiplexer
+/// instead of binding their own ports.
+///
+/// \param multiplexer
+
+void QXmppIceConnection::bind(QXmppIceMultiplexer *multiplexer)
+{
+    foreach (QXmppIceComponent *socket, m_components.values())
+        socket->setMultiplexer(multiplexer);
+}
+
 /// Closes the ICE connection.
 
 void QXmppIceConnection::close()
@@ -2443,6 +3511,21 @@ void QXmppIceConnection::setIceControlling(bool controlling)
         socket->setIceControlling(controlling);
 }
 
+/// Sets whether the controlling agent uses aggressive nomination, which
+/// is the default, or regular nomination.
+///
+/// Aggressive nomination establishes the connection faster, while regular
+/// nomination guarantees the highest priority working pair is selected.
+///
+/// \param aggressive
+
+void QXmppIceConnection::setAggressiveNomination(bool aggressive)
+{
+    m_aggressiveNomination = aggressive;
+    foreach (QXmppIceComponent *socket, m_components.values())
+        socket->setAggressiveNomination(aggressive);
+}
+
 /// Returns the list of local HOST CANDIDATES candidates by iterating
 /// over the available network interfaces.
 
@@ -2532,13 +3615,17 @@ void QXmppIceConnection::setStunServer(const QHostAddress &host, quint16 port)
 ///
 /// \param host The address of the TURN server.
 /// \param port The port of the TURN server.
+/// \param transport The transport used to reach the TURN server.
+/// \param name The name used to verify the TURN server's certificate.
 
-void QXmppIceConnection::setTurnServer(const QHostAddress &host, quint16 port)
+void QXmppIceConnection::setTurnServer(const QHostAddress &host, quint16 port, QXmppTurnAllocation::Transport transport, const QString &name)
 {
     m_turnHost = host;
     m_turnPort = port;
+    m_turnTransport = transport;
+    m_turnName = name;
     foreach (QXmppIceComponent *socket, m_components.values())
-        socket->setTurnServer(host, port);
+        socket->setTurnServer(host, port, transport, name);
 }
 
 /// Sets the \a user used for authentication with the TURN server.
@@ -24,14 +24,22 @@
 #ifndef QXMPPSTUN_H
 #define QXMPPSTUN_H
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QObject>
 
 #include "QXmppLogger.h"
 #include "QXmppJingleIq.h"
 
 class QDataStream;
+class QSslError;
+class QTcpSocket;
 class QUdpSocket;
 class QTimer;
+class QXmppHmacSha1;
+class QXmppIceMultiplexer;
+class QXmppTurnStreamReader;
+class QXmppUdpBatch;
 
 /// \internal
 ///
@@ -84,6 +92,7 @@ public:
     QByteArray data() const;
     void setData(const QByteArray &data);
 
+    bool hasLifetime() const;
     quint32 lifetime() const;
     void setLifetime(quint32 changeRequest);
 
@@ -108,6 +117,8 @@ public:
     QString username() const;
     void setUsername(const QString &username);
 
+    bool hasMessageIntegrity() const;
+
     QByteArray encode(const QByteArray &key = QByteArray(), bool addFingerprint = true) const;
     bool decode(const QByteArray &buffer, const QByteArray &key = QByteArray(), QStringList *errors = 0);
     QString toString() const;
@@ -135,6 +146,9 @@ public:
     bool useCandidate;
 
 private:
+    QByteArray encode(const QXmppHmacSha1 *integrity, bool addFingerprint) const;
+    bool decode(const QByteArray &buffer, const QXmppHmacSha1 *integrity, QStringList *errors);
+
     quint32 m_cookie;
     QByteArray m_id;
     quint16 m_type;
@@ -152,6 +166,8 @@ private:
     QByteArray m_reservationToken;
     QString m_software;
     QString m_username;
+
+    friend class QXmppStunCodec;
 };
 
 /// \internal
@@ -164,7 +180,7 @@ class QXMPP_EXPORT QXmppStunTransaction : public QXmppLoggable
     Q_OBJECT
 
 public:
-    QXmppStunTransaction(const QXmppStunMessage &request, QObject *parent);
+    QXmppStunTransaction(const QXmppStunMessage &request, QObject *parent, bool reliable = false);
     QXmppStunMessage request() const;
     QXmppStunMessage response() const;
 
@@ -183,6 +199,7 @@ private:
     QXmppStunMessage m_response;
     QTimer *m_retryTimer;
     int m_tries;
+    bool m_reliable;
 };
 
 /// \internal
@@ -204,6 +221,14 @@ public:
         ClosingState,
     };
 
+    /// This enum describes the transport used to reach the TURN server.
+    enum Transport
+    {
+        UdpTransport,   ///< UDP
+        TcpTransport,   ///< TCP
+        TlsTransport,   ///< TLS over TCP
+    };
+
     QXmppTurnAllocation(QObject *parent = 0);
     ~QXmppTurnAllocation();
 
@@ -212,6 +237,10 @@ public:
     AllocationState state() const;
 
     void setServer(const QHostAddress &host, quint16 port = 3478);
+    QString serverName() const;
+    void setServerName(const QString &name);
+    Transport transport() const;
+    void setTransport(Transport transport);
     void setUser(const QString &user);
     void setPassword(const QString &password);
 
@@ -235,14 +264,23 @@ private slots:
     void readyRead();
     void refresh();
     void refreshChannels();
+    void streamConnected();
+    void streamDisconnected();
+    void streamReadyRead();
+    void streamSslErrors(const QList<QSslError> &errors);
     void transactionFinished();
     void writeStun(const QXmppStunMessage &message);
 
 private:
-    void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void handleDatagram(QByteArray &datagram, const QHostAddress &host, quint16 port);
+    void sendAllocate();
     void setState(AllocationState state);
+    qint64 writePacket(const QByteArray &packet);
 
     QUdpSocket *socket;
+    QTcpSocket *m_streamSocket;
+    QXmppTurnStreamReader *m_streamReader;
+    Transport m_transport;
     QTimer *m_timer;
     QTimer *m_channelTimer;
     QString m_password;
@@ -251,15 +289,36 @@ private:
     quint16 m_relayedPort;
     QHostAddress m_turnHost;
     quint16 m_turnPort;
+    QString m_turnName;
 
     // channels
     typedef QPair<QHostAddress, quint16> Address;
+    class AddressKey {
+    public:
+        AddressKey(const QHostAddress &host, quint16 port);
+        bool operator==(const AddressKey &other) const;
+
+        friend uint qHash(const AddressKey &key)
+        {
+            uint h = key.port;
+            for (int i = 0; i < 16; ++i)
+                h = 31 * h + key.address[i];
+            return h;
+        }
+
+    private:
+        Q_IPV6ADDR address;
+        quint16 port;
+    };
     quint16 m_channelNumber;
-    QMap<quint16, Address> m_channels;
+    QHash<quint16, Address> m_channels;
+    QHash<AddressKey, quint16> m_channelsByAddress;
+    QByteArray m_channelBuffer;
 
     // state
     quint32 m_lifetime;
     QByteArray m_key;
+    QXmppHmacSha1 *m_integrity;
     QString m_realm;
     QByteArray m_nonce;
     AllocationState m_state;
@@ -278,8 +337,11 @@ public:
     QXmppIceComponent(QObject *parent=0);
     ~QXmppIceComponent();
     void setIceControlling(bool controlling);
+    void setAggressiveNomination(bool aggressive);
     void setStunServer(const QHostAddress &host, quint16 port);
-    void setTurnServer(const QHostAddress &host, quint16 port);
+    void setTurnServer(const QHostAddress &host, quint16 port,
+                       QXmppTurnAllocation::Transport transport = QXmppTurnAllocation::UdpTransport,
+                       const QString &name = QString());
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
 
@@ -296,6 +358,7 @@ public:
 
     bool isConnected() const;
     void setSockets(QList<QUdpSocket*> sockets);
+    void setMultiplexer(QXmppIceMultiplexer *multiplexer);
 
     static QList<QHostAddress> discoverAddresses();
     static QList<QUdpSocket*> reservePorts(const QList<QHostAddress> &addresses, int count, QObject *parent = 0);
@@ -308,6 +371,7 @@ public slots:
 private slots:
     void checkCandidates();
     void checkStun();
+    void flushDatagrams();
     void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port, QUdpSocket *socket = 0);
     void readyRead();
     void turnConnected();
@@ -325,11 +389,26 @@ signals:
 private:
     class Pair {
     public:
+        // RFC 5245 - 5.7.4. Computing Candidate Pair States
+        enum State {
+            FrozenState,
+            WaitingState,
+            InProgressState,
+            SucceededState,
+            FailedState
+        };
+
         Pair(int component, bool controlling);
         quint64 priority() const;
         QString toString() const;
 
         QIODevice::OpenMode checked;
+        State state;
+        bool nominating;
+        bool nominated;
+        QString foundation;
+        int tries;
+        QElapsedTimer lastCheck;
         QXmppJingleCandidate remote;
         QXmppJingleCandidate reflexive;
         QByteArray transaction;
@@ -340,24 +419,59 @@ private:
         bool m_controlling;
     };
 
+    class PairKey {
+    public:
+        PairKey(const QHostAddress &host, quint16 port, QUdpSocket *socket);
+        bool operator==(const PairKey &other) const;
+
+        friend uint qHash(const PairKey &key)
+        {
+            uint h = key.port ^ ::qHash(key.socket);
+            for (int i = 0; i < 16; ++i)
+                h = 31 * h + key.address[i];
+            return h;
+        }
+
+    private:
+        Q_IPV6ADDR address;
+        quint16 port;
+        QUdpSocket *socket;
+    };
+
+    void addHostCandidates(const QList<QUdpSocket*> &sockets);
+    void addPair(Pair *pair);
     Pair *addRemoteCandidate(QUdpSocket *socket, const QHostAddress &host, quint16 port, quint32 priority);
+    Pair *nominatePair();
+    void sendCheck(Pair *pair, bool retransmit);
+    void triggerCheck(Pair *pair);
+    void unfreezePairs(const QString &foundation);
     qint64 writeStun(const QXmppStunMessage &message, QXmppIceComponent::Pair *pair);
 
     int m_component;
 
     QList<QXmppJingleCandidate> m_localCandidates;
     QString m_localUser;
-    QString m_localPassword;
+    QByteArray m_localPassword;
+    QXmppHmacSha1 *m_localIntegrity;
 
     Pair *m_activePair;
     Pair *m_fallbackPair;
     bool m_iceControlling;
+    bool m_aggressiveNomination;
+    bool m_checking;
+    Pair *m_nominatedPair;
     QList<Pair*> m_pairs;
+    QHash<PairKey, Pair*> m_pairsByAddress;
+    QHash<QByteArray, Pair*> m_pairsByTransaction;
+    QList<Pair*> m_triggeredPairs;
     quint32 m_peerReflexivePriority;
     QString m_remoteUser;
-    QString m_remotePassword;
+    QByteArray m_remotePassword;
+    QXmppHmacSha1 *m_remoteIntegrity;
 
     QList<QUdpSocket*> m_sockets;
+    QXmppIceMultiplexer *m_multiplexer;
+    QXmppUdpBatch *m_udp;
     QTimer *m_timer;
 
     // STUN server
@@ -370,6 +484,53 @@ private:
     // TURN server
     QXmppTurnAllocation *m_turnAllocation;
     bool m_turnConfigured;
+
+    friend class QXmppIceMultiplexer;
+};
+
+/// \brief The QXmppIceMultiplexer class represents a set of UDP sockets
+/// which are shared by many ICE components.
+///
+/// Incoming datagrams are dispatched to the right component using the
+/// STUN transaction ID, the STUN USERNAME or the remote address. If the
+/// remote party also multiplexes RTP and RTCP on a single port, media
+/// datagrams are dispatched using their RTCP packet type (RFC 5761). This
+/// avoids binding new ports for every call, which is useful for servers
+/// handling a large number of sessions.
+///
+/// The multiplexer must outlive the components which use it.
+
+class QXMPP_EXPORT QXmppIceMultiplexer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppIceMultiplexer(QObject *parent = 0);
+    ~QXmppIceMultiplexer();
+
+    bool bind(const QList<QHostAddress> &addresses, quint16 port = 0);
+    QList<QUdpSocket*> sockets() const;
+
+private slots:
+    void readyRead();
+
+private:
+    void addComponent(QXmppIceComponent *component);
+    void removeComponent(QXmppIceComponent *component);
+    void addRemoteAddress(const QHostAddress &host, quint16 port, QUdpSocket *socket, QXmppIceComponent *component);
+    void addTransaction(const QByteArray &id, QXmppIceComponent *component);
+    void removeTransaction(const QByteArray &id);
+    void handleDatagram(const QByteArray &buffer, const QHostAddress &host, quint16 port, QUdpSocket *socket);
+    void setLocalUser(QXmppIceComponent *component, const QString &oldUser);
+
+    QList<QUdpSocket*> m_sockets;
+    QXmppUdpBatch *m_udp;
+    QList<QXmppIceComponent*> m_components;
+    QMultiHash<QXmppIceComponent::PairKey, QXmppIceComponent*> m_addresses;
+    QHash<QByteArray, QXmppIceComponent*> m_transactions;
+    QMultiHash<QString, QXmppIceComponent*> m_users;
+
+    friend class QXmppIceComponent;
 };
 
 /// \brief The QXmppIceConnection class represents a set of UDP sockets
@@ -386,6 +547,7 @@ public:
     QXmppIceComponent *component(int component);
     void addComponent(int component);
     void setIceControlling(bool controlling);
+    void setAggressiveNomination(bool aggressive);
 
     QList<QXmppJingleCandidate> localCandidates() const;
     QString localUser() const;
@@ -398,11 +560,14 @@ public:
     void setRemotePassword(const QString &password);
 
     void setStunServer(const QHostAddress &host, quint16 port = 3478);
-    void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnServer(const QHostAddress &host, quint16 port = 3478,
+                       QXmppTurnAllocation::Transport transport = QXmppTurnAllocation::UdpTransport,
+                       const QString &name = QString());
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
 
     bool bind(const QList<QHostAddress> &addresses);
+    void bind(QXmppIceMultiplexer *multiplexer);
     bool isConnected() const;
 
 signals:
@@ -426,6 +591,7 @@ private slots:
 private:
     QTimer *m_connectTimer;
     bool m_iceControlling;
+    bool m_aggressiveNomination;
     QMap<int, QXmppIceComponent*> m_components;
     QString m_localUser;
     QString m_localPassword;
@@ -433,6 +599,8 @@ private:
     quint16 m_stunPort;
     QHostAddress m_turnHost;
     quint16 m_turnPort;
+    QXmppTurnAllocation::Transport m_turnTransport;
+    QString m_turnName;
     QString m_turnUser;
     QString m_turnPassword;
 };
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTUN_P_H
+#define QXMPPSTUN_P_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QStringList>
+
+#include "QXmppGlobal.h"
+
+class QIODevice;
+class QUdpSocket;
+class QXmppHmacSha1;
+class QXmppStunMessage;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppIceComponent, QXmppIceMultiplexer, QXmppTurnAllocation and
+// QXmppTurnServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// The QXmppStunCodec class encodes and decodes STUN messages using a
+/// prebuilt HMAC context for the message integrity attribute, which avoids
+/// deriving the HMAC key for every message.
+
+class QXMPP_AUTOTEST_EXPORT QXmppStunCodec
+{
+public:
+    static QByteArray encode(const QXmppStunMessage &message, const QXmppHmacSha1 *integrity, bool addFingerprint = true);
+    static bool decode(QXmppStunMessage &message, const QByteArray &buffer, const QXmppHmacSha1 *integrity, QStringList *errors = 0);
+};
+
+/// The QXmppUdpDatagram class represents a UDP datagram along with the
+/// remote address and the local socket it was received on or is to be
+/// sent from.
+
+class QXmppUdpDatagram
+{
+public:
+    QByteArray data;
+    QHostAddress host;
+    quint16 port;
+    QUdpSocket *socket;
+};
+
+/// The QXmppUdpBatch class reads and writes UDP datagrams in batches.
+///
+/// On Linux, pending datagrams are read with a single recvmmsg() call into
+/// a buffer which is allocated once. The datagrams returned by datagrams()
+/// point into that buffer instead of owning a copy, so they are only valid
+/// until the next call to readDatagrams(). Queued datagrams are written with
+/// a single sendmmsg() call.
+///
+/// Other systems use the QUdpSocket API.
+
+class QXMPP_AUTOTEST_EXPORT QXmppUdpBatch
+{
+public:
+    QXmppUdpBatch();
+
+    bool readDatagrams(QUdpSocket *socket);
+    QList<QXmppUdpDatagram> datagrams() const;
+
+    void queueDatagram(const QByteArray &data, const QHostAddress &host, quint16 port, QUdpSocket *socket);
+    int queuedDatagrams() const;
+    void clearQueue();
+    void flush();
+
+    bool isSystemBatchingEnabled() const;
+    void setSystemBatchingEnabled(bool enabled);
+
+private:
+    void writeDatagrams(const QList<QXmppUdpDatagram> &datagrams);
+
+    QByteArray m_buffer;
+    QList<QXmppUdpDatagram> m_received;
+    QList<QXmppUdpDatagram> m_queue;
+    bool m_systemBatching;
+};
+
+/// The QXmppTurnStreamReader class splits the data received from a TURN
+/// server over TCP or TLS into STUN messages and ChannelData frames.
+///
+/// Frames are delimited using their own length fields, see RFC 5766
+/// section 11.5. ChannelData frames are padded to a multiple of 4 bytes,
+/// the padding is stripped from the returned frame. Partial frames are
+/// kept until the rest of the data arrives.
+
+class QXMPP_AUTOTEST_EXPORT QXmppTurnStreamReader
+{
+public:
+    QXmppTurnStreamReader();
+
+    qint64 readFrom(QIODevice *device);
+    bool readFrame(QByteArray &frame);
+    void clear();
+
+private:
+    QByteArray m_buffer;
+    int m_pos;
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPUTILS_P_H
+#define QXMPPUTILS_P_H
+
+#include <QByteArray>
+
+#include "QXmppGlobal.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppUtils and QXmppStunMessage classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// The QXmppHmacSha1 class computes SHA1 HMACs (RFC 2104).
+///
+/// The hash states after the inner and outer padded keys are computed once
+/// when the key is set, so a context can be copied and reused for every
+/// message signed with the same key.
+
+class QXMPP_AUTOTEST_EXPORT QXmppHmacSha1
+{
+public:
+    QXmppHmacSha1();
+    QXmppHmacSha1(const QByteArray &key);
+
+    void addData(const char *data, int length);
+    void addData(const QByteArray &data);
+    QByteArray result() const;
+
+private:
+    class State {
+    public:
+        void init();
+        void update(const uchar *data, int length);
+        void finish(uchar *digest);
+
+        quint32 hash[5];
+        quint64 length;
+        uchar block[64];
+        int blockLength;
+    };
+
+    void setKey(const QByteArray &key);
+    static void transform(quint32 *hash, const uchar *block);
+
+    State m_inner;
+    State m_outer;
+};
+
+#endif
@@ -27,12 +27,48 @@
 #include "QXmppUtils.h"
 #include "QXmppVersionIq.h"
 
+class QXmppVersionIqPrivate : public QSharedData
+{
+public:
+    QString name;
+    QString os;
+    QString version;
+};
+
+/// Constructs a software version IQ.
+
+QXmppVersionIq::QXmppVersionIq()
+    : d(new QXmppVersionIqPrivate)
+{
+}
+
+/// Constructs a copy of \a other.
+
+QXmppVersionIq::QXmppVersionIq(const QXmppVersionIq &other)
+    : QXmppIq(other)
+    , d(other.d)
+{
+}
+
+QXmppVersionIq::~QXmppVersionIq()
+{
+}
+
+/// Assigns \a other to this software version IQ.
+
+QXmppVersionIq& QXmppVersionIq::operator=(const QXmppVersionIq &other)
+{
+    QXmppIq::operator=(other);
+    d = other.d;
+    return *this;
+}
+
 /// Returns the name of the software.
 ///
 
 QString QXmppVersionIq::name() const
 {
-    return m_name;
+    return d->name;
 }
 
 /// Sets the name of the software.
@@ -41,7 +77,7 @@ QString QXmppVersionIq::name() const
 
 void QXmppVersionIq::setName(const QString &name)
 {
-    m_name = name;
+    d->name = name;
 }
 
 /// Returns the operating system.
@@ -49,7 +85,7 @@ void QXmppVersionIq::setName(const QString &name)
 
 QString QXmppVersionIq::os() const
 {
-    return m_os;
+    return d->os;
 }
 
 /// Sets the operating system.
@@ -58,7 +94,7 @@ QString QXmppVersionIq::os() const
 
 void QXmppVersionIq::setOs(const QString &os)
 {
-    m_os = os;
+    d->os = os;
 }
 
 /// Returns the software version.
@@ -66,7 +102,7 @@ void QXmppVersionIq::setOs(const QString &os)
 
 QString QXmppVersionIq::version() const
 {
-    return m_version;
+    return d->version;
 }
 
 /// Sets the software version.
@@ -75,7 +111,7 @@ QString QXmppVersionIq::version() const
 
 void QXmppVersionIq::setVersion(const QString &version)
 {
-    m_version = version;
+    d->version = version;
 }
 
 /// \cond
@@ -88,9 +124,9 @@ bool QXmppVersionIq::isVersionIq(const QDomElement &element)
 void QXmppVersionIq::parseElementFromChild(const QDomElement &element)
 {
     QDomElement queryElement = element.firstChildElement("query");
-    m_name = queryElement.firstChildElement("name").text();
-    m_os = queryElement.firstChildElement("os").text();
-    m_version = queryElement.firstChildElement("version").text();
+    d->name = queryElement.firstChildElement("name").text();
+    d->os = queryElement.firstChildElement("os").text();
+    d->version = queryElement.firstChildElement("version").text();
 }
 
 void QXmppVersionIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -98,14 +134,14 @@ void QXmppVersionIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeStartElement("query");
     writer->writeAttribute("xmlns", ns_version);
 
-    if (!m_name.isEmpty())
-        helperToXmlAddTextElement(writer, "name", m_name);
+    if (!d->name.isEmpty())
+        helperToXmlAddTextElement(writer, "name", d->name);
 
-    if (!m_os.isEmpty())
-        helperToXmlAddTextElement(writer, "os", m_os);
+    if (!d->os.isEmpty())
+        helperToXmlAddTextElement(writer, "os", d->os);
 
-    if (!m_version.isEmpty())
-        helperToXmlAddTextElement(writer, "version", m_version);
+    if (!d->version.isEmpty())
+        helperToXmlAddTextElement(writer, "version", d->version);
 
     writer->writeEndElement();
 }
@@ -26,6 +26,8 @@
 
 #include "QXmppIq.h"
 
+class QXmppVersionIqPrivate;
+
 /// \brief The QXmppVersionIq class represents an IQ for conveying a software
 /// version as defined by XEP-0092: Software Version.
 ///
@@ -34,6 +36,12 @@
 class QXMPP_EXPORT QXmppVersionIq : public QXmppIq
 {
 public:
+    QXmppVersionIq();
+    QXmppVersionIq(const QXmppVersionIq &other);
+    ~QXmppVersionIq();
+
+    QXmppVersionIq& operator=(const QXmppVersionIq &other);
+
     QString name() const;
     void setName(const QString &name);
 
@@ -54,9 +62,7 @@ protected:
     /// \endcond
 
 private:
-    QString m_name;
-    QString m_os;
-    QString m_version;
+    QSharedDataPointer<QXmppVersionIqPrivate> d;
 };
 
 #endif
@@ -39,16 +39,26 @@ INSTALL_HEADERS += \
     base/QXmppVersionIq.h
 
 HEADERS += \
+    base/QXmppAtom_p.h \
     base/QXmppCodec_p.h \
-    base/QXmppSasl_p.h
+    base/QXmppCompressor_p.h \
+    base/QXmppDispatchIndex_p.h \
+    base/QXmppRtpChannel_p.h \
+    base/QXmppSasl_p.h \
+    base/QXmppStanzaWriter_p.h \
+    base/QXmppStreamParser_p.h \
+    base/QXmppStun_p.h \
+    base/QXmppUtils_p.h
 
 # Source files
 SOURCES += \
     base/QXmppArchiveIq.cpp \
+    base/QXmppAtom.cpp \
     base/QXmppBindIq.cpp \
     base/QXmppBookmarkSet.cpp \
     base/QXmppByteStreamIq.cpp \
     base/QXmppCodec.cpp \
+    base/QXmppCompressor.cpp \
     base/QXmppConstants.cpp \
     base/QXmppDataForm.cpp \
     base/QXmppDiscoveryIq.cpp \
@@ -74,9 +84,11 @@ SOURCES += \
     base/QXmppSessionIq.cpp \
     base/QXmppSocks.cpp \
     base/QXmppStanza.cpp \
+    base/QXmppStanzaWriter.cpp \
     base/QXmppStream.cpp \
     base/QXmppStreamFeatures.cpp \
     base/QXmppStreamInitiationIq.cpp \
+    base/QXmppStreamParser.cpp \
     base/QXmppStun.cpp \
     base/QXmppUtils.cpp \
     base/QXmppVCardIq.cpp \
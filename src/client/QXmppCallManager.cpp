@@ -22,6 +22,7 @@
  */
 
 #include <QDomElement>
+#include <QSet>
 #include <QTimer>
 
 #include "QXmppCallManager.h"
@@ -54,9 +55,11 @@ public:
         QString creator;
         QString media;
         QString name;
+        QSet<QString> sentCandidates;
     };
 
     QXmppCallPrivate(QList<CodecID> codecs, QXmppCall *qq);
+    bool addTransportCandidates(Stream *stream, QXmppJingleIq::Content &content);
     Stream *createStream(QList<CodecID> codecs, const QString &media);
     Stream *findStreamByMedia(const QString &media);
     Stream *findStreamByName(const QString &name);
@@ -101,6 +104,8 @@ public:
     quint16 stunPort;
     QHostAddress turnHost;
     quint16 turnPort;
+    QXmppTurnAllocation::Transport turnTransport;
+    QString turnName;
     QString turnUser;
     QString turnPassword;
     QList<CodecID> codecs;
@@ -152,8 +157,27 @@ void QXmppCallPrivate::handleAck(const QXmppIq &ack)
     }
 }
 
+/// Adds the local candidates which have not yet been sent to the remote
+/// party, so that candidates can be trickled as they are gathered.
+///
+/// Returns true if any candidate was added.
+
+bool QXmppCallPrivate::addTransportCandidates(QXmppCallPrivate::Stream *stream, QXmppJingleIq::Content &content)
+{
+    bool added = false;
+    foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates()) {
+        if (stream->sentCandidates.contains(candidate.id()))
+            continue;
+        stream->sentCandidates.insert(candidate.id());
+        content.addTransportCandidate(candidate);
+        added = true;
+    }
+    return added;
+}
+
 bool QXmppCallPrivate::handleDescription(QXmppCallPrivate::Stream *stream, const QXmppJingleIq::Content &content)
 {
+    stream->channel->setRemoteHeaderExtensions(content.rtpHeaderExtensions());
     stream->channel->setRemotePayloadTypes(content.payloadTypes());
     if (!(stream->channel->openMode() & QIODevice::ReadWrite)) {
         q->warning(QString("Remote party %1 did not provide any known %2 payloads for call %3").arg(jid, stream->media, sid));
@@ -280,12 +304,12 @@ void QXmppCallPrivate::handleRequest(const QXmppJingleIq &iq)
         iq.content().setDescriptionMedia(stream->media);
         foreach (const QXmppJinglePayloadType &payload, stream->channel->localPayloadTypes())
             iq.content().addPayloadType(payload);
+        iq.content().setRtpHeaderExtensions(stream->channel->localHeaderExtensions());
 
         // transport
         iq.content().setTransportUser(stream->connection->localUser());
         iq.content().setTransportPassword(stream->connection->localPassword());
-        foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates())
-            iq.content().addTransportCandidate(candidate);
+        addTransportCandidates(stream, iq.content());
 
         sendRequest(iq);
 
@@ -336,7 +360,7 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(QList<CodecID> codecs,
     stream->connection = new QXmppIceConnection(q);
     stream->connection->setIceControlling(direction == QXmppCall::OutgoingDirection);
     stream->connection->setStunServer(manager->d->stunHost, manager->d->stunPort);
-    stream->connection->setTurnServer(manager->d->turnHost, manager->d->turnPort);
+    stream->connection->setTurnServer(manager->d->turnHost, manager->d->turnPort, manager->d->turnTransport, manager->d->turnName);
     stream->connection->setTurnUser(manager->d->turnUser);
     stream->connection->setTurnPassword(manager->d->turnPassword);
     stream->connection->addComponent(RTP_COMPONENT);
@@ -370,6 +394,16 @@ QXmppCallPrivate::Stream *QXmppCallPrivate::createStream(QList<CodecID> codecs,
         check = QObject::connect(channelObject, SIGNAL(sendDatagram(QByteArray)),
                         rtpComponent, SLOT(sendDatagram(QByteArray)));
         Q_ASSERT(check);
+
+        QXmppIceComponent *rtcpComponent = stream->connection->component(RTCP_COMPONENT);
+
+        check = QObject::connect(rtcpComponent, SIGNAL(datagramReceived(QByteArray)),
+                        channelObject, SLOT(rtcpDatagramReceived(QByteArray)));
+        Q_ASSERT(check);
+
+        check = QObject::connect(channelObject, SIGNAL(sendRtcpDatagram(QByteArray)),
+                        rtcpComponent, SLOT(sendDatagram(QByteArray)));
+        Q_ASSERT(check);
     }
     return stream;
 }
@@ -406,12 +440,12 @@ bool QXmppCallPrivate::sendInvite()
     iq.content().setDescriptionMedia(stream->media);
     foreach (const QXmppJinglePayloadType &payload, stream->channel->localPayloadTypes())
         iq.content().addPayloadType(payload);
+    iq.content().setRtpHeaderExtensions(stream->channel->localHeaderExtensions());
 
     // transport
     iq.content().setTransportUser(stream->connection->localUser());
     iq.content().setTransportPassword(stream->connection->localPassword());
-    foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates())
-        iq.content().addTransportCandidate(candidate);
+    addTransportCandidates(stream, iq.content());
 
     return sendRequest(iq);
 }
@@ -508,12 +542,12 @@ void QXmppCall::accept()
         iq.content().setDescriptionMedia(stream->media);
         foreach (const QXmppJinglePayloadType &payload, stream->channel->localPayloadTypes())
             iq.content().addPayloadType(payload);
+        iq.content().setRtpHeaderExtensions(stream->channel->localHeaderExtensions());
 
         // transport
         iq.content().setTransportUser(stream->connection->localUser());
         iq.content().setTransportPassword(stream->connection->localPassword());
-        foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates())
-            iq.content().addTransportCandidate(candidate);
+        d->addTransportCandidates(stream, iq.content());
 
         d->sendRequest(iq);
 
@@ -596,6 +630,7 @@ void QXmppCall::hangup()
 
 /// Sends a transport-info to inform the remote party of new local candidates.
 ///
+/// Only the candidates which were not previously sent are included.
 
 void QXmppCall::localCandidatesChanged()
 {
@@ -623,8 +658,8 @@ void QXmppCall::localCandidatesChanged()
     // transport
     iq.content().setTransportUser(stream->connection->localUser());
     iq.content().setTransportPassword(stream->connection->localPassword());
-    foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates())
-        iq.content().addTransportCandidate(candidate);
+    if (!d->addTransportCandidates(stream, iq.content()))
+        return;
 
     d->sendRequest(iq);
 }
@@ -719,12 +754,12 @@ void QXmppCall::startVideo()
     iq.content().setDescriptionMedia(stream->media);
     foreach (const QXmppJinglePayloadType &payload, stream->channel->localPayloadTypes())
         iq.content().addPayloadType(payload);
+    iq.content().setRtpHeaderExtensions(stream->channel->localHeaderExtensions());
 
     // transport
     iq.content().setTransportUser(stream->connection->localUser());
     iq.content().setTransportPassword(stream->connection->localPassword());
-    foreach (const QXmppJingleCandidate &candidate, stream->connection->localCandidates())
-        iq.content().addTransportCandidate(candidate);
+    d->addTransportCandidates(stream, iq.content());
 
     d->sendRequest(iq);
 }
@@ -745,6 +780,7 @@ void QXmppCall::stopVideo()
 QXmppCallManagerPrivate::QXmppCallManagerPrivate(QXmppCallManager *qq)
     : stunPort(0),
     turnPort(0),
+    turnTransport(QXmppTurnAllocation::UdpTransport),
     q(qq)
 {
 }
@@ -793,6 +829,11 @@ QStringList QXmppCallManager::discoveryFeatures() const
         << ns_jingle_ice_udp;    // XEP-0176 : Jingle ICE-UDP Transport Method
 }
 
+QStringList QXmppCallManager::handledNamespaces() const
+{
+    return QStringList() << ns_jingle;
+}
+
 bool QXmppCallManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq")
@@ -885,11 +926,15 @@ void QXmppCallManager::setStunServer(const QHostAddress &host, quint16 port)
 ///
 /// \param host The address of the TURN server.
 /// \param port The port of the TURN server.
+/// \param transport The transport used to reach the TURN server.
+/// \param name The name used to verify the TURN server's certificate.
 
-void QXmppCallManager::setTurnServer(const QHostAddress &host, quint16 port)
+void QXmppCallManager::setTurnServer(const QHostAddress &host, quint16 port, QXmppTurnAllocation::Transport transport, const QString &name)
 {
     d->turnHost = host;
     d->turnPort = port;
+    d->turnTransport = transport;
+    d->turnName = name;
 }
 
 /// Sets the \a user used for authentication with the TURN server.
@@ -30,6 +30,7 @@
 
 #include "QXmppClientExtension.h"
 #include "QXmppLogger.h"
+#include "QXmppStun.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -169,13 +170,16 @@ public:
     QXmppCallManager();
     ~QXmppCallManager();
     void setStunServer(const QHostAddress &host, quint16 port = 3478);
-    void setTurnServer(const QHostAddress &host, quint16 port = 3478);
+    void setTurnServer(const QHostAddress &host, quint16 port = 3478,
+                       QXmppTurnAllocation::Transport transport = QXmppTurnAllocation::UdpTransport,
+                       const QString &name = QString());
     void setTurnUser(const QString &user);
     void setTurnPassword(const QString &password);
     void setCodecs(QList<CodecID> codecs);
 
     /// \cond
     QStringList discoveryFeatures() const;
+    QStringList handledNamespaces() const;
     bool handleStanza(const QDomElement &element);
     /// \endcond
 
@@ -27,6 +27,7 @@
 #include "QXmppClient.h"
 #include "QXmppClientExtension.h"
 #include "QXmppConstants.h"
+#include "QXmppDispatchIndex_p.h"
 #include "QXmppLogger.h"
 #include "QXmppOutgoingClient.h"
 #include "QXmppMessage.h"
@@ -46,6 +47,7 @@ public:
 
     QXmppPresence clientPresence;                   ///< Current presence of the client
     QList<QXmppClientExtension*> extensions;
+    QXmppDispatchIndex<QXmppClientExtension> extensionIndex;
     QXmppLogger *logger;
     QXmppOutgoingClient *stream;                    ///< Pointer to the XMPP stream
 
@@ -54,6 +56,9 @@ public:
     int reconnectionTries;
     QTimer *reconnectionTimer;
 
+    // XEP-0198: the session is kept while waiting to resume it
+    bool sessionSuspended;
+
     // managers
     QXmppRosterManager *rosterManager;
     QXmppVCardManager *vCardManager;
@@ -73,6 +78,7 @@ QXmppClientPrivate::QXmppClientPrivate(QXmppClient *qq)
     , receivedConflict(false)
     , reconnectionTries(0)
     , reconnectionTimer(0)
+    , sessionSuspended(false)
     , rosterManager(0)
     , vCardManager(0)
     , versionManager(0)
@@ -237,6 +243,7 @@ bool QXmppClient::addExtension(QXmppClientExtension* extension)
     extension->setParent(this);
     extension->setClient(this);
     d->extensions << extension;
+    d->extensionIndex.rebuild(d->extensions);
     return true;
 }
 
@@ -250,6 +257,7 @@ bool QXmppClient::removeExtension(QXmppClientExtension* extension)
     if (d->extensions.contains(extension))
     {
         d->extensions.removeAll(extension);
+        d->extensionIndex.rebuild(d->extensions);
         delete extension;
         return true;
     } else {
@@ -339,6 +347,10 @@ void QXmppClient::disconnectFromServer()
 {
     // cancel reconnection
     d->reconnectionTimer->stop();
+    if (d->sessionSuspended) {
+        d->sessionSuspended = false;
+        emit disconnected();
+    }
 
     d->clientPresence.setType(QXmppPresence::Unavailable);
     d->clientPresence.setStatusText("Logged out");
@@ -433,6 +445,10 @@ void QXmppClient::setClientPresence(const QXmppPresence& presence)
     {
         // cancel reconnection
         d->reconnectionTimer->stop();
+        if (d->sessionSuspended) {
+            d->sessionSuspended = false;
+            emit disconnected();
+        }
 
         // NOTE: we can't call disconnect() because it alters
         // the client presence
@@ -488,7 +504,8 @@ QXmppVersionManager& QXmppClient::versionManager()
 
 void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
 {
-    foreach (QXmppClientExtension *extension, d->extensions)
+    // only offer the stanza to the extensions which handle its payload
+    foreach (QXmppClientExtension *extension, d->extensionIndex.candidates(element))
     {
         if (extension->handleStanza(element))
         {
@@ -519,6 +536,17 @@ void QXmppClient::_q_streamConnected()
     d->receivedConflict = false;
     d->reconnectionTries = 0;
 
+    // XEP-0198: if the session was resumed, the managers' state is still
+    // valid, otherwise let them reset before the new session starts
+    if (d->sessionSuspended) {
+        d->sessionSuspended = false;
+        if (d->stream->isStreamResumed()) {
+            emit stateChanged(QXmppClient::ConnectedState);
+            return;
+        }
+        emit disconnected();
+    }
+
     // notify managers
     emit connected();
     emit stateChanged(QXmppClient::ConnectedState);
@@ -529,6 +557,14 @@ void QXmppClient::_q_streamConnected()
 
 void QXmppClient::_q_streamDisconnected()
 {
+    // XEP-0198: if we are about to reconnect, keep the session so that
+    // it can be resumed
+    if (d->stream->isStreamResumable() && d->reconnectionTimer->isActive()) {
+        d->sessionSuspended = true;
+        emit stateChanged(QXmppClient::DisconnectedState);
+        return;
+    }
+
     // notify managers
     emit disconnected();
     emit stateChanged(QXmppClient::DisconnectedState);
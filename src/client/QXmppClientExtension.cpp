@@ -64,6 +64,17 @@ QList<QXmppDiscoveryIq::Identity> QXmppClientExtension::discoveryIdentities() co
     return QList<QXmppDiscoveryIq::Identity>();
 }
 
+/// Returns the namespaces of the payloads handled by this extension.
+///
+/// The client only offers a stanza to handleStanza() if one of its child
+/// elements is in one of these namespaces. If the list is empty, which is
+/// the default, the extension is offered every stanza.
+
+QStringList QXmppClientExtension::handledNamespaces() const
+{
+    return QStringList();
+}
+
 /// Returns the client which loaded this extension.
 ///
 
@@ -54,6 +54,7 @@ public:
 
     virtual QStringList discoveryFeatures() const;
     virtual QList<QXmppDiscoveryIq::Identity> discoveryIdentities() const;
+    virtual QStringList handledNamespaces() const;
 
     /// \brief You need to implement this method to process incoming XMPP
     /// stanzas.
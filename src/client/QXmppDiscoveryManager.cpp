@@ -249,6 +249,12 @@ QStringList QXmppDiscoveryManager::discoveryFeatures() const
     return QStringList() << ns_disco_info;
 }
 
+QStringList QXmppDiscoveryManager::handledNamespaces() const
+{
+    return QStringList() << ns_disco_info
+        << ns_disco_items;
+}
+
 bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == "iq" && QXmppDiscoveryIq::isDiscoveryIq(element))
@@ -53,6 +53,11 @@ QStringList QXmppEntityTimeManager::discoveryFeatures() const
     return QStringList() << ns_entity_time;
 }
 
+QStringList QXmppEntityTimeManager::handledNamespaces() const
+{
+    return QStringList() << ns_entity_time;
+}
+
 bool QXmppEntityTimeManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq" && QXmppEntityTimeIq::isEntityTimeIq(element))
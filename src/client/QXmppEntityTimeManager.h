@@ -43,6 +43,7 @@ public:
 
     /// \cond
     QStringList discoveryFeatures() const;
+    QStringList handledNamespaces() const;
     bool handleStanza(const QDomElement &element);
     /// \endcond
 
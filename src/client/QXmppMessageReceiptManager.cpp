@@ -44,6 +44,11 @@ QStringList QXmppMessageReceiptManager::discoveryFeatures() const
     return QStringList(ns_message_receipts);
 }
 
+QStringList QXmppMessageReceiptManager::handledNamespaces() const
+{
+    return QStringList() << ns_message_receipts;
+}
+
 bool QXmppMessageReceiptManager::handleStanza(const QDomElement &stanza)
 {
     if (stanza.tagName() != "message")
@@ -41,6 +41,7 @@ public:
 
     /// \cond
     virtual QStringList discoveryFeatures() const;
+    virtual QStringList handledNamespaces() const;
     virtual bool handleStanza(const QDomElement &stanza);
     /// \endcond
 
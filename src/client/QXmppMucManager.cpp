@@ -104,6 +104,12 @@ QStringList QXmppMucManager::discoveryFeatures() const
         << ns_conference;
 }
 
+QStringList QXmppMucManager::handledNamespaces() const
+{
+    return QStringList() << ns_muc_admin
+        << ns_muc_owner;
+}
+
 bool QXmppMucManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == "iq")
@@ -69,6 +69,7 @@ public:
 
     /// \cond
     QStringList discoveryFeatures() const;
+    QStringList handledNamespaces() const;
     bool handleStanza(const QDomElement &element);
     /// \endcond
 
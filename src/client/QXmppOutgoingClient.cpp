@@ -28,6 +28,7 @@
 #include <QUrl>
 #include "qdnslookup.h"
 
+#include "QXmppAtom_p.h"
 #include "QXmppConfiguration.h"
 #include "QXmppConstants.h"
 #include "QXmppIq.h"
@@ -36,6 +37,7 @@
 #include "QXmppPresence.h"
 #include "QXmppOutgoingClient.h"
 #include "QXmppStreamFeatures.h"
+#include "QXmppStreamParser_p.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppSasl_p.h"
 #include "QXmppUtils.h"
@@ -59,6 +61,8 @@ class QXmppOutgoingClientPrivate
 public:
     QXmppOutgoingClientPrivate(QXmppOutgoingClient *q);
     void connectToHost(const QString &host, quint16 port);
+    void bindOrResume();
+    void sendBind();
 
     // This object provides the configuration
     // required for connecting to the XMPP server.
@@ -79,6 +83,15 @@ public:
     bool sessionAvailable;
     bool sessionStarted;
 
+    // XEP-0198: Stream Management
+    bool smAvailable;
+    bool smResuming;
+    bool smResumed;
+    QString smId;
+
+    // XEP-0138: Stream Compression
+    QString compressionMethod;
+
     // Authentication
     QString nonSASLAuthId;
     QXmppSaslClient *saslClient;
@@ -93,6 +106,9 @@ private:
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
     : sessionAvailable(false)
+    , smAvailable(false)
+    , smResuming(false)
+    , smResumed(false)
     , saslClient(0)
     , q(qq)
 {
@@ -113,6 +129,42 @@ void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port
     q->socket()->connectToHost(host, port);
 }
 
+static QByteArray resumeRequest(const QString &previd, quint32 handled)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    writer.writeStartElement("resume");
+    writer.writeAttribute("xmlns", ns_stream_management);
+    writer.writeAttribute("h", QString::number(handled));
+    writer.writeAttribute("previd", previd);
+    writer.writeEndElement();
+    return data;
+}
+
+void QXmppOutgoingClientPrivate::bindOrResume()
+{
+    if (smAvailable && !smId.isEmpty()) {
+        // XEP-0198: resume the previous session instead
+        smResuming = true;
+        q->sendData(resumeRequest(smId, q->handledStanzaCount()));
+    } else {
+        sendBind();
+    }
+}
+
+void QXmppOutgoingClientPrivate::sendBind()
+{
+    // a new session replaces any previous one
+    smId.clear();
+    q->resetStreamManagement();
+
+    QXmppBindIq bind;
+    bind.setType(QXmppIq::Set);
+    bind.setResource(config.resource());
+    bindId = bind.id();
+    q->sendPacket(bind);
+}
+
 /// Constructs an outgoing client stream.
 ///
 /// \param parent
@@ -218,6 +270,30 @@ bool QXmppOutgoingClient::isConnected() const
     return QXmppStream::isConnected() && d->sessionStarted;
 }
 
+/// Returns true if the server allows the current session to be resumed
+/// after a disconnection, as per XEP-0198: Stream Management.
+
+bool QXmppOutgoingClient::isStreamResumable() const
+{
+    return !d->smId.isEmpty();
+}
+
+/// Returns true if the current session was resumed rather than started
+/// from scratch, in which case the roster and presences are still valid.
+
+bool QXmppOutgoingClient::isStreamResumed() const
+{
+    return d->smResumed;
+}
+
+/// Closes the stream, which ends the session for good.
+
+void QXmppOutgoingClient::disconnectFromHost()
+{
+    d->smId.clear();
+    QXmppStream::disconnectFromHost();
+}
+
 void QXmppOutgoingClient::socketSslErrors(const QList<QSslError> & error)
 {
     warning("SSL errors");
@@ -255,6 +331,9 @@ void QXmppOutgoingClient::handleStart()
     d->sessionId.clear();
     d->sessionAvailable = false;
     d->sessionStarted = false;
+    d->smAvailable = false;
+    d->smResuming = false;
+    d->smResumed = false;
 
     // start stream
     QByteArray data = "<?xml version='1.0'?><stream:stream to='";
@@ -280,20 +359,29 @@ void QXmppOutgoingClient::handleStream(const QDomElement &streamElement)
     }
 }
 
+void QXmppOutgoingClient::handleElement(const QXmppStanzaElement &element)
+{
+    // use the atoms computed by the parser
+    handleStanza(element.toDomElement(), element.namespaceAtom(), element.nameAtom());
+}
+
 void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
+{
+    handleStanza(nodeRecv, QXmppAtom::lookup(nodeRecv.namespaceURI()), QXmppAtom::lookup(nodeRecv.tagName()));
+}
+
+void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv, int ns, int name)
 {
     // if we receive any kind of data, stop the timeout timer
     d->timeoutTimer->stop();
 
-    const QString ns = nodeRecv.namespaceURI();
-
     // give client opportunity to handle stanza
     bool handled = false;
     emit elementReceived(nodeRecv, handled);
     if (handled)
         return;
 
-    if(QXmppStreamFeatures::isStreamFeatures(nodeRecv))
+    if(ns == QXmppAtom::NsStream && name == QXmppAtom::Features)
     {
         QXmppStreamFeatures features;
         features.parse(nodeRecv);
@@ -389,21 +477,30 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             sendPacket(QXmppSaslAuth(d->saslClient->mechanism(), response));
         }
 
+        // check whether session and stream management are available
+        if (features.sessionMode() != QXmppStreamFeatures::Disabled)
+            d->sessionAvailable = true;
+        if (features.streamManagementMode() != QXmppStreamFeatures::Disabled)
+            d->smAvailable = true;
+
         // check whether bind is available
         if (features.bindMode() != QXmppStreamFeatures::Disabled)
         {
-            QXmppBindIq bind;
-            bind.setType(QXmppIq::Set);
-            bind.setResource(configuration().resource());
-            d->bindId = bind.id();
-            sendPacket(bind);
+            // XEP-0138: compress the stream first if possible
+            if (!isCompressed()) {
+                foreach (const QString &method, availableCompressionMethods()) {
+                    if (features.compressionMethods().contains(method)) {
+                        d->compressionMethod = method;
+                        sendData(QString("<compress xmlns='%1'><method>%2</method></compress>").arg(
+                            ns_compress, method).toUtf8());
+                        return;
+                    }
+                }
+            }
+            d->bindOrResume();
         }
-
-        // check whether session is available
-        if (features.sessionMode() != QXmppStreamFeatures::Disabled)
-            d->sessionAvailable = true;
     }
-    else if(ns == ns_stream && nodeRecv.tagName() == "error")
+    else if(ns == QXmppAtom::NsStream && name == QXmppAtom::Error)
     {
         if (!nodeRecv.firstChildElement("conflict").isNull())
             d->xmppStreamError = QXmppStanza::Error::Conflict;
@@ -411,27 +508,27 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             d->xmppStreamError = QXmppStanza::Error::UndefinedCondition;
         emit error(QXmppClient::XmppStreamError);
     }
-    else if(ns == ns_tls)
+    else if(ns == QXmppAtom::NsTls)
     {
-        if(nodeRecv.tagName() == "proceed")
+        if(name == QXmppAtom::Proceed)
         {
             debug("Starting encryption");
             socket()->startClientEncryption();
             return;
         }
     }
-    else if(ns == ns_sasl)
+    else if(ns == QXmppAtom::NsSasl)
     {
         if (!d->saslClient) {
             warning("SASL stanza received, but no mechanism selected");
             return;
         }
-        if(nodeRecv.tagName() == "success")
+        if(name == QXmppAtom::Success)
         {
             debug("Authenticated");
             handleStart();
         }
-        else if(nodeRecv.tagName() == "challenge")
+        else if(name == QXmppAtom::Challenge)
         {
             QXmppSaslChallenge challenge;
             challenge.parse(nodeRecv);
@@ -444,7 +541,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 disconnectFromHost();
             }
         }
-        else if(nodeRecv.tagName() == "failure")
+        else if(name == QXmppAtom::Failure)
         {
             QXmppSaslFailure failure;
             failure.parse(nodeRecv);
@@ -459,10 +556,64 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             disconnectFromHost();
         }
     }
-    else if(ns == ns_client)
+    else if(ns == QXmppAtom::NsCompress)
+    {
+        if(name == QXmppAtom::Compressed)
+        {
+            if (!startCompression(d->compressionMethod)) {
+                warning("Could not start stream compression");
+                disconnectFromHost();
+                return;
+            }
+            debug("Starting compression");
+            handleStart();
+        }
+        else if(name == QXmppAtom::Failure)
+        {
+            // carry on without compression
+            warning("Stream compression failed");
+            d->bindOrResume();
+        }
+    }
+    else if(ns == QXmppAtom::NsStreamManagement)
+    {
+        if(name == QXmppAtom::Enabled)
+        {
+            // the server counts the stanzas it sends from now on
+            enableStanzaCount();
+            const QString resume = nodeRecv.attribute("resume");
+            if (resume == QLatin1String("true") || resume == QLatin1String("1"))
+                d->smId = nodeRecv.attribute("id");
+            debug("Stream management enabled");
+        }
+        else if(name == QXmppAtom::Resumed && d->smResuming)
+        {
+            info("Stream resumed");
+            d->smResuming = false;
+            d->smResumed = true;
+            resumeStanzaQueue(nodeRecv.attribute("h").toUInt());
+
+            // xmpp connection restored
+            d->sessionStarted = true;
+            emit connected();
+        }
+        else if(name == QXmppAtom::Failed)
+        {
+            if (d->smResuming) {
+                // the session expired, start a new one
+                warning("Could not resume stream");
+                d->smResuming = false;
+                d->sendBind();
+            } else {
+                warning("Could not enable stream management");
+                resetStreamManagement();
+            }
+        }
+    }
+    else if(ns == QXmppAtom::NsClient)
     {
 
-        if(nodeRecv.tagName() == "iq")
+        if(name == QXmppAtom::Iq)
         {
             QDomElement element = nodeRecv.firstChildElement();
             QString id = nodeRecv.attribute("id");
@@ -475,6 +626,13 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 QXmppSessionIq session;
                 session.parse(nodeRecv);
 
+                // XEP-0198: enable stream management before anything
+                // else is sent
+                if (d->smAvailable) {
+                    sendData(QByteArray("<enable xmlns='") + ns_stream_management + "' resume='true'/>");
+                    enableStanzaQueue();
+                }
+
                 // xmpp connection made
                 d->sessionStarted = true;
                 emit connected();
@@ -586,7 +744,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 }
             }
         }
-        else if(nodeRecv.tagName() == "presence")
+        else if(name == QXmppAtom::Presence)
         {
             QXmppPresence presence;
             presence.parse(nodeRecv);
@@ -594,7 +752,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             // emit presence
             emit presenceReceived(presence);
         }
-        else if(nodeRecv.tagName() == "message")
+        else if(name == QXmppAtom::Message)
         {
             QXmppMessage message;
             message.parse(nodeRecv);
@@ -643,8 +801,14 @@ void QXmppOutgoingClient::pingSend()
 void QXmppOutgoingClient::pingTimeout()
 {
     warning("Ping timeout");
-    disconnectFromHost();
+
+    // report the error first, so that the reconnection is scheduled
+    // by the time the socket is reported as disconnected
     emit error(QXmppClient::KeepAliveError);
+
+    // XEP-0198: the connection is dead, drop it without closing the
+    // stream so that the session can be resumed
+    socket()->abort();
 }
 
 void QXmppOutgoingClient::sendNonSASLAuth(bool plainText)
@@ -54,6 +54,8 @@ public:
 
     void connectToHost();
     bool isConnected() const;
+    bool isStreamResumable() const;
+    bool isStreamResumed() const;
 
     QSslSocket *socket() const { return QXmppStream::socket(); };
     QXmppStanza::Error::Condition xmppStreamError();
@@ -80,10 +82,14 @@ protected:
     /// \cond
     // Overridable methods
     virtual void handleStart();
+    virtual void handleElement(const QXmppStanzaElement &element);
     virtual void handleStanza(const QDomElement &element);
     virtual void handleStream(const QDomElement &element);
     /// \endcond
 
+public slots:
+    virtual void disconnectFromHost();
+
 private slots:
     void _q_dnsLookupFinished();
     void socketError(QAbstractSocket::SocketError);
@@ -95,6 +101,7 @@ private slots:
     void pingTimeout();
 
 private:
+    void handleStanza(const QDomElement &element, int ns, int name);
     void sendNonSASLAuth(bool plaintext);
     void sendNonSASLAuthQuery();
 
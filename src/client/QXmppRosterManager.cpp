@@ -25,6 +25,7 @@
 #include <QDomElement>
 
 #include "QXmppClient.h"
+#include "QXmppConstants.h"
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
 #include "QXmppRosterManager.h"
@@ -116,6 +117,11 @@ void QXmppRosterManager::_q_disconnected()
 }
 
 /// \cond
+QStringList QXmppRosterManager::handledNamespaces() const
+{
+    return QStringList() << ns_roster;
+}
+
 bool QXmppRosterManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() != "iq" || !QXmppRosterIq::isRosterIq(element))
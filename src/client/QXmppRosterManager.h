@@ -80,6 +80,7 @@ public:
                               const QString& resource) const;
 
     /// \cond
+    QStringList handledNamespaces() const;
     bool handleStanza(const QDomElement &element);
     /// \endcond
 
@@ -152,6 +152,11 @@ QList<QXmppDiscoveryIq::Identity> QXmppRpcManager::discoveryIdentities() const
     return QList<QXmppDiscoveryIq::Identity>() << identity;
 }
 
+QStringList QXmppRpcManager::handledNamespaces() const
+{
+    return QStringList() << ns_rpc;
+}
+
 bool QXmppRpcManager::handleStanza(const QDomElement &element)
 {
     // XEP-0009: Jabber-RPC
@@ -869,6 +869,13 @@ QStringList QXmppTransferManager::discoveryFeatures() const
         << ns_stream_initiation_file_transfer; // XEP-0096: SI File Transfer
 }
 
+QStringList QXmppTransferManager::handledNamespaces() const
+{
+    return QStringList() << ns_ibb
+        << ns_bytestreams
+        << ns_stream_initiation;
+}
+
 bool QXmppTransferManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() != "iq")
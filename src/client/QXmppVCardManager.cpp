@@ -107,6 +107,11 @@ QStringList QXmppVCardManager::discoveryFeatures() const
     return QStringList() << ns_vcard;
 }
 
+QStringList QXmppVCardManager::handledNamespaces() const
+{
+    return QStringList() << ns_vcard;
+}
+
 bool QXmppVCardManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq" && QXmppVCardIq::isVCard(element))
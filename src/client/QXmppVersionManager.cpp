@@ -144,6 +144,11 @@ QStringList QXmppVersionManager::discoveryFeatures() const
     return QStringList() << ns_version;
 }
 
+QStringList QXmppVersionManager::handledNamespaces() const
+{
+    return QStringList() << ns_version;
+}
+
 bool QXmppVersionManager::handleStanza(const QDomElement &element)
 {
     if (element.tagName() == "iq" && QXmppVersionIq::isVersionIq(element))
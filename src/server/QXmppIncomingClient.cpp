@@ -222,6 +222,9 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     {
         features.setBindMode(QXmppStreamFeatures::Required);
         features.setSessionMode(QXmppStreamFeatures::Enabled);
+        features.setStreamManagementMode(QXmppStreamFeatures::Enabled);
+        if (!isCompressed())
+            features.setCompressionMethods(availableCompressionMethods());
     }
     else if (d->passwordChecker)
     {
@@ -315,6 +318,47 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
             }
         }
     }
+    else if (ns == ns_compress && nodeRecv.tagName() == QLatin1String("compress"))
+    {
+        const QString method = nodeRecv.firstChildElement("method").text();
+        if (d->jid.isEmpty() || isCompressed() || !availableCompressionMethods().contains(method)) {
+            sendData(QString("<failure xmlns=\"%1\"><unsupported-method/></failure>").arg(ns_compress).toUtf8());
+            return;
+        }
+
+        // the stream restarts once compressed
+        sendData(QString("<compressed xmlns=\"%1\"/>").arg(ns_compress).toUtf8());
+        if (!startCompression(method)) {
+            warning("Could not start stream compression");
+            disconnectFromHost();
+            return;
+        }
+        handleStart();
+    }
+    else if (ns == ns_stream_management)
+    {
+        if (nodeRecv.tagName() == QLatin1String("enable"))
+        {
+            // stream management can only be enabled once a resource is bound
+            if (d->resource.isEmpty()) {
+                sendData(QString("<failed xmlns=\"%1\"><unexpected-request xmlns=\"%2\"/></failed>").arg(
+                    ns_stream_management, ns_stanza).toUtf8());
+                return;
+            }
+
+            // the session is not kept after a disconnection, so we do not
+            // offer to resume it
+            sendData(QString("<enabled xmlns=\"%1\"/>").arg(ns_stream_management).toUtf8());
+            enableStanzaCount();
+            enableStanzaQueue();
+        }
+        else if (nodeRecv.tagName() == QLatin1String("resume"))
+        {
+            // sessions are never offered for resumption, see above
+            sendData(QString("<failed xmlns=\"%1\"><item-not-found xmlns=\"%2\"/></failed>").arg(
+                ns_stream_management, ns_stanza).toUtf8());
+        }
+    }
     else if (ns == ns_client)
     {
         if (nodeRecv.tagName() == QLatin1String("iq"))
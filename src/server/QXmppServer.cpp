@@ -31,6 +31,7 @@
 
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
+#include "QXmppDispatchIndex_p.h"
 #include "QXmppIq.h"
 #include "QXmppIncomingClient.h"
 #include "QXmppIncomingServer.h"
@@ -39,6 +40,7 @@
 #include "QXmppServer.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
+#include "QXmppStanzaWriter_p.h"
 #include "QXmppUtils.h"
 
 static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
@@ -77,6 +79,7 @@ public:
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
     bool routeData(const QString &to, const QByteArray &data);
+    bool routeTemplate(const QXmppStanzaTemplate &stanza, const QSet<QString> &recipients);
     void startExtensions();
     void stopExtensions();
 
@@ -85,8 +88,10 @@ public:
 
     QString domain;
     QList<QXmppServerExtension*> extensions;
+    QXmppDispatchIndex<QXmppServerExtension> extensionIndex;
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
+    QXmppStanzaWriter writer;
 
     // client-to-server
     QXmppSslServer *serverForClients;
@@ -186,16 +191,31 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     }
 }
 
+/// Routes a stanza template to each of the given recipients.
+///
+/// \param stanza
+/// \param recipients
+
+bool QXmppServerPrivate::routeTemplate(const QXmppStanzaTemplate &stanza, const QSet<QString> &recipients)
+{
+    bool routed = true;
+    foreach (const QString &to, recipients) {
+        if (!routeData(to, stanza.data(to)))
+            routed = false;
+    }
+    return routed;
+}
+
 /// Handles an incoming XML element.
 ///
 /// \param server
-/// \param stream
+/// \param extensions the extensions which handle the element's payload
 /// \param element
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+static void handleStanza(QXmppServer *server, const QList<QXmppServerExtension*> &extensions, const QDomElement &element)
 {
     // try extensions
-    foreach (QXmppServerExtension *extension, server->extensions())
+    foreach (QXmppServerExtension *extension, extensions)
         if (extension->handleStanza(element))
             return;
 
@@ -345,10 +365,12 @@ void QXmppServer::addExtension(QXmppServerExtension *extension)
         QXmppServerExtension *other = d->extensions[i];
         if (other->extensionPriority() < extension->extensionPriority()) {
             d->extensions.insert(i, extension);
+            d->extensionIndex.rebuild(d->extensions);
             return;
         }
     }
     d->extensions << extension;
+    d->extensionIndex.rebuild(d->extensions);
 }
 
 /// Returns the list of loaded extensions.
@@ -550,13 +572,33 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
 bool QXmppServer::sendElement(const QDomElement &element)
 {
     // serialize data
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
     const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
-    helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
+    d->writer.clear();
+    helperToXmlAddDomElement(d->writer.xmlWriter(), element, omitNamespaces);
+
+    // route data
+    return d->routeData(element.attribute("to"), d->writer.data());
+}
+
+/// Route an XMPP stanza to several recipients, for instance a presence
+/// to a user's subscribers.
+///
+/// The stanza is serialized once and only its "to" attribute is replaced
+/// for each recipient. Returns true if it could be routed to every
+/// recipient.
+///
+/// \param element
+/// \param recipients
+
+bool QXmppServer::sendElement(const QDomElement &element, const QSet<QString> &recipients)
+{
+    // serialize data
+    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
+    d->writer.clear();
+    helperToXmlAddDomElement(d->writer.xmlWriter(), element, omitNamespaces);
 
     // route data
-    return d->routeData(element.attribute("to"), data);
+    return d->routeTemplate(QXmppStanzaTemplate(d->writer.data()), recipients);
 }
 
 /// Route an XMPP packet.
@@ -565,13 +607,24 @@ bool QXmppServer::sendElement(const QDomElement &element)
 
 bool QXmppServer::sendPacket(const QXmppStanza &packet)
 {
-    // serialize data
-    QByteArray data;
-    QXmlStreamWriter xmlStream(&data);
-    packet.toXml(&xmlStream);
+    // route data
+    return d->routeData(packet.to(), d->writer.write(packet));
+}
 
+/// Route an XMPP packet to several recipients, for instance a presence
+/// to a user's subscribers.
+///
+/// The packet is serialized once and only its "to" attribute is replaced
+/// for each recipient. Returns true if it could be routed to every
+/// recipient.
+///
+/// \param packet
+/// \param recipients
+
+bool QXmppServer::sendPacket(const QXmppStanza &packet, const QSet<QString> &recipients)
+{
     // route data
-    return d->routeData(packet.to(), data);
+    return d->routeTemplate(QXmppStanzaTemplate(d->writer.write(packet)), recipients);
 }
 
 /// Add a new incoming client \a stream.
@@ -584,6 +637,8 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
     bool check;
     Q_UNUSED(check);
 
+    // the extensions are loaded before the first element is received
+    d->loadExtensions(this);
     stream->setPasswordChecker(d->passwordChecker);
 
     check = connect(stream, SIGNAL(connected()),
@@ -706,7 +761,7 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
 void QXmppServer::handleElement(const QDomElement &element)
 {
-    handleStanza(this, element);
+    handleStanza(this, d->extensionIndex.candidates(element), element);
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -24,6 +24,7 @@
 #ifndef QXMPPSERVER_H
 #define QXMPPSERVER_H
 
+#include <QSet>
 #include <QTcpServer>
 #include <QVariantMap>
 
@@ -87,7 +88,9 @@ public:
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
 
     bool sendElement(const QDomElement &element);
+    bool sendElement(const QDomElement &element, const QSet<QString> &recipients);
     bool sendPacket(const QXmppStanza &stanza);
+    bool sendPacket(const QXmppStanza &stanza, const QSet<QString> &recipients);
 
     void addIncomingClient(QXmppIncomingClient *stream);
 
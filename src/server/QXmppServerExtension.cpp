@@ -62,6 +62,17 @@ QStringList QXmppServerExtension::discoveryItems() const
     return QStringList();
 }
 
+/// Returns the namespaces of the payloads handled by this extension.
+///
+/// The server only offers a stanza to handleStanza() if one of its child
+/// elements is in one of these namespaces. If the list is empty, which is
+/// the default, the extension is offered every stanza.
+
+QStringList QXmppServerExtension::handledNamespaces() const
+{
+    return QStringList();
+}
+
 /// Returns the extension's name.
 ///
 
@@ -57,6 +57,7 @@ public:
 
     virtual QStringList discoveryFeatures() const;
     virtual QStringList discoveryItems() const;
+    virtual QStringList handledNamespaces() const;
     virtual bool handleStanza(const QDomElement &stanza);
     virtual QSet<QString> presenceSubscribers(const QString &jid);
     virtual QSet<QString> presenceSubscriptions(const QString &jid);
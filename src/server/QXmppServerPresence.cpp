@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerPresence.h"
+#include "QXmppUtils.h"
+
+class QXmppServerPresencePrivate
+{
+public:
+    QXmppServerPresencePrivate(QXmppServerPresence *qq);
+    QSet<QString> subscribers(const QString &jid) const;
+
+    // available presences, by bare JID then full JID
+    QHash<QString, QHash<QString, QXmppPresence> > presences;
+
+private:
+    QXmppServerPresence *q;
+};
+
+QXmppServerPresencePrivate::QXmppServerPresencePrivate(QXmppServerPresence *qq)
+    : q(qq)
+{
+}
+
+/// Collects the subscribers to the given JID's presence from all the
+/// server's extensions.
+///
+/// \param jid
+
+QSet<QString> QXmppServerPresencePrivate::subscribers(const QString &jid) const
+{
+    QSet<QString> recipients;
+    foreach (QXmppServerExtension *extension, q->server()->extensions())
+        recipients += extension->presenceSubscribers(jid);
+    return recipients;
+}
+
+/// Constructs a new presence extension.
+
+QXmppServerPresence::QXmppServerPresence()
+    : d(new QXmppServerPresencePrivate(this))
+{
+}
+
+QXmppServerPresence::~QXmppServerPresence()
+{
+    delete d;
+}
+
+/// Returns the available presences of the given user's resources.
+///
+/// \param bareJid
+
+QList<QXmppPresence> QXmppServerPresence::availablePresences(const QString &bareJid) const
+{
+    return d->presences.value(bareJid).values();
+}
+
+/// \cond
+bool QXmppServerPresence::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() != QLatin1String("presence"))
+        return false;
+
+    // only broadcast the presence which local users send without a
+    // recipient, which the stream addresses to the server's domain
+    const QString domain = server()->domain();
+    const QString to = element.attribute("to");
+    const QString from = element.attribute("from");
+    if ((!to.isEmpty() && to != domain) || QXmppUtils::jidToDomain(from) != domain)
+        return false;
+
+    const QString bareFrom = QXmppUtils::jidToBareJid(from);
+    const QString type = element.attribute("type");
+    if (type.isEmpty()) {
+        QXmppPresence presence;
+        presence.parse(element);
+        d->presences[bareFrom][from] = presence;
+    } else if (type == QLatin1String("unavailable")) {
+        // RFC 6121: unavailable presence is only broadcast if available
+        // presence was sent before
+        if (!d->presences.contains(bareFrom) || !d->presences[bareFrom].remove(from))
+            return true;
+        if (d->presences[bareFrom].isEmpty())
+            d->presences.remove(bareFrom);
+    } else {
+        return false;
+    }
+
+    const QSet<QString> recipients = d->subscribers(from);
+    if (!recipients.isEmpty())
+        server()->sendElement(element, recipients);
+    return true;
+}
+
+bool QXmppServerPresence::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppServerPresence::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+    d->presences.clear();
+}
+/// \endcond
+
+void QXmppServerPresence::_q_clientDisconnected(const QString &jid)
+{
+    // the client went away without sending unavailable presence
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    if (!d->presences.contains(bareJid) || !d->presences[bareJid].remove(jid))
+        return;
+    if (d->presences[bareJid].isEmpty())
+        d->presences.remove(bareJid);
+
+    const QSet<QString> recipients = d->subscribers(jid);
+    if (!recipients.isEmpty()) {
+        QXmppPresence presence(QXmppPresence::Unavailable);
+        presence.setFrom(jid);
+        server()->sendPacket(presence, recipients);
+    }
+}
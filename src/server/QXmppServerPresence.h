@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPRESENCE_H
+#define QXMPPSERVERPRESENCE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppPresence;
+class QXmppServerPresencePrivate;
+
+/// \brief The QXmppServerPresence class is a server extension which
+/// broadcasts the presence of local users.
+///
+/// The available and unavailable presences a user sends without a
+/// recipient are delivered to the subscribers reported by the server's
+/// extensions through QXmppServerExtension::presenceSubscribers(). When a
+/// user who had sent available presence disconnects without sending
+/// unavailable presence, the extension sends it on the user's behalf.
+///
+/// \ingroup Server
+
+class QXMPP_EXPORT QXmppServerPresence : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "presence")
+
+public:
+    QXmppServerPresence();
+    ~QXmppServerPresence();
+
+    QList<QXmppPresence> availablePresences(const QString &bareJid) const;
+
+    /// \cond
+    bool handleStanza(const QDomElement &element);
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+
+private:
+    friend class QXmppServerPresencePrivate;
+    QXmppServerPresencePrivate * const d;
+};
+
+#endif
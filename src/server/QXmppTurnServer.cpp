@@ -0,0 +1,868 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QtEndian>
+
+#include <string.h>
+
+#include "QXmppPasswordChecker.h"
+#include "QXmppServer.h"
+#include "QXmppStun.h"
+#include "QXmppStun_p.h"
+#include "QXmppTurnServer.h"
+#include "QXmppUtils.h"
+#include "QXmppUtils_p.h"
+
+// lifetimes in seconds, see RFC 5766
+#define TURN_DEFAULT_LIFETIME 600
+#define TURN_MAXIMUM_LIFETIME 3600
+#define TURN_PERMISSION_LIFETIME 300
+#define TURN_CHANNEL_LIFETIME 600
+// lifetime of a nonce in seconds
+#define TURN_NONCE_LIFETIME 3600
+// lifetime of a key obtained from the password checker in seconds
+#define TURN_KEY_LIFETIME 300
+// interval between sweeps of expired allocations in milliseconds
+#define TURN_EXPIRE_INTERVAL 5000
+// maximum number of requests queued while a key is being retrieved
+#define TURN_PENDING_MAX 8
+
+static const quint32 STUN_MAGIC = 0x2112A442;
+static const quint8 UDP_PROTOCOL = 17;
+
+/// Returns a hash key for the given address and port, with IPv4
+/// addresses in their IPv4-mapped IPv6 form.
+
+static QByteArray addressKey(const QHostAddress &host, quint16 port = 0)
+{
+    Q_IPV6ADDR addr;
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+        memset(&addr, 0, sizeof(addr));
+        addr[10] = 0xff;
+        addr[11] = 0xff;
+        qToBigEndian(host.toIPv4Address(), &addr[12]);
+    } else {
+        addr = host.toIPv6Address();
+    }
+
+    QByteArray key(sizeof(addr) + 2, 0);
+    memcpy(key.data(), &addr, sizeof(addr));
+    qToBigEndian(port, reinterpret_cast<uchar*>(key.data()) + sizeof(addr));
+    return key;
+}
+
+class QXmppTurnServerAllocation
+{
+public:
+    class Channel
+    {
+    public:
+        QHostAddress host;
+        quint16 port;
+        qint64 expiry;
+    };
+
+    QHostAddress clientHost;
+    quint16 clientPort;
+    QUdpSocket *socket;
+    QUdpSocket *relay;
+
+    QString username;
+    QString user;
+    QByteArray transactionId;
+    QByteArray response;
+    qint64 expiry;
+
+    QHash<QByteArray, qint64> permissions;
+    QHash<quint16, Channel> channels;
+    QHash<QByteArray, quint16> channelsByPeer;
+};
+
+class QXmppTurnServerPrivate
+{
+public:
+    typedef QXmppUdpDatagram Datagram;
+
+    class Key
+    {
+    public:
+        QByteArray key;
+        QXmppHmacSha1 integrity;
+        qint64 expiry;
+    };
+
+    QXmppTurnServerPrivate(QXmppTurnServer *qq);
+    void expire();
+    QByteArray generateNonce() const;
+    bool checkNonce(const QByteArray &nonce) const;
+    void handleChannelData(const Datagram &datagram);
+    void handleDatagram(const Datagram &datagram);
+    void handlePending(const QString &username);
+    void handleRelayDatagram(QXmppTurnServerAllocation *allocation, const Datagram &datagram);
+    void handleRequest(const QXmppStunMessage &request, const QString &user, const QXmppHmacSha1 &integrity, const Datagram &datagram);
+    bool lookupKey(const QString &username, const Datagram &datagram, QString &user, QByteArray &key, QXmppHmacSha1 &integrity);
+    qint64 now() const;
+    void queue(QUdpSocket *socket, const QByteArray &data, const QHostAddress &host, quint16 port);
+    void readyRead(QUdpSocket *socket);
+    void relayReadyRead(QUdpSocket *socket);
+    void removeAllocation(QXmppTurnServerAllocation *allocation);
+    void sendError(const QXmppStunMessage &request, int code, const QString &phrase, const Datagram &datagram, const QXmppHmacSha1 *integrity = 0);
+
+    // configuration
+    QHostAddress host;
+    quint16 port;
+    QByteArray secret;
+    int userQuota;
+    int maximumAllocations;
+    QString realm;
+    QXmppPasswordChecker *passwordChecker;
+
+    // allocations
+    QHash<QByteArray, QXmppTurnServerAllocation*> allocations;
+    QHash<QUdpSocket*, QXmppTurnServerAllocation*> allocationsByRelay;
+    QHash<QString, int> userAllocations;
+
+    // credentials
+    QByteArray nonceKey;
+    QHash<QString, Key> keys;
+    QHash<QXmppPasswordReply*, QString> digestReplies;
+    QHash<QString, QList<Datagram> > digestDatagrams;
+
+    // I/O
+    QList<QUdpSocket*> sockets;
+    QXmppUdpBatch udp;
+    QElapsedTimer clock;
+    QTimer *expireTimer;
+
+    // statistics
+    quint64 bindingRequests;
+    quint64 relayedPackets;
+
+private:
+    QXmppTurnServer *q;
+};
+
+QXmppTurnServerPrivate::QXmppTurnServerPrivate(QXmppTurnServer *qq)
+    : port(3478),
+    userQuota(10),
+    maximumAllocations(50000),
+    passwordChecker(0),
+    expireTimer(0),
+    bindingRequests(0),
+    relayedPackets(0),
+    q(qq)
+{
+}
+
+/// Removes expired allocations, permissions, channels and keys.
+
+void QXmppTurnServerPrivate::expire()
+{
+    const qint64 current = now();
+
+    QList<QXmppTurnServerAllocation*> expired;
+    foreach (QXmppTurnServerAllocation *allocation, allocations) {
+        if (allocation->expiry <= current) {
+            expired << allocation;
+            continue;
+        }
+
+        QHash<QByteArray, qint64>::iterator pit = allocation->permissions.begin();
+        while (pit != allocation->permissions.end()) {
+            if (pit.value() <= current)
+                pit = allocation->permissions.erase(pit);
+            else
+                ++pit;
+        }
+
+        QHash<quint16, QXmppTurnServerAllocation::Channel>::iterator cit = allocation->channels.begin();
+        while (cit != allocation->channels.end()) {
+            if (cit.value().expiry <= current) {
+                allocation->channelsByPeer.remove(addressKey(cit.value().host, cit.value().port));
+                cit = allocation->channels.erase(cit);
+            } else {
+                ++cit;
+            }
+        }
+    }
+    foreach (QXmppTurnServerAllocation *allocation, expired) {
+        q->debug(QString("TURN allocation for %1 port %2 expired").arg(
+            allocation->clientHost.toString(),
+            QString::number(allocation->clientPort)));
+        removeAllocation(allocation);
+    }
+
+    QHash<QString, Key>::iterator kit = keys.begin();
+    while (kit != keys.end()) {
+        if (kit.value().expiry <= current)
+            kit = keys.erase(kit);
+        else
+            ++kit;
+    }
+}
+
+/// Returns a nonce which carries its own expiry time, so that nonces
+/// do not need to be stored.
+
+QByteArray QXmppTurnServerPrivate::generateNonce() const
+{
+    const QByteArray expiry = QByteArray::number(QDateTime::currentDateTime().toTime_t() + TURN_NONCE_LIFETIME, 16);
+    return expiry + ':' + QXmppUtils::generateHmacSha1(nonceKey, expiry).left(8).toHex();
+}
+
+/// Returns true if the nonce was issued by this server and has not expired.
+
+bool QXmppTurnServerPrivate::checkNonce(const QByteArray &nonce) const
+{
+    const int pos = nonce.indexOf(':');
+    if (pos < 0)
+        return false;
+
+    bool ok = false;
+    const QByteArray expiry = nonce.left(pos);
+    const uint timestamp = expiry.toUInt(&ok, 16);
+    return ok && timestamp >= QDateTime::currentDateTime().toTime_t() &&
+        nonce.mid(pos + 1) == QXmppUtils::generateHmacSha1(nonceKey, expiry).left(8).toHex();
+}
+
+void QXmppTurnServerPrivate::handleChannelData(const Datagram &datagram)
+{
+    const QByteArray &data = datagram.data;
+    const uchar *header = reinterpret_cast<const uchar*>(data.constData());
+    const quint16 channel = qFromBigEndian<quint16>(header);
+    const quint16 length = qFromBigEndian<quint16>(header + 2);
+    if (4 + length > data.size())
+        return;
+
+    QXmppTurnServerAllocation *allocation = allocations.value(addressKey(datagram.host, datagram.port));
+    if (!allocation)
+        return;
+
+    QHash<quint16, QXmppTurnServerAllocation::Channel>::const_iterator it = allocation->channels.constFind(channel);
+    if (it == allocation->channels.constEnd() || it.value().expiry <= now())
+        return;
+
+    queue(allocation->relay, data.mid(4, length), it.value().host, it.value().port);
+    relayedPackets++;
+}
+
+void QXmppTurnServerPrivate::handleDatagram(const Datagram &datagram)
+{
+    const QByteArray &data = datagram.data;
+
+    // ChannelData messages start with 0b01
+    if (data.size() >= 4 && (data.at(0) & 0xc0) == 0x40) {
+        handleChannelData(datagram);
+        return;
+    }
+
+    quint32 cookie;
+    QByteArray id;
+    const quint16 type = QXmppStunMessage::peekType(data, cookie, id);
+    if (!type || cookie != STUN_MAGIC)
+        return;
+
+    QXmppStunMessage message;
+    QStringList errors;
+    if (!message.decode(data, QByteArray(), &errors)) {
+        foreach (const QString &error, errors)
+            q->warning(error);
+        return;
+    }
+
+    const quint16 messageClass = message.messageClass();
+    const quint16 messageMethod = message.messageMethod();
+    if (messageMethod == QXmppStunMessage::Binding && messageClass == QXmppStunMessage::Request) {
+
+        // binding requests need no authentication
+        QXmppStunMessage response;
+        response.setType(QXmppStunMessage::Binding | QXmppStunMessage::Response);
+        response.setId(message.id());
+        response.xorMappedHost = datagram.host;
+        response.xorMappedPort = datagram.port;
+        queue(datagram.socket, response.encode(), datagram.host, datagram.port);
+        bindingRequests++;
+
+    } else if (messageMethod == QXmppStunMessage::Send && messageClass == QXmppStunMessage::Indication) {
+
+        // relay data to a peer
+        QXmppTurnServerAllocation *allocation = allocations.value(addressKey(datagram.host, datagram.port));
+        if (!allocation || allocation->permissions.value(addressKey(message.xorPeerHost)) <= now())
+            return;
+
+        queue(allocation->relay, message.data(), message.xorPeerHost, message.xorPeerPort);
+        relayedPackets++;
+
+    } else if (messageClass == QXmppStunMessage::Request) {
+
+        // TURN requests need long-term credentials
+        if (!message.hasMessageIntegrity() || message.username().isEmpty() || message.realm() != realm) {
+            sendError(message, 401, "Unauthorized", datagram);
+            return;
+        }
+        if (!checkNonce(message.nonce())) {
+            sendError(message, 438, "Stale Nonce", datagram);
+            return;
+        }
+
+        QString user;
+        QByteArray key;
+        QXmppHmacSha1 integrity;
+        if (!lookupKey(message.username(), datagram, user, key, integrity))
+            return;
+        if (key.isEmpty() || !QXmppStunCodec::decode(message, data, &integrity)) {
+            q->warning(QString("TURN authentication failed for %1").arg(message.username()));
+            sendError(message, 401, "Unauthorized", datagram);
+            return;
+        }
+
+        handleRequest(message, user, integrity, datagram);
+    }
+}
+
+/// Handles the requests which were waiting for the given user's key.
+
+void QXmppTurnServerPrivate::handlePending(const QString &username)
+{
+    foreach (const Datagram &datagram, digestDatagrams.take(username))
+        handleDatagram(datagram);
+    udp.flush();
+}
+
+/// Relays a datagram received from a peer to the client.
+
+void QXmppTurnServerPrivate::handleRelayDatagram(QXmppTurnServerAllocation *allocation, const Datagram &datagram)
+{
+    const qint64 current = now();
+    if (allocation->permissions.value(addressKey(datagram.host)) <= current)
+        return;
+
+    QByteArray packet;
+    const quint16 channel = allocation->channelsByPeer.value(addressKey(datagram.host, datagram.port));
+    if (channel && allocation->channels.value(channel).expiry > current) {
+        packet.resize(4 + datagram.data.size());
+        uchar *header = reinterpret_cast<uchar*>(packet.data());
+        qToBigEndian(channel, header);
+        qToBigEndian(quint16(datagram.data.size()), header + 2);
+        memcpy(packet.data() + 4, datagram.data.constData(), datagram.data.size());
+    } else {
+        QXmppStunMessage indication;
+        indication.setType(QXmppStunMessage::Data | QXmppStunMessage::Indication);
+        indication.setId(QXmppUtils::generateRandomBytes(12));
+        indication.xorPeerHost = datagram.host;
+        indication.xorPeerPort = datagram.port;
+        indication.setData(datagram.data);
+        packet = indication.encode(QByteArray(), false);
+    }
+
+    queue(allocation->socket, packet, allocation->clientHost, allocation->clientPort);
+    relayedPackets++;
+}
+
+/// Handles an authenticated TURN request.
+
+void QXmppTurnServerPrivate::handleRequest(const QXmppStunMessage &request, const QString &user, const QXmppHmacSha1 &integrity, const Datagram &datagram)
+{
+    const qint64 current = now();
+    const quint16 method = request.messageMethod();
+    QXmppTurnServerAllocation *allocation = allocations.value(addressKey(datagram.host, datagram.port));
+
+    QXmppStunMessage response;
+    response.setType(method | QXmppStunMessage::Response);
+    response.setId(request.id());
+
+    if (method == QXmppStunMessage::Allocate) {
+
+        if (allocation) {
+            // retransmitted request
+            if (allocation->transactionId == request.id())
+                queue(datagram.socket, allocation->response, datagram.host, datagram.port);
+            else
+                sendError(request, 437, "Allocation Mismatch", datagram, &integrity);
+            return;
+        }
+        if (request.requestedTransport() != UDP_PROTOCOL) {
+            sendError(request, 442, "Unsupported Transport Protocol", datagram, &integrity);
+            return;
+        }
+        if (userAllocations.value(user) >= userQuota) {
+            sendError(request, 486, "Allocation Quota Reached", datagram, &integrity);
+            return;
+        }
+        if (allocations.size() >= maximumAllocations) {
+            sendError(request, 508, "Insufficient Capacity", datagram, &integrity);
+            return;
+        }
+
+        QUdpSocket *relay = new QUdpSocket(q);
+        if (!relay->bind(datagram.socket->localAddress(), 0)) {
+            q->warning(QString("Could not bind TURN relay on %1").arg(datagram.socket->localAddress().toString()));
+            delete relay;
+            sendError(request, 508, "Insufficient Capacity", datagram, &integrity);
+            return;
+        }
+
+        bool check;
+        Q_UNUSED(check);
+        check = QObject::connect(relay, SIGNAL(readyRead()),
+                                 q, SLOT(_q_relayReadyRead()));
+        Q_ASSERT(check);
+
+        // the requested lifetime is only used if it exceeds the default
+        quint32 lifetime = TURN_DEFAULT_LIFETIME;
+        if (request.hasLifetime())
+            lifetime = qBound(quint32(TURN_DEFAULT_LIFETIME), request.lifetime(), quint32(TURN_MAXIMUM_LIFETIME));
+
+        allocation = new QXmppTurnServerAllocation;
+        allocation->clientHost = datagram.host;
+        allocation->clientPort = datagram.port;
+        allocation->socket = datagram.socket;
+        allocation->relay = relay;
+        allocation->username = request.username();
+        allocation->user = user;
+        allocation->transactionId = request.id();
+        allocation->expiry = current + lifetime * 1000;
+
+        response.xorRelayedHost = relay->localAddress();
+        response.xorRelayedPort = relay->localPort();
+        response.xorMappedHost = datagram.host;
+        response.xorMappedPort = datagram.port;
+        response.setLifetime(lifetime);
+        allocation->response = QXmppStunCodec::encode(response, &integrity);
+
+        allocations.insert(addressKey(datagram.host, datagram.port), allocation);
+        allocationsByRelay.insert(relay, allocation);
+        userAllocations[user]++;
+
+        q->info(QString("TURN allocation for %1 at %2 port %3 relayed on port %4").arg(
+            user, datagram.host.toString(), QString::number(datagram.port),
+            QString::number(relay->localPort())));
+        queue(datagram.socket, allocation->response, datagram.host, datagram.port);
+        return;
+    }
+
+    // all other requests refer to an existing allocation
+    if (!allocation || allocation->username != request.username()) {
+        sendError(request, 437, "Allocation Mismatch", datagram, &integrity);
+        return;
+    }
+
+    if (method == QXmppStunMessage::Refresh) {
+
+        // a request without LIFETIME asks for the default lifetime, see
+        // RFC 5766 section 7.2
+        quint32 lifetime = TURN_DEFAULT_LIFETIME;
+        if (request.hasLifetime())
+            lifetime = qMin(request.lifetime(), quint32(TURN_MAXIMUM_LIFETIME));
+        response.setLifetime(lifetime);
+        queue(datagram.socket, QXmppStunCodec::encode(response, &integrity), datagram.host, datagram.port);
+        if (lifetime)
+            allocation->expiry = current + lifetime * 1000;
+        else
+            removeAllocation(allocation);
+
+    } else if (method == QXmppStunMessage::CreatePermission) {
+
+        if (request.xorPeerHost.isNull()) {
+            sendError(request, 400, "Bad Request", datagram, &integrity);
+            return;
+        }
+        allocation->permissions.insert(addressKey(request.xorPeerHost), current + TURN_PERMISSION_LIFETIME * 1000);
+        queue(datagram.socket, QXmppStunCodec::encode(response, &integrity), datagram.host, datagram.port);
+
+    } else if (method == QXmppStunMessage::ChannelBind) {
+
+        const quint16 channel = request.channelNumber();
+        const QByteArray peerKey = addressKey(request.xorPeerHost, request.xorPeerPort);
+        const quint16 boundChannel = allocation->channelsByPeer.value(peerKey);
+        if (channel < 0x4000 || channel > 0x7ffe || request.xorPeerHost.isNull() ||
+            (boundChannel && boundChannel != channel) ||
+            (!boundChannel && allocation->channels.contains(channel))) {
+            sendError(request, 400, "Bad Request", datagram, &integrity);
+            return;
+        }
+
+        QXmppTurnServerAllocation::Channel &binding = allocation->channels[channel];
+        binding.host = request.xorPeerHost;
+        binding.port = request.xorPeerPort;
+        binding.expiry = current + TURN_CHANNEL_LIFETIME * 1000;
+        allocation->channelsByPeer.insert(peerKey, channel);
+        allocation->permissions.insert(addressKey(request.xorPeerHost), current + TURN_PERMISSION_LIFETIME * 1000);
+        queue(datagram.socket, QXmppStunCodec::encode(response, &integrity), datagram.host, datagram.port);
+
+    } else {
+        sendError(request, 400, "Bad Request", datagram, &integrity);
+    }
+}
+
+/// Looks up the long-term credentials key for the given username, along
+/// with the HMAC context used to check and sign messages.
+///
+/// Returns false if the key is being retrieved from the password checker,
+/// in which case the datagram will be handled again once it is available.
+
+bool QXmppTurnServerPrivate::lookupKey(const QString &username, const Datagram &datagram, QString &user, QByteArray &key, QXmppHmacSha1 &integrity)
+{
+    if (!secret.isEmpty()) {
+        // time-limited credentials
+        const int pos = username.indexOf(':');
+        bool ok = false;
+        const uint expiry = username.left(pos).toUInt(&ok);
+        if (pos < 0 || !ok || expiry < QDateTime::currentDateTime().toTime_t())
+            return true;
+
+        user = username.mid(pos + 1);
+        key = QCryptographicHash::hash(
+            (username + ":" + realm + ":" + q->password(username)).toUtf8(),
+            QCryptographicHash::Md5);
+        integrity = QXmppHmacSha1(key);
+        return true;
+    }
+
+    user = username;
+    QHash<QString, Key>::const_iterator it = keys.constFind(username);
+    if (it != keys.constEnd()) {
+        key = it.value().key;
+        integrity = it.value().integrity;
+        return true;
+    }
+
+    if (!passwordChecker)
+        return true;
+
+    // queue the datagram until the password checker replies, taking a
+    // copy as it points into the receive buffer
+    QList<Datagram> &pending = digestDatagrams[username];
+    if (pending.size() < TURN_PENDING_MAX) {
+        Datagram copy = datagram;
+        copy.data = QByteArray(datagram.data.constData(), datagram.data.size());
+        pending << copy;
+    }
+    if (pending.size() == 1) {
+        QXmppPasswordRequest request;
+        request.setDomain(realm);
+        request.setUsername(username);
+        QXmppPasswordReply *reply = passwordChecker->getDigest(request);
+        digestReplies.insert(reply, username);
+
+        bool check;
+        Q_UNUSED(check);
+        check = QObject::connect(reply, SIGNAL(finished()),
+                                 q, SLOT(_q_digestFinished()));
+        Q_ASSERT(check);
+    }
+    return false;
+}
+
+/// Returns the number of milliseconds since the server was started.
+
+qint64 QXmppTurnServerPrivate::now() const
+{
+    return clock.elapsed();
+}
+
+void QXmppTurnServerPrivate::queue(QUdpSocket *socket, const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    udp.queueDatagram(data, host, port, socket);
+}
+
+/// Handles the datagrams received by a listening socket, in batches.
+
+void QXmppTurnServerPrivate::readyRead(QUdpSocket *socket)
+{
+    while (udp.readDatagrams(socket)) {
+        foreach (const Datagram &datagram, udp.datagrams())
+            handleDatagram(datagram);
+        udp.flush();
+    }
+}
+
+/// Handles the datagrams received by a relay socket, in batches.
+
+void QXmppTurnServerPrivate::relayReadyRead(QUdpSocket *socket)
+{
+    QXmppTurnServerAllocation *allocation = allocationsByRelay.value(socket);
+    while (udp.readDatagrams(socket)) {
+        if (allocation) {
+            foreach (const Datagram &datagram, udp.datagrams())
+                handleRelayDatagram(allocation, datagram);
+        }
+        udp.flush();
+    }
+}
+
+void QXmppTurnServerPrivate::removeAllocation(QXmppTurnServerAllocation *allocation)
+{
+    allocations.remove(addressKey(allocation->clientHost, allocation->clientPort));
+    allocationsByRelay.remove(allocation->relay);
+    if (--userAllocations[allocation->user] <= 0)
+        userAllocations.remove(allocation->user);
+
+    // the relay may be emitting a signal
+    allocation->relay->close();
+    allocation->relay->deleteLater();
+    delete allocation;
+}
+
+void QXmppTurnServerPrivate::sendError(const QXmppStunMessage &request, int code, const QString &phrase, const Datagram &datagram, const QXmppHmacSha1 *integrity)
+{
+    QXmppStunMessage response;
+    response.setType(request.messageMethod() | QXmppStunMessage::Error);
+    response.setId(request.id());
+    response.errorCode = code;
+    response.errorPhrase = phrase;
+    if (code == 401 || code == 438) {
+        response.setNonce(generateNonce());
+        response.setRealm(realm);
+    }
+    queue(datagram.socket, QXmppStunCodec::encode(response, integrity), datagram.host, datagram.port);
+}
+
+/// Constructs a new TURN server extension.
+
+QXmppTurnServer::QXmppTurnServer()
+    : d(new QXmppTurnServerPrivate(this))
+{
+}
+
+QXmppTurnServer::~QXmppTurnServer()
+{
+    stop();
+    delete d;
+}
+
+/// Returns the address on which the server listens.
+
+QHostAddress QXmppTurnServer::host() const
+{
+    return d->host;
+}
+
+/// Sets the address on which the server listens.
+///
+/// Relayed transport addresses are allocated on the same address, so it
+/// must be a specific address reachable by clients and peers.
+///
+/// \param host
+
+void QXmppTurnServer::setHost(const QHostAddress &host)
+{
+    d->host = host;
+}
+
+/// Returns the UDP port on which the server listens.
+
+quint16 QXmppTurnServer::port() const
+{
+    return d->port;
+}
+
+/// Sets the UDP port on which the server listens, 3478 by default.
+///
+/// \param port
+
+void QXmppTurnServer::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the shared secret used for time-limited credentials.
+
+QByteArray QXmppTurnServer::secret() const
+{
+    return d->secret;
+}
+
+/// Sets the shared secret used for time-limited credentials.
+///
+/// If the secret is empty, credentials are checked against the server's
+/// QXmppPasswordChecker instead.
+///
+/// \param secret
+
+void QXmppTurnServer::setSecret(const QByteArray &secret)
+{
+    d->secret = secret;
+}
+
+/// Returns the maximum number of allocations per user.
+
+int QXmppTurnServer::userQuota() const
+{
+    return d->userQuota;
+}
+
+/// Sets the maximum number of allocations per user, 10 by default.
+///
+/// \param quota
+
+void QXmppTurnServer::setUserQuota(int quota)
+{
+    d->userQuota = quota;
+}
+
+/// Returns the maximum number of allocations.
+
+int QXmppTurnServer::maximumAllocations() const
+{
+    return d->maximumAllocations;
+}
+
+/// Sets the maximum number of allocations, 50000 by default.
+///
+/// \param maximum
+
+void QXmppTurnServer::setMaximumAllocations(int maximum)
+{
+    d->maximumAllocations = maximum;
+}
+
+/// Returns the time-limited password for the given username, which should
+/// be of the form "expiry:user".
+///
+/// If no shared secret is set, returns an empty string.
+///
+/// \param username
+
+QString QXmppTurnServer::password(const QString &username) const
+{
+    if (d->secret.isEmpty())
+        return QString();
+    return QString::fromLatin1(QXmppUtils::generateHmacSha1(d->secret, username.toUtf8()).toBase64());
+}
+
+QVariantMap QXmppTurnServer::statistics() const
+{
+    QVariantMap stats;
+    stats["allocations"] = d->allocations.size();
+    stats["users"] = d->userAllocations.size();
+    stats["binding-requests"] = d->bindingRequests;
+    stats["relayed-packets"] = d->relayedPackets;
+    return stats;
+}
+
+bool QXmppTurnServer::start()
+{
+    if (d->host.isNull() || d->host == QHostAddress::Any || d->host == QHostAddress::AnyIPv6) {
+        warning("TURN server needs a specific host address");
+        return false;
+    }
+
+    QUdpSocket *socket = new QUdpSocket(this);
+    if (!socket->bind(d->host, d->port)) {
+        warning(QString("TURN server could not bind to %1 port %2").arg(
+            d->host.toString(), QString::number(d->port)));
+        delete socket;
+        return false;
+    }
+
+    bool check;
+    Q_UNUSED(check);
+    check = connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_readyRead()));
+    Q_ASSERT(check);
+    d->sockets << socket;
+
+    d->realm = server()->domain();
+    d->passwordChecker = server()->passwordChecker();
+    if (d->secret.isEmpty() && !d->passwordChecker)
+        warning("TURN server has neither a shared secret nor a password checker");
+
+    d->nonceKey = QXmppUtils::generateRandomBytes(20);
+    d->allocations.reserve(d->maximumAllocations);
+    d->allocationsByRelay.reserve(d->maximumAllocations);
+    d->clock.start();
+
+    d->expireTimer = new QTimer(this);
+    d->expireTimer->setInterval(TURN_EXPIRE_INTERVAL);
+    check = connect(d->expireTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_expire()));
+    Q_ASSERT(check);
+    d->expireTimer->start();
+
+    info(QString("TURN server listening on %1 port %2").arg(
+        d->host.toString(), QString::number(d->port)));
+    return true;
+}
+
+void QXmppTurnServer::stop()
+{
+    foreach (QXmppTurnServerAllocation *allocation, d->allocations.values())
+        d->removeAllocation(allocation);
+
+    foreach (QXmppPasswordReply *reply, d->digestReplies.keys())
+        reply->deleteLater();
+    d->digestReplies.clear();
+    d->digestDatagrams.clear();
+    d->keys.clear();
+
+    foreach (QUdpSocket *socket, d->sockets)
+        delete socket;
+    d->sockets.clear();
+    d->udp.clearQueue();
+
+    delete d->expireTimer;
+    d->expireTimer = 0;
+}
+
+void QXmppTurnServer::_q_digestFinished()
+{
+    QXmppPasswordReply *reply = qobject_cast<QXmppPasswordReply*>(sender());
+    if (!reply || !d->digestReplies.contains(reply))
+        return;
+    reply->deleteLater();
+
+    // cache the key, an empty key rejects the user
+    const QString username = d->digestReplies.take(reply);
+    QXmppTurnServerPrivate::Key &key = d->keys[username];
+    key.key = (reply->error() == QXmppPasswordReply::NoError) ? reply->digest() : QByteArray();
+    key.integrity = QXmppHmacSha1(key.key);
+    key.expiry = d->now() + TURN_KEY_LIFETIME * 1000;
+
+    // handle the pending requests
+    d->handlePending(username);
+}
+
+void QXmppTurnServer::_q_expire()
+{
+    d->expire();
+}
+
+void QXmppTurnServer::_q_readyRead()
+{
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (socket)
+        d->readyRead(socket);
+}
+
+void QXmppTurnServer::_q_relayReadyRead()
+{
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (socket)
+        d->relayReadyRead(socket);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTURNSERVER_H
+#define QXMPPTURNSERVER_H
+
+#include <QHostAddress>
+
+#include "QXmppServerExtension.h"
+
+class QXmppTurnServerPrivate;
+
+/// \brief The QXmppTurnServer class is a server extension which acts as a
+/// STUN (RFC 5389) and TURN (RFC 5766) server over UDP.
+///
+/// Binding requests are answered without authentication. TURN requests use
+/// long-term credentials whose realm is the server's domain:
+///
+///  - if a shared secret is set, the username has the form
+///    "expiry:user" where expiry is a UNIX timestamp, and the password is
+///    the base64-encoded HMAC-SHA1 of the username keyed with the secret,
+///    as returned by password().
+///  - otherwise, the username is the XMPP user's name and the key is
+///    obtained from the server's QXmppPasswordChecker using getDigest().
+///
+/// Each user may hold at most userQuota() allocations, and the server holds
+/// at most maximumAllocations() allocations in total.
+///
+/// \ingroup Server
+
+class QXMPP_EXPORT QXmppTurnServer : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "turn")
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+    Q_PROPERTY(QByteArray secret READ secret WRITE setSecret)
+    Q_PROPERTY(int userQuota READ userQuota WRITE setUserQuota)
+    Q_PROPERTY(int maximumAllocations READ maximumAllocations WRITE setMaximumAllocations)
+
+public:
+    QXmppTurnServer();
+    ~QXmppTurnServer();
+
+    QHostAddress host() const;
+    void setHost(const QHostAddress &host);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    QByteArray secret() const;
+    void setSecret(const QByteArray &secret);
+
+    int userQuota() const;
+    void setUserQuota(int quota);
+
+    int maximumAllocations() const;
+    void setMaximumAllocations(int maximum);
+
+    QString password(const QString &username) const;
+
+    /// \cond
+    QVariantMap statistics() const;
+
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_digestFinished();
+    void _q_expire();
+    void _q_readyRead();
+    void _q_relayReadyRead();
+
+private:
+    friend class QXmppTurnServerPrivate;
+    QXmppTurnServerPrivate * const d;
+};
+
+#endif
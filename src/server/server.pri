@@ -7,7 +7,9 @@ INSTALL_HEADERS += \
     server/QXmppPasswordChecker.h \
     server/QXmppServer.h \
     server/QXmppServerExtension.h \
-    server/QXmppServerPlugin.h
+    server/QXmppServerPresence.h \
+    server/QXmppServerPlugin.h \
+    server/QXmppTurnServer.h
 
 # Source files
 SOURCES += \
@@ -17,4 +19,6 @@ SOURCES += \
     server/QXmppOutgoingServer.cpp \
     server/QXmppPasswordChecker.cpp \
     server/QXmppServer.cpp \
-    server/QXmppServerExtension.cpp
+    server/QXmppServerExtension.cpp \
+    server/QXmppServerPresence.cpp \
+    server/QXmppTurnServer.cpp
@@ -25,6 +25,11 @@ LIBS += $$QXMPP_INTERNAL_LIBS
     LIBS += -lvpx
 }
 
+!isEmpty(QXMPP_USE_ZLIB) {
+    DEFINES += QXMPP_USE_ZLIB
+    LIBS += -lz
+}
+
 #!isEmpty(QXMPP_USE_H264) {
     DEFINES += QXMPP_USE_H264 __STDC_CONSTANT_MACROS
     win32: LIBS += -L$$PWD/../3rd-party/lib
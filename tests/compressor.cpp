@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QtTest>
+
+#include "QXmppCompressor_p.h"
+
+#include "compressor.h"
+
+void tst_QXmppCompressor::testBatch()
+{
+#ifdef QXMPP_USE_ZLIB
+    const QByteArray first("<message to=\"foo@example.com\"><body>Hello</body></message>");
+    const QByteArray second("<presence to=\"foo@example.com\"/>");
+
+    QXmppCompressor compressor;
+    QXmppDecompressor decompressor(4096);
+    QVERIFY(compressor.isValid());
+    QVERIFY(decompressor.isValid());
+
+    // several stanzas share a single flush
+    QByteArray compressed = compressor.compress(first);
+    compressed += compressor.compress(second);
+    compressed += compressor.flush();
+
+    QByteArray output;
+    QVERIFY(decompressor.decompress(compressed, output));
+    QCOMPARE(output, first + second);
+
+    // the stream carries on after a flush
+    compressed = compressor.compress(first);
+    compressed += compressor.flush();
+
+    output.clear();
+    QVERIFY(decompressor.decompress(compressed, output));
+    QCOMPARE(output, first);
+#endif
+}
+
+void tst_QXmppCompressor::testInvalid()
+{
+#ifdef QXMPP_USE_ZLIB
+    QXmppDecompressor decompressor(4096);
+    QByteArray output;
+    QVERIFY(!decompressor.decompress("<stream:stream>", output));
+#endif
+}
+
+void tst_QXmppCompressor::testMaximumSize()
+{
+#ifdef QXMPP_USE_ZLIB
+    QXmppCompressor compressor;
+    QByteArray compressed = compressor.compress(QByteArray(8192, ' '));
+    compressed += compressor.flush();
+
+    QXmppDecompressor decompressor(4096);
+    QByteArray output;
+    QVERIFY(!decompressor.decompress(compressed, output));
+#endif
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomDocument>
+#include <QStringList>
+#include <QtTest>
+
+#include "QXmppDispatchIndex_p.h"
+
+#include "dispatch.h"
+
+class TestExtension
+{
+public:
+    TestExtension(const QStringList &namespaces)
+        : m_namespaces(namespaces)
+    {
+    }
+
+    QStringList handledNamespaces() const
+    {
+        return m_namespaces;
+    }
+
+private:
+    QStringList m_namespaces;
+};
+
+static QDomElement parseElement(const QByteArray &xml)
+{
+    QDomDocument doc;
+    doc.setContent(xml, true);
+    return doc.documentElement();
+}
+
+void tst_QXmppDispatchIndex::testCandidates()
+{
+    TestExtension version(QStringList() << "jabber:iq:version");
+    TestExtension disco(QStringList() << "http://jabber.org/protocol/disco#info"
+                                      << "http://jabber.org/protocol/disco#items");
+    TestExtension receipts(QStringList() << "urn:xmpp:receipts");
+
+    QXmppDispatchIndex<TestExtension> index;
+    index.rebuild(QList<TestExtension*>() << &version << &disco << &receipts);
+
+    QList<TestExtension*> found = index.candidates(parseElement(
+        "<iq xmlns=\"jabber:client\" type=\"get\"><query xmlns=\"http://jabber.org/protocol/disco#items\"/></iq>"));
+    QCOMPARE(found.size(), 1);
+    QVERIFY(found[0] == &disco);
+
+    // extensions are returned once, in priority order
+    found = index.candidates(parseElement(
+        "<message xmlns=\"jabber:client\"><request xmlns=\"urn:xmpp:receipts\"/>"
+        "<query xmlns=\"jabber:iq:version\"/><received xmlns=\"urn:xmpp:receipts\"/></message>"));
+    QCOMPARE(found.size(), 2);
+    QVERIFY(found[0] == &version);
+    QVERIFY(found[1] == &receipts);
+
+    found = index.candidates(parseElement(
+        "<message xmlns=\"jabber:client\"><body>hello</body></message>"));
+    QCOMPARE(found.size(), 0);
+}
+
+void tst_QXmppDispatchIndex::testMerge()
+{
+    TestExtension version(QStringList() << "jabber:iq:version");
+    TestExtension any((QStringList()));
+    TestExtension receipts(QStringList() << "urn:xmpp:receipts");
+
+    QXmppDispatchIndex<TestExtension> index;
+    index.rebuild(QList<TestExtension*>() << &version << &any << &receipts);
+
+    // a single namespace uses the list built with the index
+    const QDomElement request = parseElement(
+        "<message xmlns=\"jabber:client\"><request xmlns=\"urn:xmpp:receipts\"/></message>");
+    QList<TestExtension*> found = index.candidates(request);
+    QCOMPARE(found.size(), 2);
+    QVERIFY(found[0] == &any);
+    QVERIFY(found[1] == &receipts);
+    QVERIFY(found.isSharedWith(index.candidates(request)));
+
+    // several namespaces are merged in priority order
+    found = index.candidates(parseElement(
+        "<message xmlns=\"jabber:client\"><request xmlns=\"urn:xmpp:receipts\"/>"
+        "<query xmlns=\"jabber:iq:version\"/><received xmlns=\"urn:xmpp:receipts\"/></message>"));
+    QCOMPARE(found.size(), 3);
+    QVERIFY(found[0] == &version);
+    QVERIFY(found[1] == &any);
+    QVERIFY(found[2] == &receipts);
+}
+
+void tst_QXmppDispatchIndex::testWildcard()
+{
+    TestExtension version(QStringList() << "jabber:iq:version");
+    TestExtension any((QStringList()));
+
+    QXmppDispatchIndex<TestExtension> index;
+    index.rebuild(QList<TestExtension*>() << &any << &version);
+
+    QList<TestExtension*> found = index.candidates(parseElement(
+        "<iq xmlns=\"jabber:client\" type=\"get\"><query xmlns=\"jabber:iq:version\"/></iq>"));
+    QCOMPARE(found.size(), 2);
+    QVERIFY(found[0] == &any);
+    QVERIFY(found[1] == &version);
+
+    found = index.candidates(parseElement(
+        "<message xmlns=\"jabber:client\"><body>hello</body></message>"));
+    QCOMPARE(found.size(), 1);
+    QVERIFY(found[0] == &any);
+}
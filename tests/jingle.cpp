@@ -114,6 +114,37 @@ void TestJingle::testVideoPayloadType()
     serializePacket(payload, xml);
 }
 
+void TestJingle::testHeaderExtensions()
+{
+    const QByteArray xml(
+        "<iq"
+        " id=\"zid615d9\""
+        " to=\"juliet@capulet.lit/balcony\""
+        " from=\"romeo@montague.lit/orchard\""
+        " type=\"set\">"
+        "<jingle xmlns=\"urn:xmpp:jingle:1\""
+        " action=\"session-initiate\""
+        " initiator=\"romeo@montague.lit/orchard\""
+        " sid=\"a73sjjvkla37jfea\">"
+        "<content creator=\"initiator\" name=\"voice\">"
+        "<description xmlns=\"urn:xmpp:jingle:apps:rtp:1\" media=\"audio\">"
+        "<payload-type id=\"0\" name=\"PCMU\" clockrate=\"8000\"/>"
+        "<rtp-hdrext xmlns=\"urn:xmpp:jingle:apps:rtp:rtp-hdrext:0\" id=\"1\" uri=\"urn:ietf:params:rtp-hdrext:ssrc-audio-level\"/>"
+        "<rtp-hdrext xmlns=\"urn:xmpp:jingle:apps:rtp:rtp-hdrext:0\" id=\"3\" uri=\"http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\"/>"
+        "</description>"
+        "</content>"
+        "</jingle>"
+        "</iq>");
+
+    QXmppJingleIq session;
+    parsePacket(session, xml);
+    QCOMPARE(session.content().payloadTypes().size(), 1);
+    QCOMPARE(session.content().rtpHeaderExtensions().size(), 2);
+    QCOMPARE(session.content().rtpHeaderExtensions().value(1), QLatin1String("urn:ietf:params:rtp-hdrext:ssrc-audio-level"));
+    QCOMPARE(session.content().rtpHeaderExtensions().value(3), QLatin1String("http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time"));
+    serializePacket(session, xml);
+}
+
 void TestJingle::testRinging()
 {
     const QByteArray xml(
@@ -32,6 +32,7 @@ private slots:
     void testTerminate();
     void testAudioPayloadType();
     void testVideoPayloadType();
+    void testHeaderExtensions();
     void testRinging();
 };
 
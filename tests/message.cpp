@@ -162,6 +162,32 @@ void tst_QXmppMessage::testMessageReceipt()
     QCOMPARE(old.receiptId(), QString("richard2-4.1.247"));
 }
 
+void tst_QXmppMessage::testLazy()
+{
+    const QByteArray xml(
+        "<message id=\"richard2-4.1.247\" to=\"kingrichard@royalty.england.lit/throne\" from=\"northumberland@shakespeare.lit/westminster\" type=\"normal\">"
+          "<subject>Articles</subject>"
+          "<body>My lord, dispatch; read o'er these articles.</body>"
+          "<request xmlns=\"urn:xmpp:receipts\"/>"
+        "</message>");
+
+    QXmppMessage message;
+    parsePacket(message, xml);
+
+    // a copy taken before the payload is decoded sees the same fields
+    const QXmppMessage copy = message;
+
+    // changing a field keeps the other decoded fields
+    message.setBody("Changed");
+    QCOMPARE(message.body(), QString("Changed"));
+    QCOMPARE(message.subject(), QString("Articles"));
+    QCOMPARE(message.isReceiptRequested(), true);
+
+    QCOMPARE(copy.body(), QString("My lord, dispatch; read o'er these articles."));
+    QCOMPARE(copy.subject(), QString("Articles"));
+    serializePacket(copy, xml);
+}
+
 void tst_QXmppMessage::testDelay_data()
 {
     QTest::addColumn<QByteArray>("xml");
@@ -247,4 +273,31 @@ void tst_QXmppMessage::testXhtml()
     parsePacket(message, xml);
     QCOMPARE(message.xhtml(), QLatin1String("<p style=\"font-weight:bold\">hi!</p>"));
     serializePacket(message, xml);
+
+    // replacing the XHTML body of a copy leaves the parsed one untouched
+    QXmppMessage copy = message;
+    copy.setXhtml("<p>bye <b>now</b>!</p>");
+    QCOMPARE(copy.xhtml(), QLatin1String("<p>bye <b>now</b>!</p>"));
+    QCOMPARE(message.xhtml(), QLatin1String("<p style=\"font-weight:bold\">hi!</p>"));
+    serializePacket(message, xml);
+    serializePacket(copy, QByteArray("<message type=\"normal\">"
+        "<body>hi!</body>"
+        "<html xmlns=\"http://jabber.org/protocol/xhtml-im\">"
+        "<body xmlns=\"http://www.w3.org/1999/xhtml\">"
+        "<p>bye <b>now</b>!</p>"
+        "</body>"
+        "</html>"
+        "</message>"));
+
+    // markup which is not well-formed is escaped
+    copy.setXhtml("<p>bye!");
+    QCOMPARE(copy.xhtml(), QLatin1String("<p>bye!"));
+    serializePacket(copy, QByteArray("<message type=\"normal\">"
+        "<body>hi!</body>"
+        "<html xmlns=\"http://jabber.org/protocol/xhtml-im\">"
+        "<body xmlns=\"http://www.w3.org/1999/xhtml\">"
+        "&lt;p&gt;bye!"
+        "</body>"
+        "</html>"
+        "</message>"));
 }
@@ -33,6 +33,7 @@ private slots:
     void testBasic();
     void testMessageAttention();
     void testMessageReceipt();
+    void testLazy();
     void testDelay_data();
     void testDelay();
     void testState_data();
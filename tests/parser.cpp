@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppAtom_p.h"
+#include "QXmppStreamParser_p.h"
+
+#include "parser.h"
+#include "tests.h"
+
+static const QByteArray streamStart(
+    "<?xml version='1.0'?>"
+    "<stream:stream xmlns=\"jabber:client\" xmlns:stream=\"http://etherx.jabber.org/streams\""
+    " id=\"123\" from=\"example.com\" version=\"1.0\">");
+
+void tst_QXmppStreamParser::testAtoms()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    parser.addData("<message><body>Hi</body><foo xmlns=\"urn:example:foo\"/></message>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::Stanza);
+
+    const QXmppStanzaElement element = parser.element();
+    QCOMPARE(element.nameAtom(), int(QXmppAtom::Message));
+    QCOMPARE(element.namespaceAtom(), int(QXmppAtom::NsClient));
+
+    const QXmppStanzaElement body = element.firstChildElement();
+    QCOMPARE(body.nameAtom(), int(QXmppAtom::Body));
+
+    const QXmppStanzaElement foo = body.nextSiblingElement();
+    QCOMPARE(foo.nameAtom(), int(QXmppAtom::Unknown));
+    QCOMPARE(foo.namespaceAtom(), int(QXmppAtom::Unknown));
+}
+
+void tst_QXmppStreamParser::testDomElement()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    parser.addData("<message to=\"foo@example.com\" xml:lang=\"en\"><body>Hi</body>"
+                   "<x xmlns=\"jabber:x:data\" type=\"form\"/></message>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::Stanza);
+
+    const QDomElement element = parser.element().toDomElement();
+    QCOMPARE(element.tagName(), QLatin1String("message"));
+    QCOMPARE(element.namespaceURI(), QLatin1String("jabber:client"));
+    QCOMPARE(element.attribute("to"), QLatin1String("foo@example.com"));
+    QCOMPARE(element.attribute("xml:lang"), QLatin1String("en"));
+    QCOMPARE(element.firstChildElement("body").text(), QLatin1String("Hi"));
+
+    const QDomElement x = element.firstChildElement("x");
+    QCOMPARE(x.namespaceURI(), QLatin1String("jabber:x:data"));
+    QCOMPARE(x.attribute("type"), QLatin1String("form"));
+    QCOMPARE(x.firstChild().isNull(), true);
+}
+
+void tst_QXmppStreamParser::testError()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    parser.addData("<message></iq>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::Error);
+}
+
+void tst_QXmppStreamParser::testIncremental()
+{
+    const QByteArray data = streamStart +
+        "<iq type=\"result\" id=\"1\"><query xmlns=\"jabber:iq:version\"><name>qxmpp</name></query></iq>"
+        "<presence/>"
+        "</stream:stream>";
+
+    // feed the data one byte at a time
+    QXmppStreamParser parser;
+    QList<QXmppStreamParser::Token> tokens;
+    QList<QXmppStanzaElement> elements;
+    for (int i = 0; i < data.size(); ++i) {
+        parser.addData(data.mid(i, 1));
+        QXmppStreamParser::Token token;
+        while ((token = parser.readNext()) != QXmppStreamParser::NoToken) {
+            tokens << token;
+            elements << parser.element();
+        }
+    }
+
+    QCOMPARE(tokens.size(), 4);
+    QCOMPARE(tokens[0], QXmppStreamParser::StreamStart);
+    QCOMPARE(elements[0].tagName(), QLatin1String("stream"));
+    QCOMPARE(elements[0].namespaceURI(), QLatin1String("http://etherx.jabber.org/streams"));
+    QCOMPARE(elements[0].attribute("id"), QLatin1String("123"));
+
+    QCOMPARE(tokens[1], QXmppStreamParser::Stanza);
+    QCOMPARE(elements[1].tagName(), QLatin1String("iq"));
+    QCOMPARE(elements[1].attribute("type"), QLatin1String("result"));
+    const QXmppStanzaElement query = elements[1].firstChildElement("query");
+    QCOMPARE(query.namespaceURI(), QLatin1String("jabber:iq:version"));
+    QCOMPARE(query.firstChildElement("name").text(), QLatin1String("qxmpp"));
+    QVERIFY(query.nextSiblingElement().isNull());
+
+    QCOMPARE(tokens[2], QXmppStreamParser::Stanza);
+    QCOMPARE(elements[2].tagName(), QLatin1String("presence"));
+    QVERIFY(elements[2].firstChildElement().isNull());
+
+    QCOMPARE(tokens[3], QXmppStreamParser::StreamEnd);
+    QCOMPARE(parser.depth(), 0);
+}
+
+void tst_QXmppStreamParser::testRestart()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    parser.addData("<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::Stanza);
+
+    // a new stream starts with a new XML declaration
+    parser.clear();
+    parser.addData(streamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.depth(), 1);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::NoToken);
+}
+
+void tst_QXmppStreamParser::testText()
+{
+    QXmppStreamParser parser;
+    parser.addData(streamStart);
+    parser.addData("<message><body>Hello </body>"
+                   "<html xmlns=\"http://jabber.org/protocol/xhtml-im\">"
+                   "<body xmlns=\"http://www.w3.org/1999/xhtml\"><p>Hello <b>world</b>!</p></body>"
+                   "</html>\n  </message>");
+    QCOMPARE(parser.readNext(), QXmppStreamParser::StreamStart);
+    QCOMPARE(parser.readNext(), QXmppStreamParser::Stanza);
+
+    const QXmppStanzaElement element = parser.element();
+    QCOMPARE(element.firstChildElement("body").text(), QLatin1String("Hello "));
+    QCOMPARE(element.firstChildElement("html").text(), QLatin1String("Hello world!"));
+
+    // mixed content is preserved in the DOM
+    const QDomElement p = element.toDomElement().firstChildElement("html").firstChildElement("body").firstChildElement("p");
+    QCOMPARE(p.firstChild().toText().data(), QLatin1String("Hello "));
+    QCOMPARE(p.firstChildElement("b").text(), QLatin1String("world"));
+    QCOMPARE(p.lastChild().toText().data(), QLatin1String("!"));
+}
@@ -21,9 +21,14 @@
  *
  */
 
+#include <cstring>
+
 #include <QtTest/QtTest>
 
 #include "QXmppRtpChannel.h"
+#ifdef QXMPP_AUTOTEST_INTERNAL
+#include "QXmppRtpChannel_p.h"
+#endif
 
 #include "rtp.h"
 
@@ -58,7 +63,7 @@ void tst_QXmppRtpPacket::testSimple()
 
 void tst_QXmppRtpPacket::testWithCsrc()
 {
-    QByteArray data("\x84\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xde\xad\xbe\xef\x12\x34\x56", 23);
+    QByteArray data("\x82\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xab\xcd\xef\x01\xde\xad\xbe\xef\x12\x34\x56", 23);
     QXmppRtpPacket packet;
     QCOMPARE(packet.decode(data), true);
     QCOMPARE(packet.version, quint8(2));
@@ -73,4 +78,398 @@ void tst_QXmppRtpPacket::testWithCsrc()
     QCOMPARE(packet.encode(), data);
 }
 
+void tst_QXmppRtpPacket::testWithExtension()
+{
+    QByteArray data("\x90\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xbe\xde\x00\x01\x10\xaa\x00\x00\x12\x34\x56", 23);
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+    QCOMPARE(packet.sequence, quint16(16082));
+    QCOMPARE(packet.extensionProfile, quint16(0xbede));
+    QCOMPARE(packet.extension, QByteArray("\x10\xaa\x00\x00", 4));
+    QCOMPARE(packet.payload, QByteArray("\x12\x34\x56", 3));
+    QCOMPARE(packet.encode(), data);
+
+    // truncated extension
+    QCOMPARE(packet.decode(data.left(18)), false);
+}
+
+void tst_QXmppRtpPacket::testWithPadding()
+{
+    QByteArray data("\xa0\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56\x00\x00\x03", 18);
+    QXmppRtpHeader header;
+    QCOMPARE(header.parse(data.constData(), data.size()), true);
+    QCOMPARE(header.paddingLength, 3);
+    QCOMPARE(header.payloadOffset, 12);
+    QCOMPARE(header.payloadLength, 3);
+
+    QXmppRtpPacket packet;
+    QCOMPARE(packet.decode(data), true);
+    QCOMPARE(packet.payload, QByteArray("\x12\x34\x56", 3));
+
+    // padding longer than the packet
+    data[17] = 0x10;
+    QCOMPARE(packet.decode(data), false);
+}
+
+void tst_QXmppRtpPacket::testEncodeBuffer()
+{
+    QXmppRtpPacket packet;
+    packet.sequence = 16082;
+    packet.stamp = 144;
+    packet.ssrc = 1606227614;
+    packet.payload = QByteArray("\x12\x34\x56", 3);
+    QCOMPARE(packet.encodedSize(), 15);
+
+    char buffer[32];
+    QCOMPARE(packet.encode(buffer, 14), -1);
+    QCOMPARE(packet.encode(buffer, sizeof(buffer)), 15);
+    QCOMPARE(QByteArray(buffer, 15), QByteArray("\x80\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\x12\x34\x56", 15));
+}
+
+void tst_QXmppRtpPacket::testExtensionElements()
+{
+    QMap<quint8, QByteArray> elements;
+    elements.insert(1, QByteArray("\x9e", 1));
+    elements.insert(3, QByteArray("\x12\x34\x56", 3));
+
+    // one-byte header
+    QXmppRtpPacket packet;
+    packet.sequence = 16082;
+    packet.stamp = 144;
+    packet.ssrc = 1606227614;
+    packet.payload = QByteArray("\x12\x34\x56", 3);
+    packet.setExtensionElements(elements);
+    QCOMPARE(packet.extensionProfile, quint16(0xbede));
+    QCOMPARE(packet.extension, QByteArray("\x10\x9e\x32\x12\x34\x56", 6));
+
+    const QByteArray data = packet.encode();
+    QCOMPARE(data, QByteArray("\x90\x00\x3e\xd2\x00\x00\x00\x90\x5f\xbd\x16\x9e\xbe\xde\x00\x02\x10\x9e\x32\x12\x34\x56\x00\x00\x12\x34\x56", 27));
+
+    QXmppRtpPacket packet2;
+    QCOMPARE(packet2.decode(data), true);
+    QCOMPARE(packet2.extensionElements(), elements);
+    QCOMPARE(packet2.payload, QByteArray("\x12\x34\x56", 3));
+
+    // lookup without copying
+    QXmppRtpHeader header;
+    int length = 0;
+    QCOMPARE(header.parse(data.constData(), data.size()), true);
+    QCOMPARE(header.findExtensionElement(data.constData(), 1, &length), 17);
+    QCOMPARE(length, 1);
+    QCOMPARE(header.findExtensionElement(data.constData(), 3, &length), 19);
+    QCOMPARE(length, 3);
+    QCOMPARE(header.findExtensionElement(data.constData(), 2, &length), -1);
+
+    // two-byte header
+    elements.insert(20, QByteArray("\xab\xcd", 2));
+    packet.setExtensionElements(elements);
+    QCOMPARE(packet.extensionProfile, quint16(0x1000));
+    QCOMPARE(packet.extension, QByteArray("\x01\x01\x9e\x03\x03\x12\x34\x56\x14\x02\xab\xcd", 12));
+    QCOMPARE(packet2.decode(packet.encode()), true);
+    QCOMPARE(packet2.extensionElements(), elements);
+
+    // no elements
+    packet.setExtensionElements(QMap<quint8, QByteArray>());
+    QCOMPARE(packet.encode().size(), 15);
+}
+
+void tst_QXmppRtcpPacket::testBad()
+{
+    QXmppRtcpPacket packet;
+
+    // too short
+    QCOMPARE(packet.decode(QByteArray()), false);
+    QCOMPARE(packet.decode(QByteArray("\x81\xcd\x00\x04\x12\x34\x56\x78", 8)), false);
+
+    // wrong RTP version
+    QCOMPARE(packet.decode(QByteArray("\x41\xcd\x00\x01\x12\x34\x56\x78", 8)), false);
+}
+
+void tst_QXmppRtcpPacket::testNack()
+{
+    QByteArray data("\x81\xcd\x00\x04\x12\x34\x56\x78\x9a\xbc\xde\xf0\x00\x64\x00\x05\x00\xc8\x00\x00", 20);
+    const QList<quint16> sequences = QList<quint16>() << 100 << 101 << 103 << 200;
+
+    QXmppRtcpPacket packet;
+    packet.ssrc = 0x12345678;
+    packet.setNackSequences(0x9abcdef0, sequences);
+    QCOMPARE(packet.encode(), data);
+
+    QXmppRtcpPacket packet2;
+    QCOMPARE(packet2.decode(data), true);
+    QCOMPARE(packet2.version, quint8(2));
+    QCOMPARE(packet2.count, quint8(1));
+    QCOMPARE(packet2.type, quint8(QXmppRtcpPacket::RtpFeedback));
+    QCOMPARE(packet2.ssrc, quint32(0x12345678));
+    QCOMPARE(packet2.mediaSsrc(), quint32(0x9abcdef0));
+    QCOMPARE(packet2.nackSequences(), sequences);
+}
+
+void tst_QXmppRtcpPacket::testSenderReport()
+{
+    QByteArray data("\x80\xc8\x00\x06\x12\x34\x56\x78\xd3\x78\x0f\x10\x80\x00\x00\x00\x00\x01\x5f\x90\x00\x00\x00\x2a\x00\x00\x10\x00", 28);
+
+    QXmppRtcpPacket packet;
+    packet.ssrc = 0x12345678;
+    packet.setSenderInfo(Q_UINT64_C(0xd3780f1080000000), 90000, 42, 4096);
+    QCOMPARE(packet.encode(), data);
+
+    QXmppRtcpPacket packet2;
+    QCOMPARE(packet2.decode(data), true);
+    QCOMPARE(packet2.type, quint8(QXmppRtcpPacket::SenderReport));
+    QCOMPARE(packet2.count, quint8(0));
+    QCOMPARE(packet2.ssrc, quint32(0x12345678));
+    QCOMPARE(packet2.ntpStamp(), Q_UINT64_C(0xd3780f1080000000));
+    QCOMPARE(packet2.rtpStamp(), quint32(90000));
+    QCOMPARE(packet2.senderPacketCount(), quint32(42));
+    QCOMPARE(packet2.senderOctetCount(), quint32(4096));
+}
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+static QXmppRtpPacket fecMediaPacket(quint16 sequence)
+{
+    QXmppRtpPacket packet;
+    packet.version = 2;
+    packet.marker = (sequence % 3) == 0;
+    packet.type = 96;
+    packet.ssrc = 0x12345678;
+    packet.sequence = sequence;
+    packet.stamp = 90000 + 3000 * (sequence / 4);
+    packet.payload = QByteArray(10 + 7 * (sequence % 5), char('a' + sequence % 26));
+    return packet;
+}
+
+// Feeds a block of media packets through the encoder and returns the
+// FEC payloads it produced.
+static QList<QByteArray> fecEncodeBlock(QXmppRtpFecEncoder &encoder, quint16 base, int count)
+{
+    QList<QByteArray> payloads;
+    for (int i = 0; i < count; ++i) {
+        const QXmppRtpPacket packet = fecMediaPacket(base + i);
+        payloads += encoder.handlePacket(packet.sequence, packet.encode());
+    }
+    return payloads;
+}
+
+void tst_QXmppRtpFec::testRecover_data()
+{
+    QTest::addColumn<int>("blockSize");
+    QTest::addColumn<int>("depth");
+    QTest::addColumn<int>("lost");
+
+    QTest::newRow("10x1 first") << 10 << 1 << 0;
+    QTest::newRow("10x1 middle") << 10 << 1 << 5;
+    QTest::newRow("10x1 last") << 10 << 1 << 9;
+    QTest::newRow("4x2 even") << 4 << 2 << 2;
+    QTest::newRow("4x2 odd") << 4 << 2 << 3;
+}
+
+void tst_QXmppRtpFec::testRecover()
+{
+    QFETCH(int, blockSize);
+    QFETCH(int, depth);
+    QFETCH(int, lost);
+
+    const quint16 base = 65530;
+    QXmppRtpFecEncoder encoder;
+    encoder.setLevel(blockSize, depth);
+    QCOMPARE(encoder.blockSize(), blockSize);
+    QCOMPARE(encoder.depth(), depth);
+
+    // nothing is produced before the block is complete
+    QCOMPARE(fecEncodeBlock(encoder, base, blockSize - 1), QList<QByteArray>());
+    const QXmppRtpPacket last = fecMediaPacket(base + blockSize - 1);
+    const QList<QByteArray> payloads = encoder.handlePacket(last.sequence, last.encode());
+    QCOMPARE(payloads.size(), depth);
+
+    QXmppRtpPacketHistory received;
+    for (int i = 0; i < blockSize; ++i) {
+        if (i != lost)
+            received.insert(fecMediaPacket(base + i));
+    }
+
+    const QXmppRtpPacket expected = fecMediaPacket(base + lost);
+    QXmppRtpPacket packet;
+    QVERIFY(QXmppRtpFecDecoder::recover(payloads[lost % depth], expected.ssrc, received, packet));
+    QCOMPARE(packet.encode(), expected.encode());
+
+    // the other FEC packets have nothing to recover
+    for (int i = 0; i < depth; ++i) {
+        if (i != lost % depth)
+            QVERIFY(!QXmppRtpFecDecoder::recover(payloads[i], expected.ssrc, received, packet));
+    }
+}
+
+void tst_QXmppRtpFec::testUnrecoverable()
+{
+    const quint16 base = 100;
+    QXmppRtpFecEncoder encoder;
+    encoder.setLevel(6, 1);
+    const QList<QByteArray> payloads = fecEncodeBlock(encoder, base, 6);
+    QCOMPARE(payloads.size(), 1);
+
+    // two packets missing
+    QXmppRtpPacketHistory received;
+    for (int i = 0; i < 6; ++i) {
+        if (i != 1 && i != 4)
+            received.insert(fecMediaPacket(base + i));
+    }
+    QXmppRtpPacket packet;
+    QVERIFY(!QXmppRtpFecDecoder::recover(payloads[0], 0x12345678, received, packet));
+
+    // truncated FEC payload
+    received.insert(fecMediaPacket(base + 4));
+    QVERIFY(QXmppRtpFecDecoder::recover(payloads[0], 0x12345678, received, packet));
+    QVERIFY(!QXmppRtpFecDecoder::recover(payloads[0].left(13), 0x12345678, received, packet));
+    QVERIFY(!QXmppRtpFecDecoder::recover(payloads[0].left(payloads[0].size() - 1), 0x12345678, received, packet));
+
+    // disabling FEC drops the current block
+    encoder.setLevel(6, 1);
+    QCOMPARE(fecEncodeBlock(encoder, base, 3), QList<QByteArray>());
+    encoder.setLevel(0, 0);
+    encoder.setLevel(6, 1);
+    QCOMPARE(fecEncodeBlock(encoder, base + 3, 5), QList<QByteArray>());
+    QCOMPARE(fecEncodeBlock(encoder, base + 8, 1).size(), 1);
+
+    // a gap in the sequence numbers starts a new block
+    QCOMPARE(fecEncodeBlock(encoder, base + 20, 3), QList<QByteArray>());
+    QCOMPARE(fecEncodeBlock(encoder, base + 30, 5), QList<QByteArray>());
+    QCOMPARE(fecEncodeBlock(encoder, base + 35, 1).size(), 1);
+}
+
+void tst_QXmppRtpFec::testPayload()
+{
+    const quint16 base = 2000;
+    QXmppRtpFecEncoder encoder;
+    encoder.setLevel(4, 2);
+    const QList<QByteArray> payloads = fecEncodeBlock(encoder, base, 4);
+    QCOMPARE(payloads.size(), 2);
+
+    for (int offset = 0; offset < 2; ++offset) {
+        const QByteArray &payload = payloads[offset];
 
+        // E and L bits, SN base, protection length and mask
+        int length = 0;
+        for (int i = offset; i < 4; i += 2)
+            length = qMax(length, fecMediaPacket(base + i).encode().size() - 12);
+        QCOMPARE(payload.size(), 14 + length);
+        QCOMPARE(quint8(payload[0]) & 0xc0, 0);
+        QCOMPARE((quint8(payload[2]) << 8) | quint8(payload[3]), int(base));
+        QCOMPARE((quint8(payload[10]) << 8) | quint8(payload[11]), length);
+        QCOMPARE((quint8(payload[12]) << 8) | quint8(payload[13]), offset ? 0x5000 : 0xa000);
+
+        // the payload survives being carried in an RTP packet
+        QXmppRtpPacket fec;
+        fec.version = 2;
+        fec.type = 97;
+        fec.ssrc = 0xabcdef01;
+        fec.sequence = 1;
+        fec.stamp = 90000;
+        fec.payload = payload;
+        QXmppRtpPacket decoded;
+        QVERIFY(decoded.decode(fec.encode()));
+        QCOMPARE(decoded.payload, payload);
+
+        // and still recovers the packet it protects
+        QXmppRtpPacketHistory received;
+        received.insert(fecMediaPacket(base + offset + 2));
+        QXmppRtpPacket packet;
+        QVERIFY(QXmppRtpFecDecoder::recover(decoded.payload, 0x12345678, received, packet));
+        QCOMPARE(packet.encode(), fecMediaPacket(base + offset).encode());
+    }
+}
+
+void tst_QXmppRtpPlayout::testNtp_data()
+{
+    QTest::addColumn<qint64>("msecs");
+    QTest::addColumn<quint64>("ntp");
+
+    QTest::newRow("epoch") << Q_INT64_C(0) << (Q_UINT64_C(2208988800) << 32);
+    QTest::newRow("half") << Q_INT64_C(1500) << ((Q_UINT64_C(2208988801) << 32) | Q_UINT64_C(0x80000000));
+    QTest::newRow("odd") << Q_INT64_C(1234567890123) << ((Q_UINT64_C(3443556690) << 32) | Q_UINT64_C(528280977));
+    QTest::newRow("last") << Q_INT64_C(1234567890999) << ((Q_UINT64_C(3443556690) << 32) | Q_UINT64_C(4290672328));
+}
+
+void tst_QXmppRtpPlayout::testNtp()
+{
+    QFETCH(qint64, msecs);
+    QFETCH(quint64, ntp);
+
+    QCOMPARE(QXmppRtpSenderClock::ntpFromMsecs(msecs), ntp);
+    QCOMPARE(QXmppRtpSenderClock::msecsFromNtp(ntp), msecs);
+}
+
+void tst_QXmppRtpPlayout::testSenderClock()
+{
+    const qint64 reportTime = Q_INT64_C(1234567890123);
+    QXmppRtcpPacket report;
+    report.setSenderInfo(QXmppRtpSenderClock::ntpFromMsecs(reportTime), 0xfffff000, 0, 0);
+
+    QXmppRtpSenderClock clock;
+    QCOMPARE(clock.wallTime(0xfffff000), qint64(-1));
+    clock.setClockrate(8000);
+    QCOMPARE(clock.wallTime(0xfffff000), qint64(-1));
+    clock.update(report);
+    QCOMPARE(clock.wallTime(0xfffff000), reportTime);
+    QCOMPARE(clock.wallTime(0xfffff000 + 8000), reportTime + 1000);
+    QCOMPARE(clock.wallTime(0xfffff000 - 80), reportTime - 10);
+
+    // the RTP timestamp wraps around
+    QCOMPARE(clock.wallTime(0x00001000), reportTime + 1024);
+
+    clock.clear();
+    QCOMPARE(clock.wallTime(0xfffff000), qint64(-1));
+}
+
+void tst_QXmppRtpPlayout::testScheduler()
+{
+    AVFrame frames[4];
+    memset(frames, 0, sizeof(frames));
+    QXmppRtpPlayoutSchedulerPrivate scheduler;
+    int delay = 0;
+
+    // without an audio clock every frame is due
+    frames[0].pts = 900;
+    frames[1].pts = AV_NOPTS_VALUE;
+    scheduler.frames << &frames[0] << &frames[1];
+    QCOMPARE(scheduler.takeFrames(-1, delay), QList<AVFrame*>() << &frames[0] << &frames[1]);
+    QCOMPARE(delay, 0);
+
+    // the video lags, the audio is delayed and the early frame held back
+    frames[0].pts = 900;
+    frames[1].pts = 1000;
+    frames[2].pts = 1100;
+    scheduler.frames << &frames[0] << &frames[1] << &frames[2];
+    QCOMPARE(scheduler.takeFrames(1000, delay), QList<AVFrame*>() << &frames[0] << &frames[1]);
+    QCOMPARE(delay, 100);
+    QCOMPARE(scheduler.frames, QList<AVFrame*>() << &frames[2]);
+
+    // the video now leads, the delay shrinks
+    QCOMPARE(scheduler.takeFrames(1010, delay), QList<AVFrame*>());
+    QCOMPARE(delay, 50);
+
+    // in sync
+    QCOMPARE(scheduler.takeFrames(1070, delay), QList<AVFrame*>() << &frames[2]);
+    QCOMPARE(delay, 50);
+
+    // the delay is bounded
+    delay = 950;
+    frames[0].pts = 800;
+    scheduler.frames << &frames[0];
+    QCOMPARE(scheduler.takeFrames(1000, delay), QList<AVFrame*>() << &frames[0]);
+    QCOMPARE(delay, 1000);
+
+    delay = 10;
+    frames[0].pts = 1500;
+    scheduler.frames << &frames[0];
+    QCOMPARE(scheduler.takeFrames(1000, delay), QList<AVFrame*>());
+    QCOMPARE(delay, 0);
+    scheduler.frames.clear();
+
+    // a discontinuity does not hold frames back
+    frames[0].pts = 10000;
+    scheduler.frames << &frames[0];
+    QCOMPARE(scheduler.takeFrames(1000, delay), QList<AVFrame*>() << &frames[0]);
+    QCOMPARE(delay, 0);
+}
+#endif
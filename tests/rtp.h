@@ -31,5 +31,42 @@ private slots:
     void testBad();
     void testSimple();
     void testWithCsrc();
+    void testWithExtension();
+    void testWithPadding();
+    void testEncodeBuffer();
+    void testExtensionElements();
 };
 
+class tst_QXmppRtcpPacket : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBad();
+    void testNack();
+    void testSenderReport();
+};
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+class tst_QXmppRtpFec : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRecover_data();
+    void testRecover();
+    void testUnrecoverable();
+    void testPayload();
+};
+
+class tst_QXmppRtpPlayout : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testNtp_data();
+    void testNtp();
+    void testSenderClock();
+    void testScheduler();
+};
+#endif
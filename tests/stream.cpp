@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QEventLoop>
+#include <QRegExp>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppOutgoingClient.h"
+
+#include "stream.h"
+#include "tests.h"
+
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 12347;
+
+/// Runs the event loop until the given signal is emitted or the
+/// timeout expires.
+
+static void waitForSignal(QObject *sender, const char *signal, int timeout = 5000)
+{
+    QEventLoop loop;
+    QObject::connect(sender, signal, &loop, SLOT(quit()));
+    QTimer::singleShot(timeout, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+/// Waits for the client to open a stream and offers it resource binding,
+/// sessions and stream management.
+
+bool tst_QXmppStreamManagement::acceptStream()
+{
+    if (!m_server->hasPendingConnections())
+        waitForSignal(m_server, SIGNAL(newConnection()));
+    if (!m_server->hasPendingConnections())
+        return false;
+
+    delete m_peer;
+    m_peer = m_server->nextPendingConnection();
+    m_buffer.clear();
+    if (!receive("<stream:stream [^>]*>"))
+        return false;
+
+    m_peer->write("<?xml version='1.0'?>"
+        "<stream:stream from='localhost' id='stream1' version='1.0' "
+        "xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>"
+        "<stream:features>"
+        "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+        "<session xmlns='urn:ietf:params:xml:ns:xmpp-session'/>"
+        "<sm xmlns='urn:xmpp:sm:3'/>"
+        "</stream:features>");
+    return true;
+}
+
+/// Waits until the data received from the client matches \a pattern and
+/// consumes it, counting the stanzas it contains. If \a capture is not
+/// null, it receives the pattern's first capture.
+
+bool tst_QXmppStreamManagement::receive(const QString &pattern, QString *capture)
+{
+    const QRegExp stanzaRegex("<(iq|message|presence)[ />]");
+    QRegExp regex(pattern);
+    regex.setMinimal(true);
+    forever {
+        m_buffer += QString::fromUtf8(m_peer->readAll());
+        const int pos = regex.indexIn(m_buffer);
+        if (pos >= 0) {
+            const QString data = m_buffer.left(pos + regex.matchedLength());
+            m_received += data.count(stanzaRegex);
+            m_buffer.remove(0, data.size());
+            if (capture)
+                *capture = regex.cap(1);
+            return true;
+        }
+        waitForSignal(m_peer, SIGNAL(readyRead()));
+        if (!m_peer->bytesAvailable())
+            return false;
+    }
+}
+
+/// Starts a session with stream management enabled, as a server which
+/// allows the session to be resumed.
+
+bool tst_QXmppStreamManagement::startSession()
+{
+    if (!acceptStream())
+        return false;
+
+    // bind a resource
+    QString id;
+    if (!receive("<iq id=\"([^\"]+)\"[^>]*><bind ", &id))
+        return false;
+    m_peer->write(QString("<iq id='%1' type='result'>"
+        "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'><jid>test@localhost/QXmpp</jid></bind>"
+        "</iq>").arg(id).toUtf8());
+
+    // start the session
+    if (!receive("<iq id=\"([^\"]+)\"[^>]*><session ", &id))
+        return false;
+    m_peer->write(QString("<iq id='%1' type='result'/>").arg(id).toUtf8());
+
+    // enable stream management, the client's stanzas are counted from here
+    if (!receive("<enable [^>]*/>"))
+        return false;
+    m_received = 0;
+    m_peer->write("<enabled xmlns='urn:xmpp:sm:3' id='session1' resume='true'/>");
+
+    // once connected, the client requests its roster and sends its
+    // initial presence
+    if (!receive("<presence[ />]") || m_received != 2)
+        return false;
+
+    // make sure the client has handled <enabled/>
+    m_peer->write("<r xmlns='urn:xmpp:sm:3'/>");
+    return receive("<a xmlns='urn:xmpp:sm:3' h='0'/>");
+}
+
+void tst_QXmppStreamManagement::init()
+{
+    m_client = 0;
+    m_peer = 0;
+    m_received = 0;
+
+    m_server = new QTcpServer;
+    QVERIFY(m_server->listen(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("test");
+    config.setPassword("testpwd");
+    config.setStreamSecurityMode(QXmppConfiguration::TLSDisabled);
+
+    m_client = new QXmppClient;
+    m_client->connectToServer(config);
+}
+
+void tst_QXmppStreamManagement::cleanup()
+{
+    delete m_client;
+    delete m_peer;
+    delete m_server;
+}
+
+void tst_QXmppStreamManagement::testAcknowledgement()
+{
+    QVERIFY(startSession());
+
+    // the client counts the stanzas it handles, but not the
+    // acknowledgement requests and answers
+    const QByteArray message("<message from='peer@localhost/QXmpp' to='test@localhost/QXmpp' type='chat'>"
+        "<body>Hello</body>"
+        "</message>");
+    m_peer->write(message + message + "<r xmlns='urn:xmpp:sm:3'/>");
+    QString handled;
+    QVERIFY(receive("<a xmlns='urn:xmpp:sm:3' h='(\\d+)'/>", &handled));
+    QCOMPARE(handled, QString("2"));
+
+    m_peer->write("<a xmlns='urn:xmpp:sm:3' h='2'/>");
+    m_peer->write(message + "<r xmlns='urn:xmpp:sm:3'/>");
+    QVERIFY(receive("<a xmlns='urn:xmpp:sm:3' h='(\\d+)'/>", &handled));
+    QCOMPARE(handled, QString("3"));
+}
+
+void tst_QXmppStreamManagement::testResend()
+{
+    QVERIFY(startSession());
+
+    m_client->sendPacket(QXmppMessage(QString(), "peer@localhost/QXmpp", "first"));
+    m_client->sendPacket(QXmppMessage(QString(), "peer@localhost/QXmpp", "second"));
+    QVERIFY(receive("<body>second</body>"));
+    QCOMPARE(m_received, 4);
+
+    // acknowledge the roster request and the initial presence
+    m_peer->write("<a xmlns='urn:xmpp:sm:3' h='2'/>");
+    m_peer->write("<r xmlns='urn:xmpp:sm:3'/>");
+    QVERIFY(receive("<a xmlns='urn:xmpp:sm:3' h='0'/>"));
+
+    // drop the connection, the client resumes the session
+    QXmppOutgoingClient *stream = m_client->findChild<QXmppOutgoingClient*>();
+    QVERIFY(stream);
+    QMetaObject::invokeMethod(stream, "pingTimeout");
+    QVERIFY(acceptStream());
+    QVERIFY(receive("<resume xmlns=\"urn:xmpp:sm:3\" h=\"0\" previd=\"session1\"/>"));
+
+    // the server only handled the first message, so the client
+    // sends the second one again
+    m_peer->write("<resumed xmlns='urn:xmpp:sm:3' previd='session1' h='3'/>");
+    QString body;
+    QVERIFY(receive("<message [^>]*><body>([^<]*)</body>", &body));
+    QCOMPARE(body, QString("second"));
+}
+
+void tst_QXmppStreamManagement::testKeepAliveResume()
+{
+    QSignalSpy connectedSpy(m_client, SIGNAL(connected()));
+    QSignalSpy disconnectedSpy(m_client, SIGNAL(disconnected()));
+    QVERIFY(startSession());
+    QCOMPARE(connectedSpy.count(), 1);
+
+    // a keepalive failure drops the connection, but keeps the session
+    QXmppOutgoingClient *stream = m_client->findChild<QXmppOutgoingClient*>();
+    QVERIFY(stream);
+    QMetaObject::invokeMethod(stream, "pingTimeout");
+    QCOMPARE(m_client->state(), QXmppClient::DisconnectedState);
+    QVERIFY(stream->isStreamResumable());
+    QCOMPARE(disconnectedSpy.count(), 0);
+
+    // the client reconnects and resumes the session
+    QVERIFY(acceptStream());
+    QVERIFY(receive("<resume xmlns=\"urn:xmpp:sm:3\" h=\"0\" previd=\"session1\"/>"));
+    m_peer->write("<resumed xmlns='urn:xmpp:sm:3' previd='session1' h='2'/>");
+    waitForSignal(stream, SIGNAL(connected()));
+    QVERIFY(stream->isStreamResumed());
+    QCOMPARE(m_client->state(), QXmppClient::ConnectedState);
+
+    // the managers were not told about the disconnection
+    QCOMPARE(connectedSpy.count(), 1);
+    QCOMPARE(disconnectedSpy.count(), 0);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QObject>
+
+class QTcpServer;
+class QTcpSocket;
+class QXmppClient;
+
+class tst_QXmppStreamManagement : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testAcknowledgement();
+    void testResend();
+    void testKeepAliveResume();
+
+private:
+    bool acceptStream();
+    bool receive(const QString &pattern, QString *capture = 0);
+    bool startSession();
+
+    QXmppClient *m_client;
+    QTcpServer *m_server;
+    QTcpSocket *m_peer;
+    QString m_buffer;
+    int m_received;
+};
@@ -21,7 +21,19 @@
  *
  */
 
+#include <QBuffer>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QTimer>
+#include <QUdpSocket>
+
+#include "QXmppServer.h"
 #include "QXmppStun.h"
+#include "QXmppTurnServer.h"
+#ifdef QXMPP_AUTOTEST_INTERNAL
+#include "QXmppStun_p.h"
+#include "QXmppUtils_p.h"
+#endif
 
 #include "stun.h"
 #include "tests.h"
@@ -45,6 +57,20 @@ void TestStun::testIntegrity()
     msg.setType(0x0001);
     QCOMPARE(msg.encode(QByteArray("somesecret"), false),
              QByteArray("\x00\x01\x00\x18\x21\x12\xA4\x42\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x08\x00\x14\x96\x4B\x40\xD1\x84\x67\x6A\xFD\xB5\xE0\x7C\xC5\x1F\xFB\xBD\xA2\x61\xAF\xB1\x26", 44));
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    // a prebuilt HMAC context can be reused
+    const QXmppHmacSha1 integrity(QByteArray("somesecret"));
+    const QByteArray encoded = msg.encode(QByteArray("somesecret"), false);
+    QCOMPARE(QXmppStunCodec::encode(msg, &integrity, false), encoded);
+    QCOMPARE(QXmppStunCodec::encode(msg, &integrity, false), encoded);
+
+    QXmppStunMessage decoded;
+    QVERIFY(QXmppStunCodec::decode(decoded, encoded, &integrity));
+    QVERIFY(QXmppStunCodec::decode(decoded, encoded, &integrity));
+    const QXmppHmacSha1 wrong(QByteArray("othersecret"));
+    QVERIFY(!QXmppStunCodec::decode(decoded, encoded, &wrong));
+#endif
 }
 
 void TestStun::testIPv4Address()
@@ -118,3 +144,421 @@ void TestStun::testXorIPv6Address()
     QCOMPARE(msg2.xorMappedHost, QHostAddress("::1"));
     QCOMPARE(msg2.xorMappedPort, quint16(12345));
 }
+
+// Exchanges credentials and candidates between two ICE connections and
+// waits for both of them to connect.
+//
+// If \a sendCandidates is false, the controlling party is not told about
+// the controlled party's candidates and has to discover them as
+// peer-reflexive candidates.
+static bool iceConnect(QXmppIceConnection *controlling, QXmppIceConnection *controlled, bool sendCandidates = true)
+{
+    controlling->setIceControlling(true);
+    controlled->setIceControlling(false);
+
+    controlling->setRemoteUser(controlled->localUser());
+    controlling->setRemotePassword(controlled->localPassword());
+    if (sendCandidates) {
+        foreach (const QXmppJingleCandidate &candidate, controlled->localCandidates())
+            controlling->addRemoteCandidate(candidate);
+    }
+
+    controlled->setRemoteUser(controlling->localUser());
+    controlled->setRemotePassword(controlling->localPassword());
+    foreach (const QXmppJingleCandidate &candidate, controlling->localCandidates())
+        controlled->addRemoteCandidate(candidate);
+
+    QEventLoop loop;
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    QObject::connect(controlling, SIGNAL(connected()), &loop, SLOT(quit()));
+    QObject::connect(controlled, SIGNAL(connected()), &loop, SLOT(quit()));
+    QObject::connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
+
+    timeout.start(10000);
+    controlling->connectToHost();
+    controlled->connectToHost();
+    while ((!controlling->isConnected() || !controlled->isConnected()) && timeout.isActive())
+        loop.exec();
+    return controlling->isConnected() && controlled->isConnected();
+}
+
+// Sends a datagram from one ICE component and checks it is received by
+// the other component.
+//
+// The datagram starts like an RTP packet on component 1 and like an RTCP
+// sender report on component 2.
+static bool iceSend(QXmppIceComponent *sender, QXmppIceComponent *receiver)
+{
+    QByteArray datagram = QByteArray::fromHex(sender->component() == 2 ? "80c8" : "8000");
+    datagram += QByteArray("component ") + QByteArray::number(sender->component());
+    QSignalSpy spy(receiver, SIGNAL(datagramReceived(QByteArray)));
+    if (sender->sendDatagram(datagram) != datagram.size())
+        return false;
+
+    QEventLoop loop;
+    QObject::connect(receiver, SIGNAL(datagramReceived(QByteArray)), &loop, SLOT(quit()));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    return spy.count() == 1 && spy.at(0).at(0).toByteArray() == datagram;
+}
+
+void tst_QXmppIceConnection::testConnect_data()
+{
+    QTest::addColumn<bool>("aggressive");
+    QTest::addColumn<int>("components");
+
+    QTest::newRow("aggressive") << true << 1;
+    QTest::newRow("aggressive rtcp") << true << 2;
+    QTest::newRow("regular") << false << 1;
+    QTest::newRow("regular rtcp") << false << 2;
+}
+
+void tst_QXmppIceConnection::testConnect()
+{
+    QFETCH(bool, aggressive);
+    QFETCH(int, components);
+
+    const QList<QHostAddress> addresses = QList<QHostAddress>() << QHostAddress::LocalHost;
+    QXmppIceConnection controlling;
+    QXmppIceConnection controlled;
+    for (int i = 1; i <= components; ++i) {
+        controlling.addComponent(i);
+        controlled.addComponent(i);
+    }
+    controlling.setAggressiveNomination(aggressive);
+    QVERIFY(controlling.bind(addresses));
+    QVERIFY(controlled.bind(addresses));
+
+    QVERIFY(iceConnect(&controlling, &controlled));
+
+    // media flows on every component
+    for (int i = 1; i <= components; ++i) {
+        QVERIFY(iceSend(controlling.component(i), controlled.component(i)));
+        QVERIFY(iceSend(controlled.component(i), controlling.component(i)));
+    }
+}
+
+void tst_QXmppIceConnection::testMultiplexer_data()
+{
+    QTest::addColumn<bool>("sendCandidates");
+    QTest::addColumn<bool>("remoteMultiplexer");
+
+    QTest::newRow("host") << true << false;
+    QTest::newRow("peer-reflexive") << false << false;
+    QTest::newRow("host both multiplexed") << true << true;
+    QTest::newRow("peer-reflexive both multiplexed") << false << true;
+}
+
+void tst_QXmppIceConnection::testMultiplexer()
+{
+    QFETCH(bool, sendCandidates);
+    QFETCH(bool, remoteMultiplexer);
+
+    const QList<QHostAddress> addresses = QList<QHostAddress>() << QHostAddress::LocalHost;
+    QXmppIceMultiplexer multiplexer;
+    QVERIFY(multiplexer.bind(addresses));
+
+    // the RTP and RTCP components share the multiplexer's socket
+    QXmppIceConnection controlling;
+    controlling.addComponent(1);
+    controlling.addComponent(2);
+    controlling.bind(&multiplexer);
+
+    // the remote party may multiplex its components too, in which case
+    // RTP and RTCP arrive from the same remote address
+    QXmppIceMultiplexer remote;
+    QXmppIceConnection controlled;
+    controlled.addComponent(1);
+    controlled.addComponent(2);
+    if (remoteMultiplexer) {
+        QVERIFY(remote.bind(addresses));
+        controlled.bind(&remote);
+    } else {
+        QVERIFY(controlled.bind(addresses));
+    }
+
+    QVERIFY(iceConnect(&controlling, &controlled, sendCandidates));
+
+    // each component receives its own media
+    for (int i = 1; i <= 2; ++i) {
+        QVERIFY(iceSend(controlled.component(i), controlling.component(i)));
+        QVERIFY(iceSend(controlling.component(i), controlled.component(i)));
+    }
+}
+
+// Waits for a datagram from the TURN relay and checks its payload.
+static bool peerReceive(QUdpSocket *peer, const QByteArray &expected)
+{
+    if (!peer->hasPendingDatagrams()) {
+        QEventLoop loop;
+        QObject::connect(peer, SIGNAL(readyRead()), &loop, SLOT(quit()));
+        QTimer::singleShot(1000, &loop, SLOT(quit()));
+        loop.exec();
+        if (!peer->hasPendingDatagrams())
+            return false;
+    }
+    QByteArray data(peer->pendingDatagramSize(), '\0');
+    peer->readDatagram(data.data(), data.size());
+    return data == expected;
+}
+
+TestTurnReceiver::TestTurnReceiver()
+    : port(0),
+    count(0)
+{
+}
+
+void TestTurnReceiver::datagramReceived(const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    this->data = data;
+    this->host = host;
+    this->port = port;
+    count++;
+}
+
+// Sends a datagram from a peer to the relayed address and checks the
+// allocation reports it with the peer's address.
+static bool peerSend(QUdpSocket *peer, QXmppTurnAllocation *allocation, const QByteArray &data)
+{
+    TestTurnReceiver receiver;
+    QObject::connect(allocation, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)),
+                     &receiver, SLOT(datagramReceived(QByteArray,QHostAddress,quint16)));
+    peer->writeDatagram(data, allocation->relayedHost(), allocation->relayedPort());
+
+    QEventLoop loop;
+    QObject::connect(allocation, SIGNAL(datagramReceived(QByteArray,QHostAddress,quint16)), &loop, SLOT(quit()));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    return receiver.count == 1 &&
+        receiver.data == data &&
+        receiver.host == peer->localAddress() &&
+        receiver.port == peer->localPort();
+}
+
+void tst_QXmppTurnAllocation::testChannelData()
+{
+    const QHostAddress host(QHostAddress::LocalHost);
+    const quint16 turnPort = 34781;
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    QXmppTurnServer *turn = new QXmppTurnServer;
+    turn->setHost(host);
+    turn->setPort(turnPort);
+    turn->setSecret("secret");
+    server.addExtension(turn);
+    QVERIFY(server.listenForClients(host, 12348));
+
+    const QString username = QString("%1:testuser").arg(QDateTime::currentDateTime().toTime_t() + 3600);
+    QXmppTurnAllocation allocation;
+    allocation.setServer(host, turnPort);
+    allocation.setUser(username);
+    allocation.setPassword(turn->password(username));
+
+    QEventLoop loop;
+    QObject::connect(&allocation, SIGNAL(connected()), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    allocation.connectToHost();
+    loop.exec();
+    QCOMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+
+    // each peer gets its own channel
+    QUdpSocket first, second;
+    QVERIFY(first.bind(host, 0));
+    QVERIFY(second.bind(host, 0));
+    QCOMPARE(allocation.writeDatagram("first", host, first.localPort()), qint64(5));
+    QVERIFY(peerReceive(&first, "first"));
+    QCOMPARE(allocation.writeDatagram("second", host, second.localPort()), qint64(6));
+    QVERIFY(peerReceive(&second, "second"));
+
+    // writing again to a peer reuses its channel
+    QCOMPARE(allocation.writeDatagram("again", host, first.localPort()), qint64(5));
+    QVERIFY(peerReceive(&first, "again"));
+
+    // ChannelData from each peer is reported with the peer's address,
+    // without the header
+    QVERIFY(peerSend(&second, &allocation, "reply from second"));
+    QVERIFY(peerSend(&first, &allocation, "reply from first"));
+}
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+static bool waitForReadyRead(QUdpSocket *socket)
+{
+    QSignalSpy spy(socket, SIGNAL(readyRead()));
+    QEventLoop loop;
+    QObject::connect(socket, SIGNAL(readyRead()), &loop, SLOT(quit()));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    return spy.count() > 0;
+}
+
+static QList<QByteArray> udpPayloads(int count)
+{
+    QList<QByteArray> payloads;
+    for (int i = 0; i < count; ++i)
+        payloads << QByteArray(1 + (i * 97) % 1400, char('a' + i % 26));
+    return payloads;
+}
+
+void tst_QXmppUdpBatch::testRead_data()
+{
+    QTest::addColumn<bool>("systemBatching");
+
+    QTest::newRow("system") << true;
+    QTest::newRow("QUdpSocket") << false;
+}
+
+void tst_QXmppUdpBatch::testRead()
+{
+    QFETCH(bool, systemBatching);
+
+    QUdpSocket receiver;
+    QVERIFY(receiver.bind(QHostAddress::LocalHost, 0));
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+
+    QXmppUdpBatch batch;
+    batch.setSystemBatchingEnabled(systemBatching);
+
+    // the socket keeps emitting readyRead() after a batch was drained
+    const QList<QByteArray> payloads = udpPayloads(40);
+    for (int round = 0; round < 3; ++round) {
+        foreach (const QByteArray &payload, payloads)
+            QCOMPARE(sender.writeDatagram(payload, QHostAddress::LocalHost, receiver.localPort()), qint64(payload.size()));
+
+        QList<QByteArray> received;
+        while (received.size() < payloads.size() && waitForReadyRead(&receiver)) {
+            while (batch.readDatagrams(&receiver)) {
+                foreach (const QXmppUdpDatagram &datagram, batch.datagrams()) {
+                    QCOMPARE(datagram.host, QHostAddress(QHostAddress::LocalHost));
+                    QCOMPARE(datagram.port, sender.localPort());
+                    QCOMPARE(datagram.socket, &receiver);
+                    received << QByteArray(datagram.data.constData(), datagram.data.size());
+                }
+            }
+        }
+        QCOMPARE(received, payloads);
+    }
+
+    // oversized datagrams are dropped
+    QCOMPARE(sender.writeDatagram(QByteArray(8192, 'x'), QHostAddress::LocalHost, receiver.localPort()), qint64(8192));
+    QCOMPARE(sender.writeDatagram(QByteArray("small"), QHostAddress::LocalHost, receiver.localPort()), qint64(5));
+    QList<QByteArray> received;
+    while (received.isEmpty() && waitForReadyRead(&receiver)) {
+        while (batch.readDatagrams(&receiver)) {
+            foreach (const QXmppUdpDatagram &datagram, batch.datagrams())
+                received << QByteArray(datagram.data.constData(), datagram.data.size());
+        }
+    }
+    QCOMPARE(received, QList<QByteArray>() << QByteArray("small"));
+}
+
+void tst_QXmppUdpBatch::testWrite_data()
+{
+    QTest::addColumn<bool>("systemBatching");
+
+    QTest::newRow("system") << true;
+    QTest::newRow("QUdpSocket") << false;
+}
+
+void tst_QXmppUdpBatch::testWrite()
+{
+    QFETCH(bool, systemBatching);
+
+    QUdpSocket receiver;
+    QVERIFY(receiver.bind(QHostAddress::LocalHost, 0));
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+
+    QXmppUdpBatch batch;
+    batch.setSystemBatchingEnabled(systemBatching);
+
+    const QList<QByteArray> payloads = udpPayloads(40);
+    foreach (const QByteArray &payload, payloads)
+        batch.queueDatagram(payload, QHostAddress::LocalHost, receiver.localPort(), &sender);
+    QCOMPARE(batch.queuedDatagrams(), payloads.size());
+    batch.flush();
+    QCOMPARE(batch.queuedDatagrams(), 0);
+
+    QList<QByteArray> received;
+    while (received.size() < payloads.size() && (receiver.hasPendingDatagrams() || waitForReadyRead(&receiver))) {
+        while (receiver.hasPendingDatagrams()) {
+            QByteArray data(receiver.pendingDatagramSize(), 0);
+            QHostAddress host;
+            quint16 port = 0;
+            QCOMPARE(receiver.readDatagram(data.data(), data.size(), &host, &port), qint64(data.size()));
+            QCOMPARE(host, QHostAddress(QHostAddress::LocalHost));
+            QCOMPARE(port, sender.localPort());
+            received << data;
+        }
+    }
+    QCOMPARE(received, payloads);
+
+    // queued datagrams can be dropped
+    batch.queueDatagram("dropped", QHostAddress::LocalHost, receiver.localPort(), &sender);
+    batch.clearQueue();
+    batch.flush();
+    QVERIFY(!waitForReadyRead(&receiver));
+}
+
+void tst_QXmppTurnStreamReader::testReadFrame_data()
+{
+    QTest::addColumn<int>("chunkSize");
+
+    QTest::newRow("byte") << 1;
+    QTest::newRow("partial") << 7;
+    QTest::newRow("whole") << 0;
+}
+
+void tst_QXmppTurnStreamReader::testReadFrame()
+{
+    QFETCH(int, chunkSize);
+
+    // a STUN message and ChannelData frames with and without padding
+    QXmppStunMessage message;
+    message.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+    message.setId(QByteArray(12, 'x'));
+    message.setUsername(QLatin1String("user"));
+
+    QList<QByteArray> frames;
+    frames << message.encode();
+    frames << QByteArray::fromHex("4000000568656c6c6f");
+    frames << QByteArray::fromHex("4001000462617a21");
+    frames << QByteArray::fromHex("40020000");
+
+    QByteArray stream;
+    stream += frames[0];
+    stream += frames[1] + QByteArray(3, '\0');
+    stream += frames[2];
+    stream += frames[3];
+    // start of a frame which never completes
+    stream += QByteArray::fromHex("4003000a6162");
+
+    QXmppTurnStreamReader reader;
+    QList<QByteArray> received;
+    const int step = chunkSize ? chunkSize : stream.size();
+    for (int pos = 0; pos < stream.size(); pos += step) {
+        QByteArray chunk = stream.mid(pos, step);
+        QBuffer buffer(&chunk);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+        QCOMPARE(reader.readFrom(&buffer), qint64(chunk.size()));
+
+        QByteArray frame;
+        while (reader.readFrame(frame))
+            received << QByteArray(frame.constData(), frame.size());
+    }
+    QCOMPARE(received, frames);
+
+    // clearing drops the partial frame
+    QByteArray frame;
+    QVERIFY(!reader.readFrame(frame));
+    reader.clear();
+    QByteArray chunk = frames[2];
+    QBuffer buffer(&chunk);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    reader.readFrom(&buffer);
+    QVERIFY(reader.readFrame(frame));
+    QCOMPARE(frame, frames[2]);
+}
+#endif
@@ -21,6 +21,7 @@
  *
  */
 
+#include <QHostAddress>
 #include <QObject>
 
 class TestStun : public QObject
@@ -35,3 +36,60 @@ private slots:
     void testXorIPv4Address();
     void testXorIPv6Address();
 };
+
+class tst_QXmppIceConnection : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testConnect_data();
+    void testConnect();
+    void testMultiplexer_data();
+    void testMultiplexer();
+};
+
+class TestTurnReceiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestTurnReceiver();
+
+    QByteArray data;
+    QHostAddress host;
+    quint16 port;
+    int count;
+
+public slots:
+    void datagramReceived(const QByteArray &data, const QHostAddress &host, quint16 port);
+};
+
+class tst_QXmppTurnAllocation : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testChannelData();
+};
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+class tst_QXmppUdpBatch : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRead_data();
+    void testRead();
+    void testWrite_data();
+    void testWrite();
+};
+
+class tst_QXmppTurnStreamReader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testReadFrame_data();
+    void testReadFrame();
+};
+#endif
@@ -32,12 +32,14 @@
 #include "QXmppArchiveIq.h"
 #include "QXmppBindIq.h"
 #include "QXmppClient.h"
+#include "QXmppOutgoingClient.h"
 #include "QXmppDiscoveryIq.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppPasswordChecker.h"
 #include "QXmppPubSubIq.h"
 #include "QXmppSessionIq.h"
 #include "QXmppServer.h"
+#include "QXmppServerPresence.h"
 #include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 #include "QXmppVersionIq.h"
@@ -45,10 +47,13 @@
 #include "QXmppEntityTimeIq.h"
 
 #include "codec.h"
+#include "compressor.h"
 #include "dataform.h"
+#include "dispatch.h"
 #include "iq.h"
 #include "jingle.h"
 #include "message.h"
+#include "parser.h"
 #include "presence.h"
 #include "register.h"
 #include "roster.h"
@@ -56,9 +61,12 @@
 #include "rsm.h"
 #include "rtp.h"
 #include "sasl.h"
+#include "stream.h"
 #include "stun.h"
 #include "tests.h"
+#include "turn.h"
 #include "vcard.h"
+#include "writer.h"
 
 void TestUtils::testCrc32()
 {
@@ -67,6 +75,16 @@ void TestUtils::testCrc32()
 
     crc = QXmppUtils::generateCrc32(QByteArray("Hi There"));
     QCOMPARE(crc, 0xDB143BBEu);
+
+    crc = QXmppUtils::generateCrc32(QByteArray("123456789"));
+    QCOMPARE(crc, 0xCBF43926u);
+
+    // checksum computed over several buffers
+    const QByteArray data("The quick brown fox jumps over the lazy dog");
+    crc = QXmppUtils::generateCrc32(data.constData(), 5);
+    crc = QXmppUtils::generateCrc32(data.constData() + 5, data.size() - 5, crc);
+    QCOMPARE(crc, QXmppUtils::generateCrc32(data));
+    QCOMPARE(crc, 0x414FA339u);
 }
 
 void TestUtils::testHmac()
@@ -79,6 +97,18 @@ void TestUtils::testHmac()
 
     hmac = QXmppUtils::generateHmacMd5(QByteArray(16, 0xaa), QByteArray(50, 0xdd));
     QCOMPARE(hmac, QByteArray::fromHex("56be34521d144c88dbb8c733f0e8b3f6"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(20, 0x0b), QByteArray("Hi There"));
+    QCOMPARE(hmac, QByteArray::fromHex("b617318655057264e28bc0b6fb378c8ef146be00"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray("Jefe"), QByteArray("what do ya want for nothing?"));
+    QCOMPARE(hmac, QByteArray::fromHex("effcdf6ae5eb2fa2d27416d5f184df9c259a7c79"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(20, 0xaa), QByteArray(50, 0xdd));
+    QCOMPARE(hmac, QByteArray::fromHex("125d7342b9ac11cd91a39af48aa17b4f63f175d3"));
+
+    hmac = QXmppUtils::generateHmacSha1(QByteArray(80, 0xaa), QByteArray("Test Using Larger Than Block-Size Key - Hash Key First"));
+    QCOMPARE(hmac, QByteArray::fromHex("aa4ae5e15272d00e95705637ce8a3b55ed402112"));
 }
 
 void TestUtils::testJid()
@@ -384,6 +414,43 @@ void TestPackets::testDiscovery()
     serializePacket(disco, xml);
 }
 
+void TestPackets::testDiscoveryCopy()
+{
+    const QByteArray xml(
+        "<iq id=\"disco1\" from=\"benvolio@capulet.lit/230193\" type=\"result\">"
+        "<query xmlns=\"http://jabber.org/protocol/disco#info\">"
+        "<identity category=\"client\" name=\"Exodus 0.9.1\" type=\"pc\"/>"
+        "<feature var=\"http://jabber.org/protocol/caps\"/>"
+        "</query>"
+        "</iq>");
+
+    QXmppDiscoveryIq disco;
+    parsePacket(disco, xml);
+
+    // copies share the data until one of them is modified
+    QXmppDiscoveryIq copy(disco);
+    QXmppDiscoveryIq assigned;
+    assigned = disco;
+    copy.setFeatures(QStringList() << "urn:example:feature");
+    copy.setQueryNode("urn:example:node");
+    assigned.setIdentities(QList<QXmppDiscoveryIq::Identity>());
+
+    QCOMPARE(disco.features(), QStringList() << "http://jabber.org/protocol/caps");
+    QCOMPARE(disco.queryNode(), QString());
+    QCOMPARE(disco.identities().size(), 1);
+    serializePacket(disco, xml);
+
+    QCOMPARE(copy.features(), QStringList() << "urn:example:feature");
+    QCOMPARE(copy.queryNode(), QLatin1String("urn:example:node"));
+    QCOMPARE(copy.identities().size(), 1);
+    QCOMPARE(assigned.features(), QStringList() << "http://jabber.org/protocol/caps");
+    QCOMPARE(assigned.identities().size(), 0);
+
+    // an unmodified copy serializes like the original
+    const QXmppDiscoveryIq unmodified(disco);
+    serializePacket(unmodified, xml);
+}
+
 void TestPackets::testDiscoveryWithForm()
 {
     const QByteArray xml(
@@ -496,6 +563,7 @@ void TestPackets::testStreamFeatures()
     QCOMPARE(features.sessionMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.nonSaslAuthMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.tlsMode(), QXmppStreamFeatures::Disabled);
+    QCOMPARE(features.streamManagementMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.authMechanisms(), QStringList());
     QCOMPARE(features.compressionMethods(), QStringList());
     serializePacket(features, xml);
@@ -505,6 +573,7 @@ void TestPackets::testStreamFeatures()
         "<session xmlns=\"urn:ietf:params:xml:ns:xmpp-session\"/>"
         "<auth xmlns=\"http://jabber.org/features/iq-auth\"/>"
         "<starttls xmlns=\"urn:ietf:params:xml:ns:xmpp-tls\"/>"
+        "<sm xmlns=\"urn:xmpp:sm:3\"/>"
         "<compression xmlns=\"http://jabber.org/features/compress\"><method>zlib</method></compression>"
         "<mechanisms xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"><mechanism>PLAIN</mechanism></mechanisms>"
         "</stream:features>");
@@ -514,6 +583,7 @@ void TestPackets::testStreamFeatures()
     QCOMPARE(features2.sessionMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features2.nonSaslAuthMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features2.tlsMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(features2.streamManagementMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features2.authMechanisms(), QStringList() << "PLAIN");
     QCOMPARE(features2.compressionMethods(), QStringList() << "zlib");
     serializePacket(features2, xml2);
@@ -559,6 +629,44 @@ void TestPackets::testVersionResult()
     serializePacket(verIqResult, xmlResult);
 }
 
+void TestPackets::testVersionCopy()
+{
+    const QByteArray xml(
+    "<iq id=\"version_1\" to=\"romeo@montague.net/orchard\" "
+    "from=\"juliet@capulet.com/balcony\" type=\"result\">"
+    "<query xmlns=\"jabber:iq:version\">"
+        "<name>qxmpp</name>"
+        "<os>Windows-XP</os>"
+        "<version>0.2.0</version>"
+    "</query></iq>");
+
+    QXmppVersionIq version;
+    parsePacket(version, xml);
+
+    // copies share the data until one of them is modified
+    QXmppVersionIq copy(version);
+    QXmppVersionIq assigned;
+    assigned = version;
+    copy.setName("other");
+    copy.setVersion("1.0");
+    assigned.setOs("Linux");
+
+    QCOMPARE(version.name(), QString("qxmpp"));
+    QCOMPARE(version.os(), QString("Windows-XP"));
+    QCOMPARE(version.version(), QString("0.2.0"));
+    serializePacket(version, xml);
+
+    QCOMPARE(copy.name(), QString("other"));
+    QCOMPARE(copy.os(), QString("Windows-XP"));
+    QCOMPARE(copy.version(), QString("1.0"));
+    QCOMPARE(assigned.name(), QString("qxmpp"));
+    QCOMPARE(assigned.os(), QString("Linux"));
+
+    // an unmodified copy serializes like the original
+    const QXmppVersionIq unmodified(version);
+    serializePacket(unmodified, xml);
+}
+
 void TestPackets::testEntityTimeGet()
 {
     const QByteArray xml("<iq id=\"time_1\" "
@@ -597,6 +705,40 @@ void TestPackets::testEntityTimeResult()
     serializePacket(entityTime, xml);
 }
 
+void TestPackets::testEntityTimeCopy()
+{
+    const QByteArray xml(
+    "<iq id=\"time_1\" to=\"romeo@montague.net/orchard\" from=\"juliet@capulet.com/balcony\" type=\"result\">"
+      "<time xmlns=\"urn:xmpp:time\">"
+        "<tzo>-06:00</tzo>"
+        "<utc>2006-12-19T17:58:35Z</utc>"
+      "</time>"
+    "</iq>");
+
+    QXmppEntityTimeIq entityTime;
+    parsePacket(entityTime, xml);
+
+    // copies share the data until one of them is modified
+    QXmppEntityTimeIq copy(entityTime);
+    QXmppEntityTimeIq assigned;
+    assigned = entityTime;
+    copy.setTzo(3600);
+    assigned.setUtc(QDateTime(QDate(2012, 1, 1), QTime(0, 0, 0), Qt::UTC));
+
+    QCOMPARE(entityTime.tzo(), -21600);
+    QCOMPARE(entityTime.utc(), QDateTime(QDate(2006, 12, 19), QTime(17, 58, 35), Qt::UTC));
+    serializePacket(entityTime, xml);
+
+    QCOMPARE(copy.tzo(), 3600);
+    QCOMPARE(copy.utc(), QDateTime(QDate(2006, 12, 19), QTime(17, 58, 35), Qt::UTC));
+    QCOMPARE(assigned.tzo(), -21600);
+    QCOMPARE(assigned.utc(), QDateTime(QDate(2012, 1, 1), QTime(0, 0, 0), Qt::UTC));
+
+    // an unmodified copy serializes like the original
+    const QXmppEntityTimeIq unmodified(entityTime);
+    serializePacket(unmodified, xml);
+}
+
 void TestPubSub::testItems()
 {
     const QByteArray xml(
@@ -872,6 +1014,120 @@ void TestServer::testConnect()
     QCOMPARE(client.isConnected(), connected);
 }
 
+class TestSubscribers : public QXmppServerExtension
+{
+public:
+    TestSubscribers(const QString &subscriber)
+        : m_subscriber(subscriber)
+    {
+    };
+
+    /// Returns the single subscriber, whatever the JID.
+    QSet<QString> presenceSubscribers(const QString &jid)
+    {
+        Q_UNUSED(jid);
+        return QSet<QString>() << m_subscriber;
+    };
+
+private:
+    QString m_subscriber;
+};
+
+QList<QXmppPresence> TestPresenceReceiver::presences(const QString &from) const
+{
+    QList<QXmppPresence> found;
+    foreach (const QXmppPresence &presence, m_presences) {
+        if (presence.from() == from)
+            found << presence;
+    }
+    return found;
+}
+
+void TestPresenceReceiver::presenceReceived(const QXmppPresence &presence)
+{
+    m_presences << presence;
+}
+
+static bool connectClient(QXmppClient *client, const QXmppConfiguration &config, const QXmppPresence &presence = QXmppPresence())
+{
+    QEventLoop loop;
+    QObject::connect(client, SIGNAL(connected()),
+                     &loop, SLOT(quit()));
+    QObject::connect(client, SIGNAL(disconnected()),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    client->connectToServer(config, presence);
+    loop.exec();
+    return client->isConnected();
+}
+
+void TestServer::testPresence()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    // prepare server
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(new QXmppServerPresence);
+    server.addExtension(new TestSubscribers("testuser@localhost/watcher"));
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setAutoReconnectionEnabled(false);
+
+    // the watcher is subscribed to every other resource
+    TestPresenceReceiver receiver;
+    QXmppClient watcher;
+    connect(&watcher, SIGNAL(presenceReceived(QXmppPresence)),
+            &receiver, SLOT(presenceReceived(QXmppPresence)));
+    config.setResource("watcher");
+    QVERIFY(connectClient(&watcher, config));
+
+    // a client which logs out only sends unavailable presence once
+    QXmppClient leaving;
+    config.setResource("leaving");
+    QVERIFY(connectClient(&leaving, config));
+    leaving.disconnectFromServer();
+    QTest::qWait(500);
+
+    QList<QXmppPresence> presences = receiver.presences("testuser@localhost/leaving");
+    QCOMPARE(presences.size(), 2);
+    QCOMPARE(presences[0].type(), QXmppPresence::Available);
+    QCOMPARE(presences[1].type(), QXmppPresence::Unavailable);
+
+    // unavailable presence is sent on behalf of a client which drops
+    // its connection
+    QXmppClient dropped;
+    config.setResource("dropped");
+    QVERIFY(connectClient(&dropped, config));
+    QMetaObject::invokeMethod(dropped.findChild<QXmppOutgoingClient*>(), "pingTimeout");
+    QTest::qWait(500);
+
+    presences = receiver.presences("testuser@localhost/dropped");
+    QCOMPARE(presences.size(), 2);
+    QCOMPARE(presences[0].type(), QXmppPresence::Available);
+    QCOMPARE(presences[1].type(), QXmppPresence::Unavailable);
+
+    // nothing is sent for a client which never was available
+    QXmppClient hidden;
+    config.setResource("hidden");
+    QVERIFY(connectClient(&hidden, config, QXmppPresence(QXmppPresence::Unavailable)));
+    QMetaObject::invokeMethod(hidden.findChild<QXmppOutgoingClient*>(), "pingTimeout");
+    QTest::qWait(500);
+
+    QCOMPARE(receiver.presences("testuser@localhost/hidden").size(), 0);
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
@@ -891,6 +1147,12 @@ int main(int argc, char *argv[])
 #ifdef QXMPP_AUTOTEST_INTERNAL
     TestCodec testCodec;
     errors += QTest::qExec(&testCodec);
+
+    tst_QXmppCompressor testCompressor;
+    errors += QTest::qExec(&testCompressor);
+
+    tst_QXmppDispatchIndex testDispatch;
+    errors += QTest::qExec(&testDispatch);
 #endif
 
     tst_QXmppDataForm testDataForm;
@@ -905,6 +1167,11 @@ int main(int argc, char *argv[])
     tst_QXmppMessage testMessage;
     errors += QTest::qExec(&testMessage);
 
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    tst_QXmppStreamParser testParser;
+    errors += QTest::qExec(&testParser);
+#endif
+
     tst_QXmppPresence testPresence;
     errors += QTest::qExec(&testPresence);
 
@@ -923,6 +1190,17 @@ int main(int argc, char *argv[])
     tst_QXmppRtpPacket testRtp;
     errors += QTest::qExec(&testRtp);
 
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    tst_QXmppRtpFec testRtpFec;
+    errors += QTest::qExec(&testRtpFec);
+
+    tst_QXmppRtpPlayout testRtpPlayout;
+    errors += QTest::qExec(&testRtpPlayout);
+#endif
+
+    tst_QXmppRtcpPacket testRtcp;
+    errors += QTest::qExec(&testRtcp);
+
 #ifdef QXMPP_AUTOTEST_INTERNAL
     tst_QXmppSasl testSasl;
     errors += QTest::qExec(&testSasl);
@@ -932,6 +1210,9 @@ int main(int argc, char *argv[])
 
     tst_QXmppSaslServer testSaslServer;
     errors += QTest::qExec(&testSaslServer);
+
+    tst_QXmppStanzaWriter testStanzaWriter;
+    errors += QTest::qExec(&testStanzaWriter);
 #endif
 
     TestServer testServer;
@@ -940,6 +1221,26 @@ int main(int argc, char *argv[])
     TestStun testStun;
     errors += QTest::qExec(&testStun);
 
+    tst_QXmppIceConnection testIceConnection;
+    errors += QTest::qExec(&testIceConnection);
+
+    tst_QXmppTurnAllocation testTurnAllocation;
+    errors += QTest::qExec(&testTurnAllocation);
+
+#ifdef QXMPP_AUTOTEST_INTERNAL
+    tst_QXmppUdpBatch testUdpBatch;
+    errors += QTest::qExec(&testUdpBatch);
+
+    tst_QXmppTurnStreamReader testTurnStreamReader;
+    errors += QTest::qExec(&testTurnStreamReader);
+#endif
+
+    tst_QXmppTurnServer testTurnServer;
+    errors += QTest::qExec(&testTurnServer);
+
+    tst_QXmppStreamManagement testStreamManagement;
+    errors += QTest::qExec(&testStreamManagement);
+
     tst_QXmppVCardIq testVCard;
     errors += QTest::qExec(&testVCard);
 
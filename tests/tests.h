@@ -26,6 +26,8 @@
 #include <QObject>
 #include <QtTest/QtTest>
 
+#include "QXmppPresence.h"
+
 template <class T>
 static void parsePacket(T &packet, const QByteArray &xml)
 {
@@ -77,14 +79,17 @@ private slots:
     void testBindResource();
     void testBindResult();
     void testDiscovery();
+    void testDiscoveryCopy();
     void testDiscoveryWithForm();
     void testNonSaslAuth();
     void testSession();
     void testStreamFeatures();
     void testVersionGet();
     void testVersionResult();
+    void testVersionCopy();
     void testEntityTimeGet();
     void testEntityTimeResult();
+    void testEntityTimeCopy();
 };
 
 class TestPubSub : public QObject
@@ -107,4 +112,19 @@ class TestServer : public QObject
 private slots:
     void testConnect_data();
     void testConnect();
+    void testPresence();
+};
+
+class TestPresenceReceiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<QXmppPresence> presences(const QString &from) const;
+
+public slots:
+    void presenceReceived(const QXmppPresence &presence);
+
+private:
+    QList<QXmppPresence> m_presences;
 };
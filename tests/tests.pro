@@ -17,8 +17,10 @@ SOURCES += \
     rpc.cpp \
     rsm.cpp \
     rtp.cpp \
+    stream.cpp \
     stun.cpp \
     tests.cpp \
+    turn.cpp \
     vcard.cpp
 HEADERS += \
     dataform.h \
@@ -31,13 +33,16 @@ HEADERS += \
     rpc.h \
     rsm.h \
     rtp.h \
+    stream.h \
     stun.h \
     tests.h \
+    turn.h \
     vcard.h
 
 !isEmpty(QXMPP_AUTOTEST_INTERNAL) {
-    HEADERS += codec.h sasl.h
-    SOURCES += codec.cpp sasl.cpp
+    HEADERS += codec.h compressor.h dispatch.h parser.h sasl.h writer.h
+    SOURCES += codec.cpp compressor.cpp dispatch.cpp parser.cpp sasl.cpp writer.cpp
+    !isEmpty(QXMPP_USE_ZLIB): DEFINES += QXMPP_USE_ZLIB
 }
 
 QMAKE_LIBDIR += ../src
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QTimer>
+#include <QUdpSocket>
+
+#include "QXmppServer.h"
+#include "QXmppStun.h"
+#include "QXmppTurnServer.h"
+#include "QXmppUtils.h"
+
+#include "tests.h"
+#include "turn.h"
+
+static const QString testDomain("localhost");
+static const QHostAddress testHost(QHostAddress::LocalHost);
+static const quint16 testPort = 34780;
+
+/// Waits for a datagram and reads it.
+
+static bool receiveDatagram(QUdpSocket *socket, QByteArray &data, QHostAddress *host = 0, quint16 *port = 0)
+{
+    if (!socket->hasPendingDatagrams()) {
+        QEventLoop loop;
+        QObject::connect(socket, SIGNAL(readyRead()), &loop, SLOT(quit()));
+        QTimer::singleShot(1000, &loop, SLOT(quit()));
+        loop.exec();
+        if (!socket->hasPendingDatagrams())
+            return false;
+    }
+    data.resize(socket->pendingDatagramSize());
+    socket->readDatagram(data.data(), data.size(), host, port);
+    return true;
+}
+
+/// Sends a request to the TURN server and waits for the matching response,
+/// whose integrity is checked using the given key.
+
+static bool transact(QUdpSocket *socket, const QXmppStunMessage &request, const QByteArray &key, QXmppStunMessage &response)
+{
+    socket->writeDatagram(request.encode(key), testHost, testPort);
+
+    QByteArray data;
+    while (receiveDatagram(socket, data)) {
+        QXmppStunMessage message;
+        if (message.decode(data, key) && message.id() == request.id()) {
+            response = message;
+            return true;
+        }
+    }
+    return false;
+}
+
+static QXmppStunMessage turnRequest(quint16 method, const QString &username, const QByteArray &nonce)
+{
+    QXmppStunMessage request;
+    request.setType(method | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    request.setUsername(username);
+    request.setRealm(testDomain);
+    request.setNonce(nonce);
+    if (method == QXmppStunMessage::Allocate)
+        request.setRequestedTransport(17);
+    return request;
+}
+
+/// Returns a time-limited username for the given user.
+
+static QString turnUsername(const QString &user, int validity = 3600)
+{
+    return QString("%1:%2").arg(QString::number(QDateTime::currentDateTime().toTime_t() + validity), user);
+}
+
+/// Returns the long-term credentials key for the given username.
+
+static QByteArray turnKey(const QString &username, const QString &password)
+{
+    return QCryptographicHash::hash(
+        (username + ":" + testDomain + ":" + password).toUtf8(),
+        QCryptographicHash::Md5);
+}
+
+/// Sends an unauthenticated request and returns the nonce from the error.
+
+static QByteArray turnNonce(QUdpSocket *socket)
+{
+    QXmppStunMessage request;
+    request.setType(QXmppStunMessage::Allocate | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    request.setRequestedTransport(17);
+
+    QXmppStunMessage response;
+    if (!transact(socket, request, QByteArray(), response) || response.errorCode != 401)
+        return QByteArray();
+    return response.nonce();
+}
+
+/// Allocates a relayed address for the given username.
+
+static bool turnAllocate(QXmppTurnServer *turn, QUdpSocket *socket, const QString &username, QXmppStunMessage &response)
+{
+    const QXmppStunMessage request = turnRequest(QXmppStunMessage::Allocate, username, turnNonce(socket));
+    return transact(socket, request, turnKey(username, turn->password(username)), response);
+}
+
+void tst_QXmppTurnServer::init()
+{
+    m_server = new QXmppServer;
+    m_server->setDomain(testDomain);
+
+    m_turn = new QXmppTurnServer;
+    m_turn->setHost(testHost);
+    m_turn->setPort(testPort);
+    m_turn->setSecret("secret");
+    m_server->addExtension(m_turn);
+
+    QVERIFY(m_server->listenForClients(testHost, 12346));
+}
+
+void tst_QXmppTurnServer::cleanup()
+{
+    delete m_server;
+    m_server = 0;
+    m_turn = 0;
+}
+
+void tst_QXmppTurnServer::testBinding()
+{
+    QUdpSocket client;
+    QVERIFY(client.bind(testHost, 0));
+
+    // binding requests need no authentication
+    QXmppStunMessage request;
+    request.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+
+    QXmppStunMessage response;
+    QVERIFY(transact(&client, request, QByteArray(), response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.xorMappedHost, testHost);
+    QCOMPARE(response.xorMappedPort, client.localPort());
+}
+
+void tst_QXmppTurnServer::testAuthentication()
+{
+    QUdpSocket client;
+    QVERIFY(client.bind(testHost, 0));
+
+    const QString username = turnUsername("testuser");
+    const QByteArray key = turnKey(username, m_turn->password(username));
+
+    // no credentials
+    const QByteArray nonce = turnNonce(&client);
+    QVERIFY(!nonce.isEmpty());
+
+    // bad nonce
+    QXmppStunMessage response;
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Allocate, username, "0:0000"), key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Error));
+    QCOMPARE(response.errorCode, 438);
+    QVERIFY(!response.nonce().isEmpty());
+    QCOMPARE(response.realm(), testDomain);
+
+    // bad realm
+    QXmppStunMessage request = turnRequest(QXmppStunMessage::Allocate, username, nonce);
+    request.setRealm("example.com");
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.errorCode, 401);
+
+    // bad password
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Allocate, username, nonce), turnKey(username, "badpwd"), response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Error));
+    QCOMPARE(response.errorCode, 401);
+
+    // expired username
+    const QString expired = turnUsername("testuser", -60);
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Allocate, expired, nonce), turnKey(expired, m_turn->password(expired)), response));
+    QCOMPARE(response.errorCode, 401);
+
+    // good credentials, the response is signed with the same key
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Allocate, username, nonce), key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QVERIFY(response.hasMessageIntegrity());
+}
+
+void tst_QXmppTurnServer::testAllocate()
+{
+    QUdpSocket client;
+    QVERIFY(client.bind(testHost, 0));
+
+    const QString username = turnUsername("testuser");
+    const QByteArray key = turnKey(username, m_turn->password(username));
+    const QByteArray nonce = turnNonce(&client);
+
+    // unsupported transport
+    QXmppStunMessage request = turnRequest(QXmppStunMessage::Allocate, username, nonce);
+    request.setRequestedTransport(6);
+    QXmppStunMessage response;
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.errorCode, 442);
+
+    // too long a lifetime is capped
+    request = turnRequest(QXmppStunMessage::Allocate, username, nonce);
+    request.setLifetime(7200);
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.lifetime(), quint32(3600));
+    QCOMPARE(response.xorRelayedHost, testHost);
+    QVERIFY(response.xorRelayedPort != 0);
+    QCOMPARE(response.xorMappedHost, testHost);
+    QCOMPARE(response.xorMappedPort, client.localPort());
+    QCOMPARE(m_turn->statistics().value("allocations").toInt(), 1);
+
+    // a retransmitted request gets the same response
+    QXmppStunMessage retransmitted;
+    QVERIFY(transact(&client, request, key, retransmitted));
+    QCOMPARE(retransmitted.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(retransmitted.xorRelayedPort, response.xorRelayedPort);
+
+    // a new request for the same client fails
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Allocate, username, nonce), key, response));
+    QCOMPARE(response.errorCode, 437);
+
+    // without LIFETIME the default lifetime is used
+    QUdpSocket other;
+    QVERIFY(other.bind(testHost, 0));
+    QVERIFY(turnAllocate(m_turn, &other, username, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.lifetime(), quint32(600));
+    QCOMPARE(m_turn->statistics().value("allocations").toInt(), 2);
+}
+
+void tst_QXmppTurnServer::testRefresh()
+{
+    QUdpSocket client;
+    QVERIFY(client.bind(testHost, 0));
+
+    const QString username = turnUsername("testuser");
+    const QByteArray key = turnKey(username, m_turn->password(username));
+    QXmppStunMessage response;
+    QVERIFY(turnAllocate(m_turn, &client, username, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    const QByteArray nonce = turnNonce(&client);
+
+    // without LIFETIME the allocation gets the default lifetime
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Refresh, username, nonce), key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.lifetime(), quint32(600));
+    QCOMPARE(m_turn->statistics().value("allocations").toInt(), 1);
+
+    QXmppStunMessage request = turnRequest(QXmppStunMessage::CreatePermission, username, nonce);
+    request.xorPeerHost = testHost;
+    request.xorPeerPort = 1234;
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+
+    // another user cannot refresh the allocation
+    const QString otherUsername = turnUsername("otheruser");
+    QVERIFY(transact(&client, turnRequest(QXmppStunMessage::Refresh, otherUsername, nonce), turnKey(otherUsername, m_turn->password(otherUsername)), response));
+    QCOMPARE(response.errorCode, 437);
+
+    // a zero lifetime deletes the allocation
+    request = turnRequest(QXmppStunMessage::Refresh, username, nonce);
+    request.setLifetime(0);
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.lifetime(), quint32(0));
+    QCOMPARE(m_turn->statistics().value("allocations").toInt(), 0);
+
+    request = turnRequest(QXmppStunMessage::CreatePermission, username, nonce);
+    request.xorPeerHost = testHost;
+    request.xorPeerPort = 1234;
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.errorCode, 437);
+}
+
+void tst_QXmppTurnServer::testQuota()
+{
+    m_turn->setUserQuota(1);
+    m_turn->setMaximumAllocations(2);
+
+    const QString username = turnUsername("testuser");
+    QUdpSocket first, second;
+    QVERIFY(first.bind(testHost, 0));
+    QVERIFY(second.bind(testHost, 0));
+
+    QXmppStunMessage response;
+    QVERIFY(turnAllocate(m_turn, &first, username, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+
+    // the user's quota is reached
+    QVERIFY(turnAllocate(m_turn, &second, username, response));
+    QCOMPARE(response.errorCode, 486);
+
+    // another user can allocate until the server is full
+    const QString otherUsername = turnUsername("otheruser");
+    QVERIFY(turnAllocate(m_turn, &second, otherUsername, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+
+    const QString thirdUsername = turnUsername("thirduser");
+    QUdpSocket third;
+    QVERIFY(third.bind(testHost, 0));
+    QVERIFY(turnAllocate(m_turn, &third, thirdUsername, response));
+    QCOMPARE(response.errorCode, 508);
+
+    // releasing an allocation frees the quota
+    QXmppStunMessage request = turnRequest(QXmppStunMessage::Refresh, username, turnNonce(&first));
+    request.setLifetime(0);
+    QVERIFY(transact(&first, request, turnKey(username, m_turn->password(username)), response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(m_turn->statistics().value("users").toInt(), 1);
+
+    QVERIFY(turnAllocate(m_turn, &third, thirdUsername, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+}
+
+void tst_QXmppTurnServer::testChannelBind()
+{
+    QUdpSocket client, peer, stranger;
+    QVERIFY(client.bind(testHost, 0));
+    QVERIFY(peer.bind(testHost, 0));
+    QVERIFY(stranger.bind(testHost, 0));
+
+    const QString username = turnUsername("testuser");
+    const QByteArray key = turnKey(username, m_turn->password(username));
+    QXmppStunMessage response;
+    QVERIFY(turnAllocate(m_turn, &client, username, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    const quint16 relayPort = response.xorRelayedPort;
+    const QByteArray nonce = turnNonce(&client);
+
+    // invalid channel number
+    QXmppStunMessage request = turnRequest(QXmppStunMessage::ChannelBind, username, nonce);
+    request.setChannelNumber(0x3000);
+    request.xorPeerHost = testHost;
+    request.xorPeerPort = peer.localPort();
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.errorCode, 400);
+
+    // bind a channel to the peer
+    request = turnRequest(QXmppStunMessage::ChannelBind, username, nonce);
+    request.setChannelNumber(0x4000);
+    request.xorPeerHost = testHost;
+    request.xorPeerPort = peer.localPort();
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+
+    // the peer cannot be bound to a second channel
+    request = turnRequest(QXmppStunMessage::ChannelBind, username, nonce);
+    request.setChannelNumber(0x4001);
+    request.xorPeerHost = testHost;
+    request.xorPeerPort = peer.localPort();
+    QVERIFY(transact(&client, request, key, response));
+    QCOMPARE(response.errorCode, 400);
+
+    // data from the peer is relayed as ChannelData
+    QByteArray data;
+    peer.writeDatagram("hello", testHost, relayPort);
+    QVERIFY(receiveDatagram(&client, data));
+    QCOMPARE(data, QByteArray::fromHex("4000000568656c6c6f"));
+
+    // ChannelData from the client is relayed to the peer
+    QHostAddress host;
+    quint16 port = 0;
+    client.writeDatagram(QByteArray::fromHex("4000000462617a21"), testHost, testPort);
+    QVERIFY(receiveDatagram(&peer, data, &host, &port));
+    QCOMPARE(data, QByteArray("baz!"));
+    QCOMPARE(host, testHost);
+    QCOMPARE(port, relayPort);
+
+    // data for an unbound channel is dropped
+    client.writeDatagram(QByteArray::fromHex("4001000462617a21"), testHost, testPort);
+    QVERIFY(!receiveDatagram(&peer, data));
+
+    // the permission covers the peer's address, so other ports on the
+    // same host are relayed using Data indications
+    stranger.writeDatagram("world", testHost, relayPort);
+    QVERIFY(receiveDatagram(&client, data));
+    QXmppStunMessage indication;
+    QVERIFY(indication.decode(data));
+    QCOMPARE(indication.messageMethod(), quint16(QXmppStunMessage::Data));
+    QCOMPARE(indication.data(), QByteArray("world"));
+    QCOMPARE(indication.xorPeerPort, stranger.localPort());
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QtTest>
+
+#include "QXmppMessage.h"
+#include "QXmppPresence.h"
+#include "QXmppStanzaWriter_p.h"
+
+#include "writer.h"
+
+static QByteArray referenceXml(const QXmppStanza &stanza)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    stanza.toXml(&writer);
+    return data;
+}
+
+void tst_QXmppStanzaWriter::testReuse()
+{
+    QXmppStanzaWriter writer;
+
+    QXmppMessage first;
+    first.setTo("foo@example.com/QXmpp");
+    first.setBody("A rather long message body & some <markup>");
+    QCOMPARE(writer.write(first), referenceXml(first));
+
+    // a shorter stanza must not contain leftovers from the first one
+    QXmppMessage second;
+    second.setTo("bar@example.com");
+    second.setBody("Hi");
+    QCOMPARE(writer.write(second), referenceXml(second));
+
+    // data which is still referenced is not overwritten
+    const QByteArray kept = writer.write(first);
+    writer.write(second);
+    QCOMPARE(kept, referenceXml(first));
+}
+
+void tst_QXmppStanzaWriter::testTemplate()
+{
+    QXmppStanzaWriter writer;
+
+    // replace an existing "to" attribute
+    QXmppPresence presence;
+    presence.setFrom("foo@example.com/QXmpp");
+    presence.setTo("bar@example.com");
+    const QXmppStanzaTemplate replaced(writer.write(presence));
+
+    presence.setTo("baz@example.com");
+    QCOMPARE(replaced.data("baz@example.com"), referenceXml(presence));
+
+    presence.setTo("a&b@example.com");
+    QCOMPARE(replaced.data("a&b@example.com"), referenceXml(presence));
+
+    // add a "to" attribute
+    QXmppMessage message;
+    message.setBody("Hi");
+    const QXmppStanzaTemplate added(writer.write(message));
+
+    message.setTo("bar@example.com");
+    QCOMPARE(added.data("bar@example.com"), referenceXml(message));
+}
+
+void tst_QXmppStanzaWriter::testUtf8()
+{
+    QXmppStanzaWriter writer;
+
+    // latin-1, BMP and non-BMP characters
+    QString body = QString::fromUtf8("caf\xc3\xa9 \xe2\x82\xac ");
+    body += QChar(0xd83d);
+    body += QChar(0xde00);
+
+    QXmppMessage message;
+    message.setBody(body);
+
+    const QByteArray data = writer.write(message);
+    QCOMPARE(data, referenceXml(message));
+    QVERIFY(data.contains("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+}
+
+void tst_QXmppStanzaWriter::testXhtml()
+{
+    QXmppStanzaWriter writer;
+
+    QXmppMessage message;
+    message.setBody("Hello world!");
+    message.setXhtml("<p>Hello <b>world</b>!</p>");
+    QCOMPARE(writer.write(message), referenceXml(message));
+    QVERIFY(writer.write(message).contains("<body xmlns=\"http://www.w3.org/1999/xhtml\"><p>Hello <b>world</b>!</p></body>"));
+}